@@ -0,0 +1,89 @@
+// $Id$
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+#include "alloc_hook.h"
+
+static atomic<int> users {0};
+static atomic<uint64_t> allocations {0};
+static atomic<uint64_t> bytes {0};
+
+void alloc_hook::start() {
+   users.fetch_add (1);
+}
+
+void alloc_hook::stop() {
+   users.fetch_sub (1);
+}
+
+alloc_counts alloc_hook::totals() {
+   alloc_counts counts;
+   counts.allocations = allocations.load();
+   counts.bytes = bytes.load();
+   return counts;
+}
+
+/**
+ * Allocates memory the way the default operator new does, counting
+ * the call if the hook is on
+ * @param  size the bytes wanted
+ * @return      the memory, or nullptr if there is none to be had
+ */
+static void* counted_malloc (size_t size) {
+   if (users.load (memory_order_relaxed) > 0) {
+      allocations.fetch_add (1, memory_order_relaxed);
+      bytes.fetch_add (size, memory_order_relaxed);
+   }
+   if (size == 0) size = 1;
+   for (;;) {
+      void* memory = malloc (size);
+      if (memory != nullptr) return memory;
+      new_handler handler = get_new_handler();
+      if (handler == nullptr) return nullptr;
+      handler();
+   }
+}
+
+// REPLACEMENT OPERATORS ==============================================
+
+void* operator new (size_t size) {
+   void* memory = counted_malloc (size);
+   if (memory == nullptr) throw bad_alloc();
+   return memory;
+}
+
+void* operator new[] (size_t size) {
+   return operator new (size);
+}
+
+void* operator new (size_t size, const nothrow_t&) noexcept {
+   try {
+      return counted_malloc (size);
+   }catch (bad_alloc&) {
+      return nullptr;
+   }
+}
+
+void* operator new[] (size_t size, const nothrow_t& tag) noexcept {
+   return operator new (size, tag);
+}
+
+void operator delete (void* memory) noexcept {
+   free (memory);
+}
+
+void operator delete[] (void* memory) noexcept {
+   free (memory);
+}
+
+void operator delete (void* memory, const nothrow_t&) noexcept {
+   free (memory);
+}
+
+void operator delete[] (void* memory, const nothrow_t&) noexcept {
+   free (memory);
+}
@@ -0,0 +1,37 @@
+// $Id$
+
+#ifndef __ALLOC_HOOK_H__
+#define __ALLOC_HOOK_H__
+
+#include <cstdint>
+using namespace std;
+
+//
+// alloc_hook -
+//    A static class which counts the calls to the global operator
+//    new, and the bytes they ask for, while anyone wants them
+//    counted.  The program's operator new is replaced by one which
+//    checks a flag and otherwise just calls malloc, so the hook costs
+//    next to nothing when it is off.  Allocations on every thread are
+//    counted, background jobs included.
+// start, stop -
+//    Turn counting on for as long as there has been a start without
+//    its stop.
+// totals -
+//    The allocations and bytes counted so far.  Callers take the
+//    difference between two totals.
+//
+
+struct alloc_counts {
+   uint64_t allocations {0};
+   uint64_t bytes {0};
+};
+
+class alloc_hook {
+   public:
+      static void start();
+      static void stop();
+      static alloc_counts totals();
+};
+
+#endif
@@ -0,0 +1,639 @@
+// $Id$
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "batch.h"
+#include "cold.h"
+#include "commands.h"
+#include "debug.h"
+#include "pipe.h"
+#include "storage.h"
+
+static constexpr size_t no_line = SIZE_MAX;
+
+//
+// batch_line -
+//    One line of the script.  Its worker fills in out, err and
+//    cwd_after before setting done; waiting and dependents are
+//    guarded by batch_lock.  A line run by the shell's own thread is
+//    never put on the ready queue.  cwd is no_node for a line that
+//    only uses absolute paths, which runs wherever the shell happens
+//    to be.
+//
+
+struct batch_line {
+   size_t number;
+   wordvec words;
+   string heading;
+   node_id cwd {no_node};
+   node_id cwd_after {no_node};
+   size_t waiting {0};
+   bool by_shell {false};
+   vector<shared_ptr<batch_line>> dependents;
+   bool done {false};
+   ostringstream out;
+   ostringstream err;
+};
+
+using line_ptr = shared_ptr<batch_line>;
+
+//
+// path_entry -
+//    What the lines still running have done at a path: the last line
+//    to write it and the lines which have read it since.  Entries
+//    under a path that is written are dropped, since the writer
+//    stands in for them, and entries left with nothing running are
+//    dropped as they are passed.
+//
+
+struct path_entry {
+   size_t writer {no_line};
+   vector<size_t> readers;
+   map<string, unique_ptr<path_entry>> children;
+};
+
+//
+// line_paths -
+//    What a line reads and writes, as names from the root.
+//
+
+struct line_paths {
+   vector<wordvec> reads;
+   vector<wordvec> writes;
+   bool makes {false};
+   bool copies {false};
+   bool cd {false};
+};
+
+//
+// The scheduler's state, guarded by batch_lock: every line not yet
+// printed is in live, and those whose turn has come are in ready.
+// The planner's state is only touched by the shell's thread.  The
+// tree lock, when both are needed, is always taken first.
+//
+
+static mutex batch_lock;
+static condition_variable line_ready;
+static condition_variable line_done;
+static map<size_t, line_ptr> live;
+static deque<line_ptr> ready;
+static bool stopping {false};
+
+static path_entry paths;
+static vector<wordvec> copied;
+static node_id cwd {no_node};
+static wordvec cwd_path;
+static line_ptr pending_cd;
+
+// OUTPUT =============================================================
+
+//
+// route_buf -
+//    Stands in for the buffer of cout or of cerr while a batch runs,
+//    sending what a worker prints into the line it is running and
+//    anything else on to the terminal.
+//
+
+static thread_local streambuf* captured[2] {nullptr, nullptr};
+
+class route_buf: public streambuf {
+   private:
+      streambuf* terminal;
+      int which;
+      streambuf* target() {
+         return captured[which] != nullptr ? captured[which]
+                                           : terminal;
+      }
+   protected:
+      int_type overflow (int_type c) override {
+         if (traits_type::eq_int_type (c, traits_type::eof())) {
+            return traits_type::not_eof (c);
+         }
+         return target()->sputc (traits_type::to_char_type (c));
+      }
+      streamsize xsputn (const char* s, streamsize n) override {
+         return target()->sputn (s, n);
+      }
+      int sync() override {
+         return target()->pubsync();
+      }
+   public:
+      route_buf (streambuf* terminal, int which):
+         terminal (terminal), which (which) {
+      }
+};
+
+/**
+ * Prints the lines which are done and have every line before them
+ * printed, in order
+ */
+static void print_done() {
+   vector<line_ptr> finished;
+   {
+      lock_guard<mutex> guard (batch_lock);
+      while (not live.empty() and live.begin()->second->done) {
+         finished.push_back (live.begin()->second);
+         live.erase (live.begin());
+      }
+   }
+   for (const line_ptr& line: finished) {
+      cout << line->heading << line->out.str() << flush;
+      cerr << line->err.str() << flush;
+   }
+}
+
+// WORKERS ============================================================
+
+/**
+ * Runs a line in its directory, which is its own, with what it
+ * prints going into it.  A line which only reads the tree shares the
+ * tree lock with the others like it, where the storage allows it,
+ * so that only lines which change the tree take turns.
+ * @param state the tree
+ * @param cmds  the commands to run it with
+ * @param line  the line
+ */
+static void run_line (inode_state& state, commands& cmds,
+                      batch_line& line) {
+   captured[0] = line.out.rdbuf();
+   captured[1] = line.err.rdbuf();
+   {
+      cwd_guard in_cwd (line.cwd != no_node ? line.cwd
+                                            : state.get_cwd());
+      bool shared = reads_only (line.words)
+                and state.get_storage().shares_reads();
+      stage_lock lock (state.get_mutex(), shared);
+      try {
+         cmds.execute (state, line.words);
+      }catch (exception& exn) {
+         complain() << exn.what() << endl;
+      }
+      line.cwd_after = state.get_cwd();
+   }
+   captured[0] = captured[1] = nullptr;
+}
+
+/**
+ * Marks a line done, starting the lines waiting only for it.  Called
+ * with batch_lock held.
+ * @param line the line
+ */
+static void finish (const line_ptr& line) {
+   line->done = true;
+   for (const line_ptr& dependent: line->dependents) {
+      if (--dependent->waiting > 0 or dependent->by_shell) continue;
+      ready.push_back (dependent);
+      line_ready.notify_one();
+   }
+   line->dependents.clear();
+   line_done.notify_all();
+}
+
+/**
+ * A worker, which runs lines as their turn comes until the batch
+ * is over
+ */
+static void work (inode_state* state, commands* cmds) {
+   unique_lock<mutex> lock (batch_lock);
+   for (;;) {
+      line_ready.wait (lock, [] {
+         return stopping or not ready.empty();
+      });
+      if (ready.empty()) return;
+      line_ptr next = ready.front();
+      ready.pop_front();
+      lock.unlock();
+      DEBUGF ('b', "line " << next->number << ": " << next->words);
+      run_line (*state, *cmds, *next);
+      lock.lock();
+      finish (next);
+   }
+}
+
+/**
+ * Waits until every line planned so far is done
+ */
+static void wait_all() {
+   unique_lock<mutex> lock (batch_lock);
+   line_done.wait (lock, [] {
+      for (const auto& entry: live) {
+         if (not entry.second->done) return false;
+      }
+      return true;
+   });
+}
+
+// PLANNING ===========================================================
+
+/**
+ * Whether a line is still to finish.  Called with batch_lock held.
+ * @param  number the line
+ * @return        false for a line that is done or printed
+ */
+static bool running (size_t number) {
+   auto found = live.find (number);
+   return found != live.end() and not found->second->done;
+}
+
+/**
+ * Adds the lines still running at one path that a line touching it
+ * has to wait for, forgetting the ones that are done
+ * @param entry  the path
+ * @param writes true if the line writes the path, so it waits for
+ *               the readers too
+ * @param after  the lines to wait for
+ */
+static void note (path_entry& entry, bool writes, set<size_t>& after) {
+   if (running (entry.writer)) after.insert (entry.writer);
+                          else entry.writer = no_line;
+   auto gone = remove_if (entry.readers.begin(), entry.readers.end(),
+                          [] (size_t reader) {
+                             return not running (reader);
+                          });
+   entry.readers.erase (gone, entry.readers.end());
+   if (not writes) return;
+   after.insert (entry.readers.begin(), entry.readers.end());
+}
+
+static void note_below (path_entry& entry, bool writes,
+                        set<size_t>& after) {
+   auto child = entry.children.begin();
+   while (child != entry.children.end()) {
+      path_entry& below = *child->second;
+      note (below, writes, after);
+      note_below (below, writes, after);
+      if (below.writer == no_line and below.readers.empty()
+          and below.children.empty()) {
+         child = entry.children.erase (child);
+      } else {
+         ++child;
+      }
+   }
+}
+
+/**
+ * Finds the lines a line has to wait for because of one path, and
+ * records that it touches the path
+ * @param path   the names of the path from the root
+ * @param writes true if the line writes it
+ * @param number the line
+ * @param after  the lines to wait for
+ */
+static void touch (const wordvec& path, bool writes, size_t number,
+                   set<size_t>& after) {
+   path_entry* entry = &paths;
+   note (*entry, writes, after);
+   for (const string& name: path) {
+      unique_ptr<path_entry>& child = entry->children[name];
+      if (child == nullptr) child.reset (new path_entry());
+      entry = child.get();
+      note (*entry, writes, after);
+   }
+   note_below (*entry, writes, after);
+   if (writes) {
+      entry->children.clear();
+      entry->readers.clear();
+      entry->writer = number;
+   } else {
+      entry->readers.push_back (number);
+   }
+}
+
+/**
+ * Waits for the last cd, if it has not been waited for, and learns
+ * where it went
+ * @param state the tree
+ */
+static void know_cwd (inode_state& state) {
+   if (pending_cd != nullptr) {
+      unique_lock<mutex> lock (batch_lock);
+      line_done.wait (lock, [] { return pending_cd->done; });
+      cwd = pending_cd->cwd_after;
+      pending_cd.reset();
+   }
+   stage_lock lock (state.get_mutex());
+   if (cwd == no_node) cwd = state.get_cwd();
+   cwd_path = split (state.get_path (cwd), "/");
+}
+
+/**
+ * Works out the names from the root of the path a line uses.  Going
+ * up with ".." reads the directory gone up from, since the line
+ * fails if it is not there.
+ * @param state the tree
+ * @param path  the path as given
+ * @param used  what the line reads and writes
+ * @return      the names
+ */
+static wordvec resolve (inode_state& state, const string& path,
+                        line_paths& used) {
+   wordvec names;
+   if (path.find ("/") != 0) {
+      if (pending_cd != nullptr) know_cwd (state);
+      names = cwd_path;
+   }
+   for (const string& name: split (path, "/")) {
+      if (name == ".") continue;
+      if (name != "..") {
+         names.push_back (name);
+         continue;
+      }
+      used.reads.push_back (names);
+      if (not names.empty()) names.pop_back();
+   }
+   return names;
+}
+
+/**
+ * Works out what a line reads and writes from its words
+ * @param  state the tree
+ * @param  words the line
+ * @param  used  what it reads and writes
+ * @return       false if that cannot be known, or the line changes
+ *               more than its paths
+ */
+static bool classify (inode_state& state, const wordvec& words,
+                      line_paths& used) {
+   if (find (words.begin(), words.end(), "|") != words.end()
+       or find (words.begin(), words.end(), "&") != words.end()) {
+      return false;
+   }
+   wordvec args (words.begin() + 1, words.end());
+   size_t size = args.size();
+   if (size >= 2
+       and (args[size - 2] == ">" or args[size - 2] == ">>")) {
+      // the file is made if it is not there
+      used.writes.push_back (resolve (state, args.back(), used));
+      used.makes = true;
+      args.resize (size - 2);
+   }
+   const string& cmd = words.front();
+   if (cmd == "echo") return true;
+   if (cmd == "pwd") {
+      used.reads.push_back (resolve (state, ".", used));
+      return true;
+   }
+   if (cmd == "cat" or cmd == "grep" or cmd == "wc" or cmd == "ls"
+       or cmd == "lsr" or cmd == "stat") {
+      if (cmd == "stat" and not args.empty() and args.front() == "-i") {
+         return false;
+      }
+      if (cmd == "grep" and not args.empty()) args.erase (args.begin());
+      bool any = false;
+      for (size_t i = 0; i < args.size(); ++i) {
+         const string& arg = args[i];
+         if (cmd == "ls" and arg.find ("--") == 0) {
+            ++i;
+            continue;
+         }
+         used.reads.push_back (resolve (state, arg, used));
+         any = true;
+      }
+      if (not any and (cmd == "ls" or cmd == "lsr")) {
+         used.reads.push_back (resolve (state, ".", used));
+      }
+      return true;
+   }
+   if (cmd == "cd") {
+      used.cd = true;
+      if (not args.empty()) {
+         used.reads.push_back (resolve (state, args.front(), used));
+      }
+      return true;
+   }
+   if (cmd == "mkdir" or cmd == "make") {
+      used.makes = true;
+      if (not args.empty()) {
+         used.writes.push_back (resolve (state, args.front(), used));
+      }
+      return true;
+   }
+   if (cmd == "cp") {
+      used.makes = true;
+      if (not args.empty() and args.front() == "-r") {
+         args.erase (args.begin());
+      }
+      if (args.size() == 2) {
+         used.reads.push_back (resolve (state, args[0], used));
+         used.writes.push_back (resolve (state, args[1], used));
+         used.copies = true;
+      }
+      return true;
+   }
+   if (cmd == "rm" or cmd == "rmr") {
+      used.makes = true;
+      know_cwd (state);
+      for (const string& arg: args) {
+         wordvec path = resolve (state, arg, used);
+         // the shell leaves a directory removed from under it
+         if (path.size() <= cwd_path.size()
+             and equal (path.begin(), path.end(), cwd_path.begin())) {
+            return false;
+         }
+         used.writes.push_back (path);
+      }
+      return true;
+   }
+   return false;
+}
+
+/**
+ * Whether a path is a copy or under one, or above one.  Looking
+ * into a copy can make inodes, as it stops sharing with the source.
+ * @param  path the names of the path
+ * @return      true if the path and a copy are one under the other
+ */
+static bool under_copy (const wordvec& path) {
+   for (const wordvec& copy: copied) {
+      size_t common = min (path.size(), copy.size());
+      if (equal (path.begin(), path.begin() + common, copy.begin())) {
+         return true;
+      }
+   }
+   return false;
+}
+
+/**
+ * Runs a line that everything waits on, once everything before it
+ * is done, and picks up where it left the shell
+ * @param state the tree
+ * @param cmds  the commands to run it with
+ * @param line  the line
+ */
+static void run_alone (inode_state& state, commands& cmds,
+                       batch_line& line) {
+   know_cwd (state);
+   wait_all();
+   print_done();
+   {
+      stage_lock lock (state.get_mutex());
+      state.set_cwd (cwd);
+   }
+   DEBUGF ('b', "line " << line.number << " alone: " << line.words);
+   cout << line.heading;
+   try {
+      cmds.execute (state, line.words);
+   }catch (yshell_exn& exn) {
+      complain() << exn.what() << endl;
+   }
+   paths.children.clear();
+   paths.writer = no_line;
+   paths.readers.clear();
+   cwd = no_node;
+   know_cwd (state);
+}
+
+/**
+ * Starts a line once the lines it has to wait for are done
+ * @param state the tree
+ * @param cmds  the commands to run it with
+ * @param line  the line
+ */
+static void plan (inode_state& state, commands& cmds,
+                  const line_ptr& line) {
+   line_paths used;
+   if (line->words.empty() or line->words.front().at(0) == '#') {
+      lock_guard<mutex> guard (batch_lock);
+      line->done = true;
+      live[line->number] = line;
+      return;
+   }
+   if (not classify (state, line->words, used)) {
+      run_alone (state, cmds, *line);
+      return;
+   }
+   if (used.cd) know_cwd (state);
+   if (pending_cd == nullptr) line->cwd = cwd;
+   for (const wordvec& path: used.reads) {
+      if (under_copy (path)) used.makes = true;
+   }
+   for (const wordvec& path: used.writes) {
+      if (under_copy (path)) used.makes = true;
+   }
+   if (used.copies) copied.push_back (used.writes.back());
+
+   unique_lock<mutex> lock (batch_lock);
+   live[line->number] = line;
+   set<size_t> after;
+   for (const wordvec& path: used.reads) {
+      touch (path, false, line->number, after);
+   }
+   for (const wordvec& path: used.writes) {
+      touch (path, true, line->number, after);
+   }
+   after.erase (line->number);
+   for (size_t number: after) {
+      live[number]->dependents.push_back (line);
+   }
+   line->waiting = after.size();
+   line->by_shell = used.makes;
+   if (used.cd) {
+      line->cwd = cwd;
+      pending_cd = line;
+   }
+   DEBUGF ('b', "line " << line->number << " waits for "
+                << after.size() << " lines");
+   if (used.makes) {
+      // inode numbers come from the thread that makes the inode
+      line_done.wait (lock, [&line] { return line->waiting == 0; });
+      lock.unlock();
+      run_line (state, cmds, *line);
+      lock.lock();
+      finish (line);
+   } else if (line->waiting == 0) {
+      ready.push_back (line);
+      line_ready.notify_one();
+   }
+}
+
+// RUNNING ============================================================
+
+//
+// batch_session -
+//    Routes cout and cerr through the workers and starts them, and
+//    undoes both however the batch ends.  Holds contents as they are
+//    meanwhile, since lines reading them share the tree (see cold.h).
+//
+
+class batch_session {
+   private:
+      inode_state& state;
+      streambuf* terminal_out;
+      streambuf* terminal_err;
+      route_buf out_route;
+      route_buf err_route;
+      cold_hold hold;
+      vector<thread> workers;
+   public:
+      batch_session (inode_state& state, commands& cmds):
+         state (state), terminal_out (cout.rdbuf()),
+         terminal_err (cerr.rdbuf()), out_route (terminal_out, 0),
+         err_route (terminal_err, 1) {
+         cout.rdbuf (&out_route);
+         cerr.rdbuf (&err_route);
+         stopping = false;
+         unsigned count = max (1u, thread::hardware_concurrency());
+         DEBUGF ('b', "starting " << count << " workers");
+         for (unsigned i = 0; i < count; ++i) {
+            workers.emplace_back (work, &state, &cmds);
+         }
+         cwd = no_node;
+         know_cwd (state);
+      }
+      ~batch_session() {
+         wait_all();
+         print_done();
+         {
+            lock_guard<mutex> guard (batch_lock);
+            stopping = true;
+            line_ready.notify_all();
+         }
+         for (thread& worker: workers) worker.join();
+         if (pending_cd != nullptr) know_cwd (state);
+         {
+            stage_lock lock (state.get_mutex());
+            state.set_cwd (cwd);
+         }
+         paths.children.clear();
+         copied.clear();
+         cout.rdbuf (terminal_out);
+         cerr.rdbuf (terminal_err);
+      }
+};
+
+void batch::run (inode_state& state, commands& cmds, bool echo) {
+   batch_session session (state, cmds);
+   for (size_t number = 0;; ++number) {
+      print_done();
+      line_ptr line = make_shared<batch_line>();
+      line->number = number;
+      line->heading = state.get_prompt();
+      string text;
+      getline (cin, text);
+      if (cin.eof()) {
+         wait_all();
+         print_done();
+         cout << line->heading;
+         if (echo) cout << "^D";
+         cout << endl;
+         DEBUGF ('y', "EOF");
+         return;
+      }
+      if (echo) line->heading += text + "\n";
+      line->words = split (text, " \t");
+      plan (state, cmds, line);
+   }
+}
+
@@ -0,0 +1,57 @@
+// $Id$
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+using namespace std;
+
+#include "inode.h"
+
+class commands;
+
+//
+// batch -
+//    A static class which runs a script read from cin with the lines
+//    which only read the tree, and do not read what an earlier line
+//    still to finish writes, run side by side on a pool of workers,
+//    one per core, printing exactly what running it one line after
+//    another would have.  Those lines share the tree lock, where the
+//    storage allows it (see storage::shares_reads), and each runs in
+//    a directory of its own.
+//
+//    Lines which change the tree are not run side by side: each runs
+//    on the shell's own thread, in order, holding the tree lock
+//    alone.  Copies share directories with their source until they
+//    are written, which writers running at once would get wrong, and
+//    the inode numbers ls shows have to come out as they would one
+//    line at a time.
+//
+//    Before a line is started, the paths it reads and writes are
+//    worked out from its words, relative paths against the directory
+//    the shell will be in by then.  It waits for every earlier line
+//    that writes a path it reads or writes, or reads a path it
+//    writes, where one path is the other or under it.  Lines which
+//    write, and those which look into a copy, which can make inodes,
+//    are run by the shell's own thread once their turn comes.  A cd
+//    is waited for before planning the first line which needs to know
+//    where it went.  What each line prints is kept until every line
+//    before it has been printed.
+//
+//    Lines whose paths cannot be known from their words (a pipeline,
+//    a job, run, prompt, stat -i, an rm of the current directory or
+//    above it, any command not known here) wait for everything before
+//    them and are run by the shell itself, and everything after them
+//    waits for them.
+// run -
+//    Runs lines from cin until the end of the input, echoing each as
+//    the shell's loop would if echo is set.  Throws ysh_exit_exn if
+//    the script exits.
+//
+
+class batch {
+   public:
+      static void run (inode_state& state, commands& cmds, bool echo);
+};
+
+#endif
+
@@ -0,0 +1,48 @@
+#!/bin/sh
+# $Id$
+#
+# Checks that cd, ls and pwd allocate nothing once the tree is warm,
+# counting with time (see alloc_hook.h), and fails if any does, with
+# short names and long ones, from the root and from below it.
+# Each line is run once before it is timed, so caches have filled.
+# The disk backend reads the leaves of a directory into a buffer for
+# ls, so there only cd and pwd are held to none.
+# Usage: bench/allocs.sh
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+status=0
+
+for backend in ${BACKEND:-tree soa disk}; do
+   # names longer than a string keeps inside itself, and a cwd other
+   # than the root, as well as short ones
+   long=a_directory_name_of_34_characters_
+   lines="cd /a/b|cd ..|cd b/../b|cd /|pwd|cd /a/$long|pwd|cd ..|pwd"
+   lines="$lines|cd $long/$long|pwd|cd /"
+   if [ $backend != disk ]; then
+      lines="$lines|ls|ls /a|ls a/b|ls --limit 1 /a|ls /a/$long"
+      lines="$lines|cd /a/$long|ls|ls $long|ls ../$long|cd /"
+   fi
+   echo "$lines" | awk -F '|' -v long=$long '{
+      print "mkdir /a"
+      print "mkdir /a/b"
+      print "mkdir /a/" long
+      print "mkdir /a/" long "/" long
+      print "make /a/f some words"
+      print "make /a/" long "/" long "/g words"
+      for (i = 1; i <= NF; ++i) print $i
+      for (i = 1; i <= NF; ++i) print "time " $i
+   }' >$DIR/script.ysh
+   $YSHELL -b $backend -f $DIR/disk <$DIR/script.ysh 2>&1 \
+   | awk -v backend=$backend '
+      /^% time / { line = substr ($0, 8) }
+      /^allocs / {
+         printf "%-6s %-24s %s allocations\n", backend, line, $2
+         if ($2 != 0) failed = 1
+      }
+      END { exit failed }' || status=1
+   rm -f $DIR/disk*
+done
+exit $status
@@ -0,0 +1,44 @@
+#!/bin/sh
+# $Id$
+#
+# Times a script of tenants each working in their own directory, run
+# one line after another and then with --parallel, and checks that
+# both print the same.
+# Usage: bench/batch.sh [tenants] [lines]
+#
+
+YSHELL=${YSHELL:-./yshell}
+TENANTS=${1:-100}
+LINES=${2:-20000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# a third of the lines change a tenant's files, the rest read them
+awk -v tenants=$TENANTS -v n=$LINES 'BEGIN {
+   srand (1)
+   for (t = 0; t < tenants; ++t) {
+      print "mkdir /tenant" t
+      for (f = 0; f < 10; ++f) {
+         print "make /tenant" t "/f" f " words of file " f
+      }
+   }
+   for (i = 0; i < n; ++i) {
+      t = "/tenant" int (rand() * tenants)
+      f = t "/f" int (rand() * 10)
+      r = rand()
+      if (r < 0.1) print "make " f " changed " i
+      else if (r < 0.3) print "echo line " i " >> " f
+      else if (r < 0.6) print "cat " f
+      else if (r < 0.8) print "ls " t
+      else print "grep changed " f
+   }
+}' >$DIR/script.ysh
+
+for mode in "" --parallel; do
+   start=$(date +%s.%N)
+   $YSHELL $mode <$DIR/script.ysh >$DIR/out$mode 2>&1
+   stop=$(date +%s.%N)
+   awk -v m="${mode:-serial}" -v a=$start -v b=$stop -v n=$LINES '
+      BEGIN { printf "%-12s %8.1f usec/line\n", m, 1e6 * (b - a) / n }'
+done
+cmp -s $DIR/out $DIR/out--parallel || echo "outputs differ"
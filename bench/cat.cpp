@@ -0,0 +1,123 @@
+// $Id$
+
+//
+// Builds plain files in one storage backend and times cat of them
+// into cout, which is meant to be a pipe: one file of many words,
+// then many small files in one cat.  The system calls the writes
+// took are counted from the traces of the 'o' debug flag.  The
+// timings go to cerr.
+// Usage: bench/cat backend [words] [files] | cat >/dev/null
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include "commands.h"
+#include "debug.h"
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+//
+// A streambuf which counts the lines written to it and drops them.
+//
+
+class line_count_buf: public streambuf {
+   public:
+      uint64_t lines {0};
+   protected:
+      int_type overflow (int_type c) override {
+         if (c == '\n') ++lines;
+         return traits_type::not_eof (c);
+      }
+};
+
+static double seconds_since (chrono::steady_clock::time_point start) {
+   return chrono::duration<double> (chrono::steady_clock::now()
+                                    - start).count();
+}
+
+static const size_t chunk_words = 100000;
+static const size_t words_per_file = 5;
+
+//
+// Runs one cat, counting its writes, and reports how fast it went.
+//
+
+static void time_cat (commands& cmds, inode_state& state,
+                      const wordvec& line, const string& what,
+                      uint64_t bytes) {
+   line_count_buf traces;
+   streambuf* saved = cerr.rdbuf (&traces);
+   debugflags::setflags ("o");
+   auto start = chrono::steady_clock::now();
+   cmds.execute (state, line);
+   double seconds = seconds_since (start);
+   cerr.rdbuf (saved);
+   cerr << what << ": " << bytes / 1e6 << " MB, " << seconds
+        << " sec, " << bytes / 1e6 / seconds << " MB/sec, "
+        << traces.lines << " writes" << endl;
+}
+
+static void bench (const string& backend, size_t words, size_t files) {
+   inode_state state (make_storage (backend));
+   commands cmds;
+   node_id root = state.get_root();
+
+   // the big file is made a chunk at a time, so it is never all in
+   // one wordvec here
+   node_id big = state.make (root, "big", PLAIN_INODE);
+   uint64_t bytes = 0;
+   wordvec chunk;
+   for (size_t word = 0; word < words; ++word) {
+      chunk.push_back ("word" + to_string (word % 100000));
+      bytes += chunk.back().size() + 1;
+      if (chunk.size() == chunk_words or word + 1 == words) {
+         state.append (big, chunk);
+         chunk.clear();
+      }
+   }
+   time_cat (cmds, state, {"cat", "/big"},
+             backend + " cat of " + to_string (words) + " words",
+             bytes);
+
+   node_id dir = state.make (root, "small", DIR_INODE);
+   wordvec line {"cat"};
+   wordvec contents;
+   bytes = 0;
+   for (size_t word = 0; word < words_per_file; ++word) {
+      contents.push_back ("w" + to_string (word));
+      bytes += contents.back().size() + 1;
+   }
+   bytes *= files;
+   for (size_t file = 0; file < files; ++file) {
+      string name = "f" + to_string (file);
+      state.write (state.make (dir, name, PLAIN_INODE), contents);
+      line.push_back ("/small/" + name);
+   }
+   time_cat (cmds, state, line,
+             backend + " cat of " + to_string (files) + " files",
+             bytes);
+}
+
+int main (int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "Usage: " << argv[0] << " backend [words] [files]"
+           << endl;
+      return EXIT_FAILURE;
+   }
+   size_t words = argc > 2 ? strtoull (argv[2], nullptr, 10)
+                           : 10000000;
+   size_t files = argc > 3 ? strtoull (argv[3], nullptr, 10) : 10000;
+   try {
+      bench (argv[1], words, files);
+   }catch (yshell_exn& exn) {
+      cerr << argv[0] << ": " << exn.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
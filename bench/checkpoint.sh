@@ -0,0 +1,76 @@
+#!/bin/sh
+# $Id$
+#
+# Measures how long commands take while a checkpoint of a large tree
+# is being written in the background, against the same commands with
+# no checkpoint running.
+# Usage: bench/checkpoint.sh [dirs] [commands]
+# Runs against the backend named by $BACKEND, tree by default.
+#
+
+BACKEND=${BACKEND:-tree}
+YSHELL=${YSHELL:-"./yshell -b $BACKEND"}
+DIRS=${1:-50000}
+COMMANDS=${2:-5000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# a directory holding a file per directory, 50 to a parent
+awk -v dirs=$DIRS 'BEGIN {
+   for (i = 0; i < dirs; ++i) {
+      top = "/t" int(i / 50)
+      if (i % 50 == 0) print "mkdir " top
+      print "mkdir " top "/d" i
+      print "make " top "/d" i "/f some words in a file"
+   }
+}' >$DIR/tree.ysh
+echo "compile $DIR/tree.ysh $DIR/tree.ysb" | $YSHELL >/dev/null 2>&1
+
+# the commands timed are typed one at a time, not run from a script,
+# so the checkpoint can get at the tree in between them
+awk -v n=$COMMANDS 'BEGIN {
+   print "mkdir /w"
+   for (i = 0; i < n; ++i) {
+      if (i % 50 == 0) print "mkdir /w/" int(i / 50)
+      print "mkdir /w/" int(i / 50) "/" i
+      print "make /t" (i % 100) "/d" (i % 100 * 50) "/f changed"
+   }
+}' >$DIR/commands.ysh
+
+now() { date +%s.%N; }
+
+# prints the seconds between the shell echoing start and stop
+measure() {
+   { echo "run $DIR/tree.ysb"
+     echo "$1"
+     echo "echo start"
+     cat $DIR/commands.ysh
+     echo "echo stop"
+   } | $YSHELL -c $DIR/tree.ck 2>&1 \
+     | grep --line-buffered -x -e start -e stop \
+     | while read mark; do now; done \
+     | awk 'NR == 1 { start = $1 } NR == 2 { print $1 - start }'
+}
+
+best() {
+   best=
+   for try in 1 2 3; do
+      rm -f $DIR/tree.ck
+      t=$(measure "$1")
+      best=$(awk -v b="$best" -v t=$t \
+                 'BEGIN { print (b == "" || t < b) ? t : b }')
+   done
+   echo $best
+}
+
+base=$(best "echo no checkpoint")
+during=$(best "checkpoint")
+size=$(wc -c <$DIR/tree.ck)
+
+awk -v n=$((COMMANDS * 2)) -v b=$base -v d=$during -v s=$size \
+'BEGIN {
+   printf "checkpoint file:          %8d bytes\n", s
+   printf "no checkpoint:            %8.1f usec/command\n", 1e6 * b / n
+   printf "checkpoint running:       %8.1f usec/command (%.2fx)\n",
+          1e6 * d / n, d / b
+}'
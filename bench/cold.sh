@@ -0,0 +1,45 @@
+#!/bin/sh
+# $Id$
+#
+# Builds files of words drawn from a small vocabulary, and of
+# numbers, lets them all go cold, then reads a few of them over and
+# over, printing what the tree takes in memory before and after,
+# how well the words compressed, and what expanding them cost.
+# Usage: bench/cold.sh [files] [words per file] [reads]
+#
+
+YSHELL=${YSHELL:-./yshell}
+FILES=${1:-5000}
+WORDS=${2:-500}
+READS=${3:-200}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+awk -v files=$FILES -v words=$WORDS -v reads=$READS 'BEGIN {
+   srand (1)
+   print "mkdir /b"
+   for (f = 0; f < files; ++f) {
+      line = "make /b/f" f
+      for (w = int (rand() * 2 * words); w >= 0; --w) {
+         if (f % 4 == 0) {
+            line = line " " int (rand() * 1000000)
+         } else {
+            line = line " word" int (5000 ^ rand())
+         }
+      }
+      print line
+   }
+   print "memstat"
+   for (r = 0; r < reads; ++r) {
+      print "cat /b/f" int (rand() * 20) " > /b/out"
+   }
+   print "memstat"
+   print "coldstat"
+}' >$DIR/script.ysh
+
+for option in "" "--cold-after 0" "--vocab --cold-after 0"; do
+   $YSHELL $option <$DIR/script.ysh 2>&1 \
+      | awk -v o="${option:-warm}" '
+         /^total/ { print o ": " $0 }
+         /^(ratio|hot bytes|expansions|us per)/ { print o ": " $0 }'
+done
@@ -0,0 +1,58 @@
+#!/bin/sh
+# $Id$
+#
+# Compares interpreting a text script with replaying it compiled.
+# Usage: bench/compile.sh [lines] [times]
+# Runs against the backend named by $BACKEND, tree by default.
+#
+
+BACKEND=${BACKEND:-tree}
+YSHELL=${YSHELL:-"./yshell -b $BACKEND"}
+LINES=${1:-5000}
+TIMES=${2:-20}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# a tree to work in, built once per run
+cat >$DIR/setup.ysh <<END
+mkdir /tenant
+mkdir /tenant/a
+mkdir /tenant/a/b
+mkdir /tenant/a/b/c
+END
+
+# typical generated script lines: cd around, list, rewrite files
+awk -v lines=$LINES 'BEGIN {
+   for (i = 0; i < lines; i += 5) {
+      print "cd /tenant/a/b/c"
+      print "make file" i % 50 " some words for file " i
+      print "ls /tenant/a"
+      print "cd ../.."
+      print "pwd"
+   }
+}' >$DIR/body.ysh
+
+now() { date +%s.%N; }
+
+# interpreted: the text script fed through the main loop TIMES times
+cat $DIR/setup.ysh >$DIR/text.ysh
+i=0
+while [ $i -lt $TIMES ]; do cat $DIR/body.ysh >>$DIR/text.ysh; i=$((i+1)); done
+start=$(now)
+$YSHELL <$DIR/text.ysh >/dev/null 2>&1
+text_time=$(awk "BEGIN { print $(now) - $start }")
+
+# compiled: compile once, then replay TIMES times
+{ cat $DIR/setup.ysh; echo "compile $DIR/body.ysh $DIR/body.ysb"; } \
+   >$DIR/compile.ysh
+echo "run $DIR/body.ysb $TIMES" >>$DIR/compile.ysh
+start=$(now)
+$YSHELL <$DIR/compile.ysh >/dev/null 2>&1
+run_time=$(awk "BEGIN { print $(now) - $start }")
+
+total=$((LINES * TIMES))
+echo "lines run:   $total"
+awk -v n=$total -v t=$text_time -v r=$run_time 'BEGIN {
+   printf "interpreted: %d lines/sec\n", n / t
+   printf "compiled:    %d lines/sec\n", n / r
+}'
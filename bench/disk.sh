@@ -0,0 +1,66 @@
+#!/bin/sh
+# $Id$
+#
+# Builds a tree in the disk backend many times the size of its page
+# cache, then times cd, ls, cat and make over a part of it, first
+# with the cache cold and then again with it warm.
+# Usage: bench/disk.sh [dirs] [commands] [cache-mb]
+#
+
+YSHELL=${YSHELL:-"./yshell -b disk"}
+DIRS=${1:-5000}
+COMMANDS=${2:-5000}
+CACHE=${3:-8}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# a directory holding ten files per directory, 50 to a parent
+awk -v dirs=$DIRS 'BEGIN {
+   for (i = 0; i < dirs; ++i) {
+      top = "/t" int(i / 50)
+      if (i % 50 == 0) print "mkdir " top
+      print "mkdir " top "/d" i
+      for (f = 0; f < 10; ++f) {
+         print "make " top "/d" i "/f" f " some words in file " f
+      }
+   }
+}' >$DIR/tree.ysh
+echo "compile $DIR/tree.ysh $DIR/tree.ysb" | ./yshell >/dev/null 2>&1
+echo "run $DIR/tree.ysb" \
+   | $YSHELL -f $DIR/tree.disk --cache-mb $CACHE >/dev/null 2>&1
+
+# the same commands twice, over a hundred directories spread
+# through the tree, which fit in the cache
+awk -v n=$COMMANDS -v dirs=$DIRS 'BEGIN {
+   srand (1)
+   for (i = 0; i < n; ++i) {
+      d = int (int (rand() * 100) * dirs / 100)
+      path = "/t" int(d / 50) "/d" d
+      print "cd " path
+      print "ls"
+      print "cat f" (i % 10)
+      print "make g" (i % 10) " changed " i
+   }
+}' >$DIR/commands.ysh
+
+now() { date +%s.%N; }
+
+{  echo "echo start"
+   cat $DIR/commands.ysh
+   echo "echo middle"
+   cat $DIR/commands.ysh
+   echo "echo stop"
+} | $YSHELL -f $DIR/tree.disk --cache-mb $CACHE 2>&1 \
+  | grep --line-buffered -x -e start -e middle -e stop \
+  | while read mark; do now; done >$DIR/marks
+
+size=$(wc -c <$DIR/tree.disk)
+awk -v n=$((COMMANDS * 4)) -v s=$size -v c=$CACHE '
+   { mark[NR] = $1 }
+   END {
+      printf "disk file:    %8.1f MB, cache %d MB\n", s / 1048576, c
+      printf "cold cache:   %8.1f usec/command\n",
+             1e6 * (mark[2] - mark[1]) / n
+      printf "warm cache:   %8.1f usec/command\n",
+             1e6 * (mark[3] - mark[2]) / n
+   }' $DIR/marks
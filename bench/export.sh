@@ -0,0 +1,45 @@
+#!/bin/sh
+# $Id$
+#
+# Builds a tree of directories of files in each backend, times
+# exporting it to a tar archive, and checks that tar reads back as
+# many entries and bytes as went in.
+# Usage: bench/export.sh [dirs] [files per dir] [words per file]
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIRS=${1:-200}
+FILES=${2:-50}
+WORDS=${3:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+awk -v dirs=$DIRS -v files=$FILES -v words=$WORDS 'BEGIN {
+   srand (1)
+   print "mkdir /b"
+   for (d = 0; d < dirs; ++d) {
+      print "mkdir /b/d" d
+      for (f = 0; f < files; ++f) {
+         line = "make /b/d" d "/f" f
+         for (w = int (rand() * 2 * words); w >= 0; --w) {
+            line = line " w" int (rand() * 100000)
+         }
+         print line
+      }
+   }
+}' >$DIR/script.ysh
+
+for backend in ${BACKEND:-tree disk}; do
+   { cat $DIR/script.ysh; echo "time export /b $DIR/b.tar"; } \
+      | $YSHELL -b $backend -f $DIR/disk 2>&1 \
+      | awk -v b=$backend '/^(real|rss)/ { print b ": " $0 }'
+   rm -f $DIR/disk*
+   entries=$(tar -tf $DIR/b.tar | wc -l)
+   [ $entries -eq $((1 + DIRS + DIRS * FILES)) ] \
+      || echo "$backend: $entries entries in the archive"
+   mkdir $DIR/out
+   tar -xf $DIR/b.tar -C $DIR/out
+   echo "$backend: $(du -sb $DIR/out/b | cut -f1) bytes," \
+        "$(ls -l $DIR/b.tar | awk '{ print $5 }') in the archive"
+   rm -rf $DIR/out $DIR/b.tar
+done
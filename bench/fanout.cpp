@@ -0,0 +1,140 @@
+// $Id$
+
+//
+// Builds a tree shaped like a real one in one storage backend: the
+// number of entries in each directory and of words in each file are
+// drawn from log-normal distributions, so most directories hold a
+// handful of names and most files a few words, with a long tail of
+// big ones.  Reports what the backend says the tree takes, as memstat
+// does, and times lookups and reads of entries picked at random.
+// Usage: bench/fanout backend [nodes] [lookups]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <malloc.h>
+
+using namespace std;
+
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+static double seconds_since (chrono::steady_clock::time_point start) {
+   return chrono::duration<double> (chrono::steady_clock::now()
+                                    - start).count();
+}
+
+//
+// Medians of about 5 entries to a directory and 3 words to a file, a
+// fifth of entries being directories.
+//
+
+static const double dir_mu = 1.6, dir_sigma = 1.1;
+static const double file_mu = 1.0, file_sigma = 1.2;
+static const double dir_share = 0.2;
+
+static size_t drawn (lognormal_distribution<double>& dist,
+                     mt19937& random, size_t most) {
+   return min (most, static_cast<size_t> (lround (dist (random))));
+}
+
+static void bench (const string& backend, size_t nodes,
+                   size_t lookups) {
+   size_t heap_before = mallinfo2().uordblks;
+   inode_state state (make_storage (backend));
+   storage& store = state.get_storage();
+   mt19937 random (1);
+   lognormal_distribution<double> fanout (dir_mu, dir_sigma);
+   lognormal_distribution<double> length (file_mu, file_sigma);
+   bernoulli_distribution is_dir (dir_share);
+
+   vector<pair<node_id, string>> entries;
+   vector<node_id> files;
+   deque<node_id> dirs {state.get_root()};
+   size_t small_dirs = 0, dir_count = 0, small_files = 0;
+   while (entries.size() < nodes) {
+      node_id dir = dirs.empty() ? state.get_root() : dirs.front();
+      if (not dirs.empty()) dirs.pop_front();
+      size_t count = max<size_t> (1, drawn (fanout, random, 5000));
+      small_dirs += count <= 8;
+      ++dir_count;
+      for (size_t entry = 0; entry < count; ++entry) {
+         string name = "entry" + to_string (entries.size());
+         inode_t type = is_dir (random) ? DIR_INODE : PLAIN_INODE;
+         node_id made = state.make (dir, name, type);
+         entries.emplace_back (dir, name);
+         if (type == DIR_INODE) {
+            dirs.push_back (made);
+            continue;
+         }
+         wordvec words (drawn (length, random, 1000));
+         for (size_t word = 0; word < words.size(); ++word) {
+            words[word] = "w" + to_string (word);
+         }
+         small_files += words.size() <= 8;
+         state.write (made, words);
+         files.push_back (made);
+      }
+   }
+   size_t heap_after = mallinfo2().uordblks;
+
+   memory_use use = store.memory();
+   uint64_t total = 0;
+   for (const auto& heading: use.bytes) total += heading.second;
+   cout << backend << ": " << use.inodes << " inodes, "
+        << 100 * small_dirs / dir_count << "% of directories and "
+        << 100 * small_files / max<size_t> (1, files.size())
+        << "% of files 8 or less" << endl;
+   cout << backend << " memory: " << total << " bytes, "
+        << total / max<uint64_t> (1, use.inodes) << " per inode; "
+        << "malloc " << (heap_after - heap_before) / use.inodes
+        << " per inode" << endl;
+
+   vector<size_t> picks (lookups);
+   for (size_t& pick: picks) pick = random() % entries.size();
+   auto start = chrono::steady_clock::now();
+   size_t found = 0;
+   for (size_t pick: picks) {
+      found += store.lookup (entries[pick].first, entries[pick].second)
+               != no_node;
+   }
+   double seconds = seconds_since (start);
+   cout << backend << " lookup: " << 1e9 * seconds / lookups
+        << " nsec, " << found << " found" << endl;
+
+   start = chrono::steady_clock::now();
+   size_t words = 0;
+   for (size_t pick: picks) {
+      words += store.read (files[pick % files.size()]).size();
+   }
+   seconds = seconds_since (start);
+   cout << backend << " read:   " << 1e9 * seconds / lookups
+        << " nsec, " << words << " words" << endl;
+}
+
+int main (int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "Usage: " << argv[0] << " backend [nodes] [lookups]"
+           << endl;
+      return EXIT_FAILURE;
+   }
+   size_t nodes = argc > 2 ? strtoull (argv[2], nullptr, 10) : 200000;
+   size_t lookups = argc > 3 ? strtoull (argv[3], nullptr, 10)
+                             : 1000000;
+   try {
+      bench (argv[1], nodes, lookups);
+   }catch (yshell_exn& exn) {
+      cerr << argv[0] << ": " << exn.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# $Id$
+#
+# Reports the memory and the lookup and read times of a tree shaped
+# like a real one, in each backend, or only the one named by
+# $BACKEND.
+# Usage: bench/fanout.sh [nodes] [lookups]
+#
+
+NODES=${1:-200000}
+LOOKUPS=${2:-1000000}
+
+for backend in ${BACKEND:-tree soa disk}; do
+   bench/fanout $backend $NODES $LOOKUPS
+done
@@ -0,0 +1,60 @@
+#!/bin/sh
+# $Id$
+#
+# Builds a directory tree of text files on the host, then times
+# importing it with import against making the same tree with a
+# script of mkdir and make lines, and checks that both trees list
+# the same.
+# Usage: bench/import.sh [dirs] [files per dir] [words per file]
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIRS=${1:-200}
+FILES=${2:-50}
+WORDS=${3:-2000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# the same files, written out on the host and as a script
+mkdir $DIR/host
+awk -v dirs=$DIRS -v files=$FILES -v words=$WORDS -v top=$DIR/host '
+BEGIN {
+   srand (1)
+   print "mkdir /b"
+   for (d = 0; d < dirs; ++d) {
+      dir = "/d" d
+      system ("mkdir " top dir)
+      print "mkdir /b" dir
+      for (f = 0; f < files; ++f) {
+         line = ""
+         for (w = int (rand() * 2 * words); w >= 0; --w) {
+            line = line " w" int (rand() * 100000)
+         }
+         print substr (line, 2) >top dir "/f" f
+         close (top dir "/f" f)
+         print "make /b" dir "/f" f line
+      }
+   }
+}' >$DIR/script.ysh
+bytes=$(du -sb $DIR/host | cut -f1)
+
+for mode in import script; do
+   if [ $mode = import ]; then
+      printf 'import %s /b\nlsr /b\n' $DIR/host >$DIR/in
+   else
+      { cat $DIR/script.ysh; echo "lsr /b"; } >$DIR/in
+   fi
+   start=$(date +%s.%N)
+   $YSHELL <$DIR/in >$DIR/out.$mode 2>&1
+   stop=$(date +%s.%N)
+   awk -v m=$mode -v a=$start -v b=$stop -v n=$bytes '
+      BEGIN { printf "%-8s %8.3f sec %8.1f MB/sec\n",
+                     m, b - a, n / 1e6 / (b - a) }'
+done
+
+# inode numbers are given out in a different order
+for mode in import script; do
+   grep -v '^%' $DIR/out.$mode | awk '{ print $2, $3 }' \
+      >$DIR/list.$mode
+done
+cmp -s $DIR/list.import $DIR/list.script || echo "trees differ"
@@ -0,0 +1,84 @@
+#!/bin/sh
+# $Id$
+#
+# Measures what the journal costs mutations, with and without fsync,
+# and checks that replaying it rebuilds copies of the root.
+# Usage: bench/journal.sh [dirs]
+# Runs against the backend named by $BACKEND, tree by default.
+#
+
+BACKEND=${BACKEND:-tree}
+YSHELL=${YSHELL:-"./yshell -b $BACKEND"}
+DIRS=${1:-10000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# one mkdir and two makes per directory, 50 to a parent so lookups
+# stay cheap, compiled so that the shell spends its time on the
+# mutations rather than on parsing
+awk -v dirs=$DIRS 'BEGIN {
+   for (i = 0; i < dirs; ++i) {
+      top = "/t" int(i / 50)
+      if (i % 50 == 0) print "mkdir " top
+      print "mkdir " top "/d" i
+      print "make " top "/d" i "/f some words in a file"
+      print "make " top "/d" i "/f the same file rewritten"
+   }
+}' >$DIR/body.ysh
+echo "compile $DIR/body.ysh $DIR/body.ysb" | $YSHELL >/dev/null 2>&1
+
+now() { date +%s.%N; }
+
+# best of three, to keep noise from other processes out
+run() {
+   best=
+   for try in 1 2 3; do
+      rm -f $DIR/journal
+      start=$(now)
+      echo "run $DIR/body.ysb" | $YSHELL "$@" >/dev/null 2>&1
+      best=$(awk -v b="$best" "BEGIN { t = $(now) - $start;
+                                      print (b == \"\" || t < b) ? t : b }")
+   done
+   echo $best
+}
+
+base=$(run)
+group=$(run -j $DIR/journal -g 10 -s commit)
+nosync=$(run -j $DIR/journal -g 10 -s none)
+every=$(run -j $DIR/journal -g 0 -s none)
+
+awk -v n=$((DIRS * 3 + DIRS / 50)) -v b=$base -v g=$group -v s=$nosync -v e=$every \
+'BEGIN {
+   printf "no journal:               %8d mutations/sec\n", n / b
+   printf "group commit, fsync:      %8d mutations/sec (%+.1f%%)\n",
+          n / g, 100 * (b - g) / g
+   printf "group commit, no fsync:   %8d mutations/sec (%+.1f%%)\n",
+          n / s, 100 * (b - s) / s
+   printf "write per record:         %8d mutations/sec (%+.1f%%)\n",
+          n / e, 100 * (b - e) / e
+}'
+
+# replaying has to rebuild what the shell had, copies of the root
+# and what was written under them included, and exit 0
+cat >$DIR/copies.ysh <<END
+mkdir /a
+make /a/f some words
+cp -r / /b
+make /b/a/g more words
+cp -r /. /c
+cd /a
+cp -r .. /d
+mkdir /d/e
+lsr /
+END
+rm -f $DIR/journal
+$YSHELL -j $DIR/journal <$DIR/copies.ysh 2>&1 | grep -v '^%' >$DIR/before
+echo "lsr /" | $YSHELL -j $DIR/journal >$DIR/replay 2>&1
+replayed=$?
+grep -v '^%' $DIR/replay >$DIR/after
+if [ $replayed -ne 0 ] || ! cmp -s $DIR/before $DIR/after; then
+   echo "replay: root copies differ"
+   diff $DIR/before $DIR/after | head -10
+   exit 1
+fi
+echo "replay: root copies rebuilt"
@@ -0,0 +1,79 @@
+// $Id$
+
+//
+// Builds one directory with many entries in one storage backend and
+// times ls over it, then windows of it as ls --limit shows them, the
+// rows going out through cout, which is meant to be a pipe.  The
+// timings go to cerr.
+// Usage: bench/ls backend [entries] [times] | cat >/dev/null
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include "commands.h"
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+static double seconds_since (chrono::steady_clock::time_point start) {
+   return chrono::duration<double> (chrono::steady_clock::now()
+                                    - start).count();
+}
+
+static const size_t windows = 1000;
+static const size_t window_size = 100;
+
+static void bench (const string& backend, size_t entries,
+                   size_t times) {
+   inode_state state (make_storage (backend));
+   node_id dir = state.make (state.get_root(), "big", DIR_INODE);
+   for (size_t entry = 0; entry < entries; ++entry) {
+      state.make (dir, "f" + to_string (entry),
+                  entry % 10 == 0 ? DIR_INODE : PLAIN_INODE);
+   }
+   auto start = chrono::steady_clock::now();
+   for (size_t time = 0; time < times; ++time) {
+      list_directory (state, dir);
+   }
+   cout.flush();
+   double seconds = seconds_since (start);
+   cerr << backend << " ls: " << seconds << " sec, "
+        << entries * times / seconds / 1e6 << " M rows/sec" << endl;
+
+   // windows of ls --limit, each starting after a name spread
+   // through the directory, as a cursor would
+   list_window window;
+   window.limit = window_size;
+   start = chrono::steady_clock::now();
+   for (size_t time = 0; time < windows; ++time) {
+      window.after = "f" + to_string (time * 7919 % entries);
+      list_directory (state, dir, window);
+   }
+   cout.flush();
+   seconds = seconds_since (start);
+   cerr << backend << " ls --limit " << window_size << ": "
+        << 1e6 * seconds / windows << " usec/window" << endl;
+}
+
+int main (int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "Usage: " << argv[0] << " backend [entries] [times]"
+           << endl;
+      return EXIT_FAILURE;
+   }
+   size_t entries = argc > 2 ? strtoull (argv[2], nullptr, 10)
+                             : 1000000;
+   size_t times = argc > 3 ? strtoull (argv[3], nullptr, 10) : 5;
+   try {
+      bench (argv[1], entries, times);
+   }catch (yshell_exn& exn) {
+      cerr << argv[0] << ": " << exn.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+#!/bin/sh
+# $Id$
+#
+# Times ls over one directory of many entries in each backend, with
+# the rows written into a pipe.
+# Usage: bench/ls.sh [entries] [times]
+# Only the backend named by $BACKEND is run, if it is set.
+#
+
+ENTRIES=${1:-1000000}
+TIMES=${2:-5}
+
+for backend in ${BACKEND:-tree soa disk}; do
+   bench/ls $backend $ENTRIES $TIMES | cat >/dev/null
+done
@@ -0,0 +1,124 @@
+// $Id$
+
+//
+// Builds a tree in one storage backend and times lsr over it, going
+// through the storage interface the way the shell does.  Only one
+// backend is built per run, so each run's peak memory is its own.
+// Usage: bench/lsr backend [nodes]
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std;
+
+#include "commands.h"
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+//
+// A streambuf which throws away what is written to it, keeping only
+// a count and a checksum to show every backend printed the same
+// thing.
+//
+
+class sink_buf: public streambuf {
+   public:
+      uint64_t bytes {0};
+      uint64_t sum {0};
+   protected:
+      int_type overflow (int_type c) override {
+         if (c != traits_type::eof()) {
+            add (traits_type::to_char_type (c));
+         }
+         return traits_type::not_eof (c);
+      }
+      streamsize xsputn (const char* s, streamsize count) override {
+         for (streamsize i = 0; i < count; ++i) add (s[i]);
+         return count;
+      }
+   private:
+      void add (char c) {
+         ++bytes;
+         sum = sum * 31 + static_cast<unsigned char> (c);
+      }
+};
+
+static double seconds_since (chrono::steady_clock::time_point start) {
+   return chrono::duration<double> (chrono::steady_clock::now()
+                                    - start).count();
+}
+
+static long peak_rss_mb() {
+   struct rusage usage;
+   getrusage (RUSAGE_SELF, &usage);
+   return usage.ru_maxrss / 1024;
+}
+
+//
+// The tree: a directory per 10 nodes, holding 9 plain files, and a
+// hundred of those directories to each top level directory.  The
+// directories are made first, then the files a round at a time, so
+// that no directory's children are made one after the other, as in
+// a tree that has grown over time.
+//
+
+static const size_t files_per_dir = 9;
+static const size_t dirs_per_top = 100;
+
+static string numbered (char prefix, size_t number) {
+   return prefix + to_string (number);
+}
+
+static void bench (const string& backend, size_t nodes) {
+   auto start = chrono::steady_clock::now();
+   inode_state state (make_storage (backend));
+   node_id root = state.get_root();
+   node_id top = no_node;
+   vector<node_id> dirs (nodes / (files_per_dir + 1));
+   for (size_t d = 0; d < dirs.size(); ++d) {
+      if (d % dirs_per_top == 0) {
+         top = state.make (root, numbered ('t', d / dirs_per_top),
+                           DIR_INODE);
+      }
+      dirs[d] = state.make (top, numbered ('d', d), DIR_INODE);
+   }
+   for (size_t f = 0; f < files_per_dir; ++f) {
+      string name = numbered ('f', f);
+      for (node_id dir: dirs) state.make (dir, name, PLAIN_INODE);
+   }
+   cout << backend << " build: " << seconds_since (start) << " sec"
+        << endl;
+
+   sink_buf sink;
+   ostream out (&sink);
+   start = chrono::steady_clock::now();
+   {
+      yout_guard guard (out);
+      list_recursive (state, root);
+   }
+   cout << backend << " lsr:   " << seconds_since (start) << " sec, "
+        << sink.bytes << " bytes, checksum " << sink.sum << endl;
+   cout << backend << " peak:  " << peak_rss_mb() << " MB" << endl;
+}
+
+int main (int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "Usage: " << argv[0] << " backend [nodes]" << endl;
+      return EXIT_FAILURE;
+   }
+   size_t nodes = argc > 2 ? strtoull (argv[2], nullptr, 10) : 1000000;
+   try {
+      bench (argv[1], nodes);
+   }catch (yshell_exn& exn) {
+      cerr << argv[0] << ": " << exn.what() << endl;
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
+
@@ -0,0 +1,14 @@
+#!/bin/sh
+# $Id$
+#
+# Times lsr over the same tree in each backend, with the peak memory
+# of each.  The full size comparison is 10000000.  Only the backend
+# named by $BACKEND is run, if it is set.
+# Usage: bench/lsr.sh [nodes]
+#
+
+NODES=${1:-1000000}
+
+for backend in ${BACKEND:-tree soa disk}; do
+   bench/lsr $backend $NODES
+done
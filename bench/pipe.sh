@@ -0,0 +1,34 @@
+#!/bin/sh
+# $Id$
+#
+# Checks that a pipeline stage going through the tree is left alone
+# by another stage changing it, in each backend, and fails if any
+# stage complains.  The tree is copied first, so that changing it
+# copies the directories lsr is going through.
+# Usage: bench/pipe.sh [directories]
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIRS=${1:-3000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+status=0
+
+awk -v dirs=$DIRS 'BEGIN {
+   print "mkdir /a"
+   for (i = 0; i < dirs; ++i) print "mkdir /a/d" i
+   print "cp -r /a /b"
+   print "lsr / | mkdir /c1"
+   print "lsr / | grep d1 > /c1/out"
+   print "cat /c1/out | make /c1/f"
+   print "lsr /b | rmr /a"
+}' >$DIR/script.ysh
+
+for backend in ${BACKEND:-tree soa disk}; do
+   $YSHELL -b $backend -f $DIR/disk <$DIR/script.ysh >$DIR/out 2>&1
+   errors=$(grep -c -e error -e 'no such' $DIR/out)
+   printf "%-6s %s errors\n" $backend $errors
+   [ $errors = 0 ] || status=1
+   rm -f $DIR/disk*
+done
+exit $status
@@ -0,0 +1,77 @@
+#!/bin/sh
+# $Id$
+#
+# Checks that a compiled script prints what the same script prints
+# interpreted, in each backend, for the lines the compiler handles
+# itself and those it leaves to the commands, and fails if they
+# differ.
+# Usage: bench/script.sh
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+status=0
+
+cat >$DIR/setup.ysh <<END
+mkdir /d
+mkdir /d/e
+mkdir /d/.hidden
+mkdir /d/..more
+make /d/f one two
+make /d/g three
+END
+
+cat >$DIR/body.ysh <<END
+ls /d
+ls --limit 2 /d
+ls --offset 1 --limit 1 /d
+ls --after f /d
+ls /d --limit
+ls --limit 0 /d
+lsr /d
+lsr --limit 1 /d
+ls -x
+ls /nowhere
+cd /d
+ls
+ls --limit 1
+ls e --limit 1
+ls .
+ls ..
+ls .hidden
+ls ..more
+cd .hidden
+pwd
+cd ..
+cd ..more
+pwd
+cd ../e
+pwd
+cd ./..
+pwd
+make ./h four
+make .hidden/i five
+cat /d/h /d/.hidden/i
+echo a b c
+END
+
+for backend in ${BACKEND:-tree soa disk}; do
+   { cat $DIR/setup.ysh $DIR/body.ysh; } >$DIR/text.ysh
+   { cat $DIR/setup.ysh; echo "compile $DIR/body.ysh $DIR/body.ysb";
+     echo "run $DIR/body.ysb"; } >$DIR/compiled.ysh
+   rm -f $DIR/disk
+   $YSHELL -b $backend -f $DIR/disk <$DIR/text.ysh 2>&1 \
+      | grep -v -e '^%' -e ' build ' >$DIR/text.out
+   rm -f $DIR/disk
+   $YSHELL -b $backend -f $DIR/disk <$DIR/compiled.ysh 2>&1 \
+      | grep -v -e '^%' -e ' build ' >$DIR/compiled.out
+   if cmp -s $DIR/text.out $DIR/compiled.out; then
+      printf "%-6s same\n" $backend
+   else
+      printf "%-6s differs\n" $backend
+      diff $DIR/text.out $DIR/compiled.out | head -20
+      status=1
+   fi
+done
+exit $status
@@ -0,0 +1,49 @@
+#!/bin/sh
+# $Id$
+#
+# Builds a tree of directories of files, then goes back into a few
+# of them over and over, with and without a memory limit, printing
+# what malloc holds once the tree is built, how many subtrees were
+# spilled and read back in, and what that cost.
+# Usage: bench/spill.sh [dirs] [files per dir] [words per file]
+#        [limit in megabytes]
+#
+
+YSHELL=${YSHELL:-./yshell}
+DIRS=${1:-200}
+FILES=${2:-200}
+WORDS=${3:-40}
+LIMIT=${4:-16}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+awk -v dirs=$DIRS -v files=$FILES -v words=$WORDS 'BEGIN {
+   srand (1)
+   for (d = 0; d < dirs; ++d) {
+      print "mkdir /d" d
+      for (f = 0; f < files; ++f) {
+         line = "make /d" d "/f" f
+         for (w = int (rand() * 2 * words); w >= 0; --w) {
+            line = line " w" int (rand() * 100000)
+         }
+         print line
+      }
+   }
+   print "memstat"
+   for (r = 0; r < 100; ++r) {
+      d = int (rand() * 10)
+      print "ls /d" d " > /out"
+      print "cat /d" d "/f" int (rand() * files) " > /out"
+   }
+   print "spillstat"
+}' >$DIR/script.ysh
+
+for option in "" "--mem-limit $LIMIT"; do
+   start=$(date +%s.%N)
+   $YSHELL $option <$DIR/script.ysh >$DIR/out 2>&1
+   end=$(date +%s.%N)
+   awk -v o="${option:-no limit}" -v s=$start -v e=$end '
+      /^malloc in use/ && !seen { print o ": " $0; seen = 1 }
+      /^(spills|fault-ins|us per) / { print o ": " $0 }
+      END { printf "%s: %.2f seconds\n", o, e - s }' $DIR/out
+done
@@ -0,0 +1,44 @@
+#!/bin/sh
+# $Id$
+#
+# Builds files of words drawn from a small vocabulary, then compares
+# what the tree takes in memory, and how long a grep through every
+# file takes, with the words kept as strings and as ids.  Both
+# greps should write as many words.
+# Usage: bench/vocab.sh [files] [words per file] [vocabulary size]
+#
+
+YSHELL=${YSHELL:-./yshell}
+FILES=${1:-20000}
+WORDS=${2:-500}
+VOCAB=${3:-5000}
+DIR=$(mktemp -d)
+trap 'rm -rf $DIR' EXIT
+
+# word ranks follow a rough Zipf curve, as they do in text
+awk -v files=$FILES -v words=$WORDS -v vocab=$VOCAB 'BEGIN {
+   srand (1)
+   print "mkdir /b"
+   grep = "grep word" vocab - 1
+   for (f = 0; f < files; ++f) {
+      line = "make /b/f" f
+      for (w = int (rand() * 2 * words); w >= 0; --w) {
+         line = line " word" int (vocab ^ rand())
+      }
+      print line
+      grep = grep " /b/f" f
+   }
+   print "memstat"
+   print "time " grep " > /b/found"
+   print "wc /b/found"
+}' >$DIR/script.ysh
+
+for option in "" --vocab; do
+   $YSHELL $option <$DIR/script.ysh 2>&1 \
+      | awk -v o="${option:-strings}" '
+         /^(word|vocabulary|total|malloc)/ { print o ": " $0 }
+         /^(real|rss)/ { print o ": grep " $0 }
+         $NF == "/b/found" && $1 ~ /^[0-9]+$/ {
+            print o ": grep wrote " $2 " words"
+         }'
+done
@@ -0,0 +1,382 @@
+// $Id$
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#include "checkpoint.h"
+#include "cold.h"
+#include "debug.h"
+#include "journal.h"
+#include "spill.h"
+#include "storage.h"
+
+static const string checkpoint_magic {"YCP\1"};
+
+//
+// All of the checkpointer's state, guarded by state_lock.  writing
+// is true from the time a checkpoint is captured until its file has
+// been renamed into place.  The tree lock, when both are needed, is
+// always taken first.
+//
+
+static string checkpoint_file;
+static int period {0};
+static inode_state* periodic_state {nullptr};
+static mutex state_lock;
+static condition_variable wakeup;
+static bool writing {false};
+static bool stopping {false};
+static uint64_t last_position {0};
+static thread writer;
+static thread timer;
+
+//
+// snapshot -
+//    What a checkpoint captured while it held the tree lock: the
+//    shared contents of the root, held against compression while
+//    they are written, or failing that the storage to write out
+//    while the lock is still held.
+//
+
+struct snapshot {
+   file_base_ptr root;
+   unique_ptr<cold_hold> hold;
+   storage* live;
+   string prompt;
+   uint64_t position;
+   string path;
+   tree_lock* tree_mutex;
+};
+
+// ENCODING ===========================================================
+
+static void put_number (ostream& out, uint64_t number) {
+   while (number >= 0x80) {
+      out.put (static_cast<char> ((number & 0x7F) | 0x80));
+      number >>= 7;
+   }
+   out.put (static_cast<char> (number));
+}
+
+static void put_string (ostream& out, const string& word) {
+   put_number (out, word.size());
+   out.write (word.data(), word.size());
+}
+
+static bool get_number (const string& in, size_t& pos,
+                        uint64_t& number) {
+   number = 0;
+   for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= in.size()) return false;
+      unsigned char next = in[pos++];
+      number |= uint64_t (next & 0x7F) << shift;
+      if (not (next & 0x80)) return true;
+   }
+   return false;
+}
+
+static bool get_string (const string& in, size_t& pos, string& word) {
+   uint64_t size;
+   if (not get_number (in, pos, size)) return false;
+   if (in.size() - pos < size) return false;
+   word.assign (in, pos, size);
+   pos += size;
+   return true;
+}
+
+// WRITING ============================================================
+
+//
+// Each inode is written as its contents: for a plain file the count
+// of words and the words, for a directory the count of entries and
+// for each its type, its name and its contents.  "." and ".." are
+// left out and made again by load.
+//
+
+/**
+ * Writes out the contents of one inode of the captured tree. A
+ * directory's entries are read under the tree lock, since the shell
+ * may be swapping them for carriers (see directory::freeze); nothing
+ * else in the captured tree changes, so files are read without it.
+ * A spilled directory's entries are read back from the spill file.
+ * @param out        the checkpoint file
+ * @param type       the type of the inode
+ * @param contents   its contents
+ * @param tree_mutex the tree lock
+ */
+void checkpoint::write_contents (ostream& out, inode_t type,
+                                 const file_base_ptr& contents,
+                                 tree_lock& tree_mutex) {
+   if (type == PLAIN_INODE) {
+      const wordvec& words = plain_file_ptr_of (contents)->readfile();
+      put_number (out, words.size());
+      for (const string& word: words) put_string (out, word);
+      return;
+   }
+
+   struct entry {
+      string name;
+      inode_t type;
+      file_base_ptr contents;
+   };
+   vector<entry> entries;
+   {
+      directory_ptr dir =
+         spill_store::read (directory_ptr_of (contents));
+      lock_guard<tree_lock> guard (tree_mutex);
+      entries.reserve (dir->dirents.size());
+      for (const auto& dirent: dir->dirents) {
+         entries.push_back ({dirent.first, dirent.second->get_type(),
+                             dirent.second->get_contents()});
+      }
+   }
+   put_number (out, entries.size());
+   for (const entry& child: entries) {
+      out.put (static_cast<char> (child.type));
+      put_string (out, child.name);
+      write_contents (out, child.type, child.contents, tree_mutex);
+   }
+}
+
+/**
+ * Writes out a tree that cannot be shared, in the same layout as
+ * write_contents, as the storage walks it: each directory's count of
+ * entries comes just before the entries themselves.
+ * @param out   the checkpoint file
+ * @param store the tree, whose lock is held
+ */
+static void write_live (ostream& out, storage& store) {
+   put_number (out, store.stat (store.root()).size);
+   store.iterate (store.root(), [&out, &store] (const node_info& info) {
+      out.put (static_cast<char> (info.type));
+      put_string (out, *info.name);
+      if (info.type == DIR_INODE) {
+         put_number (out, info.size);
+         return;
+      }
+      const wordvec& words = store.read (info.node);
+      put_number (out, words.size());
+      for (const string& word: words) put_string (out, word);
+   });
+}
+
+/**
+ * Body of the writer thread, or for a live tree, of start itself. The
+ * file is written next to its final name and renamed over it once it
+ * is synced, so a crash never leaves a half written checkpoint
+ * behind.
+ * @param snap what was captured
+ */
+void checkpoint::write_snapshot (snapshot snap) {
+   // on its own thread, the shell's commands come first
+   if (snap.live == nullptr) {
+      ::setpriority (PRIO_PROCESS, ::syscall (SYS_gettid), 19);
+   }
+
+   string temp = snap.path + ".tmp";
+   bool written = false;
+   {
+      ofstream out (temp, ios::binary | ios::trunc);
+      if (out) {
+         out << checkpoint_magic;
+         put_number (out, snap.position);
+         put_string (out, snap.prompt);
+         if (snap.live != nullptr) {
+            write_live (out, *snap.live);
+         } else {
+            write_contents (out, DIR_INODE, snap.root,
+                            *snap.tree_mutex);
+         }
+         out.flush();
+         written = bool (out);
+      }
+   }
+   int fd = ::open (temp.c_str(), O_RDONLY);
+   if (fd >= 0) {
+      written = written and ::fsync (fd) == 0;
+      ::close (fd);
+   }
+   if (written and ::rename (temp.c_str(), snap.path.c_str()) == 0) {
+      DEBUGF ('k', snap.path << ": checkpoint at journal position "
+              << snap.position << " written");
+   } else if (snap.live != nullptr) {
+      complain() << snap.path << ": cannot write checkpoint" << endl;
+   } else {
+      // whatever command is running now did not fail
+      warn() << snap.path << ": cannot write checkpoint" << endl;
+   }
+
+   // let go of the captured tree before saying we are done
+   snap.root.reset();
+   snap.hold.reset();
+   lock_guard<mutex> guard (state_lock);
+   writing = false;
+   wakeup.notify_all();
+}
+
+void checkpoint::set_path (const string& path) {
+   checkpoint_file = path;
+}
+
+void checkpoint::set_period (int seconds) {
+   period = seconds;
+}
+
+/**
+ * Captures the tree and hands it to a new writer thread, or writes it
+ * out now if it cannot be shared
+ * @param state the state to capture, whose tree lock is held
+ * @param path  the file to write, or "" for the one from the options
+ */
+void checkpoint::start (inode_state& state, const string& path) {
+   const string& file = path.empty() ? checkpoint_file : path;
+   if (file.empty()) throw yshell_exn ("checkpoint: no file given");
+
+   unique_lock<mutex> guard (state_lock);
+   if (writing) {
+      throw yshell_exn ("checkpoint: still writing the last one");
+   }
+   if (writer.joinable()) writer.join();
+
+   snapshot snap;
+   snap.root = state.get_storage().share (state.get_root());
+   snap.live = snap.root == nullptr ? &state.get_storage() : nullptr;
+   if (snap.live == nullptr) snap.hold.reset (new cold_hold());
+   snap.prompt = state.get_prompt();
+   snap.position = journal::enabled() ? journal::position() : 0;
+   snap.path = file;
+   snap.tree_mutex = &state.get_mutex();
+   DEBUGF ('k', file << ": checkpoint at journal position "
+           << snap.position);
+
+   writing = true;
+   last_position = snap.position;
+   if (snap.live != nullptr) {
+      guard.unlock();
+      write_snapshot (move (snap));
+      return;
+   }
+   writer = thread (write_snapshot, move (snap));
+}
+
+/**
+ * Body of the periodic thread. A checkpoint is skipped when the
+ * journal shows nothing has changed since the last one.
+ */
+static void timer_loop() {
+   unique_lock<mutex> guard (state_lock);
+   while (not stopping) {
+      wakeup.wait_for (guard, chrono::seconds (period));
+      if (stopping) break;
+      if (writing) continue;
+      if (journal::enabled() and journal::position() == last_position) {
+         continue;
+      }
+      guard.unlock();
+      try {
+         lock_guard<tree_lock> tree (periodic_state->get_mutex());
+         checkpoint::start (*periodic_state);
+      }catch (yshell_exn& exn) {
+         warn() << exn.what() << endl;
+      }
+      guard.lock();
+   }
+}
+
+void checkpoint::open (inode_state& state) {
+   if (checkpoint_file.empty() or period <= 0) return;
+   periodic_state = &state;
+   stopping = false;
+   timer = thread (timer_loop);
+}
+
+void checkpoint::close() {
+   {
+      lock_guard<mutex> guard (state_lock);
+      stopping = true;
+      wakeup.notify_all();
+   }
+   if (timer.joinable()) timer.join();
+   if (writer.joinable()) writer.join();
+}
+
+// LOADING ============================================================
+
+/**
+ * Makes the entries of a directory as read from a checkpoint
+ * @param  in    the checkpoint file
+ * @param  pos   where the directory's contents start
+ * @param  state the state being rebuilt
+ * @param  dir   the directory to fill in
+ * @return       false if the file ends early or is garbled
+ */
+static bool read_directory (const string& in, size_t& pos,
+                            inode_state& state, node_id dir) {
+   uint64_t count;
+   if (not get_number (in, pos, count)) return false;
+   string name;
+   wordvec words;
+   for (uint64_t i = 0; i < count; ++i) {
+      if (pos >= in.size()) return false;
+      inode_t type = static_cast<inode_t> (in[pos++]);
+      if (type != DIR_INODE and type != PLAIN_INODE) return false;
+      if (not get_string (in, pos, name)) return false;
+      node_id child = state.make (dir, name, type);
+      if (child == no_node) return false;
+      if (type == DIR_INODE) {
+         if (not read_directory (in, pos, state, child)) return false;
+         continue;
+      }
+      uint64_t size;
+      if (not get_number (in, pos, size)) return false;
+      words.resize (size);
+      for (string& word: words) {
+         if (not get_string (in, pos, word)) return false;
+      }
+      state.write (child, words);
+   }
+   return true;
+}
+
+/**
+ * Rebuilds the tree from the checkpoint file given by set_path
+ * @param  state the empty state to fill in
+ * @return       the journal position to replay from
+ */
+uint64_t checkpoint::load (inode_state& state) {
+   if (checkpoint_file.empty()) return 0;
+   ifstream file (checkpoint_file, ios::binary);
+   if (not file) return 0;
+   string in {istreambuf_iterator<char> (file),
+              istreambuf_iterator<char>()};
+
+   size_t pos = checkpoint_magic.size();
+   uint64_t position;
+   string prompt;
+   if (in.compare (0, pos, checkpoint_magic) != 0
+       or not get_number (in, pos, position)
+       or not get_string (in, pos, prompt)
+       or not read_directory (in, pos, state, state.get_root())
+       or pos != in.size()) {
+      throw yshell_exn (checkpoint_file + ": not a checkpoint");
+   }
+   state.set_prompt (prompt);
+   last_position = position;
+   DEBUGF ('k', checkpoint_file << ": loaded, journal position "
+           << position);
+   return position;
+}
+
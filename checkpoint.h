@@ -0,0 +1,66 @@
+// $Id$
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "inode.h"
+#include "util.h"
+
+//
+// checkpoint -
+//    A static class which writes the whole tree out to one file, so
+//    that the journal does not have to be replayed from the start.
+//    Where the storage can share the contents of the root, the way
+//    cp -r does, the tree is captured that way in constant time.  It
+//    is then written out on a background thread while the shell
+//    goes on; anything the shell changes meanwhile is copied on
+//    write, so the file holds the tree exactly as it was when the
+//    checkpoint started.  Any other storage (soa and disk) is written
+//    out there and then, through storage::iterate, holding up the
+//    shell for as long as that takes.  A checkpoint which cannot be
+//    written in the background is reported without changing the
+//    exit status.
+// set_path, set_period -
+//    The file checkpoints go to, and how many seconds apart they are
+//    taken in the background (0 for never).  Set from the options.
+// load -
+//    Rebuilds the state from the checkpoint file, if there is one,
+//    and returns the journal position it was taken at.
+// open -
+//    Starts taking checkpoints of the state every period.
+// start -
+//    Captures the tree and starts writing it out to the given file,
+//    or the one set by set_path.  Called with the tree lock held.
+//    Throws a yshell_exn if the last checkpoint is still being
+//    written.
+// close -
+//    Stops the periodic checkpoints and waits for the one being
+//    written, if any.
+// write_snapshot, write_contents -
+//    The writer, and the contents of one inode of a tree captured
+//    by sharing it.
+//
+
+struct snapshot;
+
+class checkpoint {
+   private:
+      static void write_snapshot (snapshot snap);
+      static void write_contents (ostream& out, inode_t type,
+                                  const file_base_ptr& contents,
+                                  tree_lock& tree_mutex);
+   public:
+      static void set_path (const string& path);
+      static void set_period (int seconds);
+      static uint64_t load (inode_state& state);
+      static void open (inode_state& state);
+      static void start (inode_state& state, const string& path = "");
+      static void close();
+};
+
+#endif
+
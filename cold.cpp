@@ -0,0 +1,447 @@
+// $Id$
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+
+#include "cold.h"
+#include "debug.h"
+#include "storage.h"
+
+//
+// The policy, set from the options before anything is written.
+//
+
+bool cold_store::on {false};
+static uint64_t after_millis {0};
+static size_t min_bytes {256};
+static size_t cache_bytes {size_t (1) << 20};
+
+//
+// The two lists, each a chain of blobs from newest to oldest through
+// their newer and older links, and what is known about them, guarded
+// by cold_lock.  Compressed blobs are on neither list.  The counts of
+// expansions are kept apart, since any thread reading a compressed
+// blob expands it, with or without the lock.
+//
+
+enum {OFF_LIST, WARM_LIST, HOT_LIST};
+
+struct blob_list {
+   content_blob* newest {nullptr};
+   content_blob* oldest {nullptr};
+   uint64_t count {0};
+};
+
+static blob_list lists[3];
+static uint64_t hot_bytes {0};
+static uint64_t cold_count {0};
+static uint64_t cold_bytes {0};
+static uint64_t warm_bytes {0};
+static uint64_t compressions {0};
+static int holds {0};
+static mutex cold_lock;
+static atomic<uint64_t> expansions {0};
+static atomic<uint64_t> expand_nanos {0};
+
+static uint64_t now_millis() {
+   return chrono::duration_cast<chrono::milliseconds> (
+             chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void cold_store::set_after (int millis) {
+   on = millis >= 0;
+   after_millis = millis;
+}
+
+void cold_store::set_min_bytes (size_t bytes) {
+   min_bytes = bytes;
+}
+
+void cold_store::set_cache_kb (size_t kilobytes) {
+   cache_bytes = kilobytes << 10;
+}
+
+// CODING =============================================================
+
+static void put_number (string& out, uint64_t number) {
+   while (number >= 0x80) {
+      out += static_cast<char> ((number & 0x7F) | 0x80);
+      number >>= 7;
+   }
+   out += static_cast<char> (number);
+}
+
+static uint64_t get_number (const char*& at) {
+   uint64_t number = 0;
+   for (int shift = 0;; shift += 7) {
+      unsigned char byte = *at++;
+      number |= uint64_t (byte & 0x7F) << shift;
+      if (byte < 0x80) return number;
+   }
+}
+
+//
+// A word is a number if printing the number gives the word back.
+//
+
+static bool is_number (const string& word) {
+   if (word.empty() or word.size() > 19) return false;
+   if (word.size() > 1 and word[0] == '0') return false;
+   for (char digit: word) {
+      if (digit < '0' or digit > '9') return false;
+   }
+   return true;
+}
+
+//
+// LZ77 in the manner of LZ4: a run of literals and then a match,
+// over and over, each pair led by a byte holding both lengths, with
+// longer ones carried on in bytes of 255, and the match as a 16 bit
+// distance back.  The last run is literals alone.  Matches of fewer
+// than four bytes are not worth their distance.
+//
+
+static constexpr size_t min_match = 4;
+static constexpr size_t max_distance = 65535;
+static constexpr int hash_bits = 12;
+
+static void put_length (string& out, size_t length) {
+   for (; length >= 255; length -= 255) out += static_cast<char> (255);
+   out += static_cast<char> (length);
+}
+
+static void put_run (string& out, const char* literals, size_t count,
+                     size_t distance, size_t match) {
+   size_t extra = match == 0 ? 0 : match - min_match;
+   out += static_cast<char> ((min<size_t> (count, 15) << 4)
+                             | min<size_t> (extra, 15));
+   if (count >= 15) put_length (out, count - 15);
+   out.append (literals, count);
+   if (match == 0) return;
+   out += static_cast<char> (distance & 0xFF);
+   out += static_cast<char> (distance >> 8);
+   if (extra >= 15) put_length (out, extra - 15);
+}
+
+static uint32_t load (const char* at) {
+   uint32_t word;
+   memcpy (&word, at, sizeof word);
+   return word;
+}
+
+static void lz_compress (const string& in, string& out) {
+   static constexpr uint32_t none = UINT32_MAX;
+   uint32_t table[1 << hash_bits];
+   fill (begin (table), end (table), none);
+   const char* data = in.data();
+   size_t size = in.size();
+   size_t pos = 0;
+   size_t anchor = 0;
+   while (pos + min_match <= size) {
+      uint32_t sequence = load (data + pos);
+      uint32_t slot = (sequence * 2654435761u) >> (32 - hash_bits);
+      uint32_t candidate = table[slot];
+      table[slot] = pos;
+      if (candidate == none or pos - candidate > max_distance
+          or load (data + candidate) != sequence) {
+         ++pos;
+         continue;
+      }
+      size_t match = min_match;
+      while (pos + match < size
+             and data[candidate + match] == data[pos + match]) {
+         ++match;
+      }
+      put_run (out, data + anchor, pos - anchor, pos - candidate,
+               match);
+      pos += match;
+      anchor = pos;
+   }
+   put_run (out, data + anchor, size - anchor, 0, 0);
+}
+
+static size_t get_length (const char*& at, size_t length) {
+   if (length < 15) return length;
+   unsigned char byte;
+   do {
+      byte = *at++;
+      length += byte;
+   } while (byte == 255);
+   return length;
+}
+
+static void lz_expand (const string& in, string& out) {
+   const char* at = in.data();
+   const char* end = at + in.size();
+   while (at < end) {
+      unsigned char token = *at++;
+      size_t count = get_length (at, token >> 4);
+      out.append (at, count);
+      at += count;
+      if (at == end) break;
+      size_t distance = static_cast<unsigned char> (at[0])
+                      | static_cast<unsigned char> (at[1]) << 8;
+      at += 2;
+      size_t match = get_length (at, token & 15) + min_match;
+      // the match may run on into what it copies
+      size_t from = out.size() - distance;
+      for (size_t i = 0; i < match; ++i) out += out[from + i];
+   }
+}
+
+/**
+ * Codes the words of a warm blob into a cold form: ids and numbers
+ * as varints, anything else as varint lengths and the words, put
+ * through the LZ77 coder
+ * @param words   the words, unless they are encoded
+ * @param ids     the ids, if they are
+ * @param encoded whether they are
+ * @param form    where the coded words go
+ */
+static void compress (const wordvec& words, const vector<word_id>& ids,
+                      bool encoded, cold_form& form) {
+   if (encoded) {
+      form.kind = 'i';
+      for (word_id id: ids) put_number (form.bytes, id);
+      form.count = ids.size();
+   }else if (all_of (words.begin(), words.end(), is_number)) {
+      form.kind = 'n';
+      for (const string& word: words) {
+         put_number (form.bytes, stoull (word));
+      }
+      form.count = words.size();
+   }else {
+      form.kind = 'z';
+      string plain;
+      for (const string& word: words) {
+         put_number (plain, word.size());
+         plain += word;
+      }
+      lz_compress (plain, form.bytes);
+      form.count = words.size();
+      form.plain_size = plain.size();
+   }
+   form.bytes.shrink_to_fit();
+}
+
+// LISTS ==============================================================
+
+void cold_store::enter (content_blob* blob) {
+   if (not on) return;
+   lock_guard<mutex> guard (cold_lock);
+   blob->used = now_millis();
+   push (*blob, WARM_LIST);
+}
+
+void cold_store::leave (content_blob* blob) {
+   if (not on) return;
+   lock_guard<mutex> guard (cold_lock);
+   if (blob->on_list != OFF_LIST) {
+      unlink (*blob);
+   }
+   if (blob->cold != nullptr) {
+      --cold_count;
+      cold_bytes -= blob->cold_bytes();
+      warm_bytes -= blob->cold->warm_bytes;
+   }
+}
+
+/**
+ * Marks a blob used, moving it to the front of its list, or if it is
+ * compressed, expanding it and putting it on the hot list.  While a
+ * cold_hold is held, a compressed blob that others may be reading is
+ * left as it is, and whoever reads it expands a copy.
+ * @param blob  the blob
+ * @param owned whether only the caller's file can see the blob
+ */
+void cold_store::touch (content_blob& blob, bool owned) {
+   if (not on) return;
+   lock_guard<mutex> guard (cold_lock);
+   blob.used = now_millis();
+   if (blob.cold != nullptr) {
+      if (holds == 0 or owned) thaw (blob);
+      return;
+   }
+   int which = blob.on_list == OFF_LIST ? WARM_LIST : blob.on_list;
+   if (blob.on_list != OFF_LIST) unlink (blob);
+   push (blob, which);
+}
+
+/**
+ * Compresses a blob in place, if it is worth it, and takes it off
+ * its list.  Called with cold_lock held.
+ * @param blob the blob
+ */
+void cold_store::freeze (content_blob& blob) {
+   size_t before = blob.header_bytes() + blob.char_bytes()
+                 + blob.id_bytes();
+   unlink (blob);
+   blob.hot_bytes = 0;
+   if (before < min_bytes) return;
+   unique_ptr<cold_form> form (new cold_form());
+   compress (blob.words, blob.ids, blob.encoded, *form);
+   if (sizeof (cold_form) + form->bytes.capacity() >= before) return;
+   form->warm_bytes = before;
+   blob.cold = move (form);
+   wordvec().swap (blob.words);
+   vector<word_id>().swap (blob.ids);
+   ++compressions;
+   ++cold_count;
+   cold_bytes += blob.cold_bytes();
+   warm_bytes += before;
+   DEBUGF ('z', "compressed " << before << " bytes to "
+           << blob.cold_bytes());
+}
+
+/**
+ * Expands a blob in place and puts it on the hot list.  Called with
+ * cold_lock held.
+ * @param blob the blob
+ */
+void cold_store::thaw (content_blob& blob) {
+   --cold_count;
+   cold_bytes -= blob.cold_bytes();
+   warm_bytes -= blob.cold->warm_bytes;
+   expand (blob, blob);
+   blob.cold.reset();
+   blob.hot_bytes = blob.header_bytes() + blob.char_bytes()
+                  + blob.id_bytes();
+   push (blob, HOT_LIST);
+}
+
+/**
+ * Compresses, oldest first, every blob unread for longer than the
+ * policy allows, then hot blobs until the rest fit in the cache.
+ * Nothing is done while a cold_hold is held.
+ * @param state the state whose tree lock is taken
+ */
+void cold_store::sweep (inode_state& state) {
+   if (not on) return;
+   lock_guard<tree_lock> tree (state.get_mutex());
+   lock_guard<mutex> guard (cold_lock);
+   if (holds > 0) return;
+   uint64_t now = now_millis();
+   auto stale = [now] (const content_blob* blob) {
+      return blob != nullptr and now - blob->used >= after_millis;
+   };
+   while (stale (lists[WARM_LIST].oldest)) {
+      freeze (*lists[WARM_LIST].oldest);
+   }
+   while (stale (lists[HOT_LIST].oldest)
+          or (hot_bytes > cache_bytes
+              and lists[HOT_LIST].oldest != nullptr)) {
+      freeze (*lists[HOT_LIST].oldest);
+   }
+}
+
+/**
+ * Parses the words of a compressed blob out of its cold form, and
+ * counts the time it took
+ * @param blob the blob
+ * @param into the blob, or a buffer, to hold the words
+ */
+void cold_store::expand (const content_blob& blob,
+                         content_blob& into) {
+   auto start = chrono::steady_clock::now();
+   const cold_form& form = *blob.cold;
+   into.encoded = blob.encoded;
+   into.words.clear();
+   into.ids.clear();
+   const char* at = form.bytes.data();
+   if (form.kind == 'i') {
+      into.ids.reserve (form.count);
+      for (size_t i = 0; i < form.count; ++i) {
+         into.ids.push_back (get_number (at));
+      }
+   }else if (form.kind == 'n') {
+      into.words.reserve (form.count);
+      for (size_t i = 0; i < form.count; ++i) {
+         into.words.push_back (to_string (get_number (at)));
+      }
+   }else {
+      static thread_local string plain;
+      plain.clear();
+      plain.reserve (form.plain_size);
+      lz_expand (form.bytes, plain);
+      into.words.resize (form.count);
+      const char* word = plain.data();
+      for (string& expanded: into.words) {
+         size_t length = get_number (word);
+         expanded.assign (word, length);
+         word += length;
+      }
+   }
+   ++expansions;
+   expand_nanos += chrono::duration_cast<chrono::nanoseconds> (
+                      chrono::steady_clock::now() - start).count();
+}
+
+cold_use cold_store::report() {
+   cold_use use;
+   lock_guard<mutex> guard (cold_lock);
+   use.cold = cold_count;
+   use.cold_bytes = cold_bytes;
+   use.warm_bytes = warm_bytes;
+   use.warm = lists[WARM_LIST].count + lists[HOT_LIST].count;
+   use.hot = lists[HOT_LIST].count;
+   use.hot_bytes = hot_bytes;
+   use.cache_bytes = cache_bytes;
+   use.compressions = compressions;
+   use.expansions = expansions;
+   use.expand_nanos = expand_nanos;
+   return use;
+}
+
+/**
+ * Takes a blob off its list.  Called with cold_lock held.
+ * @param blob the blob
+ */
+void cold_store::unlink (content_blob& blob) {
+   blob_list& list = lists[blob.on_list];
+   if (blob.on_list == HOT_LIST) hot_bytes -= blob.hot_bytes;
+   (blob.newer != nullptr ? blob.newer->older : list.newest)
+      = blob.older;
+   (blob.older != nullptr ? blob.older->newer : list.oldest)
+      = blob.newer;
+   blob.newer = blob.older = nullptr;
+   blob.on_list = OFF_LIST;
+   --list.count;
+}
+
+/**
+ * Puts a blob at the front of a list.  Called with cold_lock held.
+ * @param blob  the blob
+ * @param which the list
+ */
+void cold_store::push (content_blob& blob, int which) {
+   blob_list& list = lists[which];
+   if (which == HOT_LIST) hot_bytes += blob.hot_bytes;
+   blob.older = list.newest;
+   blob.newer = nullptr;
+   (list.newest != nullptr ? list.newest->newer : list.oldest)
+      = &blob;
+   list.newest = &blob;
+   blob.on_list = which;
+   ++list.count;
+}
+
+cold_hold::cold_hold() {
+   lock_guard<mutex> guard (cold_lock);
+   ++holds;
+}
+
+cold_hold::~cold_hold() {
+   lock_guard<mutex> guard (cold_lock);
+   --holds;
+}
+
+bool cold_hold::held() {
+   lock_guard<mutex> guard (cold_lock);
+   return holds > 0;
+}
+
@@ -0,0 +1,131 @@
+// $Id$
+
+#ifndef __COLD_H__
+#define __COLD_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "content.h"
+#include "inode.h"
+
+//
+// cold_form -
+//    The words of a compressed blob: how bytes is coded, how many
+//    words it holds, how long it is expanded, before the words are
+//    parsed out of it, and what the words took on the heap.
+//
+
+struct cold_form {
+   char kind;
+   string bytes;
+   size_t count;
+   size_t plain_size;
+   size_t warm_bytes;
+};
+
+//
+// cold_use -
+//    What compression has done: blobs compressed and the bytes they
+//    take, against what they took before; blobs warm, and of those,
+//    the ones expanded again, which make up the hot cache; and how
+//    many times, and for how long in all, blobs were expanded.
+//
+
+struct cold_use {
+   uint64_t cold {0};
+   uint64_t cold_bytes {0};
+   uint64_t warm_bytes {0};
+   uint64_t warm {0};
+   uint64_t hot {0};
+   uint64_t hot_bytes {0};
+   uint64_t cache_bytes {0};
+   uint64_t compressions {0};
+   uint64_t expansions {0};
+   uint64_t expand_nanos {0};
+};
+
+//
+// cold_store -
+//    A static class which compresses the contents of plain files in
+//    the tree backend once they have gone unread for a while, and
+//    expands them again when they are next read.  Blobs are kept on
+//    two lists, least recently used last: warm ones, and hot ones,
+//    which were compressed once and expanded again.  A sweep, which
+//    the shell makes between commands, compresses what has been on
+//    either list for longer than the policy allows, and as many hot
+//    blobs as the hot cache needs to stay in its size.  Words which
+//    are all numbers, and ids into the vocabulary, are coded as
+//    varints; any other words with a fast LZ77 coder.  While any
+//    cold_hold is held, blobs are neither compressed nor expanded in
+//    place, and reading a cold blob expands a copy instead.
+// set_after, set_min_bytes, set_cache_kb -
+//    The policy, set from the options: how many milliseconds a blob
+//    goes unread before it is compressed (negative for never, the
+//    default), the fewest bytes worth compressing, and the size of
+//    the hot cache.
+// enabled -
+//    Whether anything is ever compressed.
+// enter, leave -
+//    Puts a new blob on the warm list, and takes one that is going
+//    away off its list.
+// touch -
+//    Marks a blob used, expanding it if it is compressed, and no
+//    cold_hold is held or the blob is owned by the caller's file
+//    alone.  Called with the tree lock held.
+// sweep -
+//    Compresses what the policy says is cold.  Takes the tree lock.
+// expand -
+//    Expands the words of a compressed blob into another blob.
+// report -
+//    What compression has done so far.
+//
+
+class cold_store {
+   friend class cold_hold;
+   private:
+      static bool on;
+      static void freeze (content_blob& blob);
+      static void thaw (content_blob& blob);
+      static void unlink (content_blob& blob);
+      static void push (content_blob& blob, int which);
+   public:
+      static void set_after (int millis);
+      static void set_min_bytes (size_t bytes);
+      static void set_cache_kb (size_t kilobytes);
+      static bool enabled() { return on; }
+      static void enter (content_blob* blob);
+      static void leave (content_blob* blob);
+      static void touch (content_blob& blob, bool owned = false);
+      static void sweep (inode_state& state);
+      static void expand (const content_blob& blob,
+                          content_blob& into);
+      static cold_use report();
+};
+
+//
+// cold_hold -
+//    Held by whatever reads the contents of plain files outside the
+//    tree lock, such as a checkpoint being written, an export, or a
+//    background job, for as long as it reads them.  Made before it
+//    starts reading, where no sweep can be under way: with the tree
+//    lock held, or on the shell's thread.
+// held -
+//    Whether any cold_hold is held.  Subtrees are not spilled while
+//    one is either (see spill.h).
+//
+
+class cold_hold {
+   private:
+      cold_hold (const cold_hold&) = delete;
+      cold_hold& operator= (const cold_hold&) = delete;
+   public:
+      cold_hold();
+      ~cold_hold();
+      static bool held();
+};
+
+#endif
+
@@ -1,33 +1,69 @@
 // $Id: commands.cpp,v 1.11 2014-06-11 13:49:31-07 - - $
 // MODIFY IT!
+#include "alloc_hook.h"
+#include "checkpoint.h"
+#include "cold.h"
 #include "commands.h"
 #include "debug.h"
+#include "export.h"
+#include "gather.h"
+#include "import.h"
+#include "jobs.h"
+#include "listing.h"
+#include "pipe.h"
+#include "script.h"
+#include "spill.h"
+#include "storage.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <malloc.h>
+#include <memory>
+#include <set>
+#include <sys/resource.h>
+#include <thread>
 #include <vector>
 
 commands::commands(): map ({
    {"cat"   , fn_cat   },
    {"cd"    , fn_cd    },
+   {"checkpoint", fn_checkpoint},
+   {"coldstat", fn_coldstat},
+   {"compile", fn_compile},
+   {"cp"    , fn_cp    },
+   {"dedupstat", fn_dedupstat},
    {"echo"  , fn_echo  },
    {"exit"  , fn_exit  },
+   {"export", fn_export},
+   {"fg"    , fn_fg    },
+   {"grep"  , fn_grep  },
+   {"import", fn_import},
+   {"jobs"  , fn_jobs  },
    {"ls"    , fn_ls    },
    {"lsr"   , fn_lsr   },
    {"make"  , fn_make  },
+   {"memstat", fn_memstat},
    {"mkdir" , fn_mkdir },
    {"prompt", fn_prompt},
    {"pwd"   , fn_pwd   },
    {"rm"    , fn_rm    },
+   {"rmr"   , fn_rmr   },
+   {"run"   , fn_run   },
+   {"spillstat", fn_spillstat},
+   {"stat"  , fn_stat  },
+   {"wait"  , fn_wait  },
+   {"wc"    , fn_wc    },
    {"quit"  , fn_exit  }, // added my own little "alias" that I use
 }){}
 
 // HELPER FUNCTIONS ====================================================
 /**
- * Helper function to pop off the command from a wordvec given
- * @param  words  a wordvec that consists of whole line
- * @return        returns the first word of the command
+ * Helper function to pop off the command from the words given
+ * @param  words  the whole line
+ * @return        the words after the command, without copying them
  */
-wordvec pop_command(wordvec words){
-   wordvec tmp = words;
-   tmp.erase(tmp.begin());
+word_span pop_command(word_span words){
+   word_span tmp = words.empty() ? words : words.subspan(1);
    DEBUGF('c', "commandless words: " << tmp);
    return tmp;
 }
@@ -37,337 +73,490 @@ wordvec pop_command(wordvec words){
  * Parses a path string into a vector of folder names
  * @param path wordvec of all the folder names in the path
  */
-wordvec parse_path(string path){
+wordvec parse_path(const string& path){
    // wordvec to return
    wordvec ret;
 
-   // temp string to manipulate
-   string tmp = path;
+   // where the rest of the path starts
+   size_t start = 0;
 
    // iterate over the string to parse the slashes out
-   while (tmp != ""){
+   while (start < path.size()){
 
-      size_t pos = tmp.find("/");
+      size_t pos = path.find("/", start);
       DEBUGF('c', "pos = " << pos);
 
       // if the first slash is root, add an empty string to signify it
-      if (pos == 0){
+      if (pos == start){
          ret.push_back("");
-         tmp.erase(0, 1);
+         ++start;
          continue;
       }
 
-      // if there are no slashes in the path, we are done
-      if (pos >= tmp.size() - 1) {
-         ret.push_back(tmp);
+      // if there are no slashes in the rest of the path, we are done
+      if (pos == string::npos or pos + 1 >= path.size()) {
+         ret.push_back(path.substr(start));
          break;
       };
 
-      // otherwise pop off a directory, and erase it and continue
-      string dir = tmp.substr (0, pos);
-      ret.push_back(dir);
-      tmp.erase(0, pos + 1);
-      DEBUGF('c', "curr dir =  " << dir);
-      DEBUGF('c', "new pos = " << tmp.find("/"));
+      // otherwise take a directory off the front and continue
+      ret.push_back(path.substr(start, pos - start));
+      start = pos + 1;
+      DEBUGF('c', "curr dir =  " << ret.back());
    }
    // finally return the wordvec
    return ret;
 }
 
-// /**
-//  * helper function that returns true if the
-//  * @param  path wordvec of the directories, should start at root
-//  * @return      [description]
-//  */
-// bool dir_exists(wordvec path){
-//
-// }
-//
-// /**
-//  * [get_dir description]
-//  * @param  path [description]
-//  * @return      [description]
-//  */
-// bool get_dir(wordvec path){
-//
-// }
-
-/**
- * Helper function that returns a wordvec of the complete path to the
- * root
- * @param  node  [the node that the path is from]
- * @param  root  [a poine to the root]
- * @return       [wordvec  that is the root]
- */
-wordvec get_path_from_root(inode_ptr node, inode_ptr root){
-   wordvec ret;
-   inode_ptr curr = node;
+/**
+ * Finds the node at a path. An absolute path starts at the root and
+ * any other at the cwd. "." and ".." are looked up like any other
+ * name, since every directory has them.
+ * @param  path  the path
+ * @param  state the current inode state
+ * @return       the node, or no_node if there is nothing there
+ */
+node_id find_node(const string& path, inode_state& state){
+   storage& store = state.get_storage();
+   node_id node = path.find("/") == 0 ? store.root() : state.get_cwd();
+   // kept from one call to the next, so a long name is only ever
+   // given room once
+   static thread_local string name;
+   size_t end = 0;
+   while (node != no_node and next_word(path, "/", end, name)){
+      node = store.lookup(node, name);
+   }
+   return node;
+}
 
-   while(curr != root){
-      ret.insert(ret.begin(), curr->get_name());
-      curr = curr->get_parent();
+/**
+ * Finds the directory that the last name in a path goes in
+ * @param  path  the path
+ * @param  state the current inode state
+ * @param  name  set to the last name in the path
+ * @return       the node the name goes in, or no_node if there is
+ *               nothing there or the path has no names
+ */
+node_id find_parent(const string& path, inode_state& state,
+                    string& name){
+   size_t end = 0;
+   if (not next_word(path, "/", end, name)) return no_node;
+   storage& store = state.get_storage();
+   node_id node = path.find("/") == 0 ? store.root() : state.get_cwd();
+   string next;
+   while (next_word(path, "/", end, next)){
+      if (node != no_node) node = store.lookup(node, name);
+      name.swap(next);
    }
-   ret.insert(ret.begin(), "");
-   return ret;
+   return node;
 }
 
 /**
- * Get an inode pointer to any point in the directory tree by giving it
- * a path from root
- * @param  path complete path from root. If it's a string run
- *              parse path first
- * @pre         if the path doesn't exist throw a runtime error
- * @return      the complete path
+ * Finds the plain file at the given path, making an empty one if it
+ * does not exist yet. Prints an error if the directory it would be in
+ * does not exist or the path is a directory.
+ * @param  path  the path of the file
+ * @param  state the current inode state
+ * @return       the file's node, or no_node on error
  */
-inode_ptr get_ptr_to_dir(wordvec path, inode_ptr root){
-   if (path.at(0) != ""){
-      throw runtime_error("path does not begin at root");
+node_id open_plain(const string& path, inode_state& state){
+   storage& store = state.get_storage();
+   string filename;
+   node_id plain_place = find_parent(path, state, filename);
+   if (plain_place == no_node){
+      cout << "error: " << path << " does not exist" << endl;
+      return no_node;
    }
 
-   wordvec new_path = pop_command(path);
+   DEBUGF('f', "Path registered as existing");
 
-   inode_ptr curr_dir = root;
+   if (store.stat(plain_place).type != DIR_INODE){
+      cout << "error: " << path << " is not in a directory" << endl;
+      return no_node;
+   }
 
-   for (auto it = new_path.begin(); it < new_path.end(); it++){
-      curr_dir = curr_dir->get_child(*it);
+   node_id file = store.lookup(plain_place, filename);
+   if (file == no_node){
+      file = state.make(plain_place, filename, PLAIN_INODE);
+   }
+   if (file == no_node or store.stat(file).type == DIR_INODE){
+      cout << "error: " << path << " is a directory" << endl;
+      return no_node;
    }
-   return curr_dir;
+   return file;
 }
 
 /**
- * helper function that returns the child of the given directory
- * @param  dir        the directory that you're looking for a child of
- * @param  child_name the name of the child node
- * @return            inode_ptr to the child
+ * Helper function for fn_mkdir. Makes a directory of the given path,
+ * and any directories leading to it that are not there yet.
+ * @param path the string describing the path
+ * @param state the current inode state. Necesary to get current working
+ * directory or the root.
  */
-inode_ptr get_child(inode_ptr dir, string child_name){
-   return dir->get_child(child_name);
-}
+void make_directory(const string& path, inode_state& state){
+   storage& store = state.get_storage();
+   wordvec dirs = split(path, "/");
 
-/**
- * helper function that returns true if the dir has, false if it
- * does not
- * @param  path A string representing a path
- * @return      true if the directory has a child named the name given
- * false otherwise
- */
-bool dir_has_child(inode_ptr dir, string name){
-   return dir->has_child(name);
+   DEBUGF ('c', "dirs is " << dirs);
+
+   if (dirs.empty()){
+      cout << "error: directory " << path << " already exists" << endl;
+      return;
+   }
+
+   node_id curr_level = path.find("/") == 0 ? store.root()
+                                            : state.get_cwd();
+   for (auto it = dirs.begin(); it != dirs.end(); it++){
+      if (store.stat(curr_level).type != DIR_INODE){
+         cout << "error: " << path << " is not in a directory" << endl;
+         return;
+      }
+      node_id next = store.lookup(curr_level, *it);
+      if (next != no_node and it + 1 == dirs.end()){
+         cout << "error: directory " << *it << " already exists"
+              << endl;
+         return;
+      }
+      DEBUGF('h', "making directory:" <<  *it);
+      if (next == no_node){
+         next = state.make(curr_level, *it, DIR_INODE);
+      }
+      curr_level = next;
+   }
 }
 
 /**
- * Checks if the path is a valid one from the root
- * @param  path_from_root wordvec containing the complete path
- * @return                true if the path exists, false otherwise
+ * Prints the entries of a directory, as ls does. Prints nothing for a
+ * plain file.
+ * @param state the current inode state
+ * @param dir   the directory
  */
-bool full_path_exists(wordvec path_from_root, inode_ptr root){
-   if (path_from_root.at(0) != ""){
-      throw runtime_error("path does not begin at root");
+void list_directory(inode_state& state, node_id dir,
+                    const list_window& window){
+   storage& store = state.get_storage();
+   if (store.stat(dir).type != DIR_INODE) return;
+   // the rows point into the directory until they are written out
+   stage_lock::keep keep;
+   listing rows(yout());
+   rows.header();
+   if (window.after.empty() and window.skip == 0
+       and window.limit == SIZE_MAX){
+      store.list(dir, [&rows](const node_info& info){
+         rows.row(info);
+      });
+      return;
    }
 
-   inode_ptr curr_dir = root;
-   wordvec curr_path = pop_command(path_from_root);
-
-   for (auto it = curr_path.begin(); it < curr_path.end(); it++){
-      if (curr_dir->get_type() == PLAIN_INODE ){
-         if(it != curr_path.end()){
-            return false;
-         } else {
-            return true;
-         };
+   // one more than the limit is asked for, to know if any are left;
+   // the visitor reaches what it keeps through one reference, which
+   // std::function holds without allocating, and the last name seen
+   // goes in a buffer kept from one call to the next
+   static thread_local string last;
+   last.clear();
+   struct {
+      listing& rows;
+      size_t limit;
+      size_t shown;
+      string& last;
+   } seen {rows, window.limit, 0, last};
+   size_t count = window.limit == SIZE_MAX ? SIZE_MAX
+                                           : window.limit + 1;
+   store.list_range(dir, window.after, window.skip, count,
+                    [&seen](const node_info& info){
+      if (seen.shown == seen.limit){
+         seen.rows.cursor(seen.last);
+         return;
       }
+      ++seen.shown;
+      seen.rows.row(info);
+      seen.last = *info.name;
+   });
+}
 
-      if (!dir_has_child(curr_dir, *it)) return false;
-      curr_dir = get_child(curr_dir, *it);
-
+/**
+ * Prints every directory under a directory and then the directory
+ * itself, as lsr does. The directories under it are noted before
+ * any of them is printed, so that a pipeline stage changing the tree
+ * while this one waits on its pipe never changes entries it is
+ * still going through. Between directories others get a turn at the
+ * tree (see stage_lock::pause), and one removed in the meantime is
+ * passed over.
+ * @param state    the current inode state
+ * @param dir      the directory
+ * @param inode_nr its inode number
+ */
+void list_recursive(inode_state& state, node_id dir,
+                    uint64_t inode_nr){
+   storage& store = state.get_storage();
+   if (stage_lock::pause() and store.find_number(inode_nr) != dir){
+      return;
    }
-   return true;
+   if (store.stat(dir).type != DIR_INODE) return;
+   vector<pair<node_id,uint64_t>> subdirs;
+   store.list(dir, [&subdirs](const node_info& info){
+      if (info.type != DIR_INODE) return;
+      subdirs.emplace_back(info.node, info.inode_nr);
+   });
+   for (const auto& subdir: subdirs){
+      list_recursive(state, subdir.first, subdir.second);
+   }
+   list_directory(state, dir);
 }
 
 /**
- * changes an arguement into a full path. Does not check if it's a valid
- * path
- * @param  path  [description]
- * @param  state [description]
- * @return       [description]
+ * Prints every directory under a directory and then the directory
+ * itself, as lsr does.
+ * @param state the current inode state
+ * @param dir   the directory
  */
-wordvec get_full_path(string path, inode_state& state){
-
-   wordvec dirs = parse_path(path);
-
-   inode_ptr root = state.get_root();
-
-   inode_ptr cwd = state.get_cwd();
-
-   inode_ptr curr_level;
-
-   wordvec full_path;
-
-   if (path.find("/") == 0){
+void list_recursive(inode_state& state, node_id dir){
+   storage& store = state.get_storage();
+   list_recursive(state, dir, store.stat(dir).inode_nr);
+}
 
-      // the first entry is an empty string to signify root.
-      DEBUGF ('d', "top level is root");
 
-      return dirs;
+command_fn commands::at (const string& cmd) {
+   // Note: value_type is pair<const key_type, mapped_type>
+   // So: iterator->first is key_type (string)
+   // So: iterator->second is mapped_type (command_fn)
+   command_map::const_iterator result = map.find (cmd);
+   if (result == map.end()) {
+      throw yshell_exn (cmd + ": no such function");
+   }
+   return result->second;
+}
+
+/**
+ * Runs one command line. If it ends in "> file" or ">> file" the
+ * output of the command is streamed into that file for the duration
+ * of the command, replacing or appending to its contents. If it ends
+ * in "&" it is started as a job instead (see jobs.h), and if it
+ * starts with "time" the rest of it is timed.
+ * @param state the current inode state
+ * @param words the split command line
+ */
+void commands::execute (inode_state& state, word_span words) {
+   if (not words.empty() and words.front() == "time") {
+      if (words.size() == 1) throw yshell_exn ("time: missing command");
+      this->run_timed (state, words.subspan (1));
+      return;
+   }
+   if (words.size() > 1 and words.back() == "&") {
+      wordvec command (words.begin(), words.end() - 1);
+      this->at(command.at(0));
+      cout << "[" << jobs::start (state, *this, command) << "]"
+           << endl;
+      return;
+   }
 
-   } else if (path.find("..") == 0){
-      // erase first entry for logic
-      curr_level = cwd->get_parent();
-      dirs.erase(dirs.begin());
+   // keep background work, such as a checkpoint, off the tree while
+   // the command runs
+   stage_lock lock (state.get_mutex());
 
-   } else if (path.find(".") == 0){
-      // erase first entry for logic
-      curr_level = cwd;
-      dirs.erase(dirs.begin());
-   } else {
-      curr_level = cwd;
+   size_t size = words.size();
+   if (size < 3 or (words.at(size - 2) != ">"
+                    and words.at(size - 2) != ">>")) {
+      this->run (state, words, false);
+      return;
    }
 
-   wordvec front_path = get_path_from_root(curr_level, root);
-   // preallocate memory
-   // Note: modified from code found on stack overflow
-   full_path.reserve(front_path.size() + dirs.size());
+   word_span command = words.subspan (0, size - 2);
+   this->at(command.at(0));
 
-   full_path.insert( full_path.end(), front_path.begin(),
-      front_path.end());
+   node_id target = open_plain(words.back(), state);
+   if (target == no_node) return;
 
-   full_path.insert(full_path.end(), dirs.begin(), dirs.end());
+   if (words.at(size - 2) == ">") state.write(target, wordvec());
 
-   return full_path;
+   // the writer appends the words a batch at a time, so the output
+   // never has to be held anywhere but in the file itself
+   plain_file_writer writer (state, target);
+   {
+      ostream out (&writer);
+      yout_guard guard (out);
+      this->run (state, command, true);
+   }
+   writer.finish();
 }
 
-
 /**
- * magically finds an inode from the state and a path given
- * @param  path  string input from the user for the path
- * @param  state current inode state
- * @pre          inode must exist
- * @return       a pointer to the inode
+ * Runs a command line and then reports the time it took, the
+ * processor time and peak memory the shell used meanwhile and the
+ * allocations made, which includes those of any jobs running.
+ * @param state the current inode state
+ * @param words the command line after "time"
  */
-inode_ptr find_inode(string path, inode_state& state){
-   wordvec full_path = get_full_path(path, state);
-
-   inode_ptr root = state.get_root();
-
-   if (full_path_exists(full_path, root)){
-      return get_ptr_to_dir(full_path, root);
+void commands::run_timed (inode_state& state, word_span words) {
+   // an unknown command is reported without timing it; time itself
+   // is not a command, but execute knows it
+   if (words.front() != "time") this->at(words.front());
+   rusage before;
+   getrusage (RUSAGE_SELF, &before);
+   alloc_hook::start();
+   alloc_counts allocs = alloc_hook::totals();
+   auto start = chrono::steady_clock::now();
+   try {
+      this->execute (state, words);
+   }catch (yshell_exn& exn) {
+      complain() << exn.what() << endl;
+   }catch (...) {
+      alloc_hook::stop();
+      throw;
    }
-   throw runtime_error("path doesn't exist");
+   chrono::duration<double> real = chrono::steady_clock::now() - start;
+   alloc_counts after_allocs = alloc_hook::totals();
+   alloc_hook::stop();
+   rusage after;
+   getrusage (RUSAGE_SELF, &after);
+
+   auto seconds = [] (const timeval& from, const timeval& to) {
+      return (to.tv_sec - from.tv_sec)
+           + (to.tv_usec - from.tv_usec) / 1e6;
+   };
+   ostream& out = yout();
+   ios::fmtflags flags = out.flags();
+   out << fixed << setprecision (6)
+       << "real   " << real.count() << " s" << endl
+       << "user   " << seconds (before.ru_utime, after.ru_utime) << " s"
+       << endl
+       << "sys    " << seconds (before.ru_stime, after.ru_stime) << " s"
+       << endl
+       << "rss    +" << after.ru_maxrss - before.ru_maxrss
+       << " KB (peak " << after.ru_maxrss << " KB)" << endl
+       << "allocs " << after_allocs.allocations - allocs.allocations
+       << " (" << after_allocs.bytes - allocs.bytes << " bytes)"
+       << endl;
+   out.flags (flags);
 }
 
 /**
- * Helper function for fn_mkdir. Makes a directory of the given path
- * @param path the string describing the path
- * @param state the current inode state. Necesary to get current working
- * directory or the root.
+ * Runs a command line without any redirection, either as a single
+ * command or as a pipeline.
+ * @param state   the current inode state
+ * @param words   the command line
+ * @param to_file true if the output is going into a plain file
  */
-void make_directory(string path, inode_state& state){
-   // an inode pointer that will point to the level of the path
-   inode_ptr curr_level;
-
-   // parse the directories into a word vector
-   wordvec dirs = parse_path(path);
-
-   DEBUGF ('c', "dirs is " << dirs);
-
-   // getting the level which the path refers to using a bunch
-   // of else if statements since C++ doesn't support switches
-   // on strings
-
-   // if the first character is "/" that means that we are
-   // making a directory at the root level
-   if (path.find("/") == 0){
-      curr_level = state.get_root();
-      DEBUGF ('d', "top level is root");
-      // the first entry is an empty string to signify root.
-      // Pop it off to prevent logic errors
-      dirs.erase(dirs.begin());
-      // note that this doesn't return here
-   } else if (path.find("..") == 0){
-      curr_level = state.get_cwd()->get_parent();
-      DEBUGF('d', "Making direcotry at parent level");
-
-      wordvec full_path =
-         get_path_from_root(curr_level, state.get_root());
-
-      DEBUGF ('d', "get path from root: " << full_path);
-
-      if (dirs.size() > 2) {
-         cout << "error: multiple dirs not supported" << endl;
-         return;
-      }
-      curr_level->make_directory(dirs.at(1));
-      return;
-   } else if (path.find(".") == 0){
-
-      // works the same as the end event
-      DEBUGF('d', "Making direcotry at current level (\".\")");
-      curr_level = state.get_cwd();
-
-      // if there are multiple directories in the path, escape while
-      if (dirs.size() > 2) {
-         cout << "error: multiple dirs not supported" << endl;
-         return;
-      }
-
-      // make the directory and return
-      curr_level->make_directory(dirs.at(1));
+void commands::run (inode_state& state, word_span words,
+                    bool to_file) {
+   if (find (words.begin(), words.end(), "|") == words.end()) {
+      this->at(words.at(0)) (state, words);
       return;
-   } else {
-      DEBUGF('d', "Making direcotry at current level (else)");
-      curr_level = state.get_cwd();
-
-      wordvec full_path =
-         get_path_from_root(curr_level, state.get_root());
+   }
+   this->run_pipeline (state, words, to_file);
+}
 
-      DEBUGF ('d', "get path from root: " << full_path);
+/**
+ * Checks whether a pipeline stage looks at the tree at all. Stages
+ * that only filter their input do not need to wait for the tree
+ * lock, so they run alongside the stage producing their input.
+ * @param  stage the words of the stage
+ * @return       false for echo, and grep or wc without file names
+ */
+bool needs_tree(word_span stage){
+   const string& cmd = stage.at(0);
+   if (cmd == "echo") return false;
+   if (cmd == "grep") return stage.size() > 2;
+   if (cmd == "wc") return stage.size() > 1;
+   return true;
+}
 
-      if (dirs.size() > 1) {
-         cout << "error: multiple dirs not supported" << endl;
-         return;
+/**
+ * Tells whether a command line only looks at the tree
+ * @param  words the command line
+ * @return       true for a single cat, cd, echo, grep, ls, lsr, pwd,
+ *               stat or wc, with nothing after it
+ */
+bool reads_only(word_span words){
+   static const set<string> readers {
+      "cat", "cd", "echo", "grep", "ls", "lsr", "pwd", "stat", "wc",
+   };
+   if (words.empty() or readers.count(words.front()) == 0) return false;
+   for (const string& word: words){
+      if (word == "|" or word == ">" or word == ">>" or word == "&"){
+         return false;
       }
-
-      DEBUGF ('d', "dirs size is: " << dirs.size());
-      string dirname = dirs.front();
-      DEBUGF ('d', "Dirname is: " << dirname);
-      curr_level->make_directory(dirname);
-      return;
    }
+   return true;
+}
 
-   // iterate through the paths and make the directories
-   for(auto it = dirs.begin(); it < dirs.end(); it++){
-      // check if exists
-      // if (directory_exists(curr_level, path)){
-      //    cout << "Error: path " << path << " already exists" << endl;
-      //    return;
-      // }
+/**
+ * Runs the stages of cmd1 | cmd2 | ... each on its own thread. Each
+ * stage writes into a bounded word_pipe read by the next, so the
+ * memory used does not depend on how much output flows through.
+ * Stages that use the tree take turns on it with a stage_lock. Each
+ * starts in the directory the line was run in, and a cd in one only
+ * moves that stage, as in a subshell.
+ * @param state   the current inode state
+ * @param words   the command line, with "|" between stages
+ * @param to_file true if the last stage writes into a plain file
+ */
+void commands::run_pipeline (inode_state& state, word_span words,
+                             bool to_file) {
+   vector<word_span> stages;
+   auto start = words.begin();
+   for (auto word = words.begin(); word != words.end(); ++word) {
+      if (*word != "|") continue;
+      stages.emplace_back (start, word);
+      start = word + 1;
+   }
+   stages.emplace_back (start, words.end());
 
-      DEBUGF('h', "making directory:" <<  *it);
-      // make the directory with inode's function
-      inode_ptr new_dir = curr_level->make_directory(*it);
-      DEBUGF('c', "Made directory: " << *it);
-      curr_level = new_dir; // TODO test
+   // look up every command before starting any of them
+   vector<command_fn> fns;
+   for (word_span stage: stages) {
+      if (stage.empty()) throw yshell_exn ("|: missing command");
+      fns.push_back (this->at (stage.front()));
    }
-}
 
+   size_t count = stages.size();
+   vector<unique_ptr<word_pipe>> pipes;
+   for (size_t i = 0; i + 1 < count; ++i) {
+      pipes.emplace_back (new word_pipe());
+   }
 
-command_fn commands::at (const string& cmd) {
-   // Note: value_type is pair<const key_type, mapped_type>
-   // So: iterator->first is key_type (string)
-   // So: iterator->second is mapped_type (command_fn)
-   command_map::const_iterator result = map.find (cmd);
-   if (result == map.end()) {
-      throw yshell_exn (cmd + ": no such function");
+   ostream& last_out = yout();
+   node_id cwd = state.get_cwd();
+   vector<thread> threads;
+   for (size_t i = 0; i < count; ++i) {
+      threads.emplace_back ([&, i] {
+         cwd_guard in_cwd (cwd);
+         unique_ptr<stage_lock> lock;
+         if (needs_tree (stages[i]) or (to_file and i + 1 == count)) {
+            lock.reset (new stage_lock (state.get_mutex()));
+         }
+
+         unique_ptr<pipe_reader> reader;
+         if (i > 0) reader.reset (new pipe_reader (*pipes[i - 1]));
+         unique_ptr<pipe_writer> writer;
+         if (i + 1 < count) writer.reset (new pipe_writer (*pipes[i]));
+
+         istream in (reader.get());
+         ostream pipe_out (writer.get());
+         yin_guard in_guard (reader ? &in : nullptr);
+         yout_guard out_guard (writer ? pipe_out : last_out);
+         try {
+            fns[i] (state, stages[i]);
+         }catch (ysh_exit_exn&) {
+            // exit only leaves the stage, as in a subshell
+         }catch (exception& exn) {
+            complain() << exn.what() << endl;
+         }
+      });
    }
-   return result->second;
+   // the stages need the tree lock this thread is holding
+   stage_lock::yield yield;
+   for (thread& stage: threads) stage.join();
 }
-
+
 /**
  * The contents of each file is copied to stdout. An error is reported
  * if no files are specified, a file does not exist, or there is no
- * directory.
+ * directory. The words go out as the storage keeps them (see
+ * storage::gather), gathered into a few large writes, and are never
+ * joined into one string, so a file of any size is written with the
+ * same memory.
  */
-void fn_cat (inode_state& state, const wordvec& words){
+void fn_cat (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
@@ -377,16 +566,31 @@ void fn_cat (inode_state& state, const wordvec& words){
       return;
    }
 
-   // iterate through the commands and print out the contents
-   // this essentially hands off the code to the inode state
-   /*for (int i = 1; i < words.size(); i++){
-         String path = words.at(i);
-         cout << state.readfile(path) << endl;
-   }*/
-
+   // iterate through the paths and write out the contents, each file
+   // on one line, as grep prints it
+   storage& store = state.get_storage();
+   gather_writer writer(yout());
+   for (const string& path: pop_command(words)){
+      node_id file = find_node(path, state);
+      if (file == no_node or store.stat(file).type != PLAIN_INODE){
+         // what was written so far goes ahead of the error
+         writer.flush();
+         cout << "error: " << path << (file == no_node
+                                       ? " does not exist"
+                                       : " is a directory") << endl;
+         continue;
+      }
+      // the runs point into the file until they are written out
+      stage_lock::keep keep;
+      store.gather(file, [&writer](const char* run, size_t size){
+         writer.add(run, size);
+      });
+      writer.add("\n", 1);
+   }
+   writer.flush();
 }
 
-void fn_cd (inode_state& state, const wordvec& words){
+void fn_cd (inode_state& state, word_span words){
    // Error handling
    switch (pop_command(words).size()){
       case 0:
@@ -398,24 +602,193 @@ void fn_cd (inode_state& state, const wordvec& words){
       default: break;
    }
 
-   // pop off the command to manipulate the string
-   string path = pop_command(words).at(0);
+   // pop off the command to get at the path
+   const string& path = pop_command(words).at(0);
 
-   // parse the path with helper function
-   wordvec dir_list = parse_path(path);
+   node_id destination = find_node(path, state);
+   if (destination == no_node){
+      cout << "error: directory " + path + " doesn't exist" << endl;
+   } else if (state.get_storage().stat(destination).type != DIR_INODE){
+      cout << "error: " + path + " is not a directory" << endl;
+   } else{
+      state.set_cwd(destination);
+   }
 
-   inode_ptr destination;
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+}
 
-   wordvec full_path = get_full_path(path, state);
-   if (full_path_exists(full_path, state.get_root())){
-      destination = find_inode(path, state);
-      state.set_cwd(destination);
-   }  else{
-      cout << "error: directory " + path + " doesn't exist" << endl;
+/**
+ * Starts writing the tree out to a checkpoint file in the background.
+ * The shell can go on changing the tree while it is written.
+ * @param state the current inode state
+ * @param words checkpoint [file]
+ */
+void fn_checkpoint (inode_state& state, word_span words){
+   DEBUGF ('c', words);
+
+   if (words.size() > 2){
+      cout << "error: checkpoint takes at most one file" << endl;
+      return;
    }
+   checkpoint::start(state, words.size() == 2 ? words.at(1) : "");
+}
 
+/**
+ * Copies a file, or a whole directory with -r. The copy shares its
+ * contents with the source until either side is modified, so even
+ * large subtrees are copied in constant time.
+ * @param state the current inode state
+ * @param words cp [-r] source destination
+ */
+void fn_cp (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+
+   word_span args = pop_command(words);
+   bool recursive = false;
+   if (not args.empty() and args.front() == "-r"){
+      recursive = true;
+      args = args.subspan(1);
+   }
+
+   if (args.size() != 2){
+      cout << "error: cp needs a source and a destination" << endl;
+      return;
+   }
+
+   storage& store = state.get_storage();
+
+   node_id source = find_node(args.at(0), state);
+   if (source == no_node){
+      cout << "error: " << args.at(0) << " does not exist" << endl;
+      return;
+   }
+
+   if (store.stat(source).type == DIR_INODE and not recursive){
+      cout << "error: cp: omitting directory " << args.at(0) << endl;
+      return;
+   }
+
+   // copying into an existing directory keeps the source's name,
+   // otherwise the last part of the destination is the new name
+   node_id dest = find_node(args.at(1), state);
+   string name;
+   if (dest != no_node and store.stat(dest).type == DIR_INODE){
+      name = store.name(source);
+   } else{
+      dest = find_parent(args.at(1), state, name);
+   }
+
+   if (name == "" or dest == no_node){
+      cout << "error: cp: cannot create " << args.at(1) << endl;
+      return;
+   }
+
+   if (store.stat(dest).type != DIR_INODE){
+      cout << "error: " << args.at(1) << " is not a directory" << endl;
+      return;
+   }
+   if (store.lookup(dest, name) != no_node){
+      cout << "error: cp: " << name << " already exists" << endl;
+      return;
+   }
+
+   state.copy(source, dest, name);
+}
+
+/**
+ * Compiles a script into a file that run can replay without splitting
+ * lines, looking up commands or parsing paths again
+ * @param state unused inode state
+ * @param words compile script output
+ */
+void fn_compile (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3){
+      cout << "error: compile needs a script and an output file"
+           << endl;
+      return;
+   }
+   compile_script(words.at(1), words.at(2));
+}
+
+/**
+ * Prints how many contents are compressed, what they take against
+ * what they took before, how many are warm and how many of those
+ * are in the hot cache, and how often, and for how long, contents
+ * have been expanded (see cold.h).
+ * @param state the current inode state
+ * @param words coldstat
+ */
+void fn_coldstat (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() > 1){
+      cout << "error: coldstat takes no arguments" << endl;
+      return;
+   }
+   cold_use use = cold_store::report();
+   ostream& out = yout();
+   ios::fmtflags flags = out.flags();
+   auto row = [&](const string& what, uint64_t count){
+      out << left << setw(20) << what << right << setw(14) << count
+          << endl;
+   };
+   row("cold contents", use.cold);
+   row("compressed bytes", use.cold_bytes);
+   row("expanded bytes", use.warm_bytes);
+   out << left << setw(20) << "ratio" << right << fixed
+       << setprecision(2) << setw(13)
+       << use.warm_bytes / double(max<uint64_t>(use.cold_bytes, 1))
+       << "x" << endl;
+   row("warm contents", use.warm);
+   row("hot contents", use.hot);
+   row("hot bytes", use.hot_bytes);
+   row("hot cache bytes", use.cache_bytes);
+   row("compressions", use.compressions);
+   row("expansions", use.expansions);
+   row("expand time us", use.expand_nanos / 1000);
+   row("us per expansion",
+       use.expand_nanos / 1000 / max<uint64_t>(use.expansions, 1));
+   out.flags(flags);
+}
+
+/**
+ * Prints how many bytes the plain files hold, counting each file,
+ * against how many the distinct contents among them take, and what
+ * sharing identical contents saves.
+ * @param state the current inode state
+ * @param words dedupstat
+ */
+void fn_dedupstat (inode_state& state, word_span words){
+   DEBUGF ('c', words);
+
+   if (words.size() > 1){
+      cout << "error: dedupstat takes no arguments" << endl;
+      return;
+   }
+   dedup_use use = state.get_storage().dedup();
+   ostream& out = yout();
+   ios::fmtflags flags = out.flags();
+   auto row = [&](const string& what, uint64_t count){
+      out << left << setw(20) << what << right << setw(14) << count
+          << endl;
+   };
+   row("files", use.files);
+   row("distinct contents", use.contents);
+   row("logical bytes", use.logical_bytes);
+   row("unique bytes", use.unique_bytes);
+   row("saved bytes", use.logical_bytes - use.unique_bytes);
+   double logical = max<uint64_t>(use.logical_bytes, 1);
+   out << left << setw(20) << "saved" << right << fixed
+       << setprecision(1) << setw(13)
+       << 100 * (use.logical_bytes - use.unique_bytes) / logical
+       << "%" << endl;
+   out.flags(flags);
 }
 
 /**
@@ -423,16 +796,16 @@ void fn_cd (inode_state& state, const wordvec& words){
  * @param state unused inode state
  * @param words the command given to the
  */
-void fn_echo (inode_state& state, const wordvec& words){
+void fn_echo (inode_state& state, word_span words){
    // Debug stuff (Unused)
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    // use helper function to delete unecessary words
-   wordvec tmp = pop_command(words);
+   word_span tmp = pop_command(words);
 
    // print it to standard out
-   cout << tmp << endl;
+   yout() << tmp << endl;
 }
 
 /**
@@ -440,7 +813,7 @@ void fn_echo (inode_state& state, const wordvec& words){
  * @param state the state of the current inode
  * @param words the command given
  */
-void fn_exit (inode_state& state, const wordvec& words){
+void fn_exit (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
@@ -465,65 +838,304 @@ void fn_exit (inode_state& state, const wordvec& words){
    throw ysh_exit_exn();
 }
 
-void fn_ls (inode_state& state, const wordvec& words){
+/**
+ * Writes a file or a directory and everything under it to a host
+ * file as a tar archive (see export.h)
+ * @param state the current inode state
+ * @param words export path host-file
+ */
+void fn_export (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() != 3){
+      cout << "error: export needs a path and a host file" << endl;
+      return;
+   }
 
+   node_id node = find_node(words.at(1), state);
+   if (node == no_node){
+      cout << "error: " << words.at(1) << " does not exist" << endl;
+      return;
+   }
+   tar_export::run(state, node, words.at(2));
+}
+
+/**
+ * Helper function that reads the job number a command was given, as
+ * 3 or %3, printing an error if it is not one.
+ * @param  words  the command and its arguments
+ * @param  number set to the number, or 0 if none was given
+ * @return        false if the arguments are wrong
+ */
+bool job_number(word_span words, int& number){
+   number = 0;
+   if (words.size() > 2){
+      cout << "error: " << words.at(0) << " takes at most one job"
+           << endl;
+      return false;
+   }
+   if (words.size() == 1) return true;
+   string arg = words.at(1);
+   if (not arg.empty() and arg.front() == '%') arg.erase(0, 1);
+   try {
+      number = stoi(arg);
+   } catch (std::logic_error& e){
+      number = 0;
+   }
+   if (number < 1){
+      cout << "error: " << words.at(0) << ": " << words.at(1)
+           << " is not a job" << endl;
+      return false;
+   }
+   return true;
+}
+
+/**
+ * Waits for a job, the last one started by default, then prints what
+ * it printed and forgets it.
+ * @param state the current inode state
+ * @param words fg [job]
+ */
+void fn_fg (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
-   if (words.size() == 1){
-      state.get_cwd()->list();
+   int number = 0;
+   if (not job_number(words, number)) return;
+   string output;
+   if (not jobs::finish(number, output)){
+      cout << "error: fg: no such job" << endl;
       return;
    }
+   yout() << output;
+}
 
-   wordvec paths = pop_command(words);
+/**
+ * Helper function that looks up a plain file for reading, printing an
+ * error if it does not exist or is a directory.
+ * @param  path  the path of the file
+ * @param  state the current inode state
+ * @return       the file, or no_node on error
+ */
+node_id find_plain(const string& path, inode_state& state){
+   node_id file = find_node(path, state);
+   if (file == no_node){
+      cout << "error: " << path << " does not exist" << endl;
+      return no_node;
+   }
+   if (state.get_storage().stat(file).type != PLAIN_INODE){
+      cout << "error: " << path << " is a directory" << endl;
+      return no_node;
+   }
+   return file;
+}
 
-   for (auto it = paths.begin(); it < paths.end(); it++){
-      // get the full path of the state
-      wordvec full_path = get_full_path(*it, state);
+/**
+ * Prints the lines of its input containing the pattern. Given file
+ * names instead, prints the contents of each file that has a word
+ * containing the pattern.
+ * @param state the current inode state
+ * @param words grep pattern [file...]
+ */
+void fn_grep (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() < 2){
+      cout << "error: grep needs a pattern" << endl;
+      return;
+   }
+   const string& pattern = words.at(1);
+
+   if (words.size() == 2){
+      istream* in = yin();
+      if (in == nullptr){
+         cout << "error: grep needs input or a file" << endl;
+         return;
+      }
+      // lines are only ever as long as a single row of output, so
+      // this uses the same memory however much comes down the pipe
+      string line;
+      while (getline(*in, line)){
+         if (line.find(pattern) != string::npos) yout() << line << endl;
+      }
+      return;
+   }
+
+   // the storage looks for the pattern, which with the vocabulary
+   // on goes through each distinct word once, not each file's words
+   storage& store = state.get_storage();
+   for (auto it = words.begin() + 2; it != words.end(); it++){
+      stage_lock::pause();
+      node_id file = find_plain(*it, state);
+      if (file == no_node) continue;
+      if (not store.search(file, pattern)) continue;
+      stage_lock::keep keep;
+      if (words.size() > 3) yout() << *it << ": ";
+      yout() << store.read(file) << endl;
+   }
+}
+
+/**
+ * Imports a directory tree, or a file, of the host into the tree,
+ * reading it on several threads (see import.h)
+ * @param state the current inode state
+ * @param words import host-path path
+ */
+void fn_import (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   word_span args = pop_command(words);
+   if (args.size() != 2){
+      cout << "error: import needs a host path and a destination"
+           << endl;
+      return;
+   }
+
+   storage& store = state.get_storage();
+
+   // importing into an existing directory keeps the host name, as
+   // cp does, otherwise the last part of the destination is the name
+   node_id dest = find_node(args.at(1), state);
+   string name;
+   if (dest != no_node and store.stat(dest).type == DIR_INODE){
+      string host = args.at(0);
+      while (host.size() > 1 and host.back() == '/') host.pop_back();
+      name = host.substr(host.rfind('/') + 1);
+   } else{
+      dest = find_parent(args.at(1), state, name);
+   }
 
-      if (full_path_exists(full_path, state.get_root())){
-         inode_ptr list_dir = find_inode( *it, state);
-         list_dir->list();
+   if (name == "" or name == "." or name == ".." or dest == no_node){
+      cout << "error: import: cannot create " << args.at(1) << endl;
+      return;
+   }
+   if (store.stat(dest).type != DIR_INODE){
+      cout << "error: " << args.at(1) << " is not a directory" << endl;
+      return;
+   }
+   if (store.lookup(dest, name) != no_node){
+      cout << "error: import: " << name << " already exists" << endl;
+      return;
+   }
+
+   host_import::run(state, args.at(0), dest, name);
+}
+
+/**
+ * Lists the jobs started with "&" which fg has not taken back.
+ * @param state the current inode state
+ * @param words jobs
+ */
+void fn_jobs (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   jobs::list(yout());
+}
+
+/**
+ * Helper function for fn_ls that tells its options, each of which
+ * takes the word after it as its value, from paths
+ * @param  word a word of the ls command line
+ * @return      true if the word is an option
+ */
+bool ls_option(const string& word){
+   return word == "--limit" or word == "--offset"
+       or word == "--after" or word == "--cursor";
+}
+
+void fn_ls (inode_state& state, word_span words){
+
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   list_window window;
+   size_t paths = 0;
+   for (size_t i = 1; i < words.size(); ++i){
+      const string& option = words.at(i);
+      if (not ls_option(option)){
+         ++paths;
+         continue;
+      }
+      if (i + 1 == words.size()){
+         cout << "error: ls: " << option << " needs a value" << endl;
+         return;
+      }
+      const string& value = words.at(++i);
+      if (option == "--after"){
+         window.after = value;
+      } else if (option == "--cursor"){
+         if (not listing::resume(value, window.after)){
+            cout << "error: ls: " << value << " is not a cursor"
+                 << endl;
+            return;
+         }
+      } else{
+         size_t number = 0;
+         try {
+            number = stoull(value);
+         } catch (std::logic_error& e){
+            cout << "error: ls: " << value << " is not a number"
+                 << endl;
+            return;
+         }
+         if (option == "--limit" and number == 0){
+            cout << "error: ls: --limit must be at least 1" << endl;
+            return;
+         }
+         if (option == "--limit") window.limit = number;
+                             else window.skip = number;
+      }
+   }
+
+   if (paths == 0){
+      list_directory(state, state.get_cwd(), window);
+      return;
+   }
+
+   // the options were all read above, so here they and their values
+   // are only skipped
+   for (auto it = words.begin() + 1; it < words.end(); it++){
+      if (ls_option(*it)){
+         ++it;
+         continue;
+      }
+      stage_lock::pause();
+      node_id list_dir = find_node(*it, state);
+      if (list_dir != no_node){
+         list_directory(state, list_dir, window);
       } else{
          cout << "error: " << *it << " does not exist" << endl;
       }
    }
 }
 
-void fn_lsr (inode_state& state, const wordvec& words){
+void fn_lsr (inode_state& state, word_span words){
 
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
    if (words.size() == 1){
-      state.get_cwd()->list_recursive();
+      list_recursive(state, state.get_cwd());
       return;
    }
 
-   wordvec paths = pop_command(words);
+   word_span paths = pop_command(words);
 
    for (auto it = paths.begin(); it < paths.end(); it++){
-      // get the full path of the state
-      wordvec full_path = get_full_path(*it, state);
-
-      if (full_path_exists(full_path, state.get_root())){
-         inode_ptr start = find_inode( *it, state);
-         start->list_recursive();
+      node_id start = find_node(*it, state);
+      if (start != no_node){
+         list_recursive(state, start);
       } else{
          cout << "error: " << *it << " does not exist" << endl;
       }
    }
 }
 
-string wordvec_to_path(wordvec convert){
-   string ret = "";
-   for (auto it = convert.begin(); it != convert.end(); it++){
-      ret = ret + "/" + (*it);
-   }
-   return ret;
-}
-
-void fn_make (inode_state& state, const wordvec& words){
+void fn_make (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 
@@ -532,34 +1144,19 @@ void fn_make (inode_state& state, const wordvec& words){
       return;
    }
 
-   string path = pop_command(words).at(0);
+   string path = words.at(1);
 
    DEBUGF('f', "Path: " + path);
 
-   wordvec contents = pop_command(words);
+   // the contents are everything after the path
+   wordvec contents (words.begin() + 2, words.end());
 
    DEBUGF('f', "Contents: " << contents);
 
-   wordvec vec_path = get_full_path(path, state);
-
-   DEBUGF('f', "vec_path: " << vec_path);
-
-   string filename = vec_path.back();
-
-   vec_path.pop_back();
-
-   if (full_path_exists(vec_path, state.get_root())){
-
-      DEBUGF('f', "Path registered as existing");
-
-      string pth = wordvec_to_path(vec_path);
+   node_id file = open_plain(path, state);
+   if (file == no_node) return;
 
-      inode_ptr plain_place = find_inode( pth, state);
-
-      plain_place->make_plain(filename);
-   } else{
-      cout << "error: " << vec_path << " does not exist" << endl;
-   }
+   state.write(file, contents);
 
    //
    // for (auto it = paths.begin(); it != paths.end(); it++){
@@ -592,7 +1189,43 @@ void fn_make (inode_state& state, const wordvec& words){
    // }
 }
 
-void fn_mkdir (inode_state& state, const wordvec& words){
+/**
+ * Prints what the tree takes in memory, by what it is used for, and
+ * per inode, then all the memory malloc has handed out, which
+ * includes everything else the shell has allocated.
+ * @param state the current inode state
+ * @param words memstat
+ */
+void fn_memstat (inode_state& state, word_span words){
+   DEBUGF ('c', words);
+
+   if (words.size() > 1){
+      cout << "error: memstat takes no arguments" << endl;
+      return;
+   }
+   memory_use use = state.get_storage().memory();
+   ostream& out = yout();
+   ios::fmtflags flags = out.flags();
+   double inodes = max<uint64_t>(use.inodes, 1);
+   auto row = [&](const string& what, uint64_t bytes){
+      out << left << setw(20) << what << right << setw(14) << bytes
+          << setw(12) << bytes / inodes << endl;
+   };
+   out << fixed << setprecision(1) << use.inodes << " inodes" << endl
+       << left << setw(20) << "what" << right << setw(14) << "bytes"
+       << setw(12) << "per inode" << endl;
+   uint64_t total = 0;
+   for (const auto& part: use.bytes){
+      row(part.first, part.second);
+      total += part.second;
+   }
+   row("total", total);
+   struct mallinfo2 heap = mallinfo2();
+   row("malloc in use", heap.uordblks + heap.hblkhd);
+   out.flags(flags);
+}
+
+void fn_mkdir (inode_state& state, word_span words){
 
    // if there are no arguments return an error.
    if (words.size() == 1){
@@ -601,7 +1234,7 @@ void fn_mkdir (inode_state& state, const wordvec& words){
    }
 
    // pop off the command
-   wordvec dirs = pop_command(words);
+   word_span dirs = pop_command(words);
 
    // iterate over directories given and hand off the work to the
    // helper functions
@@ -614,7 +1247,7 @@ void fn_mkdir (inode_state& state, const wordvec& words){
    DEBUGF ('c', words);
 }
 
-void fn_prompt (inode_state& state, const wordvec& words){
+void fn_prompt (inode_state& state, word_span words){
    // allocate new string
    string new_prompt;
 
@@ -631,23 +1264,269 @@ void fn_prompt (inode_state& state, const wordvec& words){
    DEBUGF ('c', words);
 }
 
-void fn_pwd (inode_state& state, const wordvec& words){
+void fn_pwd (inode_state& state, word_span words){
    // hand off all heavy lifting to inode.cpp beacuse that's where the
    // real logic should take place
-   cout << state.get_path() << endl;
+   yout() << state.get_path() << endl;
 
    DEBUGF ('c', state);
    DEBUGF ('c', words);
 }
 
-void fn_rm (inode_state& state, const wordvec& words){
+/**
+ * Helper function for fn_rm and fn_rmr. Removes each path given,
+ * complaining about the ones that cannot be removed.
+ * @param state     the current inode state
+ * @param words     the command and its paths
+ * @param recursive true to remove directories that are not empty
+ */
+void remove_paths(inode_state& state, word_span words,
+                  bool recursive){
+   if (words.size() == 1){
+      cout << "error: " << words.at(0) << " needs arguments" << endl;
+      return;
+   }
+
+   for (auto it = words.begin() + 1; it != words.end(); it++){
+      node_id node = find_node(*it, state);
+      if (node == no_node){
+         cout << "error: " << *it << " does not exist" << endl;
+         continue;
+      }
+      string last;
+      node_id dir = find_parent(*it, state, last);
+      if (node == state.get_root() or last == "." or last == ".."){
+         cout << "error: " << *it << " cannot be removed" << endl;
+         continue;
+      }
+      try {
+         state.remove(dir, last, recursive);
+      } catch (yshell_exn& exn){
+         complain() << words.at(0) << ": " << exn.what() << endl;
+      }
+   }
+}
+
+/**
+ * Removes files and empty directories
+ * @param state the current inode state
+ * @param words rm path...
+ */
+void fn_rm (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+
+   remove_paths(state, words, false);
 }
 
-void fn_rmr (inode_state& state, const wordvec& words){
+/**
+ * Removes files and directories along with everything below them
+ * @param state the current inode state
+ * @param words rmr path...
+ */
+void fn_rmr (inode_state& state, word_span words){
    DEBUGF ('c', state);
    DEBUGF ('c', words);
+
+   remove_paths(state, words, true);
+}
+
+/**
+ * Runs a script made by compile, optionally several times over
+ * @param state the current inode state
+ * @param words run file [times]
+ */
+void fn_run (inode_state& state, word_span words){
+   DEBUGF ('c', words);
+
+   if (words.size() != 2 and words.size() != 3){
+      cout << "error: run needs a compiled script" << endl;
+      return;
+   }
+
+   int times = 1;
+   if (words.size() == 3){
+      try {
+         times = stoi(words.at(2));
+      } catch (std::invalid_argument& e){
+         cout << "error: " << words.at(2) << " is not a number" << endl;
+         return;
+      }
+   }
+
+   commands cmdmap;
+   compiled_script script = load_script(words.at(1), cmdmap);
+   for (int i = 0; i < times; ++i){
+      run_script(script, cmdmap, state);
+   }
+}
+
+/**
+ * Prints the memory limit against what malloc has handed out, the
+ * subtrees spilled and what they take in the spill file, and how
+ * often, and how fast, subtrees have been spilled and read back in
+ * (see spill.h).
+ * @param state the current inode state
+ * @param words spillstat
+ */
+void fn_spillstat (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() > 1){
+      cout << "error: spillstat takes no arguments" << endl;
+      return;
+   }
+   spill_use use = spill_store::report();
+   ostream& out = yout();
+   ios::fmtflags flags = out.flags();
+   auto row = [&](const string& what, uint64_t count){
+      out << left << setw(20) << what << right << setw(14) << count
+          << endl;
+   };
+   auto rate = [&](const string& what, double count){
+      out << left << setw(20) << what << right << fixed
+          << setprecision(2) << setw(14) << count << endl;
+   };
+   double seconds = max(use.seconds, 1e-9);
+   row("memory limit", use.limit_bytes);
+   row("malloc in use", use.heap_bytes);
+   row("stubs", use.stubs);
+   row("stub bytes", use.stub_bytes);
+   row("spill file bytes", use.file_bytes);
+   row("spills", use.spills);
+   row("inodes spilled", use.spilled_inodes);
+   row("spill time us", use.spill_nanos / 1000);
+   row("us per spill",
+       use.spill_nanos / 1000 / max<uint64_t>(use.spills, 1));
+   rate("spills per sec", use.spills / seconds);
+   row("fault-ins", use.faults);
+   row("inodes faulted in", use.faulted_inodes);
+   row("fault-in time us", use.fault_nanos / 1000);
+   row("us per fault-in",
+       use.fault_nanos / 1000 / max<uint64_t>(use.faults, 1));
+   rate("fault-ins per sec", use.faults / seconds);
+   out.flags(flags);
+}
+
+/**
+ * Prints the number, type, size and path of an inode
+ * @param state the current inode state
+ * @param node  the inode
+ */
+void print_stat(inode_state& state, node_id node){
+   node_info info = state.get_storage().stat(node);
+   yout() << "inode_nr: " << info.inode_nr << endl
+          << "type:     "
+          << (info.type == DIR_INODE ? "directory" : "plain")
+          << endl
+          << "size:     " << info.size << endl
+          << "path:     " << state.get_path(node) << endl;
+}
+
+/**
+ * Describes the inodes at the given paths, or with -i, the inodes
+ * with the given numbers
+ * @param state the current inode state
+ * @param words stat path... or stat -i inode_nr...
+ */
+void fn_stat (inode_state& state, word_span words){
+   DEBUGF ('c', words);
+
+   bool by_number = words.size() > 1 and words.at(1) == "-i";
+   size_t first = by_number ? 2 : 1;
+   if (words.size() <= first){
+      cout << "error: stat needs a path, or -i and an inode number"
+           << endl;
+      return;
+   }
+
+   for (auto it = words.begin() + first; it != words.end(); ++it){
+      stage_lock::pause();
+      node_id node = no_node;
+      if (by_number){
+         uint64_t inode_nr = 0;
+         try {
+            inode_nr = stoull(*it);
+         } catch (std::logic_error& e){
+            cout << "error: " << *it << " is not an inode number"
+                 << endl;
+            continue;
+         }
+         node = state.get_storage().find_number(inode_nr);
+      } else{
+         node = find_node(*it, state);
+      }
+      if (node == no_node){
+         cout << "error: " << *it
+              << (by_number ? ": no such inode" : " does not exist")
+              << endl;
+         continue;
+      }
+      print_stat(state, node);
+   }
+}
+
+/**
+ * Waits for a job to be done, or for all of them, leaving what they
+ * printed for fg.
+ * @param state the current inode state
+ * @param words wait [job]
+ */
+void fn_wait (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   int number = 0;
+   if (not job_number(words, number)) return;
+   if (not jobs::wait(number)){
+      cout << "error: wait: no such job" << endl;
+   }
+}
+
+/**
+ * Counts the lines, words and characters of its input, or of each of
+ * the files given. A file counts as one line, as it would be printed.
+ * @param state the current inode state
+ * @param words wc [file...]
+ */
+void fn_wc (inode_state& state, word_span words){
+   DEBUGF ('c', state);
+   DEBUGF ('c', words);
+
+   if (words.size() == 1){
+      istream* in = yin();
+      if (in == nullptr){
+         cout << "error: wc needs input or a file" << endl;
+         return;
+      }
+      size_t lines = 0;
+      size_t word_count = 0;
+      size_t chars = 0;
+      bool in_word = false;
+      for (istreambuf_iterator<char> it (*in), end; it != end; ++it){
+         char c = *it;
+         ++chars;
+         if (c == '\n') ++lines;
+         bool space = c == ' ' or c == '\t' or c == '\n';
+         if (not space and not in_word) ++word_count;
+         in_word = not space;
+      }
+      yout() << lines << " " << word_count << " " << chars << endl;
+      return;
+   }
+
+   for (auto it = words.begin() + 1; it != words.end(); it++){
+      stage_lock::pause();
+      node_id file = find_plain(*it, state);
+      if (file == no_node) continue;
+      const wordvec& data = state.get_storage().read(file);
+      size_t chars = data.size();
+      for (const string& word: data) chars += word.size();
+      if (data.empty()) chars = 1;
+      yout() << 1 << " " << data.size() << " " << chars << " " << *it
+             << endl;
+   }
 }
 
 int exit_status_message() {
@@ -3,6 +3,7 @@
 #ifndef __COMMANDS_H__
 #define __COMMANDS_H__
 
+#include <cstdint>
 #include <map>
 using namespace std;
 
@@ -13,7 +14,7 @@ using namespace std;
 // A couple of convenient usings to avoid verbosity.
 //
 
-using command_fn = void (*)(inode_state& state, const wordvec& words);
+using command_fn = void (*)(inode_state& state, word_span words);
 using command_map = map<string,command_fn>;
 
 //
@@ -25,6 +26,15 @@ using command_map = map<string,command_fn>;
 // operator[] -
 //    Given a string, returns a command_fn associated with it,
 //    or 0 if not found.
+// execute -
+//    Looks up and runs the command on a line.  A trailing
+//    "> file" replaces the contents of the file with the output
+//    of the command and ">> file" appends to them.  Commands
+//    separated by "|" are run as a pipeline, each stage on its own
+//    thread, with the output of one streamed into the next.  A
+//    line ending in "&" is run in the background (see jobs.h).
+//    "time" before a line reports the time, memory and allocations
+//    it took (see alloc_hook.h); the line may itself be timed.
 //
 
 class commands {
@@ -32,29 +42,92 @@ class commands {
       commands (const inode&) = delete; // copy ctor
       commands& operator= (const inode&) = delete; // operator=
       command_map map;
+      void run (inode_state& state, word_span words,
+                bool to_file);
+      void run_pipeline (inode_state& state, word_span words,
+                         bool to_file);
+      void run_timed (inode_state& state, word_span words);
    public:
       commands();
       command_fn at (const string& cmd);
+      void execute (inode_state& state, word_span words);
 };
 
 
+//
+// parse_path -
+//    Splits a path into the names along it.  An absolute path
+//    starts with an empty name standing for the root.
+//
+
+wordvec parse_path(const string& path);
+
+//
+// list_window -
+//    The part of a directory ls --limit shows: the entries whose
+//    names come after after, less the first skip of them, and at most
+//    limit of them.  The whole directory by default.
+//
+// list_directory, list_recursive -
+//    Print what ls and lsr print for a directory: a heading and a
+//    line for each entry, and for lsr every directory under it
+//    first.  Nothing is printed for a plain file.  Given a window
+//    with a limit which leaves entries out, ls ends with a cursor to
+//    go on from (see listing.h).
+//
+
+struct list_window {
+   string after;
+   size_t skip {0};
+   size_t limit {SIZE_MAX};
+};
+
+void list_directory(inode_state& state, node_id dir,
+                    const list_window& window = list_window());
+void list_recursive(inode_state& state, node_id dir);
+
+//
+// reads_only -
+//    Whether a command line is a single command which only looks at
+//    the tree, with no pipe, redirection or "&", so that it can share
+//    the tree lock with others like it (see storage::shares_reads).
+//
+
+bool reads_only(word_span words);
+
 //
 // execution functions -
 //    See the man page for a description of each of these functions.
 //
 
-void fn_cat    (inode_state& state, const wordvec& words);
-void fn_cd     (inode_state& state, const wordvec& words);
-void fn_echo   (inode_state& state, const wordvec& words);
-void fn_exit   (inode_state& state, const wordvec& words);
-void fn_ls     (inode_state& state, const wordvec& words);
-void fn_lsr    (inode_state& state, const wordvec& words);
-void fn_make   (inode_state& state, const wordvec& words);
-void fn_mkdir  (inode_state& state, const wordvec& words);
-void fn_prompt (inode_state& state, const wordvec& words);
-void fn_pwd    (inode_state& state, const wordvec& words);
-void fn_rm     (inode_state& state, const wordvec& words);
-void fn_rmr    (inode_state& state, const wordvec& words);
+void fn_cat    (inode_state& state, word_span words);
+void fn_cd     (inode_state& state, word_span words);
+void fn_checkpoint (inode_state& state, word_span words);
+void fn_coldstat (inode_state& state, word_span words);
+void fn_compile(inode_state& state, word_span words);
+void fn_cp     (inode_state& state, word_span words);
+void fn_dedupstat (inode_state& state, word_span words);
+void fn_echo   (inode_state& state, word_span words);
+void fn_exit   (inode_state& state, word_span words);
+void fn_export (inode_state& state, word_span words);
+void fn_fg     (inode_state& state, word_span words);
+void fn_grep   (inode_state& state, word_span words);
+void fn_import (inode_state& state, word_span words);
+void fn_jobs   (inode_state& state, word_span words);
+void fn_ls     (inode_state& state, word_span words);
+void fn_lsr    (inode_state& state, word_span words);
+void fn_make   (inode_state& state, word_span words);
+void fn_memstat(inode_state& state, word_span words);
+void fn_mkdir  (inode_state& state, word_span words);
+void fn_prompt (inode_state& state, word_span words);
+void fn_pwd    (inode_state& state, word_span words);
+void fn_rm     (inode_state& state, word_span words);
+void fn_rmr    (inode_state& state, word_span words);
+void fn_run    (inode_state& state, word_span words);
+void fn_spillstat (inode_state& state, word_span words);
+void fn_stat   (inode_state& state, word_span words);
+void fn_wait   (inode_state& state, word_span words);
+void fn_wc     (inode_state& state, word_span words);
 
 //
 // exit_status_message -
@@ -0,0 +1,311 @@
+// $Id$
+
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#include "cold.h"
+#include "content.h"
+#include "debug.h"
+#include "storage.h"
+
+//
+// The words of the vocabulary, each the key of its entry in
+// word_index, and found by id through chunks of pointers to those
+// keys.  Keys of an unordered_map stay where they are, and a chunk,
+// once made, is never moved, so word reads them without vocab_lock,
+// which guards everything else here: word_index, the number of
+// words, and the answer to the last pattern matched.
+//
+
+bool vocabulary::on {false};
+
+static constexpr size_t chunk_bits = 14;
+static constexpr size_t chunk_size = size_t (1) << chunk_bits;
+static constexpr size_t max_chunks = (size_t (1) << 32) >> chunk_bits;
+static unordered_map<string, word_id> word_index;
+static unique_ptr<const string*[]> chunks[max_chunks];
+static size_t word_count {0};
+static string last_pattern;
+static id_set last_matching;
+static mutex vocab_lock;
+
+void vocabulary::enable() {
+   on = true;
+}
+
+/**
+ * Finds the id of a word, giving it the next one if it has none.
+ * Called with vocab_lock held.
+ * @param  word the word
+ * @return      its id
+ */
+static word_id id_of (const string& word) {
+   auto found = word_index.find (word);
+   if (found != word_index.end()) return found->second;
+   if (word_count == max_chunks * chunk_size) {
+      throw yshell_exn ("vocabulary: too many words");
+   }
+   found = word_index.emplace (word, word_count).first;
+   auto& chunk = chunks[word_count >> chunk_bits];
+   if (chunk == nullptr) chunk.reset (new const string*[chunk_size]);
+   chunk[word_count & (chunk_size - 1)] = &found->first;
+   DEBUGF ('i', "word " << word_count << " is " << word);
+   return word_count++;
+}
+
+void vocabulary::encode (const wordvec& words, vector<word_id>& ids) {
+   ids.reserve (ids.size() + words.size());
+   lock_guard<mutex> guard (vocab_lock);
+   for (const string& word: words) ids.push_back (id_of (word));
+}
+
+const string& vocabulary::word (word_id id) {
+   return *chunks[id >> chunk_bits][id & (chunk_size - 1)];
+}
+
+/**
+ * Brings the answer for pattern up to date, starting afresh if the
+ * last one was for another pattern.  An answer handed out is never
+ * changed, so one grown is a copy.
+ * @param  pattern what grep looks for
+ * @return         whether each word holds it, by id
+ */
+id_set vocabulary::matching (const string& pattern) {
+   lock_guard<mutex> guard (vocab_lock);
+   if (last_matching == nullptr or pattern != last_pattern) {
+      last_pattern = pattern;
+      last_matching = make_shared<vector<char>>();
+   }
+   if (last_matching->size() < word_count) {
+      auto grown = make_shared<vector<char>> (*last_matching);
+      grown->reserve (word_count);
+      for (size_t id = grown->size(); id < word_count; ++id) {
+         grown->push_back (word (id).find (pattern) != string::npos);
+      }
+      last_matching = grown;
+   }
+   return last_matching;
+}
+
+size_t vocabulary::size() {
+   lock_guard<mutex> guard (vocab_lock);
+   return word_count;
+}
+
+/**
+ * Adds up word_index as libstdc++ lays it out, a node for each word
+ * with a link, the entry and the word's hash, and a bucket array,
+ * then the chunks made so far.
+ */
+size_t vocabulary::heap_bytes() {
+   static constexpr size_t node = sizeof (void*)
+         + sizeof (pair<const string, word_id>) + sizeof (size_t);
+   lock_guard<mutex> guard (vocab_lock);
+   // a table of one bucket keeps it inside itself
+   size_t buckets = word_index.bucket_count();
+   size_t bytes = buckets > 1 ? buckets * sizeof (void*) : 0;
+   for (const auto& entry: word_index) {
+      bytes += node + ::heap_bytes (entry.first);
+   }
+   size_t made = (word_count + chunk_size - 1) >> chunk_bits;
+   return bytes + made * chunk_size * sizeof (const string*);
+}
+
+
+content_blob::~content_blob() {
+   cold_store::leave (this);
+}
+
+/**
+ * The blob itself, or if it is compressed, its words expanded into
+ * a blob of the calling thread's, good until that thread next
+ * expands one
+ * @return a blob holding the words
+ */
+const content_blob& content_blob::view() const {
+   if (cold == nullptr) return *this;
+   static thread_local content_blob thawed;
+   cold_store::expand (*this, thawed);
+   return thawed;
+}
+
+size_t content_blob::size() const {
+   if (cold != nullptr) return cold->count;
+   return encoded ? ids.size() : words.size();
+}
+
+const wordvec& content_blob::read() const {
+   const content_blob& warm = view();
+   if (not warm.encoded) return warm.words;
+   static thread_local wordvec decoded;
+   decoded.resize (warm.ids.size());
+   for (size_t i = 0; i < warm.ids.size(); ++i) {
+      decoded[i] = vocabulary::word (warm.ids[i]);
+   }
+   return decoded;
+}
+
+bool content_blob::contains (const string& pattern) const {
+   const content_blob& warm = view();
+   if (not warm.encoded) {
+      for (const string& word: warm.words) {
+         if (word.find (pattern) != string::npos) return true;
+      }
+      return false;
+   }
+   id_set matching = vocabulary::matching (pattern);
+   const char* matches = matching->data();
+   for (word_id id: warm.ids) {
+      if (matches[id]) return true;
+   }
+   return false;
+}
+
+void content_blob::append (const string& word) {
+   cold_store::touch (*this, true);
+   if (not encoded) {
+      words.push_back (word);
+      return;
+   }
+   lock_guard<mutex> guard (vocab_lock);
+   ids.push_back (id_of (word));
+}
+
+size_t content_blob::header_bytes() const {
+   return words.capacity() * sizeof (string);
+}
+
+size_t content_blob::char_bytes() const {
+   size_t bytes = 0;
+   for (const string& word: words) bytes += ::heap_bytes (word);
+   return bytes;
+}
+
+size_t content_blob::id_bytes() const {
+   return ids.capacity() * sizeof (word_id);
+}
+
+size_t content_blob::cold_bytes() const {
+   if (cold == nullptr) return 0;
+   return sizeof (cold_form) + ::heap_bytes (cold->bytes);
+}
+
+
+//
+// The interned blobs, by the hash of their words, guarded by
+// table_lock.  The table only holds weak pointers, so that it never
+// keeps contents alive by itself; an entry whose blob is gone is
+// skipped until forget takes it out.
+//
+
+static unordered_multimap<size_t, weak_ptr<content_blob>> table;
+static mutex table_lock;
+
+static size_t hash_words (const wordvec& words) {
+   size_t hash = words.size();
+   for (const string& word: words) {
+      hash ^= std::hash<string>() (word) + 0x9e3779b97f4a7c15
+            + (hash << 6) + (hash >> 2);
+   }
+   return hash;
+}
+
+static size_t hash_ids (const vector<word_id>& ids) {
+   size_t hash = ids.size();
+   for (word_id id: ids) {
+      hash ^= id + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+   }
+   return hash;
+}
+
+/**
+ * Finds the blob already holding these words, or interns a new one.
+ * With the vocabulary on, the words are encoded first, and blobs
+ * are told apart by their ids.
+ * @param  words the contents
+ * @return       the blob, shared with every file holding the words
+ */
+blob_ptr content_table::intern (const wordvec& words) {
+   unique_ptr<content_blob> made (new content_blob());
+   if (made->encoded) {
+      vocabulary::encode (words, made->ids);
+      made->hash = hash_ids (made->ids);
+   }else {
+      made->hash = hash_words (words);
+   }
+   // blobs looked at are let go of after the lock, since letting go
+   // of the last one takes it
+   vector<blob_ptr> looked_at;
+   lock_guard<mutex> guard (table_lock);
+   auto range = table.equal_range (made->hash);
+   for (auto entry = range.first; entry != range.second; ++entry) {
+      blob_ptr blob = entry->second.lock();
+      if (blob == nullptr) continue;
+      const content_blob& warm = blob->view();
+      if (warm.encoded == made->encoded
+          and (made->encoded ? warm.ids == made->ids
+                             : warm.words == words)) {
+         DEBUGF ('i', "sharing contents " << made->hash);
+         return blob;
+      }
+      looked_at.push_back (blob);
+   }
+   if (not made->encoded) made->words = words;
+   made->interned = true;
+   size_t hash = made->hash;
+   blob_ptr blob (made.release(), forget);
+   table.emplace (hash, blob);
+   cold_store::enter (blob.get());
+   return blob;
+}
+
+blob_ptr content_table::make_private (const wordvec& words) {
+   blob_ptr blob = make_shared<content_blob>();
+   if (blob->encoded) {
+      vocabulary::encode (words, blob->ids);
+   }else {
+      blob->words = words;
+   }
+   cold_store::enter (blob.get());
+   return blob;
+}
+
+blob_ptr content_table::make_private (const content_blob& from) {
+   const content_blob& warm = from.view();
+   blob_ptr blob = make_shared<content_blob>();
+   blob->encoded = warm.encoded;
+   blob->words = warm.words;
+   blob->ids = warm.ids;
+   cold_store::enter (blob.get());
+   return blob;
+}
+
+/**
+ * The deleter of an interned blob: takes an entry that has gone
+ * out of the table.  Any gone entry with the same hash will do,
+ * since each blob that goes takes out one.
+ * @param blob the blob
+ */
+void content_table::forget (content_blob* blob) {
+   {
+      lock_guard<mutex> guard (table_lock);
+      auto range = table.equal_range (blob->hash);
+      for (auto entry = range.first; entry != range.second; ++entry) {
+         if (entry->second.expired()) {
+            table.erase (entry);
+            break;
+         }
+      }
+   }
+   delete blob;
+}
+
+size_t content_table::size() {
+   lock_guard<mutex> guard (table_lock);
+   return table.size();
+}
+
@@ -0,0 +1,164 @@
+// $Id$
+
+#ifndef __CONTENT_H__
+#define __CONTENT_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "util.h"
+
+//
+// vocabulary -
+//    A static class which, when enabled, gives every distinct word
+//    written to a plain file a 32 bit id, so that files keep arrays
+//    of ids instead of strings.  Words are never taken out: the
+//    vocabulary only grows, and is meant for contents drawn from a
+//    vocabulary much smaller than the words written.
+// enable, enabled -
+//    Turns the vocabulary on, before anything is written, or says
+//    whether it is on.
+// encode -
+//    Appends the ids of words to ids, giving new words new ids.
+//    Throws a yshell_exn once there are more words than ids.
+// word -
+//    The word with an id.  It is kept where it is for good, so this
+//    takes no lock, and may be called on any thread which got the id
+//    from a blob.
+// matching -
+//    Which ids name a word holding pattern, as grep looks for it,
+//    indexed by id.  The last pattern's answer is kept, and brought
+//    up to date with words added since, so that one grep over many
+//    files goes through the vocabulary once.
+// size, heap_bytes -
+//    The number of words, and what they and the index finding them
+//    take on the heap.
+//
+
+using word_id = uint32_t;
+using id_set = shared_ptr<const vector<char>>;
+
+class vocabulary {
+   private:
+      static bool on;
+   public:
+      static void enable();
+      static bool enabled() { return on; }
+      static void encode (const wordvec& words, vector<word_id>& ids);
+      static const string& word (word_id id);
+      static id_set matching (const string& pattern);
+      static size_t size();
+      static size_t heap_bytes();
+};
+
+//
+// class content_blob -
+//
+// The words of one or more plain files, as strings, or as ids into
+// the vocabulary if it was enabled when the blob was made.  A blob
+// made by content_table::intern is shared by every file written with
+// the same words, and never changes; one made by make_private belongs
+// to a single file, which may append to it in place.  Either may be
+// compressed while it is cold, and expanded again, by cold_store
+// (see cold.h); reading a compressed blob expands it into a buffer
+// of the calling thread's, and leaves the blob as it is.
+// dtor -
+//    Takes the blob out of cold_store's lists.
+// size -
+//    The number of words.
+// read -
+//    The words.  Those of an encoded or compressed blob are looked up
+//    into a buffer of the calling thread's, good until that thread
+//    next reads such a blob.
+// each -
+//    Calls visit with each word in turn, where it is kept.
+// contains -
+//    Whether any word holds pattern, compared by id when encoded.
+// append -
+//    Adds one word to the end, marking the blob used, and expanding
+//    it first if it is compressed.
+// header_bytes, char_bytes, id_bytes, cold_bytes -
+//    What the words take on the heap: the headers of their strings,
+//    the characters of those too long to be kept in their headers,
+//    their ids, and their compressed form.  Words kept as ids count
+//    only as ids, and compressed words only as compressed.
+//
+
+struct cold_form;
+
+class content_blob {
+   friend class content_table;
+   friend class cold_store;
+   private:
+      size_t hash {0};
+      bool interned {false};
+      bool encoded {vocabulary::enabled()};
+      wordvec words;
+      vector<word_id> ids;
+      // kept by cold_store, under its lock
+      unique_ptr<cold_form> cold;
+      content_blob* older {nullptr};
+      content_blob* newer {nullptr};
+      uint64_t used {0};
+      size_t hot_bytes {0};
+      int on_list {0};
+      const content_blob& view() const;
+   public:
+      ~content_blob();
+      bool is_interned() const { return interned; }
+      size_t size() const;
+      const wordvec& read() const;
+      template <typename visitor>
+      void each (visitor visit) const;
+      bool contains (const string& pattern) const;
+      void append (const string& word);
+      size_t header_bytes() const;
+      size_t char_bytes() const;
+      size_t id_bytes() const;
+      size_t cold_bytes() const;
+};
+using blob_ptr = shared_ptr<content_blob>;
+
+template <typename visitor>
+void content_blob::each (visitor visit) const {
+   const content_blob& warm = view();
+   if (not warm.encoded) {
+      for (const string& word: warm.words) visit (word);
+   }else {
+      for (word_id id: warm.ids) visit (vocabulary::word (id));
+   }
+}
+
+//
+// content_table -
+//    A static class which keeps one blob for each distinct contents
+//    written, found by a hash of the words, or of their ids when the
+//    vocabulary is on, so that telling whether contents are already
+//    there compares ids rather than strings.  A blob leaves the table
+//    when the last file sharing it lets go of it, on whatever thread
+//    that happens, so the table has a lock of its own.
+// intern -
+//    The shared blob holding words, made if there is none yet.
+// make_private -
+//    A new blob for one file, holding a copy of words, or of the
+//    words of another blob.
+// size -
+//    How many distinct contents the table holds.
+//
+
+class content_table {
+   private:
+      static void forget (content_blob* blob);
+   public:
+      static blob_ptr intern (const wordvec& words);
+      static blob_ptr make_private (const wordvec& words);
+      static blob_ptr make_private (const content_blob& blob);
+      static size_t size();
+};
+
+#endif
+
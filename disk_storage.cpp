@@ -0,0 +1,955 @@
+// $Id$
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "disk_storage.h"
+#include "journal.h"
+
+//
+// The file is made of page_size pages, numbered from 0, in the
+// byte order of the machine that wrote it.  Page 0 is the header.
+// Inode records are in pages of their own, found by number through
+// three levels of pages of page numbers, the top level being in the
+// header.  A directory is a B+ tree: every entry is in a leaf, the
+// leaves are linked in name order, and an interior node's link is
+// its leftmost child, each entry after it the first key in the
+// child it names.  Entries are a key size byte, the key and an
+// 8 byte value, and are not merged as they are removed; a
+// directory's pages are freed when it goes.  A page number of 0 is
+// no page at all.
+//
+// Free pages and inode numbers are only known in memory, and are
+// written to the end of the file when it is closed.
+//
+
+static constexpr size_t page_size = page_cache::page_size;
+static constexpr uint64_t pointers_per_page = page_size / 8;
+static constexpr char disk_magic[8] = "YDISK\1";
+static constexpr size_t max_name = 255;
+static constexpr size_t inline_name = 72;
+
+struct disk_header {
+   char magic[8];
+   uint64_t page_size;
+   uint64_t pages;
+   uint64_t inodes;
+   uint64_t clean;
+   uint64_t position;
+   uint64_t free_start;
+   uint64_t free_pages;
+   uint64_t free_bytes;
+   uint64_t table[pointers_per_page - 9];
+};
+static_assert (sizeof (disk_header) == page_size,
+               "the header is one page");
+
+struct disk_inode {
+   uint8_t used;
+   uint8_t type;
+   uint16_t name_size;
+   uint32_t unused;
+   uint64_t parent;
+   uint64_t size;
+   uint64_t start;
+   uint64_t pages;
+   uint64_t bytes;
+   uint64_t name_page;
+   char name[inline_name];
+};
+static_assert (sizeof (disk_inode) == 128, "inodes are 128 bytes");
+
+static constexpr uint64_t inodes_per_page =
+      page_size / sizeof (disk_inode);
+
+struct btree_head {
+   uint8_t leaf;
+   uint8_t unused;
+   uint16_t count;
+   uint32_t unused2;
+   uint64_t link;
+};
+
+static string disk_path;
+static size_t cache_mb = 64;
+
+static uint64_t pages_for (uint64_t bytes) {
+   return (bytes + page_size - 1) / page_size;
+}
+
+static size_t entry_size (const string& key) {
+   return 1 + key.size() + sizeof (uint64_t);
+}
+
+static void put_number (string& out, uint64_t number) {
+   while (number >= 0x80) {
+      out.push_back (static_cast<char> ((number & 0x7F) | 0x80));
+      number >>= 7;
+   }
+   out.push_back (static_cast<char> (number));
+}
+
+static bool get_number (const string& in, size_t& pos,
+                        uint64_t& number) {
+   number = 0;
+   for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= in.size()) return false;
+      unsigned char next = in[pos++];
+      number |= uint64_t (next & 0x7F) << shift;
+      if (not (next & 0x80)) return true;
+   }
+   return false;
+}
+
+/**
+ * Opens the file the tree is kept in, or a scratch file which is
+ * unlinked at once
+ * @param  path the file, or "" for a scratch file
+ * @return      its file descriptor
+ */
+static int open_disk (const string& path) {
+   int fd;
+   string name = path;
+   if (path.empty()) {
+      const char* tmpdir = getenv ("TMPDIR");
+      name = string (tmpdir == nullptr ? "/tmp" : tmpdir)
+           + "/yshell.XXXXXX";
+      fd = mkstemp (&name[0]);
+      if (fd >= 0) unlink (name.c_str());
+   } else {
+      fd = open (path.c_str(), O_RDWR | O_CREAT, 0666);
+   }
+   if (fd < 0) throw yshell_exn (name + ": " + strerror (errno));
+   DEBUGF ('d', "tree in " << name);
+   return fd;
+}
+
+void disk_storage::set_path (const string& path) {
+   disk_path = path;
+}
+
+void disk_storage::set_cache_mb (size_t megabytes) {
+   cache_mb = megabytes;
+}
+
+/**
+ * Opens the tree kept by an earlier run, or makes an empty one
+ */
+disk_storage::disk_storage():
+   fd (open_disk (disk_path)), keep (not disk_path.empty()),
+   head (new disk_header()), cache (fd, cache_mb << 20) {
+   struct stat info;
+   if (fstat (fd, &info) == 0 and info.st_size > 0) {
+      ssize_t got = pread (fd, head.get(), page_size, 0);
+      const char* error = nullptr;
+      if (got != static_cast<ssize_t> (page_size)
+          or memcmp (head->magic, disk_magic, sizeof disk_magic) != 0
+          or head->page_size != page_size) {
+         error = ": not a disk tree";
+      } else if (not head->clean) {
+         error = ": was not closed cleanly";
+      }
+      if (error != nullptr) {
+         ::close (fd);
+         throw yshell_exn (disk_path + error);
+      }
+      load_free_lists();
+      kept_tree = true;
+      DEBUGF ('d', "kept tree of " << head->pages << " pages");
+   } else {
+      memcpy (head->magic, disk_magic, sizeof disk_magic);
+      head->page_size = page_size;
+      head->pages = 1;
+      head->inodes = 1;
+      new_inode (no_node, "", DIR_INODE);
+   }
+   head->clean = 0;
+   if (keep) write_header();
+}
+
+/**
+ * Writes back the cache, then the free lists and a header marking
+ * the file as closed cleanly, unless it is only scratch
+ */
+disk_storage::~disk_storage() {
+   DEBUGF ('d', "page cache: " << cache.hits() << " hits, "
+           << cache.misses() << " misses, " << cache.writes()
+           << " writes");
+   if (keep) {
+      try {
+         save_free_lists();
+         cache.flush();
+         fsync (fd);
+         head->clean = 1;
+         head->position = journal::position();
+         write_header();
+         fsync (fd);
+      }catch (yshell_exn& exn) {
+         complain() << exn.what() << endl;
+      }
+   }
+   ::close (fd);
+}
+
+void disk_storage::write_header() {
+   ssize_t wrote = pwrite (fd, head.get(), page_size, 0);
+   if (wrote != static_cast<ssize_t> (page_size)) {
+      throw yshell_exn (disk_path + ": " + strerror (errno));
+   }
+}
+
+void disk_storage::load_free_lists() {
+   if (head->free_pages == 0) return;
+   read_extent (head->free_start, head->free_bytes, bytes);
+   size_t pos = 0;
+   uint64_t count;
+   bool good = get_number (bytes, pos, count);
+   for (; good and count > 0; --count) {
+      uint64_t inode_nr;
+      good = get_number (bytes, pos, inode_nr);
+      free_inodes.push_back (inode_nr);
+   }
+   good = good and get_number (bytes, pos, count);
+   for (; good and count > 0; --count) {
+      uint64_t pages;
+      uint64_t start;
+      good = get_number (bytes, pos, pages)
+         and get_number (bytes, pos, start);
+      free_extents.emplace (pages, start);
+   }
+   if (not good) throw yshell_exn (disk_path + ": not a disk tree");
+   release (head->free_start, head->free_pages);
+   head->free_pages = 0;
+}
+
+/**
+ * Writes the free lists past the end of everything else, so that
+ * writing them frees nothing and uses nothing that is free
+ */
+void disk_storage::save_free_lists() {
+   bytes.clear();
+   put_number (bytes, free_inodes.size());
+   for (uint64_t inode_nr: free_inodes) put_number (bytes, inode_nr);
+   put_number (bytes, free_extents.size());
+   for (const auto& extent: free_extents) {
+      put_number (bytes, extent.first);
+      put_number (bytes, extent.second);
+   }
+   head->free_start = head->pages;
+   head->free_pages = pages_for (bytes.size());
+   head->free_bytes = bytes.size();
+   head->pages += head->free_pages;
+   write_extent (head->free_start, 0, bytes);
+}
+
+/**
+ * Takes the smallest free extent big enough, giving back what is
+ * left over, or grows the file
+ * @param  count the number of pages
+ * @return       the first of them
+ */
+uint64_t disk_storage::allocate (uint64_t count) {
+   auto found = free_extents.lower_bound (count);
+   if (found == free_extents.end()) {
+      uint64_t start = head->pages;
+      head->pages += count;
+      return start;
+   }
+   uint64_t have = found->first;
+   uint64_t start = found->second;
+   free_extents.erase (found);
+   if (have > count) free_extents.emplace (have - count, start + count);
+   return start;
+}
+
+void disk_storage::release (uint64_t start, uint64_t count) {
+   if (count == 0) return;
+   for (uint64_t page = start; page < start + count; ++page) {
+      cache.forget (page);
+   }
+   free_extents.emplace (count, start);
+}
+
+// INODES =============================================================
+
+/**
+ * Finds the page holding an inode's record, remembering the last
+ * one, since the records looked at together are often in one page
+ * @param  inode_nr the inode number
+ * @param  make     true to make the pages that lead to it
+ * @return          the page, or 0 if it has not been made
+ */
+uint64_t disk_storage::record_page (uint64_t inode_nr, bool make) {
+   uint64_t slot = inode_nr / inodes_per_page;
+   // pages of records are never freed, so the last one found stays
+   if (slot == last_slot) return last_page;
+   uint64_t top = slot / (pointers_per_page * pointers_per_page);
+   if (top >= sizeof head->table / sizeof head->table[0]) {
+      throw yshell_exn ("inode " + to_string (inode_nr)
+                        + ": out of inode numbers");
+   }
+   uint64_t page = head->table[top];
+   if (page == 0) {
+      if (not make) return 0;
+      page = head->table[top] = allocate (1);
+      cache.fresh (page);
+   }
+   uint64_t indexes[] {slot / pointers_per_page % pointers_per_page,
+                       slot % pointers_per_page};
+   for (uint64_t index: indexes) {
+      uint64_t next;
+      page_cache::page_ref ref = cache.fetch (page);
+      memcpy (&next, ref.data() + index * 8, 8);
+      if (next == 0) {
+         if (not make) return 0;
+         next = allocate (1);
+         memcpy (ref.write() + index * 8, &next, 8);
+         cache.fresh (next);
+      }
+      page = next;
+   }
+   last_slot = slot;
+   last_page = page;
+   return page;
+}
+
+disk_inode disk_storage::get_inode (uint64_t inode_nr) {
+   disk_inode record;
+   uint64_t page = record_page (inode_nr, false);
+   if (page == 0) {
+      memset (&record, 0, sizeof record);
+   } else {
+      page_cache::page_ref ref = cache.fetch (page);
+      memcpy (&record, ref.data() + inode_nr % inodes_per_page
+                                  * sizeof record, sizeof record);
+   }
+   return record;
+}
+
+void disk_storage::put_inode (uint64_t inode_nr,
+                              const disk_inode& record) {
+   uint64_t page = record_page (inode_nr, true);
+   page_cache::page_ref ref = cache.fetch (page);
+   memcpy (ref.write() + inode_nr % inodes_per_page * sizeof record,
+           &record, sizeof record);
+}
+
+disk_inode disk_storage::inode_of (node_id node) {
+   if (node != 0 and node < head->inodes) {
+      disk_inode record = get_inode (node);
+      if (record.used) return record;
+   }
+   throw yshell_exn ("inode " + to_string (node) + ": no such inode");
+}
+
+disk_inode disk_storage::dir_of (node_id node) {
+   disk_inode record = inode_of (node);
+   if (record.type != DIR_INODE) {
+      throw yshell_exn (name_of (record) + ": not a directory");
+   }
+   return record;
+}
+
+disk_inode disk_storage::file_of (node_id node) {
+   disk_inode record = inode_of (node);
+   if (record.type != PLAIN_INODE) {
+      throw yshell_exn (name_of (record) + ": is a directory");
+   }
+   return record;
+}
+
+/**
+ * Makes the record of a new inode, with an empty directory if it is
+ * one, but does not enter it in its directory
+ * @param  dir  its directory, or no_node for the root
+ * @param  name its name
+ * @param  type what it is
+ * @return      its number
+ */
+node_id disk_storage::new_inode (node_id dir, const string& name,
+                                 inode_t type) {
+   node_id made;
+   if (free_inodes.empty()) {
+      made = head->inodes++;
+   } else {
+      made = free_inodes.back();
+      free_inodes.pop_back();
+   }
+   disk_inode record;
+   memset (&record, 0, sizeof record);
+   record.used = 1;
+   record.type = type;
+   record.parent = dir == no_node ? made : dir;
+   record.name_size = name.size();
+   if (name.size() <= inline_name) {
+      memcpy (record.name, name.data(), name.size());
+   } else {
+      record.name_page = allocate (1);
+      page_cache::page_ref ref = cache.fresh (record.name_page);
+      memcpy (ref.write(), name.data(), name.size());
+   }
+   if (type == DIR_INODE) record.start = btree_new_leaf();
+   put_inode (made, record);
+   DEBUGF ('d', "made " << name << " as inode " << made);
+   return made;
+}
+
+string disk_storage::name_of (const disk_inode& record) {
+   if (record.name_page == 0) {
+      return string (record.name, record.name_size);
+   }
+   page_cache::page_ref ref = cache.fetch (record.name_page);
+   return string (ref.data(), record.name_size);
+}
+
+node_info disk_storage::info_of (node_id node, const string& name) {
+   disk_inode record = get_inode (node);
+   node_info info;
+   info.node = node;
+   info.inode_nr = node;
+   info.type = static_cast<inode_t> (record.type);
+   info.size = record.size;
+   info.name = &name;
+   return info;
+}
+
+/**
+ * Frees an inode and everything under it
+ * @param node the inode, already out of its directory
+ */
+void disk_storage::free_node (node_id node) {
+   disk_inode record = get_inode (node);
+   if (record.type == DIR_INODE) {
+      vector<node_id> children;
+      btree_entries leaf_entries;
+      for (uint64_t page = btree_first (record.start); page != 0;) {
+         bool leaf;
+         btree_read (page, leaf, page, leaf_entries);
+         for (const btree_entry& entry: leaf_entries) {
+            children.push_back (entry.value);
+         }
+      }
+      for (node_id child: children) free_node (child);
+      btree_free (record.start);
+   } else {
+      release (record.start, record.pages);
+   }
+   if (record.name_page != 0) release (record.name_page, 1);
+   memset (&record, 0, sizeof record);
+   put_inode (node, record);
+   free_inodes.push_back (node);
+}
+
+// EXTENTS ============================================================
+
+void disk_storage::read_extent (uint64_t start, uint64_t length,
+                                string& out) {
+   out.resize (length);
+   for (uint64_t done = 0; done < length; done += page_size) {
+      page_cache::page_ref ref = cache.fetch (start + done / page_size);
+      memcpy (&out[done], ref.data(), min (page_size, length - done));
+   }
+}
+
+/**
+ * Writes into an extent.  Only the page data starts in the middle of
+ * is read in; anything after data in the page it ends in is lost.
+ * @param start  the first page of the extent
+ * @param offset where in the extent data goes
+ * @param data   the bytes
+ */
+void disk_storage::write_extent (uint64_t start, uint64_t offset,
+                                 const string& data) {
+   for (size_t done = 0; done < data.size();) {
+      uint64_t at = offset + done;
+      uint64_t page = start + at / page_size;
+      size_t within = at % page_size;
+      size_t count = min (page_size - within, data.size() - done);
+      page_cache::page_ref ref = within == 0 ? cache.fresh (page)
+                                             : cache.fetch (page);
+      memcpy (ref.write() + within, data.data() + done, count);
+      done += count;
+   }
+}
+
+void disk_storage::copy_extent (uint64_t from, uint64_t to,
+                                uint64_t length) {
+   for (uint64_t page = 0; page < pages_for (length); ++page) {
+      page_cache::page_ref source = cache.fetch (from + page);
+      page_cache::page_ref copy = cache.fresh (to + page);
+      memcpy (copy.write(), source.data(), page_size);
+   }
+}
+
+// B+ TREES ===========================================================
+
+uint64_t disk_storage::btree_new_leaf() {
+   uint64_t page = allocate (1);
+   btree_head node {1, 0, 0, 0, 0};
+   page_cache::page_ref ref = cache.fresh (page);
+   memcpy (ref.write(), &node, sizeof node);
+   return page;
+}
+
+/**
+ * Looks a key up straight from the pages, without copying entries
+ * @param  page the root of the tree
+ * @param  key  the name
+ * @return      its value, or no_node
+ */
+node_id disk_storage::btree_find (uint64_t page, const string& key) {
+   for (;;) {
+      page_cache::page_ref ref = cache.fetch (page);
+      btree_head node;
+      memcpy (&node, ref.data(), sizeof node);
+      const char* entry = ref.data() + sizeof node;
+      uint64_t child = node.link;
+      for (size_t i = 0; i < node.count; ++i) {
+         size_t size = static_cast<unsigned char> (*entry);
+         int order = key.compare (0, string::npos, entry + 1, size);
+         if (order < 0) break;
+         uint64_t value;
+         memcpy (&value, entry + 1 + size, sizeof value);
+         if (node.leaf and order == 0) return value;
+         child = value;
+         entry += 1 + size + sizeof value;
+      }
+      if (node.leaf) return no_node;
+      page = child;
+   }
+}
+
+void disk_storage::btree_read (uint64_t page, bool& leaf,
+                               uint64_t& link, btree_entries& into) {
+   page_cache::page_ref ref = cache.fetch (page);
+   btree_head node;
+   memcpy (&node, ref.data(), sizeof node);
+   leaf = node.leaf;
+   link = node.link;
+   into.resize (node.count);
+   const char* entry = ref.data() + sizeof node;
+   for (btree_entry& read: into) {
+      size_t size = static_cast<unsigned char> (*entry);
+      read.key.assign (entry + 1, size);
+      memcpy (&read.value, entry + 1 + size, sizeof read.value);
+      entry += entry_size (read.key);
+   }
+}
+
+void disk_storage::btree_write (uint64_t page, bool leaf,
+                                uint64_t link,
+                                const btree_entries& from,
+                                size_t begin, size_t end) {
+   page_cache::page_ref ref = cache.fresh (page);
+   btree_head node {leaf, 0, static_cast<uint16_t> (end - begin), 0,
+                    link};
+   char* entry = ref.write();
+   memcpy (entry, &node, sizeof node);
+   entry += sizeof node;
+   for (size_t i = begin; i < end; ++i) {
+      *entry = static_cast<char> (from[i].key.size());
+      memcpy (entry + 1, from[i].key.data(), from[i].key.size());
+      memcpy (entry + 1 + from[i].key.size(), &from[i].value,
+              sizeof from[i].value);
+      entry += entry_size (from[i].key);
+   }
+}
+
+/**
+ * Inserts a key under a node, splitting it in two by size if it
+ * overflows
+ * @param  page  the node
+ * @param  key   a name not in the tree
+ * @param  value its inode number
+ * @param  split the first key of the new right half and its page
+ * @return       true if the node was split
+ */
+bool disk_storage::btree_insert (uint64_t page, const string& key,
+                                 uint64_t value, btree_entry& split) {
+   bool leaf;
+   uint64_t link;
+   btree_entries node;
+   btree_read (page, leaf, link, node);
+   auto at = upper_bound (node.begin(), node.end(), key, key_before);
+   if (leaf) {
+      node.insert (at, {key, value});
+   } else {
+      uint64_t child = at == node.begin() ? link : (at - 1)->value;
+      size_t index = at - node.begin();
+      btree_entry up;
+      if (not btree_insert (child, key, value, up)) return false;
+      node.insert (node.begin() + index, move (up));
+   }
+
+   size_t total = sizeof (btree_head);
+   for (const btree_entry& entry: node) total += entry_size (entry.key);
+   if (total <= page_size) {
+      btree_write (page, leaf, link, node, 0, node.size());
+      return false;
+   }
+   size_t mid = 0;
+   for (size_t left = sizeof (btree_head); left < total / 2; ++mid) {
+      left += entry_size (node[mid].key);
+   }
+   mid = min (max<size_t> (mid, 1), node.size() - 1);
+   uint64_t right = allocate (1);
+   if (leaf) {
+      btree_write (right, true, link, node, mid, node.size());
+      btree_write (page, true, right, node, 0, mid);
+   } else {
+      btree_write (right, false, node[mid].value, node, mid + 1,
+                   node.size());
+      btree_write (page, false, link, node, 0, mid);
+   }
+   split = {node[mid].key, right};
+   DEBUGF ('d', "split page " << page << " at " << split.key);
+   return true;
+}
+
+/**
+ * Inserts a key, growing a new root if the old one splits
+ * @return the root, which may have changed
+ */
+uint64_t disk_storage::btree_add (uint64_t root, const string& key,
+                                  uint64_t value) {
+   btree_entry split;
+   if (not btree_insert (root, key, value, split)) return root;
+   uint64_t top = allocate (1);
+   btree_write (top, false, root, {split}, 0, 1);
+   return top;
+}
+
+bool disk_storage::btree_remove (uint64_t page, const string& key) {
+   btree_entries node;
+   for (;;) {
+      bool leaf;
+      uint64_t link;
+      btree_read (page, leaf, link, node);
+      auto at = upper_bound (node.begin(), node.end(), key,
+                             key_before);
+      if (not leaf) {
+         page = at == node.begin() ? link : (at - 1)->value;
+         continue;
+      }
+      if (at == node.begin() or (at - 1)->key != key) return false;
+      node.erase (at - 1);
+      btree_write (page, true, link, node, 0, node.size());
+      return true;
+   }
+}
+
+bool disk_storage::key_before (const string& key,
+                               const btree_entry& entry) {
+   return key < entry.key;
+}
+
+uint64_t disk_storage::btree_first (uint64_t page) {
+   for (;;) {
+      page_cache::page_ref ref = cache.fetch (page);
+      btree_head node;
+      memcpy (&node, ref.data(), sizeof node);
+      if (node.leaf) return page;
+      page = node.link;
+   }
+}
+
+/**
+ * Finds the leaf where a key is, or would be
+ * @param  page the root of the tree
+ * @param  key  the name
+ * @return      the leaf
+ */
+uint64_t disk_storage::btree_seek (uint64_t page, const string& key) {
+   btree_entries node;
+   for (;;) {
+      bool leaf;
+      uint64_t link;
+      btree_read (page, leaf, link, node);
+      if (leaf) return page;
+      auto at = upper_bound (node.begin(), node.end(), key, key_before);
+      page = at == node.begin() ? link : (at - 1)->value;
+   }
+}
+
+void disk_storage::btree_free (uint64_t page) {
+   bool leaf;
+   uint64_t link;
+   btree_entries node;
+   btree_read (page, leaf, link, node);
+   if (not leaf) {
+      btree_free (link);
+      for (const btree_entry& entry: node) btree_free (entry.value);
+   }
+   release (page, 1);
+}
+
+// STORAGE ============================================================
+
+node_id disk_storage::root() {
+   return 1;
+}
+
+node_id disk_storage::parent (node_id node) {
+   return inode_of (node).parent;
+}
+
+/**
+ * The name of a node, kept until the tree next changes, so that a
+ * path can be built from references to the names along it
+ */
+const string& disk_storage::name (node_id node) {
+   auto found = names.find (node);
+   if (found != names.end()) return found->second;
+   return names[node] = name_of (inode_of (node));
+}
+
+node_info disk_storage::stat (node_id node) {
+   inode_of (node);
+   return info_of (node, name (node));
+}
+
+node_id disk_storage::find_number (uint64_t inode_nr) {
+   if (inode_nr == 0 or inode_nr >= head->inodes) return no_node;
+   return get_inode (inode_nr).used ? inode_nr : no_node;
+}
+
+node_id disk_storage::lookup (node_id dir, const string& name) {
+   // nothing holds on to names between commands
+   if (names.size() > 4096) names.clear();
+   disk_inode record = inode_of (dir);
+   if (record.type != DIR_INODE) return no_node;
+   if (name == ".") return dir;
+   if (name == "..") return record.parent;
+   return btree_find (record.start, name);
+}
+
+node_id disk_storage::create (node_id dir, const string& name,
+                              inode_t type) {
+   disk_inode parent = dir_of (dir);
+   if (name.empty() or btree_find (parent.start, name) != no_node) {
+      return no_node;
+   }
+   if (name.size() > max_name) {
+      throw yshell_exn (name + ": file name too long");
+   }
+   names.clear();
+   node_id made = new_inode (dir, name, type);
+   parent.start = btree_add (parent.start, name, made);
+   ++parent.size;
+   put_inode (dir, parent);
+   return made;
+}
+
+/**
+ * Lists a directory a leaf at a time, so visit can call back into
+ * the storage, as iterate does
+ */
+void disk_storage::list (node_id dir, const visitor& visit) {
+   btree_entries leaf_entries;
+   for (uint64_t page = btree_first (dir_of (dir).start); page != 0;) {
+      bool leaf;
+      btree_read (page, leaf, page, leaf_entries);
+      for (const btree_entry& entry: leaf_entries) {
+         visit (info_of (entry.value, entry.key));
+      }
+   }
+}
+
+/**
+ * Seeks down the tree to the leaf after is in, then walks the leaves.
+ * Whole leaves are skipped by their counts without being read.
+ */
+void disk_storage::list_range (node_id dir, const string& after,
+                               size_t skip, size_t count,
+                               const visitor& visit) {
+   btree_entries leaf_entries;
+   uint64_t page = btree_seek (dir_of (dir).start, after);
+   for (bool first = true; page != 0 and count > 0; first = false) {
+      if (not first and skip > 0) {
+         btree_head node;
+         memcpy (&node, cache.fetch (page).data(), sizeof node);
+         if (skip >= node.count) {
+            skip -= node.count;
+            page = node.link;
+            continue;
+         }
+      }
+      bool leaf;
+      btree_read (page, leaf, page, leaf_entries);
+      auto entry = leaf_entries.begin();
+      if (first) {
+         entry = upper_bound (entry, leaf_entries.end(), after,
+                              key_before);
+      }
+      size_t skipped = min<size_t> (skip, leaf_entries.end() - entry);
+      entry += skipped;
+      skip -= skipped;
+      for (; entry != leaf_entries.end() and count > 0; ++entry) {
+         --count;
+         visit (info_of (entry->value, entry->key));
+      }
+   }
+}
+
+const wordvec& disk_storage::read (node_id file) {
+   disk_inode record = file_of (file);
+   read_extent (record.start, record.bytes, bytes);
+   contents.clear();
+   size_t pos = 0;
+   for (uint64_t word = 0; word < record.size; ++word) {
+      uint64_t size;
+      get_number (bytes, pos, size);
+      contents.emplace_back (bytes, pos, size);
+      pos += size;
+   }
+   return contents;
+}
+
+/**
+ * Replaces the words of a file, moving it to a new extent if it no
+ * longer fits or fills less than half of the one it is in
+ */
+/**
+ * Walks the file's extent a page at a time, handing out each word
+ * from the page it is on, so a file of any size goes out through the
+ * page cache without being read into contents
+ */
+void disk_storage::gather (node_id file, const run_visitor& visit) {
+   disk_inode record = file_of (file);
+   uint64_t length = 0;
+   int shift = 0;
+   uint64_t left = 0;
+   bool first = true;
+   for (uint64_t done = 0; done < record.bytes; done += page_size) {
+      page_cache::page_ref ref =
+         cache.fetch (record.start + done / page_size);
+      const char* at = ref.data();
+      const char* end = at + min (page_size, record.bytes - done);
+      while (at < end) {
+         if (left > 0) {
+            size_t size = min<uint64_t> (left, end - at);
+            visit (at, size);
+            at += size;
+            left -= size;
+            continue;
+         }
+         // the length of the next word, which a page may split
+         unsigned char next = *at++;
+         length |= uint64_t (next & 0x7F) << shift;
+         shift += 7;
+         if (next & 0x80) continue;
+         if (not first) visit (" ", 1);
+         first = false;
+         left = length;
+         length = 0;
+         shift = 0;
+      }
+   }
+}
+
+void disk_storage::write (node_id file, const wordvec& words) {
+   disk_inode record = file_of (file);
+   bytes.clear();
+   for (const string& word: words) {
+      put_number (bytes, word.size());
+      bytes.append (word);
+   }
+   uint64_t pages = pages_for (bytes.size());
+   if (pages > record.pages or pages < record.pages / 2) {
+      release (record.start, record.pages);
+      record.start = pages == 0 ? 0 : allocate (pages);
+      record.pages = pages;
+   }
+   write_extent (record.start, 0, bytes);
+   record.bytes = bytes.size();
+   record.size = words.size();
+   put_inode (file, record);
+}
+
+/**
+ * Adds words to the end of a file, doubling its extent when they
+ * do not fit, so appending a word at a time copies each word a
+ * constant number of times on average
+ */
+void disk_storage::append (node_id file, const wordvec& words) {
+   disk_inode record = file_of (file);
+   bytes.clear();
+   for (const string& word: words) {
+      put_number (bytes, word.size());
+      bytes.append (word);
+   }
+   uint64_t total = record.bytes + bytes.size();
+   if (pages_for (total) > record.pages) {
+      uint64_t pages = max (pages_for (total), 2 * record.pages);
+      uint64_t start = allocate (pages);
+      copy_extent (record.start, start, record.bytes);
+      release (record.start, record.pages);
+      record.start = start;
+      record.pages = pages;
+   }
+   write_extent (record.start, record.bytes, bytes);
+   record.bytes = total;
+   record.size += words.size();
+   put_inode (file, record);
+}
+
+void disk_storage::remove (node_id dir, const string& name,
+                           bool recursive) {
+   if (name == "." or name == "..") {
+      throw yshell_exn (name + ": cannot be removed");
+   }
+   disk_inode parent = dir_of (dir);
+   node_id child = btree_find (parent.start, name);
+   if (child == no_node) {
+      throw yshell_exn (name + ": no such file or directory");
+   }
+   disk_inode record = get_inode (child);
+   if (not recursive and record.type == DIR_INODE and record.size > 0) {
+      throw yshell_exn (name + ": directory not empty");
+   }
+   btree_remove (parent.start, name);
+   --parent.size;
+   put_inode (dir, parent);
+   names.clear();
+   free_node (child);
+}
+
+bool disk_storage::restored (uint64_t& position) {
+   if (kept_tree) position = head->position;
+   return kept_tree;
+}
+
+
+/**
+ * Only what is kept in memory counts: the page cache's frames in use,
+ * the names looked up lately, the free lists, and the words of the
+ * last file read.  The tree itself is on disk.
+ */
+memory_use disk_storage::memory() {
+   uint64_t cached = 0;
+   for (const auto& entry: names) cached += heap_bytes (entry.second);
+   cached += names.size() * (2 * sizeof (void*)
+                             + sizeof (*names.begin()))
+           + names.bucket_count() * sizeof (void*);
+   uint64_t words = contents.capacity() * sizeof (string);
+   for (const string& word: contents) words += heap_bytes (word);
+   memory_use use;
+   use.inodes = head->inodes - 1 - free_inodes.size();
+   use.bytes = {
+      {"page cache", cache.bytes()},
+      {"name cache", cached},
+      {"free lists", free_extents.size() * (4 * sizeof (void*)
+                        + sizeof (*free_extents.begin()))
+                     + free_inodes.capacity() * sizeof (uint64_t)},
+      {"file read", words},
+   };
+   return use;
+}
@@ -0,0 +1,129 @@
+// $Id$
+
+#ifndef __DISK_STORAGE_H__
+#define __DISK_STORAGE_H__
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "page_cache.h"
+#include "storage.h"
+
+//
+// disk_storage -
+//    The tree in one file of fixed size pages, only as much of which
+//    is in memory as the page cache holds, so the tree can be far
+//    bigger than memory.  A node_id is an inode number, whose record
+//    is found through a table of pages indexed by number.  Each
+//    directory is a B+ tree of pages keyed by name, so a lookup reads
+//    a few pages however big the directory is, and a plain file's
+//    words are kept in one extent of pages, which doubles as it is
+//    appended to.  Pages and numbers freed by remove are used again.
+//    Nothing is shared, so copy and checkpoints go through the tree
+//    node by node.
+// set_path -
+//    The file to keep the tree in from one run to the next.  With no
+//    file, the tree is kept in a scratch file which is gone when the
+//    shell exits.  A file left by a shell that did not exit cleanly
+//    cannot be used, since pages still in its cache were lost.
+// set_cache_mb -
+//    The size of the page cache, in megabytes.
+// restored -
+//    True if the tree was kept from an earlier run, with the journal
+//    position it was kept at.
+//
+
+struct disk_header;
+struct disk_inode;
+
+class disk_storage: public storage {
+   private:
+      struct btree_entry {
+         string key;
+         uint64_t value;
+      };
+      using btree_entries = vector<btree_entry>;
+      int fd;
+      bool keep;
+      bool kept_tree {false};
+      unique_ptr<disk_header> head;
+      uint64_t last_slot {UINT64_MAX};
+      uint64_t last_page {0};
+      page_cache cache;
+      multimap<uint64_t, uint64_t> free_extents;
+      vector<uint64_t> free_inodes;
+      unordered_map<node_id, string> names;
+      wordvec contents;
+      string bytes;
+
+      void write_header();
+      void load_free_lists();
+      void save_free_lists();
+      uint64_t allocate (uint64_t count);
+      void release (uint64_t start, uint64_t count);
+      uint64_t record_page (uint64_t inode_nr, bool make);
+      disk_inode get_inode (uint64_t inode_nr);
+      void put_inode (uint64_t inode_nr, const disk_inode& record);
+      disk_inode inode_of (node_id node);
+      disk_inode dir_of (node_id node);
+      disk_inode file_of (node_id node);
+      node_id new_inode (node_id dir, const string& name, inode_t type);
+      string name_of (const disk_inode& record);
+      node_info info_of (node_id node, const string& name);
+      void free_node (node_id node);
+
+      void read_extent (uint64_t start, uint64_t length, string& out);
+      void write_extent (uint64_t start, uint64_t offset,
+                         const string& data);
+      void copy_extent (uint64_t from, uint64_t to, uint64_t length);
+
+      uint64_t btree_new_leaf();
+      node_id btree_find (uint64_t page, const string& key);
+      void btree_read (uint64_t page, bool& leaf, uint64_t& link,
+                       btree_entries& into);
+      void btree_write (uint64_t page, bool leaf, uint64_t link,
+                        const btree_entries& from, size_t begin,
+                        size_t end);
+      bool btree_insert (uint64_t page, const string& key,
+                         uint64_t value, btree_entry& split);
+      uint64_t btree_add (uint64_t root, const string& key,
+                          uint64_t value);
+      bool btree_remove (uint64_t page, const string& key);
+      uint64_t btree_first (uint64_t page);
+      uint64_t btree_seek (uint64_t page, const string& key);
+      static bool key_before (const string& key,
+                              const btree_entry& entry);
+      void btree_free (uint64_t page);
+   public:
+      static void set_path (const string& path);
+      static void set_cache_mb (size_t megabytes);
+      disk_storage();
+      ~disk_storage();
+      node_id root() override;
+      node_id parent (node_id node) override;
+      const string& name (node_id node) override;
+      node_info stat (node_id node) override;
+      node_id find_number (uint64_t inode_nr) override;
+      node_id lookup (node_id dir, const string& name) override;
+      node_id create (node_id dir, const string& name,
+                      inode_t type) override;
+      void list (node_id dir, const visitor& visit) override;
+      void list_range (node_id dir, const string& after, size_t skip,
+                       size_t count, const visitor& visit) override;
+      const wordvec& read (node_id file) override;
+      void gather (node_id file, const run_visitor& visit) override;
+      void write (node_id file, const wordvec& words) override;
+      void append (node_id file, const wordvec& words) override;
+      void remove (node_id dir, const string& name,
+                   bool recursive) override;
+      bool restored (uint64_t& position) override;
+      memory_use memory() override;
+};
+
+#endif
+
@@ -0,0 +1,523 @@
+// $Id$
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#include "cold.h"
+#include "debug.h"
+#include "export.h"
+#include "pipe.h"
+#include "spill.h"
+#include "storage.h"
+
+// FORMAT =============================================================
+
+//
+// An archive is a run of 512 byte blocks: a header block for each
+// entry, then its body padded out to a whole block, and two blocks
+// of zeros at the end.  Numbers in a header are octal.
+//
+
+static constexpr size_t block_size = 512;
+static constexpr size_t name_size = 100;
+static constexpr size_t prefix_size = 155;
+static constexpr uint64_t size_limit = uint64_t (1) << 33;
+
+static void put_octal (char* field, size_t length, uint64_t value) {
+   snprintf (field, length, "%0*llo", static_cast<int> (length - 1),
+             static_cast<unsigned long long> (value));
+}
+
+/**
+ * Appends one ustar header block
+ * @param out    the archive text
+ * @param name   the name, or the part of it after prefix
+ * @param prefix the leading directories of the name, if it is long
+ * @param type   '0' for a file, '5' for a directory, 'x' for a pax
+ *               extended header
+ * @param size   the size of the body
+ * @param mtime  the time the entry is stamped with
+ */
+static void put_block (string& out, const string& name,
+                       const string& prefix, char type, uint64_t size,
+                       time_t mtime) {
+   char block[block_size] {};
+   memcpy (block, name.data(), min (name.size(), name_size));
+   put_octal (block + 100, 8, type == '5' ? 0755 : 0644);
+   put_octal (block + 108, 8, 0);
+   put_octal (block + 116, 8, 0);
+   put_octal (block + 124, 12, size);
+   put_octal (block + 136, 12, mtime);
+   block[156] = type;
+   memcpy (block + 257, "ustar", 6);
+   memcpy (block + 263, "00", 2);
+   memcpy (block + 345, prefix.data(),
+           min (prefix.size(), prefix_size));
+
+   // the checksum is taken with its own field as spaces
+   memset (block + 148, ' ', 8);
+   unsigned sum = 0;
+   for (unsigned char c: block) sum += c;
+   put_octal (block + 148, 7, sum);
+   out.append (block, block_size);
+}
+
+static void put_padding (string& out, uint64_t size) {
+   out.append ((block_size - size % block_size) % block_size, '\0');
+}
+
+/**
+ * Makes one pax record, whose length counts its own digits
+ * @param  key   the keyword
+ * @param  value the value
+ * @return       the record
+ */
+static string pax_record (const string& key, const string& value) {
+   size_t length = key.size() + value.size() + 3;
+   size_t total = length + to_string (length).size();
+   total = length + to_string (total).size();
+   return to_string (total) + " " + key + "=" + value + "\n";
+}
+
+/**
+ * Appends the header of an entry, preceded by a pax extended header
+ * if its name or size does not fit in the ustar fields
+ * @param out   the archive text
+ * @param path  the name of the entry
+ * @param type  '0' for a file, '5' for a directory
+ * @param size  the size of the body
+ * @param mtime the time the entry is stamped with
+ */
+static void put_header (string& out, const string& path, char type,
+                        uint64_t size, time_t mtime) {
+   string name = path, prefix, records;
+   if (path.size() > name_size) {
+      // the first slash with at most name_size characters after it
+      size_t slash = path.find ('/', path.size() - name_size - 1);
+      if (slash != string::npos and slash > 0 and slash <= prefix_size
+          and slash + 1 < path.size()) {
+         prefix = path.substr (0, slash);
+         name = path.substr (slash + 1);
+      } else {
+         records += pax_record ("path", path);
+         name = path.substr (path.size() - name_size);
+      }
+   }
+   if (size >= size_limit) {
+      records += pax_record ("size", to_string (size));
+   }
+   if (not records.empty()) {
+      put_block (out, "PaxHeader", "", 'x', records.size(), mtime);
+      out += records;
+      put_padding (out, records.size());
+   }
+   put_block (out, name, prefix, type,
+              size >= size_limit ? 0 : size, mtime);
+}
+
+static uint64_t text_size (const wordvec& words) {
+   uint64_t size = 0;
+   for (const string& word: words) size += word.size() + 1;
+   return size;
+}
+
+/**
+ * Appends some of the words of a file as cat prints them, each
+ * followed by a space except the last, which is followed by a newline
+ * @param out   the archive text
+ * @param words the file
+ * @param from  the first word to append
+ * @param to    one past the last
+ */
+static void put_words (string& out, const wordvec& words, size_t from,
+                       size_t to) {
+   for (size_t index = from; index < to; ++index) {
+      out += words[index];
+      out += index + 1 == words.size() ? '\n' : ' ';
+   }
+}
+
+// WALKING ============================================================
+
+//
+// tar_entry -
+//    A child of a shared directory.
+//
+
+struct tar_entry {
+   string name;
+   inode_t type;
+   file_base_ptr contents;
+};
+
+//
+// tar_item -
+//    What goes in the archive for one directory, or for a piece of a
+//    file: its header if it is the first piece, words from to to,
+//    and the padding if it is the last.  A big file is cut into
+//    pieces so that no one piece is rendered in too much memory.
+//
+// tar_unit -
+//    The items one worker renders at a time, and what it rendered.
+//
+
+struct tar_item {
+   string path;
+   inode_t type;
+   file_base_ptr contents;
+   size_t from {0};
+   size_t to {0};
+   bool first {true};
+   bool last {true};
+};
+
+struct tar_unit {
+   vector<tar_item> items;
+   string text;
+   bool done {false};
+};
+using unit_ptr = shared_ptr<tar_unit>;
+
+static constexpr size_t unit_items = 64;
+static constexpr size_t unit_words = 65536;
+
+//
+// tar_walker -
+//    Walks a shared subtree depth first, each directory before what
+//    is in it, handing out units of the items met along the way.
+//    list gives the children of a directory.
+//
+
+class tar_walker {
+   private:
+      struct frame {
+         string path;
+         vector<tar_entry> entries;
+         size_t next {0};
+      };
+      function<vector<tar_entry> (const file_base_ptr&)> list;
+      vector<frame> frames;
+      tar_item pending;
+      bool has_pending {false};
+      size_t piece_from {0};
+      void enter (const string& path, const file_base_ptr& dir);
+      void add (tar_unit& unit, size_t& words);
+   public:
+      tar_walker (function<vector<tar_entry> (const file_base_ptr&)>
+                  list, const string& name, inode_t type,
+                  const file_base_ptr& contents);
+      unit_ptr next_unit();
+};
+
+/**
+ * Starts a walk at the exported node
+ * @param list     gives the children of a directory
+ * @param name     the node's name in the archive, or "" for the root,
+ *                 which has no entry of its own
+ * @param type     the node's type
+ * @param contents the node's shared contents
+ */
+tar_walker::tar_walker (
+      function<vector<tar_entry> (const file_base_ptr&)> list,
+      const string& name, inode_t type,
+      const file_base_ptr& contents): list (list) {
+   if (name.empty()) {
+      enter ("", contents);
+      return;
+   }
+   pending.path = type == DIR_INODE ? name + "/" : name;
+   pending.type = type;
+   pending.contents = contents;
+   has_pending = true;
+}
+
+void tar_walker::enter (const string& path, const file_base_ptr& dir) {
+   frames.emplace_back();
+   frames.back().path = path;
+   frames.back().entries = list (dir);
+}
+
+/**
+ * Adds the pending entry to a unit, or as much of it as fits, and
+ * moves on into a directory
+ * @param unit  the unit being filled
+ * @param words how many words the unit holds so far
+ */
+void tar_walker::add (tar_unit& unit, size_t& words) {
+   if (pending.type == DIR_INODE) {
+      unit.items.push_back (pending);
+      enter (pending.path, pending.contents);
+      has_pending = false;
+      return;
+   }
+   size_t count = plain_file_ptr_of (pending.contents)
+                  ->readfile().size();
+   tar_item item = pending;
+   item.from = piece_from;
+   item.to = min (count, piece_from + (unit_words - words));
+   item.first = piece_from == 0;
+   item.last = item.to == count;
+   words += item.to - item.from;
+   unit.items.push_back (item);
+   if (item.last) {
+      has_pending = false;
+      piece_from = 0;
+   } else {
+      piece_from = item.to;
+   }
+}
+
+/**
+ * Fills the next unit
+ * @return the unit, or nullptr once the walk is done
+ */
+unit_ptr tar_walker::next_unit() {
+   unit_ptr unit = make_shared<tar_unit>();
+   size_t words = 0;
+   while (unit->items.size() < unit_items and words < unit_words) {
+      if (not has_pending) {
+         auto finished = [] (const frame& dir) {
+            return dir.next == dir.entries.size();
+         };
+         while (not frames.empty() and finished (frames.back())) {
+            frames.pop_back();
+         }
+         if (frames.empty()) break;
+         frame& top = frames.back();
+         tar_entry& entry = top.entries[top.next++];
+         pending.path = top.path + entry.name;
+         if (entry.type == DIR_INODE) pending.path += "/";
+         pending.type = entry.type;
+         pending.contents = move (entry.contents);
+         has_pending = true;
+      }
+      add (*unit, words);
+   }
+   return unit->items.empty() ? nullptr : unit;
+}
+
+vector<tar_entry> tar_export::entries_of (const file_base_ptr& dir,
+                                          tree_lock& tree_mutex) {
+   vector<tar_entry> entries;
+   directory_ptr contents = spill_store::read (directory_ptr_of (dir));
+   lock_guard<tree_lock> guard (tree_mutex);
+   entries.reserve (contents->dirents.size());
+   for (const auto& dirent: contents->dirents) {
+      entries.push_back ({dirent.first, dirent.second->get_type(),
+                          dirent.second->get_contents()});
+   }
+   return entries;
+}
+
+// RENDERING ==========================================================
+
+/**
+ * Renders the items of a unit into its text
+ * @param unit  the unit
+ * @param mtime the time the entries are stamped with
+ */
+static void render (tar_unit& unit, time_t mtime) {
+   for (const tar_item& item: unit.items) {
+      if (item.type == DIR_INODE) {
+         put_header (unit.text, item.path, '5', 0, mtime);
+         continue;
+      }
+      const wordvec& words =
+            plain_file_ptr_of (item.contents)->readfile();
+      uint64_t size = item.first or item.last ? text_size (words) : 0;
+      if (item.first) put_header (unit.text, item.path, '0', size,
+                                  mtime);
+      put_words (unit.text, words, item.from, item.to);
+      if (item.last) put_padding (unit.text, size);
+   }
+   unit.items.clear();
+}
+
+//
+// export_session -
+//    The units handed to the workers and not yet written out, in
+//    archive order, guarded by lock.  At most window of them are in
+//    flight.  However the export ends, the workers are stopped and
+//    joined.
+//
+
+class export_session {
+   private:
+      static constexpr size_t window = 16;
+      mutex lock;
+      condition_variable work_ready;
+      condition_variable unit_done;
+      deque<unit_ptr> to_render;
+      deque<unit_ptr> in_flight;
+      bool stopping {false};
+      time_t mtime;
+      vector<thread> workers;
+      void work();
+   public:
+      explicit export_session (time_t mtime);
+      ~export_session();
+      void write (tar_walker& walker, ostream& out);
+};
+
+export_session::export_session (time_t mtime): mtime (mtime) {
+   unsigned count = max (1u, thread::hardware_concurrency());
+   DEBUGF ('x', "starting " << count << " workers");
+   for (unsigned i = 0; i < count; ++i) {
+      workers.emplace_back (&export_session::work, this);
+   }
+}
+
+export_session::~export_session() {
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+      work_ready.notify_all();
+   }
+   for (thread& worker: workers) worker.join();
+}
+
+void export_session::work() {
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      work_ready.wait (guard, [this] {
+         return stopping or not to_render.empty();
+      });
+      if (stopping) return;
+      unit_ptr unit = to_render.front();
+      to_render.pop_front();
+      guard.unlock();
+      render (*unit, mtime);
+      guard.lock();
+      unit->done = true;
+      unit_done.notify_all();
+   }
+}
+
+/**
+ * Walks the subtree, keeping the window full, and writes each unit
+ * out once it and those before it are rendered
+ * @param walker the walk
+ * @param out    the archive
+ */
+void export_session::write (tar_walker& walker, ostream& out) {
+   unique_lock<mutex> guard (lock);
+   bool walked = false;
+   for (;;) {
+      while (not walked and in_flight.size() < window) {
+         guard.unlock();
+         unit_ptr unit = walker.next_unit();
+         guard.lock();
+         if (unit == nullptr) {
+            walked = true;
+            break;
+         }
+         in_flight.push_back (unit);
+         to_render.push_back (unit);
+         work_ready.notify_one();
+      }
+      if (in_flight.empty()) break;
+      unit_done.wait (guard, [this] {
+         return in_flight.front()->done;
+      });
+      unit_ptr unit = in_flight.front();
+      in_flight.pop_front();
+      guard.unlock();
+      out.write (unit->text.data(), unit->text.size());
+      guard.lock();
+   }
+}
+
+// EXPORTING ==========================================================
+
+/**
+ * Writes a subtree out entry by entry as the storage walks it, with
+ * the tree lock held
+ * @param out   the archive
+ * @param store the tree
+ * @param node  the exported node
+ * @param name  its name in the archive, or "" for the root
+ * @param mtime the time the entries are stamped with
+ */
+static void write_live (ostream& out, storage& store, node_id node,
+                        const string& name, time_t mtime) {
+   string text;
+   auto put = [&] (const string& path, node_id file) {
+      text.clear();
+      if (file == no_node) {
+         put_header (text, path, '5', 0, mtime);
+      } else {
+         const wordvec& words = store.read (file);
+         uint64_t size = text_size (words);
+         put_header (text, path, '0', size, mtime);
+         put_words (text, words, 0, words.size());
+         put_padding (text, size);
+      }
+      out.write (text.data(), text.size());
+   };
+   if (store.stat (node).type == PLAIN_INODE) {
+      put (name, node);
+      return;
+   }
+   unordered_map<node_id, string> dirs {{node, ""}};
+   if (not name.empty()) {
+      dirs[node] = name + "/";
+      put (dirs[node], no_node);
+   }
+   store.iterate (node, [&] (const node_info& info) {
+      string path = dirs[store.parent (info.node)] + *info.name;
+      if (info.type == DIR_INODE) {
+         path += "/";
+         put (path, no_node);
+         dirs[info.node] = path;
+      } else {
+         put (path, info.node);
+      }
+   });
+}
+
+void tar_export::run (inode_state& state, node_id node,
+                      const string& host) {
+   ofstream out (host, ios::binary | ios::trunc);
+   if (not out) throw yshell_exn (host + ": " + strerror (errno));
+
+   storage& store = state.get_storage();
+   node_id root = store.root();
+   string name = node == root ? "" : store.name (node);
+   inode_t type = store.stat (node).type;
+   time_t mtime = time (nullptr);
+   file_base_ptr shared = store.share (node);
+   if (shared == nullptr) {
+      write_live (out, store, node, name, mtime);
+   } else {
+      // the subtree is shared, so the shell may go on meanwhile,
+      // leaving the contents as they are until the workers are done
+      cold_hold hold;
+      stage_lock::yield yield;
+      tree_lock& tree_mutex = state.get_mutex();
+      tar_walker walker ([&tree_mutex] (const file_base_ptr& dir) {
+         return entries_of (dir, tree_mutex);
+      }, name, type, shared);
+      export_session session (mtime);
+      session.write (walker, out);
+   }
+
+   string end (2 * block_size, '\0');
+   out.write (end.data(), end.size());
+   out.flush();
+   if (not out) throw yshell_exn (host + ": cannot write");
+}
+
@@ -0,0 +1,51 @@
+// $Id$
+
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "inode.h"
+#include "util.h"
+
+//
+// tar_export -
+//    A static class which writes a subtree out to a host file as a
+//    POSIX tar archive: a directory entry for each directory and a
+//    file entry for each plain file, holding its words as cat prints
+//    them.  Names too long for a ustar header, and files too big for
+//    one, get a pax extended header.  Where the storage can share
+//    the subtree copy on write, as a checkpoint does, the shell's
+//    thread walks it without the tree lock and hands the entries, in
+//    the order they go in the archive, to a pool of workers which
+//    render them side by side.  The rendered pieces are written out
+//    in order as they come back, and only a small window of them is
+//    ever in flight, so memory stays bounded however big the tree.
+//    Any other storage is walked and written out there and then,
+//    with the tree lock held.
+// run -
+//    Exports node, named by its own name in the archive, or for the
+//    root, everything under it.  Called with the tree lock held.
+//    Throws a yshell_exn if the host file cannot be written.
+// entries_of -
+//    The children of a directory of a shared subtree, read under the
+//    tree lock, or from the spill file if it is spilled (see
+//    checkpoint::write_contents).
+//
+
+struct tar_entry;
+
+class tar_export {
+   private:
+      static vector<tar_entry> entries_of (const file_base_ptr& dir,
+                                           tree_lock& tree_mutex);
+   public:
+      static void run (inode_state& state, node_id node,
+                       const string& host);
+};
+
+#endif
+
@@ -0,0 +1,79 @@
+// $Id$
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "gather.h"
+#include "util.h"
+
+// where cout writes to standard output, as it was before anything,
+// such as a --parallel run, pointed it elsewhere
+static streambuf* const console = cout.rdbuf();
+
+gather_writer::gather_writer (ostream& init_out):
+   out (init_out), direct (&out == &cout and cout.rdbuf() == console)
+{
+   if (direct) stage.reset (new char[stage_size]);
+}
+
+void gather_writer::add (const char* run, size_t size) {
+   if (direct and size < copy_limit) {
+      if (staged + size > stage_size) flush();
+      memcpy (stage.get() + staged, run, size);
+      staged += size;
+   }else if (direct) {
+      write_out (run, size);
+   }else {
+      out.write (run, size);
+   }
+}
+
+void gather_writer::flush() {
+   if (staged > 0) write_out (nullptr, 0);
+}
+
+/**
+ * Writes what is staged and then a run with one writev, or more if
+ * the system takes only part of them at a time.  Whatever cout holds
+ * goes first, since it was written before.
+ * @param run  the run, or nullptr
+ * @param size its length
+ */
+void gather_writer::write_out (const char* run, size_t size) {
+   cout.flush();
+   iovec parts[] {
+      {stage.get(), staged},
+      {const_cast<char*> (run), size},
+   };
+   iovec* next = parts;
+   int count = 2;
+   while (count > 0) {
+      ssize_t wrote = writev (STDOUT_FILENO, next, count);
+      if (wrote < 0) {
+         if (errno == EINTR) continue;
+         staged = 0;
+         throw yshell_exn (string ("standard output: ")
+                           + strerror (errno));
+      }
+      DEBUGF ('o', "writev " << count << " parts, " << wrote
+                   << " bytes");
+      size_t done = wrote;
+      while (count > 0 and done >= next->iov_len) {
+         done -= next->iov_len;
+         ++next;
+         --count;
+      }
+      if (count > 0) {
+         next->iov_base = static_cast<char*> (next->iov_base) + done;
+         next->iov_len -= done;
+      }
+   }
+   staged = 0;
+}
+
@@ -0,0 +1,46 @@
+// $Id$
+
+#ifndef __GATHER_H__
+#define __GATHER_H__
+
+#include <iostream>
+#include <memory>
+using namespace std;
+
+//
+// gather_writer -
+//    Writes runs of bytes, such as the words of a file, to an ostream
+//    without joining them into one string first.  When the stream is
+//    cout and cout still goes to standard output, runs go out through
+//    writev: short runs are copied into a staging block, and a run of
+//    copy_limit bytes or more is written from where it is, in the
+//    same writev as whatever was staged ahead of it.  Many small files
+//    then take one system call a block, and no long word is copied.
+//    Any other stream, such as a pipe, a redirection or the output of
+//    a job, gets the runs through its own write.
+// add -
+//    Writes a run, which only has to stay good until add returns.
+// flush -
+//    Writes out what is staged.  It must be called before anything
+//    else writes to the stream, and at the end.
+//
+
+class gather_writer {
+   private:
+      static constexpr size_t stage_size = 64 * 1024;
+      static constexpr size_t copy_limit = 512;
+      gather_writer (const gather_writer&) = delete;
+      gather_writer& operator= (const gather_writer&) = delete;
+      ostream& out;
+      bool direct;
+      unique_ptr<char[]> stage;
+      size_t staged {0};
+      void write_out (const char* run, size_t size);
+   public:
+      explicit gather_writer (ostream& init_out);
+      void add (const char* run, size_t size);
+      void flush();
+};
+
+#endif
+
@@ -0,0 +1,325 @@
+// $Id$
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "import.h"
+
+//
+// host_listing -
+//    A host directory and the node it is imported as.  Once a worker
+//    has read it, done is set and entries holds what is in it, by
+//    name, or error says why it could not be read.
+//
+
+struct host_listing {
+   node_id dir;
+   string path;
+   bool done {false};
+   string error;
+   vector<pair<string, inode_t>> entries;
+};
+using listing_ptr = shared_ptr<host_listing>;
+
+//
+// host_file -
+//    A host file and the node it is imported as.  Once a worker has
+//    read it, words holds what is in it, or error says why it could
+//    not be read.  bytes is its size, counted against memory_cap
+//    until the words are written in.
+//
+
+struct host_file {
+   node_id file;
+   string path;
+   size_t bytes {0};
+   string error;
+   wordvec words;
+};
+
+static string host_error (const string& path) {
+   return path + ": " + strerror (errno);
+}
+
+//
+// import_session -
+//    The work shared between the calling thread and the workers,
+//    all of it guarded by lock.  Workers read directories before
+//    files, so that there is always more work to hand out.  The
+//    listings are taken back in the order they were handed out,
+//    and files as they come.  The words read but not yet written in
+//    are kept to memory_cap bytes, unless one file alone is bigger.
+//    However the import ends, the workers are stopped and joined.
+//
+
+class import_session {
+   private:
+      static constexpr size_t memory_cap = 64 << 20;
+      mutex lock;
+      condition_variable work_ready;
+      condition_variable result_ready;
+      condition_variable room_ready;
+      deque<listing_ptr> dirs_to_read;
+      deque<host_file> files_to_read;
+      deque<listing_ptr> listings;
+      deque<host_file> files_read;
+      size_t files_out {0};
+      size_t bytes_held {0};
+      bool stopping {false};
+      vector<thread> workers;
+      void work();
+      void read_dir (host_listing& listing);
+      void read_file (host_file& file, unique_lock<mutex>& guard);
+      void make_entries (inode_state& state,
+                         const host_listing& listing);
+   public:
+      import_session();
+      ~import_session();
+      void add_dir (node_id dir, const string& path);
+      void add_file (node_id file, const string& path);
+      void finish (inode_state& state);
+};
+
+import_session::import_session() {
+   // reads block on the disk, so there are more workers than cores
+   unsigned count = max (4u, thread::hardware_concurrency());
+   DEBUGF ('x', "starting " << count << " workers");
+   for (unsigned i = 0; i < count; ++i) {
+      workers.emplace_back (&import_session::work, this);
+   }
+}
+
+import_session::~import_session() {
+   {
+      lock_guard<mutex> guard (lock);
+      stopping = true;
+      work_ready.notify_all();
+      room_ready.notify_all();
+   }
+   for (thread& worker: workers) worker.join();
+}
+
+void import_session::add_dir (node_id dir, const string& path) {
+   listing_ptr listing = make_shared<host_listing>();
+   listing->dir = dir;
+   listing->path = path;
+   lock_guard<mutex> guard (lock);
+   dirs_to_read.push_back (listing);
+   listings.push_back (listing);
+   work_ready.notify_one();
+}
+
+void import_session::add_file (node_id file, const string& path) {
+   lock_guard<mutex> guard (lock);
+   files_to_read.emplace_back();
+   files_to_read.back().file = file;
+   files_to_read.back().path = path;
+   ++files_out;
+   work_ready.notify_one();
+}
+
+void import_session::work() {
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      work_ready.wait (guard, [this] {
+         return stopping or not dirs_to_read.empty()
+                or not files_to_read.empty();
+      });
+      if (stopping) return;
+      if (not dirs_to_read.empty()) {
+         listing_ptr listing = dirs_to_read.front();
+         dirs_to_read.pop_front();
+         guard.unlock();
+         read_dir (*listing);
+         guard.lock();
+         listing->done = true;
+      } else {
+         host_file file = move (files_to_read.front());
+         files_to_read.pop_front();
+         guard.unlock();
+         read_file (file, guard);
+         guard.lock();
+         files_read.push_back (move (file));
+      }
+      result_ready.notify_one();
+   }
+}
+
+/**
+ * Lists a host directory, leaving out "." and "..", and anything
+ * that is neither a directory nor a regular file
+ * @param listing the directory, whose entries are filled in
+ */
+void import_session::read_dir (host_listing& listing) {
+   DIR* host_dir = opendir (listing.path.c_str());
+   if (host_dir == nullptr) {
+      listing.error = host_error (listing.path);
+      return;
+   }
+   while (dirent* entry = readdir (host_dir)) {
+      string name = entry->d_name;
+      if (name == "." or name == "..") continue;
+      unsigned char type = entry->d_type;
+      if (type == DT_UNKNOWN) {
+         struct stat info;
+         string path = listing.path + "/" + name;
+         if (lstat (path.c_str(), &info) != 0) continue;
+         if (S_ISDIR (info.st_mode)) type = DT_DIR;
+         else if (S_ISREG (info.st_mode)) type = DT_REG;
+      }
+      if (type == DT_DIR) {
+         listing.entries.emplace_back (name, DIR_INODE);
+      } else if (type == DT_REG) {
+         listing.entries.emplace_back (name, PLAIN_INODE);
+      }
+   }
+   closedir (host_dir);
+   sort (listing.entries.begin(), listing.entries.end());
+}
+
+/**
+ * Maps a host file into memory and splits it into words, once there
+ * is room for it under memory_cap
+ * @param file  the file, whose words are filled in
+ * @param guard the session's lock, not held, taken only to wait for
+ *              room
+ */
+void import_session::read_file (host_file& file,
+                                unique_lock<mutex>& guard) {
+   int fd = open (file.path.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      file.error = host_error (file.path);
+      return;
+   }
+   struct stat info;
+   if (fstat (fd, &info) != 0) {
+      file.error = host_error (file.path);
+      close (fd);
+      return;
+   }
+   size_t size = info.st_size;
+   guard.lock();
+   room_ready.wait (guard, [this, size] {
+      return stopping or bytes_held == 0
+             or bytes_held + size <= memory_cap;
+   });
+   bytes_held += size;
+   file.bytes = size;
+   guard.unlock();
+   if (size > 0) {
+      void* text = mmap (nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (text == MAP_FAILED) {
+         file.error = host_error (file.path);
+      } else {
+         madvise (text, size, MADV_SEQUENTIAL);
+         const char* begin = static_cast<const char*> (text);
+         split_text (begin, begin + size, file.words);
+         munmap (text, size);
+      }
+   }
+   close (fd);
+   DEBUGF ('x', file.path << ": " << file.words.size() << " words");
+}
+
+/**
+ * Makes the nodes for what is in a host directory, and hands them to
+ * the workers to read
+ * @param state   the inode state, whose tree lock is held
+ * @param listing the directory, read
+ */
+void import_session::make_entries (inode_state& state,
+                                   const host_listing& listing) {
+   if (not listing.error.empty()) {
+      cout << "error: import: " << listing.error << endl;
+      return;
+   }
+   for (const auto& entry: listing.entries) {
+      node_id node = state.make (listing.dir, entry.first,
+                                 entry.second);
+      if (node == no_node) continue;
+      string path = listing.path + "/" + entry.first;
+      if (entry.second == DIR_INODE) add_dir (node, path);
+      else add_file (node, path);
+   }
+}
+
+/**
+ * Takes back what the workers read and puts it in the tree, until
+ * there is nothing left to read
+ * @param state the inode state, whose tree lock is held
+ */
+void import_session::finish (inode_state& state) {
+   unique_lock<mutex> guard (lock);
+   for (;;) {
+      result_ready.wait (guard, [this] {
+         return not files_read.empty()
+                or (listings.empty() and files_out == 0)
+                or (not listings.empty() and listings.front()->done);
+      });
+      if (not files_read.empty()) {
+         host_file file = move (files_read.front());
+         files_read.pop_front();
+         guard.unlock();
+         if (not file.error.empty()) {
+            cout << "error: import: " << file.error << endl;
+         } else if (not file.words.empty()) {
+            state.write (file.file, file.words);
+         }
+         file.words = wordvec();
+         guard.lock();
+         --files_out;
+         bytes_held -= file.bytes;
+         room_ready.notify_all();
+      } else if (not listings.empty()) {
+         listing_ptr listing = listings.front();
+         listings.pop_front();
+         guard.unlock();
+         make_entries (state, *listing);
+         guard.lock();
+      } else {
+         break;
+      }
+   }
+}
+
+/**
+ * Imports a host directory tree, or one file
+ * @param state the inode state, whose tree lock is held
+ * @param host  the host path
+ * @param dir   the directory to import it into
+ * @param name  the name to import it as, which is not taken
+ */
+void host_import::run (inode_state& state, const string& host,
+                       node_id dir, const string& name) {
+   struct stat info;
+   if (stat (host.c_str(), &info) != 0) {
+      throw yshell_exn (host_error (host));
+   }
+   if (not S_ISDIR (info.st_mode) and not S_ISREG (info.st_mode)) {
+      throw yshell_exn (host + ": not a directory or regular file");
+   }
+   bool is_dir = S_ISDIR (info.st_mode);
+   import_session session;
+   node_id top = state.make (dir, name,
+                             is_dir ? DIR_INODE : PLAIN_INODE);
+   if (is_dir) session.add_dir (top, host);
+   else session.add_file (top, host);
+   session.finish (state);
+}
+
@@ -0,0 +1,39 @@
+// $Id$
+
+#ifndef __IMPORT_H__
+#define __IMPORT_H__
+
+#include <string>
+using namespace std;
+
+#include "inode.h"
+#include "util.h"
+
+//
+// host_import -
+//    A static class which copies a directory tree of the host into
+//    the simulated one in bulk, without going through command lines
+//    or resolving a path for each node.  A pool of workers lists the
+//    host directories and maps each file into memory to split it
+//    into words; the calling thread, which holds the tree lock, makes
+//    the nodes under parents it already knows and writes the words
+//    in.  Directories are made in the order they are found, a level
+//    at a time and by name within each, so the same host tree gets
+//    the same inode numbers however the workers happen to run.
+//    Anything but directories and regular files, such as symbolic
+//    links, is left out.
+// run -
+//    Imports host, a directory or a regular file, as name in dir.
+//    Errors reading the host, such as a file that cannot be opened,
+//    are reported and the rest goes on.  Throws a yshell_exn if host
+//    cannot be read at all.
+//
+
+class host_import {
+   public:
+      static void run (inode_state& state, const string& host,
+                       node_id dir, const string& name);
+};
+
+#endif
+
@@ -1,6 +1,10 @@
 // $Id: inode.cpp,v 1.12 2014-07-03 13:29:57-07 - - $
 
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <mutex>
+#include <set>
 #include <stdexcept>
 #include <vector>
 
@@ -8,12 +12,15 @@ using namespace std;
 
 #include "debug.h"
 #include "inode.h"
-
-int inode::next_inode_nr {1};
+#include "inode_table.h"
+#include "journal.h"
+#include "pipe.h"
+#include "spill.h"
+#include "storage.h"
 
 inode::inode(inode_t init_type, string init_name,
    inode_ptr init_parent):
-   inode_nr (next_inode_nr++), type (init_type), name (init_name),
+   inode_nr (inode_table::allocate (this)), type (init_type), name (init_name),
    parent (init_parent)
 {
    switch (type) {
@@ -27,7 +34,51 @@ inode::inode(inode_t init_type, string init_name,
    DEBUGF ('i', "inode " << inode_nr << ", type = " << type);
 }
 
-int inode::get_inode_nr() const {
+inode::inode(inode_t init_type, string init_name,
+   inode_ptr init_parent, file_base_ptr init_contents):
+   inode_nr (inode_table::allocate (this)), type (init_type),
+   contents (init_contents), name (init_name), parent (init_parent)
+{
+   DEBUGF ('i', "inode " << inode_nr << ", type = " << type
+          << ", shared contents");
+}
+
+//
+// Carriers only hold on to the contents of a frozen directory entry
+// for the borrowers of that directory.  They are never reachable from
+// a path, so they do not use up an inode number.
+//
+inode::inode(carrier_tag, inode_t init_type, const string& init_name,
+   file_base_ptr init_contents):
+   inode_nr (0), type (init_type), contents (init_contents),
+   name (init_name)
+{
+}
+
+//
+// An inode read back in from the spill file takes the number it had
+// before it was spilled, which was set aside for it.
+//
+inode::inode(spilled_tag, uint64_t init_nr, inode_t init_type,
+   const string& init_name, inode_ptr init_parent):
+   inode_nr (inode_table::enter (this, init_nr)), type (init_type),
+   name (init_name), parent (init_parent)
+{
+   switch (type) {
+      case PLAIN_INODE:
+           contents = make_shared<plain_file>();
+           break;
+      case DIR_INODE:
+           contents = make_shared<directory>();
+           break;
+   }
+}
+
+inode::~inode() {
+   if (inode_nr != 0) inode_table::release (inode_nr);
+}
+
+uint64_t inode::get_inode_nr() const {
    DEBUGF ('i', "inode = " << inode_nr);
    return inode_nr;
 }
@@ -45,142 +96,278 @@ directory_ptr directory_ptr_of (file_base_ptr ptr) {
 }
 
 
+//
+// A word can be packed if it can be told apart from the space which
+// follows it.
+//
+static bool packable (const string& word) {
+   return not word.empty() and word.find (' ') == string::npos;
+}
+
+/**
+ * Counts the words of a packed file by the spaces between them
+ * @return the number of words
+ */
+size_t plain_file::packed_count() const {
+   if (packed.empty()) return 0;
+   return count (packed.begin(), packed.end(), ' ') + 1;
+}
+
 size_t plain_file::size() const {
-   size_t size = this->data.size();
+   size_t size = blob == nullptr ? packed_count() : blob->size();
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
 
 int plain_file::get_size(){
-   return data.size();
+   return size();
 }
 
 
 const wordvec& plain_file::readfile() const {
-   // wordvec ret_data;
-   //
-   // for(auto it = this->data.begin(); it != this->data.end(); it++){
-   //    ret.push_back
-   // }
-   //
-   // DEBUGF ('i', ret_data);
-   return this->data;
+   static const wordvec empty;
+   if (blob != nullptr) return blob->read();
+   if (packed.empty()) return empty;
+   static thread_local wordvec unpacked;
+   unpacked.resize (packed_count());
+   size_t start = 0;
+   for (string& word: unpacked) {
+      size_t stop = min (packed.find (' ', start), packed.size());
+      word.assign (packed, start, stop - start);
+      start = stop + 1;
+   }
+   return unpacked;
 }
 
 void plain_file::writefile (const wordvec& words) {
-   this->data = words;
+   if (words.size() <= packed_words
+       and all_of (words.begin(), words.end(), packable)) {
+      string joined;
+      for (const string& word: words) {
+         if (not joined.empty()) joined += ' ';
+         joined += word;
+      }
+      packed.swap (joined);
+      this->blob.reset();
+   }else {
+      this->blob = content_table::intern (words);
+      string().swap (packed);
+   }
    DEBUGF ('i', words);
 }
 
+void plain_file::append (const string& word) {
+   if (blob == nullptr and packed_count() < packed_words
+       and packable (word)) {
+      if (not packed.empty()) packed += ' ';
+      packed += word;
+      return;
+   }
+   if (blob == nullptr) {
+      this->blob = content_table::make_private (readfile());
+      string().swap (packed);
+   }else if (blob->is_interned() or blob.use_count() > 1) {
+      this->blob = content_table::make_private (*blob);
+   }
+   this->blob->append (word);
+}
+
+directory::directory (const directory& that):
+   file_base (that), dirents (that.dirents), dot (that.dot),
+   dotdot (that.dotdot), used (that.used.load()) {
+}
+
 size_t directory::size() const {
-   size_t size {0};
+   size_t size = this->dirents.size() + 2;
    DEBUGF ('i', "size = " << size);
    return size;
 }
 
 void directory::remove (const string& filename) {
    DEBUGF ('i', filename);
+   if (filename == "." or filename == ".."){
+      throw yshell_exn (filename + ": cannot be removed");
+   }
+   const inode_ptr* entry = this->dirents.find(filename);
+   if (entry == nullptr){
+      throw yshell_exn (filename + ": no such file or directory");
+   }
+   inode_ptr child = *entry;
+   if (child->type == DIR_INODE
+       and directory_ptr_of(child->contents)->size() > 2){
+      throw yshell_exn (filename + ": directory not empty");
+   }
+   this->dirents.erase(filename);
+   child->release();
+}
+
+void directory::remove_recursive (const string& filename) {
+   DEBUGF ('i', filename);
+   if (filename == "." or filename == ".."){
+      throw yshell_exn (filename + ": cannot be removed");
+   }
+   const inode_ptr* entry = this->dirents.find(filename);
+   if (entry == nullptr){
+      throw yshell_exn (filename + ": no such file or directory");
+   }
+   inode_ptr child = *entry;
+   this->dirents.erase(filename);
+   child->release();
 }
 
 /**
- * the constructor for inode_state. Initializes the root and current
- * working directory to be appropriate for the start.
+ * Drops every entry, including "." and ".."
  */
-inode_state::inode_state() {
-   // set the root to be a pointer to the inode, and make the inode
-   // for it
-   this->root = make_shared<inode>(DIR_INODE, "", this->root);
-
-   // setting the root's parent manually because we couldn't set it in
-   // the constructor
-   this->root->parent = this->root;
+void directory::clear () {
+   this->dirents.clear();
+   this->dot = nullptr;
+   this->dotdot = nullptr;
+}
 
-   inode_ptr root_parent = this->root;
+// DIRENT TABLE =======================================================
 
-   // get reference to the directory contents
-   directory_ptr root_dir_ptr;
-   root_dir_ptr = directory_ptr_of(this->root->get_contents());
+dirent_table::dirent_table (const dirent_table& that):
+   small (that.small),
+   big (that.big == nullptr ? nullptr : new entry_map (*that.big))
+{
+}
 
-   // set the dot and dotdot entries
-   root_dir_ptr->set_dot(this->root);
-   root_dir_ptr->set_dotdot(this->root);
+dirent_table& dirent_table::operator= (const dirent_table& that) {
+   if (this != &that) {
+      small = that.small;
+      big.reset (that.big == nullptr ? nullptr
+                                     : new entry_map (*that.big));
+   }
+   return *this;
+}
 
-   // set the current working directory to be the root
-   this->cwd = root;
+size_t dirent_table::size() const {
+   return big == nullptr ? small.size() : big->size();
+}
 
-   DEBUGF ('i', "root = " << root << ", cwd = " << cwd
-          << ", prompt = \"" << prompt << "\"");
+dirent_table::iterator dirent_table::begin() {
+   if (big != nullptr) return big->begin();
+   return small.data();
 }
 
-ostream& operator<< (ostream& out, const inode_state& state) {
-   out << "inode_state: root = " << state.root
-       << ", cwd = " << state.cwd;
-   return out;
+dirent_table::iterator dirent_table::end() {
+   if (big != nullptr) return big->end();
+   return small.data() + small.size();
 }
-// ====================================================================
-// MY FUNCTIONS =======================================================
-// ====================================================================
 
-// HELPER =============================================================
+dirent_table::const_iterator dirent_table::begin() const {
+   if (big != nullptr) return big->cbegin();
+   return small.data();
+}
 
+dirent_table::const_iterator dirent_table::end() const {
+   if (big != nullptr) return big->cend();
+   return small.data() + small.size();
+}
 
-// INODE ==============================================================
+static bool name_before (const dirent_table::entry& entry,
+                         const string& name) {
+   return entry.first < name;
+}
 
-void inode::list(){
-   if (this->type != DIR_INODE){
-      return;
+dirent_table::const_iterator
+dirent_table::upper_bound (const string& name) const {
+   if (big != nullptr) {
+      return entry_map::const_iterator (big->upper_bound (name));
    }
-   directory_ptr dir_ptr = directory_ptr_of(this->get_contents());
-   dir_ptr->list();
-}
-
-string digit_length(int number){
-   string ret;
-   if (number < 10){
-      ret = "     ";
-   } else if (number < 100){
-      ret = "    ";
-   } else if (number < 1000){
-      ret = "   ";
-   } else if (number < 10000){
-      ret = "  ";
-   } else if (number < 100000){
-      ret = " ";
-   } else{
-      ret = "";
+   auto after = lower_bound (small.begin(), small.end(), name,
+                             name_before);
+   if (after != small.end() and after->first == name) ++after;
+   return small.data() + (after - small.begin());
+}
+
+const inode_ptr* dirent_table::find (const string& name) const {
+   if (big != nullptr) {
+      auto found = big->find (name);
+      return found == big->end() ? nullptr : &found->second;
    }
-   ret = to_string(number) + ret;
-   return ret;
+   auto found = lower_bound (small.begin(), small.end(), name,
+                             name_before);
+   if (found == small.end() or found->first != name) return nullptr;
+   return &found->second;
 }
 
-string inode::list_info(){
-   string ret;
+/**
+ * Adds a child in name order, moving the entries into a map if the
+ * vector is full
+ */
+bool dirent_table::insert (const string& name,
+                           const inode_ptr& child) {
+   if (big != nullptr) return big->emplace (name, child).second;
+   auto at = lower_bound (small.begin(), small.end(), name,
+                          name_before);
+   if (at != small.end() and at->first == name) return false;
+   if (small.size() < small_size) {
+      small.emplace (at, name, child);
+      return true;
+   }
+   big.reset (new entry_map (make_move_iterator (small.begin()),
+                             make_move_iterator (small.end())));
+   vector<entry>().swap (small);
+   big->emplace (name, child);
+   return true;
+}
 
-   string number = digit_length(this->inode_nr);
-   string size = digit_length(this->get_size());
+/**
+ * Removes a child, moving the entries back into a vector once the
+ * map is down to half of what the vector holds
+ */
+bool dirent_table::erase (const string& name) {
+   if (big == nullptr) {
+      auto at = lower_bound (small.begin(), small.end(), name,
+                             name_before);
+      if (at == small.end() or at->first != name) return false;
+      small.erase (at);
+      return true;
+   }
+   if (big->erase (name) == 0) return false;
+   if (big->size() <= small_size / 2) {
+      small.reserve (big->size());
+      for (auto& moved: *big) {
+         small.emplace_back (moved.first, move (moved.second));
+      }
+      big.reset();
+   }
+   return true;
+}
 
-   ret = number + "   " + size + " " + this->name;
-   return ret;
+void dirent_table::clear() {
+   vector<entry>().swap (small);
+   big.reset();
+}
 
+/**
+ * A map node, as libstdc++ lays it out, is three pointers and a
+ * color ahead of its key and value.
+ */
+size_t dirent_table::heap_bytes() const {
+   static constexpr size_t map_node = 4 * sizeof (void*)
+                                    + sizeof (entry_map::value_type);
+   if (big == nullptr) return small.capacity() * sizeof (entry);
+   return sizeof (entry_map) + big->size() * map_node;
 }
 
-void inode::list_recursive(){
-   if (this->type != DIR_INODE){
-      return;
-   }
-   directory_ptr dir_ptr = directory_ptr_of(this->get_contents());
+// ====================================================================
+// MY FUNCTIONS =======================================================
+// ====================================================================
 
-   dir_ptr->list_recursive();
-   dir_ptr->list();
-}
+// HELPER =============================================================
+
+
+// INODE ==============================================================
 
 bool inode::has_child(string dir_name){
    if (this->type != DIR_INODE){
       throw runtime_error("inode is not a directory");
    }
 
-   directory_ptr this_dir = directory_ptr_of(this->get_contents());
+   directory_ptr this_dir = this->read_dir();
 
    // quick reference to make line length smaller
    wordvec dirents = this_dir->get_dir_list();
@@ -198,7 +385,7 @@ bool inode::has_child(string dir_name){
 
 int inode::get_size(){
    if (this->type == DIR_INODE){
-      directory_ptr this_dir = directory_ptr_of(this->get_contents());
+      directory_ptr this_dir = this->read_dir();
       return this_dir->get_dir_list().size() - 2;
    }
 
@@ -216,17 +403,28 @@ inode_ptr inode::get_child(string dir_name){
       throw runtime_error("inode is not a directory");
    }
 
-   directory_ptr this_dir = directory_ptr_of (this->get_contents());
+   directory_ptr this_dir = this->read_dir();
    return this_dir->get_child(dir_name);
 }
 
+/**
+ * Looks up a child of this directory in a single map search
+ * @param  child_name the name of the child
+ * @return            the child, or nullptr if this is not a directory
+ *                    or has no such child
+ */
+inode_ptr inode::lookup(const string& child_name){
+   if (this->type != DIR_INODE) return nullptr;
+   return this->read_dir()->lookup(child_name);
+}
+
 /**
  * A function that call's directory's mkdir function, as well as makes
  * sure the derectory does not already exist
  * @param directory_name [description]
  */
 inode_ptr inode::make_directory(string& directory_name){
-   directory_ptr dir_ptr = directory_ptr_of(this->get_contents());
+   directory_ptr dir_ptr = this->write_dir();
 
    DEBUGF ('h', "inode's make directory called");
 
@@ -240,10 +438,48 @@ inode_ptr inode::make_directory(string& directory_name){
 }
 
 inode_ptr inode::make_plain(string& file_name){
-   directory_ptr this_dir = directory_ptr_of(this->get_contents());
+   directory_ptr this_dir = this->write_dir();
    return this_dir->mkfile (file_name);
 }
 
+/**
+ * Replaces the contents of a plain file, copying it first if the
+ * contents are still shared with a copy made by cp.
+ * @param words the new contents of the file
+ */
+void inode::writefile(const wordvec& words){
+   this->write_plain()->writefile(words);
+}
+
+/**
+ * Removes a child of this directory, and with recursive everything
+ * under it too
+ * @param child_name the name of the child
+ * @param recursive  true to remove a directory that is not empty
+ */
+void inode::remove_child(const string& child_name, bool recursive){
+   directory_ptr this_dir = this->write_dir();
+   if (recursive) this_dir->remove_recursive(child_name);
+             else this_dir->remove(child_name);
+}
+
+/**
+ * Makes a copy of source under this directory. The copy shares its
+ * contents with the source, so this takes constant time no matter how
+ * big the subtree is.
+ * @param child_name the name of the copy
+ * @param source     the inode to copy
+ * @return           the inode of the copy
+ */
+inode_ptr inode::copy_child(const string& child_name, inode_ptr source){
+   // hold on to the shared contents before preparing the write, so
+   // that copying a directory into its own subtree detaches the
+   // source first and the copy does not end up containing itself
+   file_base_ptr shared = source->contents;
+   directory_ptr this_dir = this->write_dir();
+   return this_dir->copy_in(child_name, source->type, shared);
+}
+
 /**
  * A function that gets the directory list of this inode
  * @param  dir an inode pointer that is of type DIR_INODE
@@ -255,45 +491,141 @@ wordvec inode::get_dir_list(){
       throw runtime_error("this inode is not a directory");
    }
 
-   directory_ptr dir_ptr = directory_ptr_of(this->get_contents());
+   directory_ptr dir_ptr = this->read_dir();
 
    return dir_ptr->get_dir_list();
 }
 
 
+// COPY ON WRITE ======================================================
+
 /**
- * Return the contents of the inode
- * @return file_base_ptr refering to the contents
+ * Makes sure a directory is not borrowed from the tree it was copied
+ * from. A borrowed directory's "." does not point back at this inode,
+ * so give this inode its own directory whose children share the
+ * contents of the borrowed ones. A stub left by spilling has no ".",
+ * and is read back in instead.
  */
-file_base_ptr inode::get_contents(){
-   return this->contents;
+void inode::materialize(){
+   if (this->type != DIR_INODE) return;
+   directory_ptr dir_ptr = directory_ptr_of(this->contents);
+   if (dir_ptr->owned_by(this)) return;
+   if (spill_store::is_stub(*dir_ptr)){
+      this->contents = spill_store::fault_in(shared_from_this(),
+                                             *dir_ptr);
+      return;
+   }
+   DEBUGF ('w', "materializing inode " << this->inode_nr);
+   this->contents = dir_ptr->materialize(shared_from_this());
 }
 
 /**
- * returns the string of the whole path. Works by taking the inode and
- * getting parents the whole way up.
- * @param state the current inode state. Necessary to get the root.
- * @return a string of the current directory.
+ * Makes sure nothing else can see a mutation of this inode's
+ * contents. Shared directories keep their child inodes on this side
+ * and leave carriers behind for the other side, so that cwd and
+ * other references into this tree stay valid.
  */
-string inode::get_path(inode_state& state){
-   // make the reference for the first iterations
-   inode_ptr curr_dir = this->get_parent();
+void inode::detach(){
+   // check before taking any copies of the pointer ourselves
+   bool shared = this->contents.use_count() > 1;
+   if (this->type == PLAIN_INODE){
+      if (!shared) return;
+      DEBUGF ('w', "copying file inode " << this->inode_nr);
+      this->contents =
+         make_shared<plain_file>(*plain_file_ptr_of(this->contents));
+      return;
+   }
+   directory_ptr dir_ptr = directory_ptr_of(this->contents);
+   if (!dir_ptr->owned_by(this)){
+      this->materialize();
+   } else if (shared) {
+      DEBUGF ('w', "copying directory inode " << this->inode_nr);
+      this->contents = make_shared<directory>(*dir_ptr);
+      dir_ptr->freeze();
+   }
+}
 
-   // string to return
-   string ret = this->get_name();
+/**
+ * Breaks up a removed subtree so that its "." and ".." entries do not
+ * keep it alive. Directories still shared with a copy are left alone.
+ */
+void inode::release(){
+   if (this->type != DIR_INODE or this->contents.use_count() > 1){
+      return;
+   }
+   directory_ptr dir_ptr = directory_ptr_of(this->contents);
+   if (not dir_ptr->owned_by(this)) return;
+   for (const string& child_name: dir_ptr->get_dir_list()){
+      if (child_name == "." or child_name == "..") continue;
+      dir_ptr->lookup(child_name)->release();
+   }
+   dir_ptr->clear();
+}
 
-   // itarating loop. Note: could be a for loop, decided that looked
-   // ugly though
-   while(curr_dir != state.get_root()){
-      DEBUGF('i', "parent is not root! continueing");
-      ret = curr_dir->get_name() + "/" + ret;
-      DEBUGF('i', "curent path:" + ret);
-      curr_dir = curr_dir->get_parent();
+/**
+ * Gets the directory of this inode for reading, materializing it if
+ * it is borrowed from a copy.
+ * @return directory_ptr to the contents
+ */
+directory_ptr inode::read_dir(){
+   if (this->type != DIR_INODE){
+      throw runtime_error("inode is not a directory");
+   }
+   if (not directory_ptr_of(this->contents)->owned_by(this)){
+      // making it our own changes the tree, which a reader sharing
+      // the tree lock may only do holding it alone
+      stage_lock::exclusive alone;
+      this->materialize();
+   }
+   directory_ptr dir_ptr = directory_ptr_of(this->contents);
+   dir_ptr->used.store(spill_store::now(), memory_order_relaxed);
+   return dir_ptr;
+}
+
+/**
+ * Gets the directory of this inode for writing. Every directory from
+ * the root down to this one is detached from its copies first,
+ * otherwise a copy could still see the mutation through a shared
+ * ancestor.
+ * @return directory_ptr to the contents, owned only by this inode
+ */
+directory_ptr inode::write_dir(){
+   if (this->type != DIR_INODE){
+      throw runtime_error("inode is not a directory");
+   }
+   vector<inode*> ancestors;
+   for (inode* curr = this; ; curr = curr->parent.get()){
+      ancestors.push_back(curr);
+      if (curr->parent == nullptr or curr->parent.get() == curr) break;
+   }
+   for (auto it = ancestors.rbegin(); it != ancestors.rend(); ++it){
+      (*it)->detach();
+   }
+   directory_ptr dir_ptr = directory_ptr_of(this->contents);
+   dir_ptr->used.store(spill_store::now(), memory_order_relaxed);
+   return dir_ptr;
+}
+
+/**
+ * Gets the contents of this plain file for writing, detaching it and
+ * its directories from any copies first.
+ * @return plain_file_ptr owned only by this inode
+ */
+plain_file_ptr inode::write_plain(){
+   if (this->type != PLAIN_INODE){
+      throw runtime_error("inode is not a plain file");
    }
-   // adding the last / for the root directory
-   ret = "/" + ret;
-   DEBUGF('i', "Path is: " + ret);
-   return ret; // finally returning it
+   this->parent->write_dir();
+   this->detach();
+   return plain_file_ptr_of(this->contents);
+}
+
+/**
+ * Return the contents of the inode
+ * @return file_base_ptr refering to the contents
+ */
+file_base_ptr inode::get_contents(){
+   return this->contents;
 }
 
 /**
@@ -325,6 +657,52 @@ inode_t inode::get_type(){
 }
 
 // INODE state ========================================================
+
+// the current directory of a thread with one of its own, and every
+// one of those, so that removing a directory can move them all
+static thread_local node_id* thread_cwd = nullptr;
+static mutex guards_lock;
+static set<node_id*> guarded_cwds;
+
+cwd_guard::cwd_guard(node_id init_cwd):
+   cwd (init_cwd), saved (thread_cwd) {
+   thread_cwd = &this->cwd;
+   lock_guard<mutex> lock (guards_lock);
+   guarded_cwds.insert(&this->cwd);
+}
+
+cwd_guard::~cwd_guard(){
+   thread_cwd = this->saved;
+   lock_guard<mutex> lock (guards_lock);
+   guarded_cwds.erase(&this->cwd);
+}
+
+/**
+ * the constructor for inode_state. Starts out in the root of an empty
+ * tree of inodes.
+ */
+inode_state::inode_state(): inode_state(make_storage("tree")) {
+}
+
+/**
+ * Starts out in the root of the given tree
+ * @param init_store the backend holding the tree
+ */
+inode_state::inode_state(unique_ptr<storage> init_store):
+   store (move(init_store)), cwd (store->root())
+{
+   DEBUGF ('i', "root = " << cwd << ", prompt = \"" << prompt << "\"");
+}
+
+inode_state::~inode_state() {
+}
+
+ostream& operator<< (ostream& out, const inode_state& state) {
+   out << "inode_state: root = " << state.store->root()
+       << ", cwd = " << state.cwd;
+   return out;
+}
+
 /**
  * setter for the shell's prompt
  * @param new_prompt a string that will be the new prompt. Will
@@ -332,16 +710,20 @@ inode_t inode::get_type(){
  */
 void inode_state::set_prompt(const string& new_prompt){
    this->prompt = new_prompt;
+   if (journal::enabled()){
+      journal::record(JOURNAL_PROMPT, wordvec(), wordvec {new_prompt});
+   }
 };
 
 /**
  * setter for the cwd. Effectively makes cwd public.
  * I'm lazy and decided working code is better than good code that's
  * late.
- * @param new_cwd inode pointer to the new cwd
+ * @param new_cwd the directory to make the cwd
  */
-void inode_state::set_cwd(inode_ptr new_cwd){
-   this->cwd = new_cwd;
+void inode_state::set_cwd(node_id new_cwd){
+   if (thread_cwd != nullptr) *thread_cwd = new_cwd;
+                         else this->cwd = new_cwd;
 }
 
 /**
@@ -356,20 +738,20 @@ const string& inode_state::get_prompt(){
 /**
  * Getter for the current working direcotry of the shell through the
  * state
- * @return inode pointer to the current working direcotry
+ * @return the node of the current working direcotry
  */
-inode_ptr inode_state::get_cwd(){
+node_id inode_state::get_cwd(){
    DEBUGF ('i', "getting current working directory");
-   return this->cwd;
+   return thread_cwd != nullptr ? *thread_cwd : this->cwd;
 }
 
 /**
  * returns the root of the file structure
- * @return an inode pointer pointing at the root of the file structure
+ * @return the node of the root of the file structure
  */
-inode_ptr inode_state::get_root(){
+node_id inode_state::get_root(){
    DEBUGF ('i', "getting root");
-   return this->root;
+   return this->store->root();
 }
 
 /**
@@ -377,12 +759,151 @@ inode_ptr inode_state::get_root(){
  * there just in case.
  * @return a string that represents the current path
  */
-string inode_state::get_path(){
+const string& inode_state::get_path(){
    DEBUGF('i', "getting path from cwd");
-   return this->cwd->get_path(*this);
+   return this->get_path(this->get_cwd());
+}
+
+/**
+ * returns the string of the whole path. Works by taking the node and
+ * getting parents the whole way up. The path is written into a
+ * buffer of the calling thread's, which keeps its room from one call
+ * to the next, so once it has held a path that long it allocates
+ * nothing.
+ * @param node the node to find the path of
+ * @return a string of the path from the root, good until the thread
+ *         next asks for a path
+ */
+const string& inode_state::get_path(node_id node){
+   static thread_local string path;
+   static thread_local vector<const string*> names;
+   node_id root = this->store->root();
+   names.clear();
+   for (; node != root; node = this->store->parent(node)){
+      names.push_back(&this->store->name(node));
+   }
+   path.clear();
+   if (names.empty()) path += '/';
+   for (auto name = names.rbegin(); name != names.rend(); ++name){
+      path += '/';
+      path += **name;
+   }
+   DEBUGF('i', "Path is: " << path);
+   return path;
+}
+
+/**
+ * The lock that commands running on other threads, such as the stages
+ * of a pipeline, hold while they work on the tree.
+ * @return the lock guarding the tree
+ */
+tree_lock& inode_state::get_mutex(){
+   return this->tree_mutex;
+}
+
+/**
+ * The backend holding the tree. Changes to the tree should go through
+ * the mutations below, so that they are journaled.
+ * @return the storage
+ */
+storage& inode_state::get_storage(){
+   return *this->store;
+}
+
+/**
+ * Makes an empty directory or plain file
+ * @param  dir  the directory to make it in
+ * @param  name its name
+ * @param  type DIR_INODE or PLAIN_INODE
+ * @return      the new node, or no_node if the name is taken
+ */
+node_id inode_state::make(node_id dir, const string& name,
+                          inode_t type){
+   node_id node = this->store->create(dir, name, type);
+   if (node != no_node and journal::enabled()){
+      journal_op op = type == DIR_INODE ? JOURNAL_MKDIR : JOURNAL_MKFILE;
+      journal::record(op, *this->store, dir, name);
+   }
+   return node;
 }
 
+/**
+ * Replaces the contents of a plain file
+ * @param file  the file
+ * @param words the new contents
+ */
+void inode_state::write(node_id file, const wordvec& words){
+   this->store->write(file, words);
+   if (journal::enabled()){
+      journal::record(JOURNAL_WRITE, *this->store, file, "", words);
+   }
+}
+
+/**
+ * Adds words to the end of a plain file
+ * @param file  the file
+ * @param words the words to add
+ */
+void inode_state::append(node_id file, const wordvec& words){
+   this->store->append(file, words);
+   if (journal::enabled()){
+      journal::record(JOURNAL_APPEND, *this->store, file, "", words);
+   }
+}
 
+/**
+ * Removes a child of a directory. If the cwd is the child or under
+ * it, the cwd moves up to the directory, since the node it names is
+ * gone and may be handed out again. That goes for the shell's cwd
+ * and for that of every thread with its own, such as a job's, which
+ * are all waiting on the tree lock this thread holds alone.
+ * @param dir       the directory
+ * @param name      the name of the child
+ * @param recursive true to remove a directory that is not empty
+ */
+void inode_state::remove(node_id dir, const string& name,
+                         bool recursive){
+   node_id child = this->store->lookup(dir, name);
+   node_id root = this->store->root();
+   auto under_child = [this, child, root](node_id node){
+      for (; child != no_node; node = this->store->parent(node)){
+         if (node == child) return true;
+         if (node == root) break;
+      }
+      return false;
+   };
+   bool cwd_removed = under_child(this->cwd);
+   vector<node_id*> moved;
+   {
+      lock_guard<mutex> lock (guards_lock);
+      for (node_id* guarded: guarded_cwds){
+         if (under_child(*guarded)) moved.push_back(guarded);
+      }
+   }
+   this->store->remove(dir, name, recursive);
+   if (cwd_removed) this->cwd = dir;
+   for (node_id* guarded: moved) *guarded = dir;
+   if (journal::enabled()){
+      journal::record(recursive ? JOURNAL_RMR : JOURNAL_REMOVE,
+                      *this->store, dir, name);
+   }
+}
+
+/**
+ * Makes a copy of a node and everything under it
+ * @param source the node to copy
+ * @param dir    the directory to put the copy in
+ * @param name   the name of the copy
+ */
+void inode_state::copy(node_id source, node_id dir, const string& name){
+   this->store->copy(source, dir, name);
+   if (journal::enabled()){
+      wordvec dest = journal::path_of(*this->store, dir);
+      dest.push_back(name);
+      journal::record(JOURNAL_COPY,
+                      journal::path_of(*this->store, source), dest);
+   }
+}
 
 // directory ==========================================================
 
@@ -398,13 +919,11 @@ inode_ptr directory::mkdir(const string& name){
    // check if it has the name
    if (this->has(name)){
       cout << "Error: " + name + " already exists" << endl;
-      auto pair = this->dirents.find(name);
-      inode_ptr ret = pair->second;
-      return ret;
+      return this->lookup(name);
    }
 
    // get a reference for the parent
-   inode_ptr dir_parent = dirents.at(".");
+   inode_ptr dir_parent = this->dot;
 
    // make the new directory
    inode_ptr new_dir = make_shared<inode>(DIR_INODE, name, dir_parent);
@@ -418,7 +937,7 @@ inode_ptr directory::mkdir(const string& name){
    // set the ".." entry
    new_directory->set_dotdot(dir_parent);
 
-   this->dirents[name] = new_dir;
+   this->dirents.insert(name, new_dir);
 
    // return the finished directory
    return new_dir; // TODO ask why star!
@@ -429,22 +948,85 @@ inode_ptr directory::mkfile(const string& name){
    DEBUGF('f', "Making file: " + name);
    if (this->has(name)){
       cout << "Error: " + name + " already exists" << endl;
-      auto pair = this->dirents.find(name);
-      inode_ptr ret = pair->second;
-      return ret;
+      return this->lookup(name);
    }
 
    // get a reference for the parent
-   inode_ptr dir_parent = dirents.at(".");
+   inode_ptr dir_parent = this->dot;
 
    // make the new directory
    inode_ptr file = make_shared<inode>(PLAIN_INODE, name, dir_parent);
 
-   this->dirents[name] = file;
+   this->dirents.insert(name, file);
 
    return file;
 
 }
+/**
+ * Makes a new entry sharing the contents of another inode.
+ * @param  name   the name of the new entry
+ * @param  type   the type of the inode being copied
+ * @param  shared the contents to share
+ * @return        the new inode
+ */
+inode_ptr directory::copy_in(const string& name, inode_t type,
+   file_base_ptr shared){
+
+   DEBUGF('w', "Copying into: " + name);
+   if (this->has(name)){
+      cout << "Error: " + name + " already exists" << endl;
+      return this->lookup(name);
+   }
+
+   inode_ptr dir_parent = this->dot;
+   inode_ptr copy = make_shared<inode>(type, name, dir_parent, shared);
+   this->dirents.insert(name, copy);
+   return copy;
+}
+
+/**
+ * Builds a private copy of a borrowed directory for its new owner.
+ * Only this level is copied; the children share their contents with
+ * the children of the original.
+ * @param  owner the inode that will own the new directory
+ * @return       the new directory
+ */
+directory_ptr directory::materialize(inode_ptr owner) const {
+   directory_ptr copy = make_shared<directory>();
+   copy->set_dot(owner);
+   copy->set_dotdot(owner->parent);
+   for (const auto& entry: this->dirents){
+      const inode_ptr& child = entry.second;
+      copy->dirents.insert(entry.first, make_shared<inode>(
+         child->type, entry.first, owner, child->contents));
+   }
+   return copy;
+}
+
+/**
+ * Swaps the children of a directory that is being handed over to its
+ * borrowers for carriers. The carriers share the children's contents,
+ * so the live children see them as shared and copy before they
+ * mutate.
+ */
+void directory::freeze(){
+   for (auto entry: this->dirents){
+      const inode_ptr& child = entry.second;
+      entry.second = inode_ptr (new inode (inode::carrier_tag(),
+         child->type, entry.first, child->contents));
+   }
+}
+
+/**
+ * Checks whether this directory belongs to the given inode, rather
+ * than being borrowed from the tree it was copied out of.
+ * @param  owner the inode holding this directory
+ * @return       true if "." is the owner
+ */
+bool directory::owned_by(const inode* owner) const {
+   return this->dot.get() == owner;
+}
+
 /**
  * Setter for the parent of a director
  * @param parent inode pointer pointing to the parent of the directory
@@ -452,13 +1034,7 @@ inode_ptr directory::mkfile(const string& name){
  * will point at itself.
  */
 void directory::set_dotdot(inode_ptr parent){
-   if (dirents.find("..") == dirents.end()){
-      // directory .. does not exist, insert it;
-      pair<string, inode_ptr> dot_dot = std::make_pair("..", parent);
-      dirents.insert(dot_dot);
-   }else {
-      dirents.at("..") =  parent;
-   }
+   this->dotdot = parent;
 }
 
 /**
@@ -466,14 +1042,7 @@ void directory::set_dotdot(inode_ptr parent){
  * @param dot inode pointer that refers to directory
  */
 void directory::set_dot(inode_ptr dot){
-   if (dirents.find(".") == dirents.end()){
-      // if directory . does not exist, insert it in
-      pair<string, inode_ptr> new_dot = std::make_pair(".", dot);
-      dirents.insert(new_dot);
-   }
-   else {
-      dirents.at(".") = dot;
-   }
+   this->dot = dot;
 }
 
 /**
@@ -483,13 +1052,9 @@ void directory::set_dot(inode_ptr dot){
  * @return      true if it is exists, false otherwise.
  */
 bool directory::has(const string& name){
-   wordvec dirlist = this->get_dir_list();
    DEBUGF('h', "name: " + name);
-   DEBUGF('h', "dirlist: " << dirlist);
-
-   auto it = find(dirlist.begin(), dirlist.end(), name);
 
-   if (it == dirlist.end()){
+   if (this->lookup(name) == nullptr){
       DEBUGF('h', "not found!");
       // there is no directory of that name.
       return false;
@@ -505,7 +1070,7 @@ bool directory::has(const string& name){
  * @return wordvec with all the names of the children of the directory
  */
 wordvec directory::get_dir_list(){
-   wordvec ret;
+   wordvec ret {".", ".."};
    for (auto it = this->dirents.begin(); it != this->dirents.end();
       it++ ){
       string curr_dir = it->first;
@@ -516,46 +1081,22 @@ wordvec directory::get_dir_list(){
 }
 
 inode_ptr directory::get_child(string child_name){
-   if (this->dirents.find(".") == this->dirents.end()){
+   if (this->dot == nullptr){
       throw runtime_error ("error: directory not found");
    }
-   return dirents[child_name];
+   return this->lookup(child_name);
 }
 
-void directory::list(){
-   auto entries = this->dirents;
-
-   inode_ptr this_dir = this->dirents["."];
-   inode_ptr this_parent = this->dirents[".."];
-
-   cout << "inode_nr size   filename" << endl;
-
-   for (auto it = entries.begin(); it != entries.end(); it++){
-      // check if the current directory is the . or ..
-      inode_ptr curr_dir = it->second;
-      if (curr_dir == this_dir || curr_dir == this_parent){
-         continue;
-      }
-      cout << curr_dir->list_info() << endl;
-   }
-}
-
-void directory::list_recursive(){
-
-   auto entries = this->dirents;
-
-   inode_ptr this_dir = this->dirents["."];
-   inode_ptr this_parent = this->dirents[".."];
-
-   for (auto it = entries.begin(); it != entries.end(); it++){
-
-      inode_ptr curr_dir = it->second;
-
-      if (curr_dir == this_dir || curr_dir == this_parent){
-         continue;
-      }
-      it->second->list_recursive();
-   }
+/**
+ * Looks up a child without adding an entry for it if it is missing
+ * @param  child_name the name to look up
+ * @return            the child, or nullptr if there is none
+ */
+inode_ptr directory::lookup(const string& child_name) const {
+   if (child_name == ".") return this->dot;
+   if (child_name == "..") return this->dotdot;
+   const inode_ptr* child = this->dirents.find(child_name);
+   return child == nullptr ? nullptr : *child;
 }
 
 // PLAIN FILE ==========================================================
@@ -3,13 +3,20 @@
 #ifndef __INODE_H__
 #define __INODE_H__
 
+#include <atomic>
+#include <cstdint>
 #include <exception>
 #include <iostream>
 #include <memory>
 #include <map>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 using namespace std;
 
+#include "content.h"
+#include "tree_lock.h"
 #include "util.h"
 
 //
@@ -27,53 +34,122 @@ using file_base_ptr = shared_ptr<file_base>;
 using plain_file_ptr = shared_ptr<plain_file>;
 using directory_ptr = shared_ptr<directory>;
 
+//
+// node_id -
+//    A node of the tree, as the storage backend holding it names it
+//    (see storage.h).  no_node is a null node.
+//
+
+class storage;
+using node_id = uint64_t;
+static constexpr node_id no_node = UINT64_MAX;
+
 //
 // inode_state -
 //    A small convenient class to maintain the state of the simulated
-//    process:  the root (/), the current directory (.), and the
-//    prompt.
+//    process:  the tree, kept by a storage backend, the current
+//    directory (.), and the prompt.
+// ctor -
+//    Starts with an empty tree in the given backend, or by default
+//    in inodes (see inode_storage).
+// make, write, append, remove, copy -
+//    Change the tree through the backend and record the change in
+//    the journal, if it is open.  make returns no_node if the name
+//    is already taken.  Removing the current directory, or a
+//    directory above it, leaves the shell in the directory it was
+//    removed from.
+// get_cwd, set_cwd -
+//    The current directory of the calling thread, which is the
+//    shell's unless a cwd_guard gives the thread one of its own.
+// get_path -
+//    The path of the cwd, or of a node, from the root.  What it
+//    returns is good until the calling thread next asks for a path.
+// get_mutex -
+//    The lock on the tree (see tree_lock.h).
 //
 
 class inode_state {
-   friend class inode;
    friend ostream& operator<< (ostream& out, const inode_state&);
    private:
       inode_state (const inode_state&) = delete; // copy ctor
       inode_state& operator= (const inode_state&) = delete; // op=
-      inode_ptr root {nullptr};
-      inode_ptr cwd {nullptr};
+      unique_ptr<storage> store;
+      node_id cwd {no_node};
       string prompt {"% "};
+      tree_lock tree_mutex;
    public:
       // Constructor
       inode_state();
+      explicit inode_state(unique_ptr<storage> init_store);
+      ~inode_state();
 
       // MY FUNCTIONS =================================================
 
-      bool has_child();
-
       // setters
       void set_prompt(const string& new_prompt);
-      void set_cwd(inode_ptr new_cwd);
+      void set_cwd(node_id new_cwd);
 
       // getters
       const string& get_prompt();
-      inode_ptr get_cwd();
-      inode_ptr get_root();
-      string get_path();
+      node_id get_cwd();
+      node_id get_root();
+      const string& get_path();
+      const string& get_path(node_id node);
+      tree_lock& get_mutex();
+      storage& get_storage();
+
+      // mutations
+      node_id make(node_id dir, const string& name, inode_t type);
+      void write(node_id file, const wordvec& words);
+      void append(node_id file, const wordvec& words);
+      void remove(node_id dir, const string& name, bool recursive);
+      void copy(node_id source, node_id dir, const string& name);
+};
 
-      wordvec get_dir_list(inode_ptr dir);
+//
+// cwd_guard -
+//    Gives the calling thread a current directory of its own,
+//    starting out as the given one, for as long as it is in scope.
+//    get_cwd and set_cwd use it in place of the shell's, so that a
+//    job, a line of a batch or a pipeline stage can cd without
+//    moving the shell.
+//
+
+class cwd_guard {
+   private:
+      node_id cwd;
+      node_id* saved;
+      cwd_guard (const cwd_guard&) = delete;
+      cwd_guard& operator= (const cwd_guard&) = delete;
+   public:
+      explicit cwd_guard (node_id init_cwd);
+      ~cwd_guard();
 };
 
 
-
+
 //
 // class inode -
 //
 // inode ctor -
 //    Create a new inode of the given type.
+// inode dtor -
+//    Gives the inode's number back to the inode_table.
 // get_inode_nr -
 //    Retrieves the serial number of the inode.  Inode numbers are
-//    allocated in sequence by small integer.
+//    allocated in sequence by 64 bit integer (see inode_table).
+// copy-on-write -
+//    Contents may be shared between several inodes (see cp).  A
+//    directory whose "." entry is not this inode is borrowed from
+//    the tree it was copied from, and is materialized one level at
+//    a time when its children are first looked at.  Before any
+//    mutation, write_dir and write_plain detach every shared node
+//    on the path from the root, so that the other side of the copy
+//    never sees the change.
+// spilling -
+//    A directory may be spilled to disk, leaving a stub in its place
+//    (see spill.h).  read_dir and detach read a stub back in before
+//    anything looks at or changes it, so only they need know.
 // size -
 //    Returns the size of an inode.  For a directory, this is the
 //    number of dirents.  For a text file, the number of characters
@@ -81,40 +157,58 @@ class inode_state {
 //    number of words.
 //
 
-class inode {
-   friend class inode_state;
+class inode: public enable_shared_from_this<inode> {
+   friend class directory;
+   friend class inode_storage;
+   friend class spill_store;
    private:
-      static int next_inode_nr;
-      int inode_nr;
+      uint64_t inode_nr;
       inode_t type;
       file_base_ptr contents;
       const string name;
       inode_ptr parent {nullptr};
+      struct carrier_tag {};
+      inode (carrier_tag, inode_t init_type, const string& init_name,
+         file_base_ptr init_contents);
+      struct spilled_tag {};
+      inode (spilled_tag, uint64_t init_nr, inode_t init_type,
+         const string& init_name, inode_ptr init_parent);
+      void materialize();
+      void detach();
+      void release();
    public:
       // constructor
       inode (inode_t init_type, string init_name,
          inode_ptr init_parent);
+      inode (inode_t init_type, string init_name,
+         inode_ptr init_parent, file_base_ptr init_contents);
+      ~inode();
 
       // getters
-      int get_inode_nr() const;
-      string get_path(inode_state& state);
+      uint64_t get_inode_nr() const;
       string get_name();
       inode_ptr get_parent();
       file_base_ptr get_contents();
       inode_t get_type();
       int get_size();
 
+      // copy-on-write
+      directory_ptr read_dir();
+      directory_ptr write_dir();
+      plain_file_ptr write_plain();
+
       // directory specific
       inode_ptr make_directory(string& directory_name);
+      inode_ptr copy_child(const string& child_name, inode_ptr source);
+      void remove_child(const string& child_name, bool recursive);
       wordvec get_dir_list();
       bool has_child(string dir_name);
       inode_ptr get_child(string dir_name);
-      void list_recursive();
-      void list();
-      string list_info();
+      inode_ptr lookup(const string& child_name);
 
       // plain file specific
       inode_ptr make_plain(string& file_name);
+      void writefile(const wordvec& words);
 };
 
 //
@@ -143,38 +237,148 @@ class file_base {
 //
 // class plain_file -
 //
-// Used to hold data.
+// Used to hold data.  A file of at most packed_words words, none of
+// them empty or holding a space, keeps them in one string with a
+// space between each; any other file keeps its words in a blob (see
+// content.h).
 // synthesized default ctor -
-//    Default vector<string> is a an empty vector.
+//    An empty file, packed.
 // readfile -
-//    Returns a copy of the contents of the wordvec in the file.
-//    Throws an yshell_exn for a directory.
+//    Returns the words of the file.  Those of a packed file are
+//    unpacked into a buffer of the calling thread's, good until that
+//    thread next reads a packed file.
 // writefile -
-//    Replaces the contents of a file with new contents.
-//    Throws an yshell_exn for a directory.
+//    Replaces the contents of a file with new contents.  A file too
+//    big to pack shares the blob of every other file written with
+//    the same words; writing it again moves only this file to
+//    another blob.
+// append -
+//    Adds one word to the end of the file in amortized constant
+//    time per byte appended.  The first append to a shared blob
+//    copies it into one of the file's own.
 //
 
 class plain_file: public file_base {
+   friend class inode_storage;
    private:
-      wordvec data;
+      static constexpr size_t packed_words = 8;
+      string packed;
+      blob_ptr blob;
+      size_t packed_count() const;
    public:
       size_t size() const override;
       const wordvec& readfile() const;
       void writefile (const wordvec& newdata);
+      void append (const string& word);
       int get_size();
 };
 
+//
+// class dirent_table -
+//
+// The entries of a directory other than "." and "..", in name order.
+// Up to small_size of them are kept in a sorted vector, searched by
+// bisection; one more moves them into a map, and they move back once
+// removals leave half that.  Iterating yields entries with first, the
+// name, and second, the child, as for a map.
+// find -
+//    The child with a name, or nullptr.
+// insert -
+//    Adds a child, or returns false if the name is taken.
+// erase -
+//    Removes a child, or returns false if there is none.
+// upper_bound -
+//    The first entry whose name comes after the given one.
+// heap_bytes -
+//    What the entries take on the heap, not counting their names.
+//
+
+class dirent_table {
+   public:
+      using entry = pair<string, inode_ptr>;
+      using entry_map = map<string, inode_ptr>;
+      template <typename small_t, typename big_t, typename child_t>
+      class basic_iterator;
+      using iterator = basic_iterator<entry*, entry_map::iterator,
+                                      inode_ptr>;
+      using const_iterator = basic_iterator<const entry*,
+         entry_map::const_iterator, const inode_ptr>;
+   private:
+      static constexpr size_t small_size = 8;
+      vector<entry> small;
+      unique_ptr<entry_map> big;
+   public:
+      dirent_table() = default;
+      dirent_table (const dirent_table&);
+      dirent_table& operator= (const dirent_table&);
+      size_t size() const;
+      iterator begin();
+      iterator end();
+      const_iterator begin() const;
+      const_iterator end() const;
+      const_iterator upper_bound (const string& name) const;
+      const inode_ptr* find (const string& name) const;
+      bool insert (const string& name, const inode_ptr& child);
+      bool erase (const string& name);
+      void clear();
+      size_t heap_bytes() const;
+};
+
+template <typename small_t, typename big_t, typename child_t>
+class dirent_table::basic_iterator {
+   private:
+      small_t small;
+      big_t big;
+      bool in_map;
+   public:
+      struct reference {
+         const string& first;
+         child_t& second;
+      };
+      struct pointer {
+         reference ref;
+         const reference* operator-> () const { return &ref; }
+      };
+      basic_iterator (small_t at): small (at), in_map (false) {}
+      basic_iterator (big_t at): small(), big (at), in_map (true) {}
+      reference operator* () const {
+         if (in_map) return {big->first, big->second};
+         return {small->first, small->second};
+      }
+      pointer operator-> () const { return {**this}; }
+      basic_iterator& operator++ () {
+         if (in_map) ++big; else ++small;
+         return *this;
+      }
+      basic_iterator operator++ (int) {
+         basic_iterator was = *this;
+         ++*this;
+         return was;
+      }
+      bool operator== (const basic_iterator& that) const {
+         return in_map ? big == that.big : small == that.small;
+      }
+      bool operator!= (const basic_iterator& that) const {
+         return not (*this == that);
+      }
+};
+
 //
 // class directory -
 //
-// Used to map filenames onto inode pointers.
+// Used to map filenames onto inode pointers.  "." and ".." are kept
+// apart from the other entries, which are in a dirent_table.
 // default ctor -
-//    Creates a new map with keys "." and "..".
+//    Creates a directory with no entries and null "." and "..".
+// size -
+//    The number of entries, counting "." and "..".
 // remove -
 //    Removes the file or subdirectory from the current inode.
 //    Throws an yshell_exn if this is not a directory, the file
 //    does not exist, or the subdirectory is not empty.
 //    Here empty means the only entries are dot (.) and dotdot (..).
+// remove_recursive -
+//    Removes the file or subdirectory and everything below it.
 // mkdir -
 //    Creates a new directory under the current directory and
 //    immediately adds the directories dot (.) and dotdot (..) to it.
@@ -183,23 +387,54 @@ class plain_file: public file_base {
 // mkfile -
 //    Create a new empty text file with the given name.  Error if
 //    a dirent with that name exists.
+// copy_in -
+//    Create a new dirent which shares the given contents.  Nothing
+//    below it is copied until one side mutates it.
+// materialize -
+//    Builds a private directory for owner out of a borrowed one,
+//    with fresh child inodes sharing the children's contents.
+// freeze -
+//    Replaces the child inodes of a directory that is being left
+//    to its borrowers with carriers, so that the original tree can
+//    keep the live inodes and mutate them.
+// used -
+//    When the directory was last read or written, by spill_store's
+//    clock, so that the least recently used subtrees are spilled
+//    first (see spill.h).  Readers sharing the tree lock stamp it at
+//    once, so it is atomic, and copied by hand.
 
 class directory: public file_base {
+   friend class checkpoint;
+   friend class inode;
+   friend class inode_storage;
+   friend class spill_store;
+   friend class tar_export;
    private:
-      map<string,inode_ptr> dirents;
+      dirent_table dirents;
+      inode_ptr dot;
+      inode_ptr dotdot;
+      atomic<uint64_t> used {0};
    public:
+      directory() = default;
+      directory (const directory& that);
       size_t size() const override;
       void remove (const string& filename);
+      void remove_recursive (const string& filename);
+      void clear();
       inode_ptr mkdir (const string& dirname);
       inode_ptr mkfile (const string& filename);
+      inode_ptr copy_in (const string& name, inode_t type,
+                         file_base_ptr shared);
+      directory_ptr materialize (inode_ptr owner) const;
+      void freeze();
+      bool owned_by (const inode* owner) const;
       // my functions
       void set_dotdot(inode_ptr parent);
       void set_dot(inode_ptr dot);
       bool has(const string& name);
       wordvec get_dir_list();
       inode_ptr get_child(string child_name);
-      void list_recursive();
-      void list();
+      inode_ptr lookup(const string& child_name) const;
 };
 
 #endif
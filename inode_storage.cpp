@@ -0,0 +1,380 @@
+// $Id$
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+#include "cold.h"
+#include "debug.h"
+#include "inode_storage.h"
+#include "inode_table.h"
+#include "spill.h"
+
+/**
+ * Makes the root directory, whose "." and ".." are both itself
+ */
+inode_storage::inode_storage() {
+   root_inode = make_shared<inode> (DIR_INODE, "", nullptr);
+   // setting the root's parent manually because we couldn't set it in
+   // the constructor
+   root_inode->parent = root_inode;
+   directory_ptr root_dir = directory_ptr_of (root_inode->contents);
+   root_dir->set_dot (root_inode);
+   root_dir->set_dotdot (root_inode);
+}
+
+/**
+ * Breaks the cycles through "." and ".." so the tree is freed
+ */
+inode_storage::~inode_storage() {
+   root_inode->release();
+   root_inode->parent.reset();
+}
+
+/**
+ * Finds the inode a node_id names
+ * @param  node the inode number
+ * @return      the inode
+ */
+inode_ptr inode_storage::node_of (node_id node) {
+   inode_ptr found = inode_table::lookup (node);
+   if (found == nullptr) {
+      throw yshell_exn ("inode " + to_string (node)
+                        + ": no such inode");
+   }
+   return found;
+}
+
+inode_ptr inode_storage::dir_of (node_id node) {
+   inode_ptr dir = node_of (node);
+   if (dir->type != DIR_INODE) {
+      throw yshell_exn (dir->name + ": not a directory");
+   }
+   return dir;
+}
+
+/**
+ * Describes an inode without materializing it, since a borrowed
+ * directory has as many entries as the one it is borrowed from.  The
+ * contents are looked at through their raw pointer, the type saying
+ * what they are, so describing a node touches no reference counts.
+ * @param  node the inode
+ * @param  name its name, kept by the inode or its directory
+ * @return      what ls shows about it
+ */
+node_info inode_storage::info_of (const inode_ptr& node,
+                                  const string& name) {
+   node_info info;
+   info.node = node->inode_nr;
+   info.inode_nr = info.node;
+   info.type = node->type;
+   const file_base* contents = node->contents.get();
+   if (info.type == DIR_INODE) {
+      info.size = static_cast<const directory*> (contents)->size() - 2;
+   } else {
+      info.size = static_cast<const plain_file*> (contents)->size();
+   }
+   info.name = &name;
+   return info;
+}
+
+node_id inode_storage::root() {
+   return root_inode->inode_nr;
+}
+
+node_id inode_storage::parent (node_id node) {
+   return node_of (node)->parent->inode_nr;
+}
+
+const string& inode_storage::name (node_id node) {
+   return node_of (node)->name;
+}
+
+node_info inode_storage::stat (node_id node) {
+   inode_ptr found = node_of (node);
+   return info_of (found, found->name);
+}
+
+node_id inode_storage::find_number (uint64_t inode_nr) {
+   return inode_table::lookup (inode_nr) == nullptr ? no_node
+                                                    : inode_nr;
+}
+
+node_id inode_storage::lookup (node_id dir, const string& name) {
+   inode_ptr child = node_of (dir)->lookup (name);
+   return child == nullptr ? no_node : child->inode_nr;
+}
+
+node_id inode_storage::create (node_id dir, const string& name,
+                               inode_t type) {
+   inode_ptr parent = dir_of (dir);
+   if (name.empty() or parent->lookup (name) != nullptr) return no_node;
+   string new_name = name;
+   inode_ptr made = type == DIR_INODE
+                  ? parent->make_directory (new_name)
+                  : parent->make_plain (new_name);
+   return made->inode_nr;
+}
+
+void inode_storage::list (node_id dir, const visitor& visit) {
+   directory_ptr entries = dir_of (dir)->read_dir();
+   for (const auto& entry: entries->dirents) {
+      visit (info_of (entry.second, entry.first));
+   }
+}
+
+/**
+ * Seeks into the directory's entries, so a window costs the log of
+ * the size of the directory, plus what it skips and shows
+ */
+void inode_storage::list_range (node_id dir, const string& after,
+                                size_t skip, size_t count,
+                                const visitor& visit) {
+   directory_ptr entries = dir_of (dir)->read_dir();
+   const dirent_table& table = entries->dirents;
+   auto entry = after.empty() ? table.begin()
+                              : table.upper_bound (after);
+   for (; entry != table.end() and count > 0; ++entry) {
+      if (skip > 0) {
+         --skip;
+         continue;
+      }
+      --count;
+      visit (info_of (entry->second, entry->first));
+   }
+}
+
+const wordvec& inode_storage::read (node_id file) {
+   inode_ptr found = node_of (file);
+   if (found->type != PLAIN_INODE) {
+      throw yshell_exn (found->name + ": is a directory");
+   }
+   const plain_file& contents = *plain_file_ptr_of (found->contents);
+   if (contents.blob != nullptr) cold_store::touch (*contents.blob);
+   return contents.readfile();
+}
+
+/**
+ * Hands out a small file's packed words as the one run they already
+ * are, and a bigger file's words where they are, in its blob or in
+ * the vocabulary
+ */
+void inode_storage::gather (node_id file, const run_visitor& visit) {
+   inode_ptr found = node_of (file);
+   if (found->type != PLAIN_INODE) {
+      throw yshell_exn (found->name + ": is a directory");
+   }
+   const plain_file& contents = *plain_file_ptr_of (found->contents);
+   if (contents.blob == nullptr) {
+      if (not contents.packed.empty()) {
+         visit (contents.packed.data(), contents.packed.size());
+      }
+      return;
+   }
+   cold_store::touch (*contents.blob);
+   bool first = true;
+   contents.blob->each ([&] (const string& word) {
+      if (not first) visit (" ", 1);
+      visit (word.data(), word.size());
+      first = false;
+   });
+}
+
+/**
+ * Looks through a small file's packed words in one go, since a
+ * pattern without a space can only be found inside one of them,
+ * and leaves a bigger file to its blob
+ */
+bool inode_storage::search (node_id file, const string& pattern) {
+   inode_ptr found = node_of (file);
+   if (found->type != PLAIN_INODE) {
+      throw yshell_exn (found->name + ": is a directory");
+   }
+   const plain_file& contents = *plain_file_ptr_of (found->contents);
+   if (contents.blob != nullptr) {
+      cold_store::touch (*contents.blob);
+      return contents.blob->contains (pattern);
+   }
+   if (contents.packed.empty()) return false;
+   if (pattern.find (' ') != string::npos) return false;
+   return contents.packed.find (pattern) != string::npos;
+}
+
+void inode_storage::write (node_id file, const wordvec& words) {
+   inode_ptr found = node_of (file);
+   if (found->type != PLAIN_INODE) {
+      throw yshell_exn (found->name + ": is a directory");
+   }
+   found->writefile (words);
+}
+
+void inode_storage::append (node_id file, const wordvec& words) {
+   inode_ptr found = node_of (file);
+   if (found->type != PLAIN_INODE) {
+      throw yshell_exn (found->name + ": is a directory");
+   }
+   plain_file_ptr contents = found->write_plain();
+   for (const string& word: words) contents->append (word);
+}
+
+void inode_storage::remove (node_id dir, const string& name,
+                            bool recursive) {
+   dir_of (dir)->remove_child (name, recursive);
+}
+
+/**
+ * Copies by sharing the source's contents (see inode::copy_child)
+ */
+void inode_storage::copy (node_id source, node_id dir,
+                          const string& name) {
+   inode_ptr copied = node_of (source);
+   inode_ptr parent = dir_of (dir);
+   if (parent->lookup (name) != nullptr) {
+      throw yshell_exn (name + ": already exists");
+   }
+   parent->copy_child (name, copied);
+   DEBUGF ('w', "copied inode " << source << " to " << name);
+}
+
+file_base_ptr inode_storage::share (node_id node) {
+   return node_of (node)->contents;
+}
+
+
+/**
+ * Goes through every inode and every directory, plain file and
+ * content blob once, however many inodes share them, adding up what
+ * each takes as libstdc++ lays it out: make_shared puts a control
+ * block of a vtable pointer and two counts in front of each object.
+ * Names and words kept inside their strings take no heap bytes.
+ * The vocabulary, when on, counts whole, with words no file holds
+ * any more.  A spilled directory counts as its stub.
+ */
+memory_use inode_storage::memory() {
+   static constexpr size_t control_block = sizeof (void*)
+                                         + 2 * sizeof (int);
+   uint64_t inodes = 0, blocks = 0, dirs = 0, files = 0;
+   uint64_t entries = 0, inode_names = 0, entry_names = 0;
+   uint64_t packed = 0, blobs = 0, headers = 0, chars = 0, ids = 0;
+   uint64_t cold = 0;
+   unordered_set<const inode*> seen_inodes;
+   unordered_set<const file_base*> seen_contents;
+   unordered_set<const content_blob*> seen_blobs;
+   vector<const inode*> pending {root_inode.get()};
+   while (not pending.empty()) {
+      const inode* node = pending.back();
+      pending.pop_back();
+      if (not seen_inodes.insert (node).second) continue;
+      inodes += sizeof (inode);
+      blocks += control_block;
+      inode_names += heap_bytes (node->name);
+      const file_base* contents = node->contents.get();
+      if (not seen_contents.insert (contents).second) continue;
+      blocks += control_block;
+      if (node->type == PLAIN_INODE) {
+         files += sizeof (plain_file);
+         const plain_file* file =
+            static_cast<const plain_file*> (contents);
+         packed += heap_bytes (file->packed);
+         const content_blob* blob = file->blob.get();
+         if (blob == nullptr or not seen_blobs.insert (blob).second) {
+            continue;
+         }
+         blobs += control_block + sizeof (content_blob);
+         headers += blob->header_bytes();
+         chars += blob->char_bytes();
+         ids += blob->id_bytes();
+         cold += blob->cold_bytes();
+         continue;
+      }
+      dirs += sizeof (directory);
+      const directory* dir = static_cast<const directory*> (contents);
+      entries += dir->dirents.heap_bytes();
+      for (const auto& entry: dir->dirents) {
+         entry_names += heap_bytes (entry.first);
+         pending.push_back (entry.second.get());
+      }
+   }
+   memory_use use;
+   use.inodes = seen_inodes.size();
+   use.bytes = {
+      {"inode objects", inodes},
+      {"control blocks", blocks},
+      {"directory objects", dirs},
+      {"plain file objects", files},
+      {"dirent tables", entries},
+      {"names in inodes", inode_names},
+      {"names in dirents", entry_names},
+      {"packed words", packed},
+      {"content blobs", blobs},
+      {"word headers", headers},
+      {"word characters", chars},
+      {"word ids", ids},
+      {"compressed words", cold},
+      {"vocabulary", vocabulary::heap_bytes()},
+   };
+   return use;
+}
+
+/**
+ * Goes through every path, so that a directory borrowed by a copy
+ * counts its files again, and keeps a plain file's bytes once for
+ * its blob, or for a packed file, for its plain file object, which
+ * files share after cp.  A spilled directory is read back from the
+ * spill file, and kept until the end, so that its blobs, which
+ * files still in memory may share, are told apart.
+ */
+dedup_use inode_storage::dedup() {
+   dedup_use use;
+   unordered_map<const void*, uint64_t> kept;
+   vector<directory_ptr> read_back;
+   vector<const inode*> pending {root_inode.get()};
+   while (not pending.empty()) {
+      const inode* node = pending.back();
+      pending.pop_back();
+      const file_base* contents = node->contents.get();
+      if (node->type == DIR_INODE) {
+         const directory* dir =
+            static_cast<const directory*> (contents);
+         if (spill_store::is_stub (*dir)) {
+            read_back.push_back (spill_store::read (
+               directory_ptr_of (node->contents)));
+            dir = read_back.back().get();
+         }
+         for (const auto& entry: dir->dirents) {
+            pending.push_back (entry.second.get());
+         }
+         continue;
+      }
+      const plain_file* file =
+         static_cast<const plain_file*> (contents);
+      const void* key = file->blob != nullptr
+                      ? static_cast<const void*> (file->blob.get())
+                      : static_cast<const void*> (file);
+      auto found = kept.find (key);
+      if (found == kept.end()) {
+         uint64_t bytes = 0;
+         if (file->blob == nullptr) {
+            if (not file->packed.empty()) {
+               bytes = file->packed.size() + 1;
+            }
+         } else {
+            file->blob->each ([&] (const string& word) {
+               bytes += word.size() + 1;
+            });
+         }
+         found = kept.emplace (key, bytes).first;
+         ++use.contents;
+         use.unique_bytes += bytes;
+      }
+      ++use.files;
+      use.logical_bytes += found->second;
+   }
+   return use;
+}
+
+bool inode_storage::shares_reads() {
+   return true;
+}
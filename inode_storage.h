@@ -0,0 +1,63 @@
+// $Id$
+
+#ifndef __INODE_STORAGE_H__
+#define __INODE_STORAGE_H__
+
+#include <string>
+using namespace std;
+
+#include "inode.h"
+#include "storage.h"
+
+//
+// inode_storage -
+//    The tree as inodes, directories and plain files (see inode.h),
+//    the default backend.  A node_id is an inode number, found again
+//    through the inode_table.  Directories are materialized as they
+//    are looked at and detached before they change, as they always
+//    have been, and copy shares contents the way cp -r always has,
+//    so it takes constant time.  The root's contents can be shared
+//    with a checkpoint.  Readers may share the tree lock: a borrowed
+//    directory or a stub is read in holding it alone (see
+//    inode::read_dir), and anything else they touch is either left
+//    as it is or has a lock of its own.
+//
+
+class inode_storage: public storage {
+   private:
+      inode_ptr root_inode;
+      inode_ptr node_of (node_id node);
+      inode_ptr dir_of (node_id node);
+      static node_info info_of (const inode_ptr& node,
+                                const string& name);
+   public:
+      inode_storage();
+      ~inode_storage();
+      node_id root() override;
+      node_id parent (node_id node) override;
+      const string& name (node_id node) override;
+      node_info stat (node_id node) override;
+      node_id find_number (uint64_t inode_nr) override;
+      node_id lookup (node_id dir, const string& name) override;
+      node_id create (node_id dir, const string& name,
+                      inode_t type) override;
+      void list (node_id dir, const visitor& visit) override;
+      void list_range (node_id dir, const string& after, size_t skip,
+                       size_t count, const visitor& visit) override;
+      const wordvec& read (node_id file) override;
+      void gather (node_id file, const run_visitor& visit) override;
+      bool search (node_id file, const string& pattern) override;
+      void write (node_id file, const wordvec& words) override;
+      void append (node_id file, const wordvec& words) override;
+      void remove (node_id dir, const string& name,
+                   bool recursive) override;
+      void copy (node_id source, node_id dir,
+                 const string& name) override;
+      file_base_ptr share (node_id node) override;
+      memory_use memory() override;
+      dedup_use dedup() override;
+      bool shares_reads() override;
+};
+
+#endif
+
@@ -0,0 +1,247 @@
+// $Id$
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+#include "debug.h"
+#include "inode_table.h"
+
+//
+// Numbers are reserved block_size at a time from next_block.  What a
+// thread has not handed out of its block when it ends goes to
+// spare_blocks, for the next thread needing a block to take instead
+// of reserving one.  With reuse on, numbers given back are kept by
+// the thread that freed them, and once it has more than it needs, a
+// block of them goes to free_numbers for any thread to take.
+//
+
+static constexpr uint64_t block_size = 1024;
+static atomic<uint64_t> next_block {1};
+static atomic<bool> reuse_numbers {false};
+static mutex free_lock;
+static vector<uint64_t> free_numbers;
+static vector<pair<uint64_t, uint64_t>> spare_blocks;
+
+//
+// The table itself: a directory of pages of page_size slots, a page
+// being made the first time a number in it is handed out.  The
+// directory starts out covering the first 2^32 numbers, and when a
+// number past its end is handed out, it is copied into one twice the
+// size, or more, under page_lock.  A directory copied from is never
+// freed, so that a lookup which loaded it still finds the pages it
+// had.  The first directory is a static array, so the table needs
+// no constructing before the first inode is made.  table_lock is
+// only taken to look an inode up or take it out, so that an inode
+// being destroyed cannot be handed out by lookup.
+//
+
+static constexpr int page_bits = 12;
+static constexpr uint64_t page_size = uint64_t (1) << page_bits;
+
+struct page_directory {
+   uint64_t count;
+   atomic<atomic<inode*>*>* pages;
+};
+
+static atomic<atomic<inode*>*> first_pages[uint64_t (1) << 20];
+static page_directory first_directory {uint64_t (1) << 20,
+                                       first_pages};
+static atomic<page_directory*> directory {&first_directory};
+static mutex page_lock;
+static atomic<uint64_t> entries {0};
+static mutex table_lock;
+
+//
+// local_numbers -
+//    The numbers a thread can hand out without asking anyone: what
+//    is left of its block, and the numbers it freed itself.  When
+//    the thread ends, they are given back if they are to be reused.
+//
+
+struct local_numbers {
+   uint64_t next {0};
+   uint64_t end {0};
+   vector<uint64_t> freed;
+   uint64_t take();
+   void give (uint64_t inode_nr);
+   ~local_numbers();
+};
+
+static thread_local local_numbers local;
+
+uint64_t local_numbers::take() {
+   if (freed.empty() and next == end and reuse_numbers) {
+      lock_guard<mutex> guard (free_lock);
+      size_t count = min<size_t> (free_numbers.size(), block_size);
+      freed.assign (free_numbers.end() - count, free_numbers.end());
+      free_numbers.resize (free_numbers.size() - count);
+   }
+   if (not freed.empty()) {
+      uint64_t inode_nr = freed.back();
+      freed.pop_back();
+      return inode_nr;
+   }
+   if (next == end) {
+      lock_guard<mutex> guard (free_lock);
+      if (not spare_blocks.empty()) {
+         tie (next, end) = spare_blocks.back();
+         spare_blocks.pop_back();
+         DEBUGF ('n', "took " << next << " to " << end - 1);
+      }
+   }
+   if (next == end) {
+      next = next_block.fetch_add (block_size);
+      end = next + block_size;
+      if (end < next) throw yshell_exn ("out of inode numbers");
+      DEBUGF ('n', "reserved " << next << " to " << end - 1);
+   }
+   return next++;
+}
+
+void local_numbers::give (uint64_t inode_nr) {
+   freed.push_back (inode_nr);
+   if (freed.size() < 2 * block_size) return;
+   lock_guard<mutex> guard (free_lock);
+   free_numbers.insert (free_numbers.end(), freed.end() - block_size,
+                        freed.end());
+   freed.resize (freed.size() - block_size);
+}
+
+local_numbers::~local_numbers() {
+   lock_guard<mutex> guard (free_lock);
+   if (next != end) spare_blocks.emplace_back (next, end);
+   free_numbers.insert (free_numbers.end(), freed.begin(), freed.end());
+}
+
+/**
+ * Makes the page for a number, and a directory big enough to hold
+ * it if the one there is not
+ * @param  page_nr the number of the page
+ * @return         the page
+ */
+static atomic<inode*>* make_page (uint64_t page_nr) {
+   lock_guard<mutex> guard (page_lock);
+   page_directory* dir = directory.load (memory_order_acquire);
+   if (page_nr >= dir->count) {
+      uint64_t count = max (2 * dir->count, page_nr + 1);
+      page_directory* grown = new page_directory {
+         count, new atomic<atomic<inode*>*>[count](),
+      };
+      for (uint64_t nr = 0; nr < dir->count; ++nr) {
+         grown->pages[nr].store (dir->pages[nr].load());
+      }
+      DEBUGF ('n', "table grown to " << count << " pages");
+      directory.store (grown, memory_order_release);
+      dir = grown;
+   }
+   atomic<inode*>* page = dir->pages[page_nr].load();
+   if (page == nullptr) {
+      page = new atomic<inode*>[page_size]();
+      dir->pages[page_nr].store (page, memory_order_release);
+   }
+   return page;
+}
+
+/**
+ * Finds the slot for a number, making its page if asked to
+ * @param  inode_nr the number
+ * @param  make     true to make the page if it is not there yet
+ * @return          the slot, or nullptr if there is none
+ */
+static atomic<inode*>* slot (uint64_t inode_nr, bool make) {
+   uint64_t page_nr = inode_nr >> page_bits;
+   page_directory* dir = directory.load (memory_order_acquire);
+   atomic<inode*>* page = nullptr;
+   if (page_nr < dir->count) {
+      page = dir->pages[page_nr].load (memory_order_acquire);
+   }
+   if (page == nullptr) {
+      if (not make) return nullptr;
+      page = make_page (page_nr);
+   }
+   return &page[inode_nr & (page_size - 1)];
+}
+
+void inode_table::set_reuse (bool reuse) {
+   reuse_numbers = reuse;
+}
+
+/**
+ * Numbers an inode and enters it in the table
+ * @param  node the inode being constructed
+ * @return      its number
+ */
+uint64_t inode_table::allocate (inode* node) {
+   uint64_t inode_nr = local.take();
+   slot (inode_nr, true)->store (node, memory_order_release);
+   entries.fetch_add (1, memory_order_relaxed);
+   return inode_nr;
+}
+
+/**
+ * Takes a destroyed inode out of the table
+ * @param inode_nr its number
+ */
+void inode_table::release (uint64_t inode_nr) {
+   set_aside (inode_nr);
+   give_back (inode_nr);
+}
+
+void inode_table::set_aside (uint64_t inode_nr) {
+   {
+      lock_guard<mutex> guard (table_lock);
+      atomic<inode*>* entry = slot (inode_nr, false);
+      if (entry != nullptr) entry->store (nullptr);
+   }
+   entries.fetch_sub (1, memory_order_relaxed);
+}
+
+/**
+ * Enters an inode under a number set aside for it
+ * @param  node     the inode being constructed
+ * @param  inode_nr the number
+ * @return          the number
+ */
+uint64_t inode_table::enter (inode* node, uint64_t inode_nr) {
+   slot (inode_nr, true)->store (node, memory_order_release);
+   entries.fetch_add (1, memory_order_relaxed);
+   return inode_nr;
+}
+
+void inode_table::give_back (uint64_t inode_nr) {
+   if (reuse_numbers) local.give (inode_nr);
+}
+
+bool inode_table::reuses() {
+   return reuse_numbers;
+}
+
+/**
+ * Finds an inode by number
+ * @param  inode_nr the number
+ * @return          the inode, or nullptr if none has that number
+ */
+inode_ptr inode_table::lookup (uint64_t inode_nr) {
+   lock_guard<mutex> guard (table_lock);
+   atomic<inode*>* entry = slot (inode_nr, false);
+   if (entry == nullptr) return nullptr;
+   inode* node = entry->load (memory_order_acquire);
+   if (node == nullptr) return nullptr;
+   try {
+      return node->shared_from_this();
+   }catch (bad_weak_ptr&) {
+      // still being made, or already on its way out
+      return nullptr;
+   }
+}
+
+uint64_t inode_table::in_use() {
+   return entries.load (memory_order_relaxed);
+}
+
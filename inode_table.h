@@ -0,0 +1,62 @@
+// $Id$
+
+#ifndef __INODE_TABLE_H__
+#define __INODE_TABLE_H__
+
+#include <cstdint>
+using namespace std;
+
+#include "inode.h"
+
+//
+// inode_table -
+//    A static class which hands out inode numbers and maps them back
+//    to their inodes.
+// allocate -
+//    Gives the inode a number and enters it in the table.  Numbers
+//    are 64 bits and come out of blocks reserved a thread at a time,
+//    so threads making inodes at once do not contend for them.  A
+//    thread's numbers run in sequence from 1, as they always have,
+//    until another thread takes a block.  What is left of a block
+//    when its thread ends is handed out by the next thread to need
+//    one, so short lived threads, such as those of a pipeline or a
+//    job, do not use numbers up.
+// release -
+//    Takes a number out of the table when its inode is destroyed.
+//    With reuse set, the number goes back to be handed out again,
+//    which keeps the table dense however many inodes come and go.
+// set_aside, enter, give_back -
+//    What release does, in two halves, for an inode whose subtree is
+//    spilled to disk (see spill.h): set_aside takes the number out
+//    of the table but keeps it from being handed out again, so that
+//    enter can put the inode made when the subtree is read back in
+//    under the number it had, and give_back lets the number go for
+//    good if the subtree goes without being read back.
+// reuses -
+//    Whether numbers given back are handed out again.
+// lookup -
+//    Finds the inode with a number in constant time, or nullptr if
+//    there is none.  The table is a directory of fixed size pages,
+//    which grows to cover any number handed out.  Pages are kept once
+//    made, so without reuse the table takes 8 bytes for every number
+//    ever handed out; with reuse set it stays as big as the most
+//    inodes there have been at once.
+// in_use -
+//    The number of inodes in the table.
+//
+
+class inode_table {
+   public:
+      static void set_reuse (bool reuse);
+      static uint64_t allocate (inode* node);
+      static void release (uint64_t inode_nr);
+      static void set_aside (uint64_t inode_nr);
+      static uint64_t enter (inode* node, uint64_t inode_nr);
+      static void give_back (uint64_t inode_nr);
+      static bool reuses();
+      static inode_ptr lookup (uint64_t inode_nr);
+      static uint64_t in_use();
+};
+
+#endif
+
@@ -0,0 +1,203 @@
+// $Id$
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "cold.h"
+#include "commands.h"
+#include "debug.h"
+#include "jobs.h"
+#include "pipe.h"
+#include "storage.h"
+
+//
+// job -
+//    One command line run in the background.  Only its worker
+//    touches output until its status is JOB_DONE, and then only fg.
+//    Contents stay as they are, uncompressed or not, until it is
+//    done (see cold.h).  It runs in the directory the shell was in
+//    when it was started, or the root if that is gone by the time it
+//    runs.
+//
+
+enum job_status {JOB_WAITING, JOB_RUNNING, JOB_DONE};
+
+struct job {
+   int number;
+   wordvec words;
+   node_id cwd;
+   uint64_t cwd_nr;
+   inode_state* state;
+   commands* cmds;
+   job_status status {JOB_WAITING};
+   ostringstream output;
+   unique_ptr<cold_hold> hold;
+};
+
+//
+// All of the jobs' state, guarded by jobs_lock.  Every job not yet
+// taken back by fg is in table, and those waiting for a worker are
+// also in queue.  A thread which holds the tree lock lets it go
+// before waiting on jobs_lock's conditions, since the jobs it waits
+// for need the tree.
+//
+
+static mutex jobs_lock;
+static condition_variable work_ready;
+static condition_variable job_done;
+static map<int, shared_ptr<job>> table;
+static deque<shared_ptr<job>> queue;
+static vector<thread> workers;
+static int last_number {0};
+static bool stopping {false};
+
+/**
+ * Runs one job, its output going into the job.  One which only looks
+ * at the tree shares the tree lock with others like it, where the
+ * storage allows it, and pauses between directories and files for
+ * the commands which change it.
+ * @param running the job
+ */
+static void run_job (job& running) {
+   yout_guard guard (running.output);
+   cwd_guard in_cwd (running.cwd);
+   inode_state& state = *running.state;
+   bool shared = reads_only (running.words)
+             and state.get_storage().shares_reads();
+   try {
+      stage_lock lock (state.get_mutex(), shared);
+      storage& store = state.get_storage();
+      if (store.find_number (running.cwd_nr) != running.cwd) {
+         state.set_cwd (store.root());
+      }
+      running.cmds->execute (state, running.words);
+   }catch (ysh_exit_exn&) {
+      // exit only ends the job, as in a subshell
+   }catch (exception& exn) {
+      complain() << "[" << running.number << "] " << exn.what()
+                 << endl;
+   }
+}
+
+/**
+ * A worker, which takes jobs off the queue until close
+ */
+static void work() {
+   unique_lock<mutex> lock (jobs_lock);
+   for (;;) {
+      work_ready.wait (lock, [] {
+         return stopping or not queue.empty();
+      });
+      if (queue.empty()) return;
+      shared_ptr<job> next = queue.front();
+      queue.pop_front();
+      next->status = JOB_RUNNING;
+      lock.unlock();
+      DEBUGF ('b', "job " << next->number << " running");
+      run_job (*next);
+      next->hold.reset();
+      lock.lock();
+      next->status = JOB_DONE;
+      DEBUGF ('b', "job " << next->number << " done");
+      job_done.notify_all();
+   }
+}
+
+/**
+ * Queues a command line, starting the workers if need be
+ * @param  state the tree the job runs against
+ * @param  cmds  the commands to run it with
+ * @param  words the command line, without the "&"
+ * @return       the job's number
+ */
+int jobs::start (inode_state& state, commands& cmds,
+                 const wordvec& words) {
+   node_id cwd = state.get_cwd();
+   uint64_t cwd_nr;
+   {
+      stage_lock lock (state.get_mutex());
+      cwd_nr = state.get_storage().stat (cwd).inode_nr;
+   }
+   lock_guard<mutex> guard (jobs_lock);
+   if (workers.empty()) {
+      unsigned count = max (1u, thread::hardware_concurrency());
+      DEBUGF ('b', "starting " << count << " workers");
+      for (unsigned i = 0; i < count; ++i) workers.emplace_back (work);
+   }
+   shared_ptr<job> started = make_shared<job>();
+   started->number = ++last_number;
+   started->words = words;
+   started->cwd = cwd;
+   started->cwd_nr = cwd_nr;
+   started->state = &state;
+   started->cmds = &cmds;
+   started->hold.reset (new cold_hold());
+   table[started->number] = started;
+   queue.push_back (started);
+   work_ready.notify_one();
+   return started->number;
+}
+
+void jobs::list (ostream& out) {
+   static const char* status_names[] {"waiting", "running", "done"};
+   lock_guard<mutex> guard (jobs_lock);
+   for (const auto& entry: table) {
+      const job& listed = *entry.second;
+      out << "[" << listed.number << "] "
+          << status_names[listed.status] << " " << listed.words
+          << endl;
+   }
+}
+
+bool jobs::wait (int number) {
+   stage_lock::yield yield;
+   unique_lock<mutex> lock (jobs_lock);
+   if (number != 0 and table.count (number) == 0) return false;
+   job_done.wait (lock, [number] {
+      for (const auto& entry: table) {
+         if ((number == 0 or entry.first == number)
+             and entry.second->status != JOB_DONE) return false;
+      }
+      return true;
+   });
+   return true;
+}
+
+bool jobs::finish (int number, string& output) {
+   stage_lock::yield yield;
+   unique_lock<mutex> lock (jobs_lock);
+   if (number == 0 and not table.empty()) {
+      number = table.rbegin()->first;
+   }
+   auto found = table.find (number);
+   if (found == table.end()) return false;
+   shared_ptr<job> finished = found->second;
+   job_done.wait (lock, [&finished] {
+      return finished->status == JOB_DONE;
+   });
+   output = finished->output.str();
+   table.erase (number);
+   return true;
+}
+
+void jobs::close() {
+   vector<thread> stopped;
+   {
+      lock_guard<mutex> guard (jobs_lock);
+      stopping = true;
+      work_ready.notify_all();
+      stopped.swap (workers);
+   }
+   stage_lock::yield yield;
+   for (thread& worker: stopped) worker.join();
+}
+
@@ -0,0 +1,55 @@
+// $Id$
+
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "inode.h"
+#include "util.h"
+
+class commands;
+
+//
+// jobs -
+//    A static class which runs commands put in the background with
+//    "&" on a pool of worker threads, one per core, started the
+//    first time a job is.  A job runs against the same tree as the
+//    shell, taking the tree lock like any other command, so it sees
+//    and makes the changes the shell would have, in the directory
+//    the shell was in when the job was started; a cd in a job only
+//    moves the job.  Jobs which only look at the tree share the lock
+//    (see reads_only) and so run alongside each other, letting a
+//    command which changes the tree in between directories.  What a
+//    job prints is kept until fg prints it; error messages go
+//    straight to the terminal, as they do from a pipeline stage.
+// start -
+//    Queues a command line to run as a job and returns its number.
+// list -
+//    Writes a line for each job: its number, whether it is waiting
+//    for a worker, running or done, and its command line.
+// wait -
+//    Waits for the job with the given number to be done, or for
+//    every job with 0.  False if there is no such job.
+// finish -
+//    Waits for the job with the given number, or the last one
+//    started with 0, then forgets it and hands back what it printed.
+//    False if there is no such job.
+// close -
+//    Lets the jobs already started finish, then stops the workers.
+//
+
+class jobs {
+   public:
+      static int start (inode_state& state, commands& cmds,
+                        const wordvec& words);
+      static void list (ostream& out);
+      static bool wait (int number);
+      static bool finish (int number, string& output);
+      static void close();
+};
+
+#endif
+
@@ -0,0 +1,389 @@
+// $Id$
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#include "debug.h"
+#include "journal.h"
+
+//
+// All of the journal's state.  buffer holds the records not yet
+// written out, guarded by buffer_lock.  Writing a group takes the
+// buffer away under buffer_lock but writes it under write_lock, so
+// the shell can keep adding records while the group goes to disk.
+//
+
+static int journal_fd = -1;
+static atomic<bool> journal_on {false};
+static int interval {10};
+static journal_sync sync_policy {SYNC_COMMIT};
+static mutex buffer_lock;
+static mutex write_lock;
+static condition_variable wakeup;
+static string buffer;
+static uint64_t end_position {0};
+static bool stopping {false};
+static thread flusher;
+
+// flush early rather than let the buffer grow without bound
+static constexpr size_t max_buffer = 1 << 20;
+
+// ENCODING ===========================================================
+
+static void put_number (string& out, uint64_t number) {
+   while (number >= 0x80) {
+      out.push_back (static_cast<char> ((number & 0x7F) | 0x80));
+      number >>= 7;
+   }
+   out.push_back (static_cast<char> (number));
+}
+
+static void put_words (string& out, const wordvec& words) {
+   put_number (out, words.size());
+   for (const string& word: words) {
+      put_number (out, word.size());
+      out.append (word);
+   }
+}
+
+// FNV-1a, enough to tell a torn record from a good one
+static uint32_t checksum (const char* data, size_t size) {
+   uint32_t hash = 2166136261u;
+   for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ static_cast<unsigned char> (data[i])) * 16777619u;
+   }
+   return hash;
+}
+
+static bool get_number (const string& in, size_t& pos,
+                        uint64_t& number) {
+   number = 0;
+   for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= in.size()) return false;
+      unsigned char next = in[pos++];
+      number |= uint64_t (next & 0x7F) << shift;
+      if (not (next & 0x80)) return true;
+   }
+   return false;
+}
+
+static bool get_words (const string& in, size_t& pos, wordvec& words) {
+   uint64_t count;
+   if (not get_number (in, pos, count)) return false;
+   words.clear();
+   for (uint64_t i = 0; i < count; ++i) {
+      uint64_t size;
+      if (not get_number (in, pos, size)) return false;
+      if (in.size() - pos < size) return false;
+      words.emplace_back (in, pos, size);
+      pos += size;
+   }
+   return true;
+}
+
+// WRITING ============================================================
+
+/**
+ * Writes out everything buffered as one group. Called with buffer_lock
+ * held by guard, which is released while the group is written.
+ * write_lock keeps groups in order.
+ */
+static void write_group (unique_lock<mutex>& guard) {
+   if (buffer.empty()) return;
+   unique_lock<mutex> writing (write_lock);
+   string group;
+   group.swap (buffer);
+   guard.unlock();
+
+   const char* data = group.data();
+   size_t left = group.size();
+   while (left > 0) {
+      ssize_t written = ::write (journal_fd, data, left);
+      if (written < 0) {
+         complain() << "journal: " << strerror (errno) << endl;
+         break;
+      }
+      data += written;
+      left -= written;
+   }
+   if (sync_policy == SYNC_COMMIT) ::fsync (journal_fd);
+   DEBUGF ('j', "wrote group of " << group.size() << " bytes");
+   writing.unlock();
+   guard.lock();
+}
+
+static void flush_loop() {
+   unique_lock<mutex> guard (buffer_lock);
+   while (not stopping) {
+      wakeup.wait_for (guard, chrono::milliseconds (interval));
+      write_group (guard);
+   }
+}
+
+void journal::set_interval (int millis) {
+   interval = millis;
+}
+
+void journal::set_sync (journal_sync sync) {
+   sync_policy = sync;
+}
+
+bool journal::enabled() {
+   return journal_on.load (memory_order_relaxed);
+}
+
+// records are put together here, so building one does not allocate
+static thread_local string payload;
+static thread_local vector<const string*> names;
+
+/**
+ * Appends a finished payload to the buffer, framed by its length and
+ * followed by its checksum
+ */
+static void append_payload() {
+   uint32_t sum = checksum (payload.data(), payload.size());
+
+   unique_lock<mutex> guard (buffer_lock);
+   size_t before = buffer.size();
+   put_number (buffer, payload.size());
+   buffer.append (payload);
+   for (int shift = 0; shift < 32; shift += 8) {
+      buffer.push_back (static_cast<char> (sum >> shift));
+   }
+   end_position += buffer.size() - before;
+   if (interval == 0 or buffer.size() >= max_buffer) write_group (guard);
+}
+
+/**
+ * Appends one record
+ * @param op    what kind of mutation this is
+ * @param path  the path of the inode it applies to
+ * @param words the second list of words, depending on op
+ */
+void journal::record (journal_op op, const wordvec& path,
+                      const wordvec& words) {
+   payload.clear();
+   payload.push_back (static_cast<char> (op));
+   put_words (payload, path);
+   put_words (payload, words);
+   append_payload();
+}
+
+/**
+ * Appends one record, reading the path off the tree
+ * @param op         what kind of mutation this is
+ * @param store      the tree
+ * @param node       the node it applies to, or its directory
+ * @param child_name the child of node it applies to, or ""
+ * @param words      the second list of words, depending on op
+ */
+void journal::record (journal_op op, storage& store, node_id node,
+                      const string& child_name, const wordvec& words) {
+   names.clear();
+   if (not child_name.empty()) names.push_back (&child_name);
+   for (node_id root = store.root(); node != root;
+        node = store.parent (node)) {
+      names.push_back (&store.name (node));
+   }
+
+   payload.clear();
+   payload.push_back (static_cast<char> (op));
+   put_number (payload, names.size());
+   for (auto name = names.rbegin(); name != names.rend(); ++name) {
+      put_number (payload, (*name)->size());
+      payload.append (**name);
+   }
+   put_words (payload, words);
+   append_payload();
+}
+
+uint64_t journal::position() {
+   lock_guard<mutex> guard (buffer_lock);
+   return end_position;
+}
+
+/**
+ * Builds the path of a node by walking up its parents
+ * @param  store the tree
+ * @param  node  the node
+ * @return       the names from the root down, not including the root
+ */
+wordvec journal::path_of (storage& store, node_id node) {
+   wordvec path;
+   for (node_id root = store.root(); node != root;
+        node = store.parent (node)) {
+      path.push_back (store.name (node));
+   }
+   return wordvec (path.rbegin(), path.rend());
+}
+
+void journal::close() {
+   if (journal_fd < 0) return;
+   journal_on = false;
+   {
+      lock_guard<mutex> guard (buffer_lock);
+      stopping = true;
+      wakeup.notify_all();
+   }
+   if (flusher.joinable()) flusher.join();
+   unique_lock<mutex> guard (buffer_lock);
+   write_group (guard);
+   ::fsync (journal_fd);
+   ::close (journal_fd);
+   journal_fd = -1;
+}
+
+// REPLAYING ==========================================================
+
+/**
+ * Walks down from the root one lookup per name
+ * @param  state     the state being rebuilt
+ * @param  path      the names from the root
+ * @param  skip_last how many names at the end to leave out
+ * @return           the node, or no_node if it is not there
+ */
+static node_id walk (inode_state& state, const wordvec& path,
+                     size_t skip_last = 0) {
+   if (path.size() < skip_last) return no_node;
+   storage& store = state.get_storage();
+   node_id node = store.root();
+   for (size_t i = 0; i + skip_last < path.size() and node != no_node;
+        ++i) {
+      node = store.lookup (node, path[i]);
+   }
+   return node;
+}
+
+/**
+ * Applies one record straight to the tree
+ * @return false if the record does not fit the tree
+ */
+static bool apply (inode_state& state, journal_op op,
+                   const wordvec& path, const wordvec& words) {
+   if (op == JOURNAL_PROMPT) {
+      if (words.size() != 1) return false;
+      state.set_prompt (words.front());
+      return true;
+   }
+   if (op == JOURNAL_COPY) {
+      // the source may be the root, whose path is empty
+      node_id source = walk (state, path);
+      if (source == no_node or words.empty()) return false;
+      node_id dest = walk (state, words, 1);
+      if (dest == no_node) return false;
+      state.copy (source, dest, words.back());
+      return true;
+   }
+   if (path.empty()) return false;
+   const string& name = path.back();
+   node_id node;
+   switch (op) {
+      case JOURNAL_MKDIR: case JOURNAL_MKFILE:
+         node = walk (state, path, 1);
+         if (node == no_node) return false;
+         state.make (node, name,
+                     op == JOURNAL_MKDIR ? DIR_INODE : PLAIN_INODE);
+         return true;
+      case JOURNAL_WRITE: case JOURNAL_APPEND:
+         node = walk (state, path);
+         if (node == no_node) return false;
+         if (op == JOURNAL_WRITE) state.write (node, words);
+                             else state.append (node, words);
+         return true;
+      case JOURNAL_REMOVE: case JOURNAL_RMR:
+         node = walk (state, path, 1);
+         if (node == no_node) return false;
+         state.remove (node, name, op == JOURNAL_RMR);
+         return true;
+      default:
+         return false;
+   }
+}
+
+/**
+ * Replays the journal file into the state and opens it for appending
+ * @param path  the journal file, created if it does not exist
+ * @param state the state to rebuild
+ * @param start where to start replaying, past what a checkpoint
+ *              already holds
+ */
+void journal::open (const string& path, inode_state& state,
+                    uint64_t start) {
+   journal_fd = ::open (path.c_str(), O_RDWR | O_CREAT, 0644);
+   if (journal_fd < 0) {
+      throw yshell_exn (path + ": cannot open journal");
+   }
+
+   string bytes;
+   char chunk[1 << 16];
+   for (;;) {
+      ssize_t got = ::read (journal_fd, chunk, sizeof chunk);
+      if (got <= 0) break;
+      bytes.append (chunk, got);
+   }
+
+   if (start > bytes.size()) {
+      complain() << path << ": shorter than the checkpoint expects, "
+                 << "not replayed" << endl;
+      start = bytes.size();
+   }
+   size_t pos = start;
+   size_t good = start;
+   size_t records = 0;
+   wordvec record_path;
+   wordvec record_words;
+   while (pos < bytes.size()) {
+      uint64_t size;
+      if (not get_number (bytes, pos, size)) break;
+      if (bytes.size() - pos < size + 4) break;
+      size_t start = pos;
+      uint32_t sum = 0;
+      for (int i = 0; i < 4; ++i) {
+         sum |= uint32_t (static_cast<unsigned char> (
+                   bytes[start + size + i])) << (8 * i);
+      }
+      if (sum != checksum (&bytes[start], size)) break;
+      journal_op op = static_cast<journal_op> (bytes[pos++]);
+      if (not get_words (bytes, pos, record_path)
+          or not get_words (bytes, pos, record_words)
+          or pos != start + size) break;
+      pos += 4;
+      try {
+         if (not apply (state, op, record_path, record_words)) {
+            complain() << path << ": record " << records
+                       << " does not fit the tree, skipped" << endl;
+         }
+      }catch (exception& exn) {
+         complain() << path << ": record " << records << ": "
+                    << exn.what() << endl;
+      }
+      good = pos;
+      ++records;
+   }
+   if (good < bytes.size()) {
+      complain() << path << ": dropping " << bytes.size() - good
+                 << " bytes of torn records" << endl;
+      if (::ftruncate (journal_fd, good) != 0) {
+         throw yshell_exn (path + ": cannot truncate journal");
+      }
+   }
+   ::lseek (journal_fd, good, SEEK_SET);
+   end_position = good;
+   DEBUGF ('j', path << ": replayed " << records << " records");
+
+   journal_on = true;
+   stopping = false;
+   if (interval > 0) flusher = thread (flush_loop);
+}
+
@@ -0,0 +1,90 @@
+// $Id$
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <cstdint>
+#include <string>
+using namespace std;
+
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+//
+// journal_op -
+//    The kinds of record in the journal.  Each record is an op and
+//    two lists of words, the first always being the path from the
+//    root of the inode it applies to:
+//       JOURNAL_MKDIR, JOURNAL_MKFILE:   path, nothing
+//       JOURNAL_WRITE, JOURNAL_APPEND:   path, the words
+//       JOURNAL_COPY:                    source, destination
+//       JOURNAL_REMOVE, JOURNAL_RMR:     path, nothing
+//       JOURNAL_PROMPT:                  nothing, the prompt
+//
+
+enum journal_op: unsigned char {
+   JOURNAL_MKDIR = 1, JOURNAL_MKFILE, JOURNAL_WRITE, JOURNAL_APPEND,
+   JOURNAL_COPY, JOURNAL_REMOVE, JOURNAL_RMR, JOURNAL_PROMPT,
+};
+
+//
+// journal_sync -
+//    When the journal file is fsynced: never (leave it to the
+//    system), or after every group of records is written out.
+//
+
+enum journal_sync {SYNC_NONE, SYNC_COMMIT};
+
+//
+// journal -
+//    A static class which keeps a write-ahead log of every mutation
+//    of the tree, so the tree survives the shell exiting or
+//    crashing.  Records are buffered in memory and written out as a
+//    group every interval milliseconds by a background thread, or
+//    immediately if the interval is 0.  A crash loses at most the
+//    last interval's worth of records.
+// set_interval, set_sync -
+//    Group commit policy, set from the options before open.
+// open -
+//    Replays the journal at the given path into the state, applying
+//    each record straight to the tree, then keeps appending to it.
+//    Replay starts at the given offset, the position a checkpoint
+//    the state was loaded from was taken at.  A record torn by a
+//    crash ends the replay and is cut off.
+// enabled -
+//    True once open, except while replaying.  Checked before doing
+//    the work of building a record.
+// record -
+//    Appends one record, given either the path as names or the
+//    node the record is about (and the name of its child, if the
+//    record is about that).  The second form goes straight from the
+//    tree to the record without building the path first.
+// position -
+//    The offset in the journal file just past the last record made,
+//    whether or not it has been written out yet.
+// path_of -
+//    The names from the root down to the given node.
+// close -
+//    Writes out and syncs whatever is still buffered.
+//
+
+class journal {
+   public:
+      static void set_interval (int millis);
+      static void set_sync (journal_sync sync);
+      static void open (const string& path, inode_state& state,
+                        uint64_t start = 0);
+      static bool enabled();
+      static void record (journal_op op, const wordvec& path,
+                          const wordvec& words = wordvec());
+      static void record (journal_op op, storage& store, node_id node,
+                          const string& child_name,
+                          const wordvec& words = wordvec());
+      static uint64_t position();
+      static wordvec path_of (storage& store, node_id node);
+      static void close();
+};
+
+#endif
+
@@ -0,0 +1,108 @@
+// $Id$
+
+#include <cstring>
+
+using namespace std;
+
+#include "listing.h"
+
+static constexpr size_t buffer_size = 64 * 1024;
+static thread_local char buffer[buffer_size];
+
+// a row without its name is never longer than this
+static constexpr size_t max_columns = 2 * 20 + 5;
+
+// the width ls pads numbers to
+static constexpr int column_width = 6;
+
+static const char heading[] = "inode_nr size   filename\n";
+static const char cursor_label[] = "cursor ";
+static const char hex_digits[] = "0123456789abcdef";
+
+listing::listing (ostream& out): out (out), next (buffer) {
+}
+
+listing::~listing() {
+   flush();
+}
+
+void listing::flush() {
+   if (next == buffer) return;
+   out.write (buffer, next - buffer);
+   next = buffer;
+}
+
+/**
+ * Writes out of the buffer, or around it if it is too big to fit
+ * @param text the bytes
+ * @param size how many
+ */
+void listing::put (const char* text, size_t size) {
+   if (size > buffer_size - (next - buffer)) {
+      flush();
+      if (size > buffer_size) {
+         out.write (text, size);
+         return;
+      }
+   }
+   memcpy (next, text, size);
+   next += size;
+}
+
+/**
+ * Converts a number into the buffer, padded to the width of a column
+ * @param number the number, with room for it already made
+ */
+void listing::put_number (uint64_t number) {
+   char digits[20];
+   int count = 0;
+   do {
+      digits[count++] = static_cast<char> ('0' + number % 10);
+      number /= 10;
+   } while (number != 0);
+   for (int digit = count; digit > 0; --digit) {
+      *next++ = digits[digit - 1];
+   }
+   for (; count < column_width; ++count) *next++ = ' ';
+}
+
+void listing::header() {
+   put (heading, sizeof heading - 1);
+}
+
+void listing::row (const node_info& info) {
+   if (buffer_size - (next - buffer) < max_columns) flush();
+   put_number (info.inode_nr);
+   memcpy (next, "   ", 3);
+   next += 3;
+   put_number (info.size);
+   *next++ = ' ';
+   put (info.name->data(), info.name->size());
+   put ("\n", 1);
+}
+
+void listing::cursor (const string& name) {
+   put (cursor_label, sizeof cursor_label - 1);
+   for (unsigned char c: name) {
+      char digits[] {hex_digits[c >> 4], hex_digits[c & 0xF]};
+      put (digits, 2);
+   }
+   put ("\n", 1);
+}
+
+static int hex_value (char digit) {
+   const char* found = strchr (hex_digits, digit);
+   return digit == '\0' or found == nullptr ? -1 : found - hex_digits;
+}
+
+bool listing::resume (const string& token, string& name) {
+   if (token.empty() or token.size() % 2 != 0) return false;
+   name.clear();
+   for (size_t pos = 0; pos < token.size(); pos += 2) {
+      int high = hex_value (token[pos]);
+      int low = hex_value (token[pos + 1]);
+      if (high < 0 or low < 0) return false;
+      name.push_back (static_cast<char> (high << 4 | low));
+   }
+   return true;
+}
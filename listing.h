@@ -0,0 +1,57 @@
+// $Id$
+
+#ifndef __LISTING_H__
+#define __LISTING_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+using namespace std;
+
+#include "storage.h"
+
+//
+// class listing -
+//
+// Formats what ls prints straight into a buffer each thread keeps
+// from one listing to the next, and writes the buffer out when it
+// fills, so a row costs no allocation and no call into the stream.
+// Numbers are converted in place, left justified in six columns or
+// as wide as they are, as ls has always shown them; the width of a
+// column is known from the same pass that writes its digits.  Only
+// one listing may be made at a time on a thread.
+// header -
+//    The line over the rows.
+// row -
+//    The line for one entry.
+// cursor -
+//    The line after a window of rows cut short by ls --limit, with a
+//    token standing for the last name shown, from which ls --cursor
+//    goes on.  The token is the name in hex, so it comes through
+//    being split into words whatever the name is.
+// resume -
+//    The name a token stands for, or false if it is not a token.
+// flush -
+//    Writes out what is buffered.  Done when the listing goes.
+//
+
+class listing {
+   private:
+      ostream& out;
+      char* next;
+      void put_number (uint64_t number);
+      void put (const char* text, size_t size);
+   public:
+      explicit listing (ostream& out);
+      listing (const listing&) = delete;
+      listing& operator= (const listing&) = delete;
+      ~listing();
+      void header();
+      void row (const node_info& info);
+      void cursor (const string& name);
+      static bool resume (const string& token, string& name);
+      void flush();
+};
+
+#endif
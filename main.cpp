@@ -3,21 +3,87 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <utility>
+#include <getopt.h>
 #include <unistd.h>
 
 using namespace std;
 
+#include "batch.h"
+#include "checkpoint.h"
+#include "cold.h"
 #include "commands.h"
+#include "content.h"
 #include "debug.h"
+#include "disk_storage.h"
 #include "inode.h"
+#include "inode_table.h"
+#include "jobs.h"
+#include "journal.h"
+#include "spill.h"
+#include "storage.h"
 #include "util.h"
 
 //
 // scan_options
-//    Options analysis:  The only option is -Dflags.
+//    Options analysis:
+//       -@flags      debug flags
+//       -j file      keep a journal of the tree in file, replaying it
+//                    first if it already exists
+//       -g millis    group commit interval of the journal, 0 to write
+//                    every record out as it is made
+//       -s policy    fsync the journal after every group (commit),
+//                    or never (none)
+//       -c file      checkpoint the tree into file, loading it first
+//                    if it already exists
+//       -p seconds   take a checkpoint in the background this often
+//       -r           reuse the numbers of inodes that are gone
+//       -b backend   keep the tree in inodes (tree, the default), in
+//                    a soa_tree (soa) or in a file of pages (disk)
+//       -f file      the file the disk backend keeps the tree in from
+//                    one run to the next, rather than a scratch file
+//       --cache-mb megabytes
+//                    the size of the disk backend's page cache
+//       --vocab      keep the words of plain files in the tree
+//                    backend as ids into one vocabulary of every
+//                    word written (see content.h)
+//       --cold-after millis
+//                    compress the words of plain files in the tree
+//                    backend once they go unread this long, and
+//                    expand them again when they are read (see
+//                    cold.h)
+//       --cold-min bytes
+//                    the fewest bytes of words worth compressing
+//       --hot-kb kilobytes
+//                    how much of what has been expanded again may
+//                    stay expanded
+//       --mem-limit megabytes
+//                    spill the subtrees of the tree backend used
+//                    least recently to a scratch file once malloc
+//                    has handed out more than this, and read them
+//                    back in when they are next used (see spill.h)
+//       --parallel   run lines which only read the tree, and not what
+//                    an earlier line is writing, side by side,
+//                    printing what they print in order (see batch.h);
+//                    ignored on a single core
 //
 
+static string journal_file;
+static string backend {"tree"};
+static bool parallel {false};
+
+static const struct option long_options[] {
+   {"cache-mb",   required_argument, nullptr, 'm'},
+   {"parallel",   no_argument,       nullptr, 'P'},
+   {"vocab",      no_argument,       nullptr, 'V'},
+   {"cold-after", required_argument, nullptr, 'A'},
+   {"cold-min",   required_argument, nullptr, 'M'},
+   {"hot-kb",     required_argument, nullptr, 'H'},
+   {"mem-limit",  required_argument, nullptr, 'L'},
+   {nullptr,      0,                 nullptr, 0},
+};
+
 /**
  * Scans the options and sets flags as appropriate
  * @param argc The number of arguments given to main
@@ -27,12 +93,67 @@ void scan_options (int argc, char** argv) {
    opterr = 0; // count of all the options
    for (;;) {
       // option is a
-      int option = getopt (argc, argv, "@:");
+      int option = getopt_long (argc, argv, "@:j:g:s:c:p:rb:f:",
+                                long_options, nullptr);
       if (option == EOF) break;
       switch (option) {
          case '@':
             debugflags::setflags (optarg);
             break;
+         case 'j':
+            journal_file = optarg;
+            break;
+         case 'g':
+            journal::set_interval (atoi (optarg));
+            break;
+         case 'c':
+            checkpoint::set_path (optarg);
+            break;
+         case 'p':
+            checkpoint::set_period (atoi (optarg));
+            break;
+         case 'r':
+            inode_table::set_reuse (true);
+            break;
+         case 'b':
+            backend = optarg;
+            break;
+         case 'f':
+            disk_storage::set_path (optarg);
+            break;
+         case 'm':
+            disk_storage::set_cache_mb (atoi (optarg));
+            break;
+         case 'P':
+            // with one core there is nothing to run side by side,
+            // and handing lines between threads only costs
+            parallel = thread::hardware_concurrency() > 1;
+            break;
+         case 'V':
+            vocabulary::enable();
+            break;
+         case 'A':
+            cold_store::set_after (atoi (optarg));
+            break;
+         case 'M':
+            cold_store::set_min_bytes (atoi (optarg));
+            break;
+         case 'H':
+            cold_store::set_cache_kb (atoi (optarg));
+            break;
+         case 'L':
+            spill_store::set_limit_mb (atoi (optarg));
+            break;
+         case 's':
+            if (string (optarg) == "none") {
+               journal::set_sync (SYNC_NONE);
+            } else if (string (optarg) == "commit") {
+               journal::set_sync (SYNC_COMMIT);
+            } else {
+               complain() << "-s " << optarg << ": invalid policy"
+                          << endl;
+            }
+            break;
          default:
             complain() << "-" << (char) option << ": invalid option"
                        << endl;
@@ -49,8 +170,9 @@ void scan_options (int argc, char** argv) {
  * @param  words  the command given
  * @return        true if the line starts with "#" false otherwise
  */
-bool check_comment(wordvec words){
-   string first_word = words.front();
+bool check_comment(const wordvec& words){
+   if (words.empty()) return false;
+   const string& first_word = words.front();
    char first_char = first_word.at(0);
    if (first_char == ('#')){
       DEBUGF('m', "Line is commented!")
@@ -77,9 +199,30 @@ int main (int argc, char** argv) {
    scan_options (argc, argv);
    bool need_echo = want_echo();
    commands cmdmap;
-   inode_state state;
+   unique_ptr<storage> store;
+   try {
+      store = make_storage (backend);
+   }catch (yshell_exn& exn) {
+      complain() << exn.what() << endl;
+      return exit_status_message();
+   }
+   inode_state state (move (store));
+   try {
+      uint64_t position = 0;
+      if (not state.get_storage().restored (position)) {
+         position = checkpoint::load (state);
+      }
+      if (not journal_file.empty()) {
+         journal::open (journal_file, state, position);
+      }
+   }catch (yshell_exn& exn) {
+      complain() << exn.what() << endl;
+      return exit_status_message();
+   }
+   checkpoint::open (state);
    try {
-      for (;;) {
+      if (parallel) batch::run (state, cmdmap, need_echo);
+      while (not parallel) {
          try {
 
             // Read a line, break at EOF, and echo print the prompt
@@ -100,11 +243,12 @@ int main (int argc, char** argv) {
             wordvec words = split (line, " \t");
             DEBUGF ('y', "words = " << words);
 
-            // if the line is commented ignore it
-            if (check_comment(words)) continue;
+            // if the line is blank or commented ignore it
+            if (words.empty() or check_comment(words)) continue;
 
-            command_fn fn = cmdmap.at(words.at(0));
-            fn (state, words);
+            cmdmap.execute (state, words);
+            cold_store::sweep (state);
+            spill_store::sweep (state);
          }catch (yshell_exn& exn) {
             // If there is a problem discovered in any function, an
             // exn is thrown and printed here.
@@ -115,5 +259,9 @@ int main (int argc, char** argv) {
       // This catch intentionally left blank.
    }
 
+   jobs::close();
+   checkpoint::close();
+   journal::close();
+
    return exit_status_message();
 }
@@ -0,0 +1,166 @@
+// $Id$
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+#include "debug.h"
+#include "page_cache.h"
+#include "util.h"
+
+// never so few frames that the pages pinned at once could fill them
+static constexpr size_t min_frames = 64;
+
+static constexpr uint64_t no_page = UINT64_MAX;
+
+/**
+ * Sets aside the frames, which take no memory until they are used
+ * @param fd    the file the pages are in
+ * @param bytes how much memory the frames may take
+ */
+page_cache::page_cache (int fd, size_t bytes):
+   fd (fd), frame_count (max (bytes / page_size, min_frames)) {
+   memory.reset (new char[frame_count * page_size]);
+   frames.reserve (frame_count);
+   DEBUGF ('d', "page cache of " << frame_count << " frames");
+}
+
+char* page_cache::frame_data (size_t slot) const {
+   return memory.get() + slot * page_size;
+}
+
+/**
+ * Finds a frame for a page, a new one while there are any left and
+ * otherwise the least recently used one not pinned
+ * @param  page the page to go in it
+ * @return      the frame, now at the front of the lru list
+ */
+size_t page_cache::take_frame (uint64_t page) {
+   size_t slot;
+   if (frames.size() < frame_count) {
+      slot = frames.size();
+      frames.push_back ({no_page, 0, false, lru.end()});
+   } else {
+      auto victim = lru.rbegin();
+      while (victim != lru.rend() and frames[*victim].pins > 0) {
+         ++victim;
+      }
+      if (victim == lru.rend()) {
+         throw yshell_exn ("page cache: every page is pinned");
+      }
+      slot = *victim;
+      frame& taken = frames[slot];
+      if (taken.dirty) write_back (taken, slot);
+      index.erase (taken.page);
+      lru.erase (taken.lru_pos);
+   }
+   frame& taken = frames[slot];
+   taken.page = page;
+   taken.dirty = false;
+   taken.lru_pos = lru.insert (lru.begin(), slot);
+   index[page] = slot;
+   return slot;
+}
+
+void page_cache::write_back (frame& taken, size_t slot) {
+   ssize_t wrote = pwrite (fd, frame_data (slot), page_size,
+                           taken.page * page_size);
+   if (wrote != static_cast<ssize_t> (page_size)) {
+      throw yshell_exn (string ("page cache: ") + strerror (errno));
+   }
+   taken.dirty = false;
+   ++write_count;
+}
+
+page_cache::page_ref page_cache::pin (size_t slot) {
+   ++frames[slot].pins;
+   return page_ref (this, slot);
+}
+
+page_cache::page_ref page_cache::fetch (uint64_t page) {
+   auto found = index.find (page);
+   if (found != index.end()) {
+      ++hit_count;
+      frame& hit = frames[found->second];
+      lru.splice (lru.begin(), lru, hit.lru_pos);
+      return pin (found->second);
+   }
+   ++miss_count;
+   size_t slot = take_frame (page);
+   char* data = frame_data (slot);
+   ssize_t got = pread (fd, data, page_size, page * page_size);
+   if (got < 0) {
+      index.erase (page);
+      frames[slot].page = no_page;
+      throw yshell_exn (string ("page cache: ") + strerror (errno));
+   }
+   memset (data + got, 0, page_size - got);
+   return pin (slot);
+}
+
+page_cache::page_ref page_cache::fresh (uint64_t page) {
+   auto found = index.find (page);
+   size_t slot;
+   if (found != index.end()) {
+      slot = found->second;
+      lru.splice (lru.begin(), lru, frames[slot].lru_pos);
+   } else {
+      slot = take_frame (page);
+   }
+   memset (frame_data (slot), 0, page_size);
+   frames[slot].dirty = true;
+   return pin (slot);
+}
+
+void page_cache::forget (uint64_t page) {
+   auto found = index.find (page);
+   if (found == index.end()) return;
+   frame& gone = frames[found->second];
+   gone.page = no_page;
+   gone.dirty = false;
+   lru.splice (lru.end(), lru, gone.lru_pos);
+   index.erase (found);
+}
+
+void page_cache::flush() {
+   for (size_t slot = 0; slot < frames.size(); ++slot) {
+      if (frames[slot].dirty) write_back (frames[slot], slot);
+   }
+}
+
+uint64_t page_cache::bytes() const {
+   // each frame is on the lru list and in the index
+   return frames.size() * (page_size + sizeof (frame)
+                           + 3 * sizeof (void*) + sizeof (size_t)
+                           + 2 * sizeof (void*) + sizeof (uint64_t)
+                           + sizeof (size_t))
+        + index.bucket_count() * sizeof (void*);
+}
+
+// PAGE REF ===========================================================
+
+page_cache::page_ref::page_ref (page_cache* cache, size_t slot):
+   cache (cache), slot (slot) {
+}
+
+page_cache::page_ref::page_ref (page_ref&& that):
+   cache (that.cache), slot (that.slot) {
+   that.cache = nullptr;
+}
+
+page_cache::page_ref::~page_ref() {
+   if (cache != nullptr) --cache->frames[slot].pins;
+}
+
+const char* page_cache::page_ref::data() const {
+   return cache->frame_data (slot);
+}
+
+char* page_cache::page_ref::write() {
+   cache->frames[slot].dirty = true;
+   return cache->frame_data (slot);
+}
+
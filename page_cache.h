@@ -0,0 +1,101 @@
+// $Id$
+
+#ifndef __PAGE_CACHE_H__
+#define __PAGE_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+//
+// class page_cache -
+//
+// A fixed number of page sized frames over a file, reused least
+// recently used first.  A page is read in the first time it is
+// fetched and written back when its frame is taken for another page,
+// or by flush, if it has been written to.  A page is pinned for as
+// long as a page_ref to it is held, so its frame cannot be taken;
+// fetching a page when every frame is pinned throws a yshell_exn.
+// fetch -
+//    The page, read in from the file if it is not in the cache.  A
+//    page past the end of the file reads as zeros.
+// fresh -
+//    The page, zeroed and not read in, for a page whose old contents
+//    do not matter.
+// forget -
+//    Drops a page that is no longer used without writing it back.
+// flush -
+//    Writes back every page that has been written to.
+// hits, misses, writes -
+//    Fetches found in the cache and not, and pages written back.
+// bytes -
+//    The memory of the frames used so far, with what it takes to
+//    find them.
+//
+
+class page_cache {
+   public:
+      static constexpr size_t page_size = 4096;
+      class page_ref;
+   private:
+      struct frame {
+         uint64_t page;
+         unsigned pins;
+         bool dirty;
+         list<size_t>::iterator lru_pos;
+      };
+      int fd;
+      unique_ptr<char[]> memory;
+      vector<frame> frames;
+      size_t frame_count;
+      list<size_t> lru;
+      unordered_map<uint64_t, size_t> index;
+      uint64_t hit_count {0};
+      uint64_t miss_count {0};
+      uint64_t write_count {0};
+      char* frame_data (size_t slot) const;
+      size_t take_frame (uint64_t page);
+      void write_back (frame& taken, size_t slot);
+      page_ref pin (size_t slot);
+   public:
+      page_cache (int fd, size_t bytes);
+      page_cache (const page_cache&) = delete;
+      page_cache& operator= (const page_cache&) = delete;
+      page_ref fetch (uint64_t page);
+      page_ref fresh (uint64_t page);
+      void forget (uint64_t page);
+      void flush();
+      uint64_t hits() const { return hit_count; }
+      uint64_t misses() const { return miss_count; }
+      uint64_t writes() const { return write_count; }
+      uint64_t bytes() const;
+};
+
+//
+// class page_cache::page_ref -
+//
+// A pinned page.  data may be read until the ref goes; write marks
+// the page to be written back and returns the same bytes.
+//
+
+class page_cache::page_ref {
+   friend class page_cache;
+   private:
+      page_cache* cache;
+      size_t slot;
+      page_ref (page_cache* cache, size_t slot);
+   public:
+      page_ref (page_ref&& that);
+      page_ref (const page_ref&) = delete;
+      page_ref& operator= (const page_ref&) = delete;
+      ~page_ref();
+      const char* data() const;
+      char* write();
+};
+
+#endif
+
@@ -0,0 +1,201 @@
+// $Id$
+
+#include <iostream>
+#include <utility>
+
+using namespace std;
+
+#include "debug.h"
+#include "pipe.h"
+
+static thread_local stage_lock* current_stage_lock = nullptr;
+static thread_local int keeping = 0;
+static thread_local word_pipe* writing_pipe = nullptr;
+
+word_pipe::word_pipe (size_t init_capacity): capacity (init_capacity) {
+}
+
+void word_pipe::push (string&& batch) {
+   if (stage_lock::kept()) {
+      // the stage holds on to parts of the tree, so rather than let
+      // go of it to wait for room the batch goes in over capacity
+      lock_guard<mutex> lock (queue_lock);
+      if (read_closed) return;
+      batches.push_back (move (batch));
+      not_empty.notify_one();
+      return;
+   }
+   // let the rest of the pipeline at the tree while we wait
+   stage_lock::yield yield;
+   unique_lock<mutex> lock (queue_lock);
+   not_full.wait (lock, [this] {
+      return batches.size() < capacity or read_closed;
+   });
+   if (read_closed) return;
+   batches.push_back (move (batch));
+   not_empty.notify_one();
+}
+
+bool word_pipe::pop (string& batch) {
+   stage_lock::yield yield;
+   unique_lock<mutex> lock (queue_lock);
+   not_empty.wait (lock, [this] {
+      return not batches.empty() or write_closed;
+   });
+   if (batches.empty()) return false;
+   batch = move (batches.front());
+   batches.pop_front();
+   not_full.notify_one();
+   return true;
+}
+
+bool word_pipe::make_room() {
+   {
+      lock_guard<mutex> lock (queue_lock);
+      if (batches.size() < capacity or read_closed) return false;
+   }
+   stage_lock::yield yield;
+   unique_lock<mutex> lock (queue_lock);
+   not_full.wait (lock, [this] {
+      return batches.size() < capacity or read_closed;
+   });
+   return true;
+}
+
+void word_pipe::close_write() {
+   lock_guard<mutex> lock (queue_lock);
+   write_closed = true;
+   not_empty.notify_all();
+}
+
+void word_pipe::close_read() {
+   lock_guard<mutex> lock (queue_lock);
+   read_closed = true;
+   batches.clear();
+   not_full.notify_all();
+}
+
+pipe_writer::pipe_writer (word_pipe& init_pipe):
+   pipe (init_pipe), saved (writing_pipe) {
+   batch.resize (word_pipe::batch_size);
+   setp (&batch[0], &batch[0] + batch.size());
+   writing_pipe = &pipe;
+}
+
+pipe_writer::~pipe_writer() {
+   writing_pipe = saved;
+   push();
+   pipe.close_write();
+}
+
+void pipe_writer::push() {
+   size_t used = pptr() - pbase();
+   if (used == 0) return;
+   batch.resize (used);
+   DEBUGF ('p', "pushing " << used << " bytes");
+   pipe.push (move (batch));
+   batch.assign (word_pipe::batch_size, '\0');
+   setp (&batch[0], &batch[0] + batch.size());
+}
+
+pipe_writer::int_type pipe_writer::overflow (int_type c) {
+   push();
+   if (c != traits_type::eof()) {
+      *pptr() = traits_type::to_char_type (c);
+      pbump (1);
+   }
+   return traits_type::not_eof (c);
+}
+
+pipe_reader::pipe_reader (word_pipe& init_pipe): pipe (init_pipe) {
+}
+
+pipe_reader::~pipe_reader() {
+   pipe.close_read();
+}
+
+pipe_reader::int_type pipe_reader::underflow() {
+   if (gptr() < egptr()) return traits_type::to_int_type (*gptr());
+   do {
+      if (not pipe.pop (batch)) return traits_type::eof();
+   } while (batch.empty());
+   setg (&batch[0], &batch[0], &batch[0] + batch.size());
+   return traits_type::to_int_type (*gptr());
+}
+
+stage_lock::stage_lock (tree_lock& init_tree, bool init_shared):
+   tree (init_tree), shared (init_shared), saved (current_stage_lock) {
+   // the outer lock on this thread already covers us
+   if (saved != nullptr) return;
+   acquire();
+   current_stage_lock = this;
+}
+
+stage_lock::~stage_lock() {
+   if (saved != nullptr) return;
+   if (held) release();
+   current_stage_lock = nullptr;
+}
+
+void stage_lock::acquire() {
+   if (shared) tree.lock_shared();
+          else tree.lock();
+   held = true;
+}
+
+void stage_lock::release() {
+   held = false;
+   if (shared) tree.unlock_shared();
+          else tree.unlock();
+}
+
+stage_lock::yield::yield(): released (current_stage_lock) {
+   // an outer yield may have let go of it already
+   if (released != nullptr and not released->held) released = nullptr;
+   if (released != nullptr) released->release();
+}
+
+stage_lock::yield::~yield() {
+   if (released != nullptr) released->acquire();
+}
+
+stage_lock::keep::keep() {
+   ++keeping;
+}
+
+stage_lock::keep::~keep() {
+   --keeping;
+}
+
+stage_lock::exclusive::exclusive(): upgraded (current_stage_lock) {
+   if (upgraded == nullptr or not upgraded->shared) {
+      upgraded = nullptr;
+      return;
+   }
+   upgraded->release();
+   upgraded->shared = false;
+   upgraded->acquire();
+}
+
+stage_lock::exclusive::~exclusive() {
+   if (upgraded == nullptr) return;
+   upgraded->release();
+   upgraded->shared = true;
+   upgraded->acquire();
+}
+
+bool stage_lock::kept() {
+   return keeping > 0;
+}
+
+bool stage_lock::pause() {
+   if (kept()) return false;
+   bool let_go = writing_pipe != nullptr and writing_pipe->make_room();
+   stage_lock* current = current_stage_lock;
+   if (current == nullptr or not current->shared
+       or not current->tree.wanted()) return let_go;
+   DEBUGF ('p', "letting a writer have the tree");
+   current->release();
+   current->acquire();
+   return true;
+}
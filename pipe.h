@@ -0,0 +1,164 @@
+// $Id$
+
+#ifndef __PIPE_H__
+#define __PIPE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include <string>
+using namespace std;
+
+#include "tree_lock.h"
+
+//
+// word_pipe -
+//    A bounded queue of batches of text flowing from one stage of a
+//    pipeline to the next.  push blocks while the queue is full and
+//    pop blocks while it is empty, so a pipeline never holds more
+//    than capacity batches no matter how much output goes through
+//    it.  Once the reading side is closed everything pushed is
+//    dropped, and once the writing side is closed pop returns false
+//    as soon as the queue is drained.
+// make_room -
+//    Waits, letting go of the tree, until there is room for another
+//    batch, for a stage which pushed batches over capacity while it
+//    held on to the tree (see stage_lock::keep).  Returns true if it
+//    had to wait.
+//
+
+class word_pipe {
+   private:
+      word_pipe (const word_pipe&) = delete;
+      word_pipe& operator= (const word_pipe&) = delete;
+      mutex queue_lock;
+      condition_variable not_full;
+      condition_variable not_empty;
+      deque<string> batches;
+      size_t capacity;
+      bool write_closed {false};
+      bool read_closed {false};
+   public:
+      static constexpr size_t batch_size = 4096;
+      explicit word_pipe (size_t init_capacity = 16);
+      void push (string&& batch);
+      bool pop (string& batch);
+      bool make_room();
+      void close_write();
+      void close_read();
+};
+
+//
+// pipe_writer -
+//    A streambuf which collects output into batches of batch_size
+//    and pushes each full batch into a word_pipe.  The last partial
+//    batch is pushed and the pipe closed when it is destroyed.  While
+//    it is there, it is the pipe the calling thread writes into (see
+//    stage_lock::pause).
+// pipe_reader -
+//    A streambuf which reads back the batches of a word_pipe, and
+//    closes the reading side when it is destroyed.
+//
+
+class pipe_writer: public streambuf {
+   private:
+      word_pipe& pipe;
+      word_pipe* saved;
+      string batch;
+      void push();
+   protected:
+      int_type overflow (int_type c) override;
+   public:
+      explicit pipe_writer (word_pipe& init_pipe);
+      ~pipe_writer();
+};
+
+class pipe_reader: public streambuf {
+   private:
+      word_pipe& pipe;
+      string batch;
+   protected:
+      int_type underflow() override;
+   public:
+      explicit pipe_reader (word_pipe& init_pipe);
+      ~pipe_reader();
+};
+
+//
+// stage_lock -
+//    Held by a pipeline stage, or by the shell around a command,
+//    while it runs against the tree.  A stage_lock made on a thread
+//    which already holds one does nothing, so commands may run other
+//    commands.  A command which only reads the tree may share the
+//    lock with others like it; anything else holds it alone.
+//    Whenever a pipe has to wait for the other end, the lock of the
+//    stage running on that thread is let go (see yield), so a stage
+//    blocked on its neighbour never keeps the others off the tree.
+// stage_lock::yield -
+//    Releases the calling thread's stage_lock, if it has one, for
+//    as long as it is in scope.
+// stage_lock::keep -
+//    Keeps the calling thread's stage_lock for as long as it is in
+//    scope, for a stage writing out what it holds references into
+//    the tree for, such as the entries of a directory or the words
+//    of a file, which another stage changing the tree would leave
+//    dangling.  A pipe which fills up meanwhile takes the batches
+//    anyway rather than letting go of the tree, so it holds at most
+//    what was kept: one listing, or one file.  Nothing may be read
+//    from a pipe while it is kept.
+// stage_lock::exclusive -
+//    Holds the calling thread's stage_lock alone for as long as it is
+//    in scope, letting go of a shared one and waiting for its turn,
+//    so a reader can make a change nobody sees, such as reading a
+//    borrowed directory in.  Nothing of the tree held from before
+//    may be relied on afterwards but the inodes themselves.
+// kept -
+//    Whether the calling thread is keeping its stage_lock.
+// pause -
+//    Called by a command between one directory or file and the next,
+//    where it holds nothing of the tree: waits for room in the pipe
+//    the thread writes into, if it is full, and if the lock is shared,
+//    lets any writer waiting for it have its turn first.  Returns
+//    true if it let go of the tree, which may have changed since.
+//
+
+class stage_lock {
+   private:
+      stage_lock (const stage_lock&) = delete;
+      stage_lock& operator= (const stage_lock&) = delete;
+      tree_lock& tree;
+      bool shared;
+      bool held {false};
+      stage_lock* saved;
+      void acquire();
+      void release();
+   public:
+      explicit stage_lock (tree_lock& init_tree,
+                           bool init_shared = false);
+      ~stage_lock();
+      class yield {
+         private:
+            stage_lock* released;
+         public:
+            yield();
+            ~yield();
+      };
+      class keep {
+         public:
+            keep();
+            ~keep();
+      };
+      class exclusive {
+         private:
+            stage_lock* upgraded;
+         public:
+            exclusive();
+            ~exclusive();
+      };
+      static bool kept();
+      static bool pause();
+};
+
+#endif
+
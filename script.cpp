@@ -0,0 +1,367 @@
+// $Id$
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+using namespace std;
+
+#include "debug.h"
+#include "script.h"
+#include "storage.h"
+
+static const string script_magic {"YSB\1"};
+
+// WRITING ============================================================
+
+static void put_number (ostream& out, uint64_t number) {
+   // seven bits at a time, high bit set on all but the last byte
+   while (number >= 0x80) {
+      out.put (static_cast<char> ((number & 0x7F) | 0x80));
+      number >>= 7;
+   }
+   out.put (static_cast<char> (number));
+}
+
+static void put_words (ostream& out, const wordvec& words) {
+   put_number (out, words.size());
+   for (const string& word: words) {
+      put_number (out, word.size());
+      out.write (word.data(), word.size());
+   }
+}
+
+/**
+ * Splits a path argument the way get_full_path would, but only once.
+ * Only a first name which is exactly "." or ".." is an anchor; one
+ * like ".hidden" is looked up in the cwd like any other.
+ * @param  path the path as written in the script
+ * @return      the anchor and the names to look up from it
+ */
+static script_path compile_path (const string& path) {
+   script_path compiled;
+   compiled.names = parse_path (path);
+   const string* first = compiled.names.empty()
+                       ? nullptr : &compiled.names.front();
+   if (path.find ("/") == 0) {
+      compiled.anchor = ANCHOR_ROOT;
+   } else if (first != nullptr and *first == "..") {
+      compiled.anchor = ANCHOR_PARENT;
+   } else if (first != nullptr and *first == ".") {
+      compiled.anchor = ANCHOR_CWD;
+   } else {
+      compiled.anchor = ANCHOR_CWD;
+      return compiled;
+   }
+   // the first name is the root, "." or "..", already in the anchor
+   if (not compiled.names.empty()) {
+      compiled.names.erase (compiled.names.begin());
+   }
+   return compiled;
+}
+
+/**
+ * Picks the handler for a line and pre-parses its paths
+ * @param  words  the split line
+ * @param  cmdmap the commands, to tell known ones from unknown ones
+ * @return        the compiled line, without its command bound
+ */
+static script_line compile_line (const wordvec& words,
+                                 commands& cmdmap) {
+   script_line line;
+   line.words = words;
+   line.op = SCRIPT_CALL;
+
+   // time and a job are seen to by commands::execute, before it
+   // looks at the command itself
+   if (words.size() > 1
+       and (words.front() == "time" or words.back() == "&")) {
+      line.op = SCRIPT_LINE;
+      return line;
+   }
+   for (const string& word: words) {
+      if (word == "|" or word == ">" or word == ">>") {
+         line.op = SCRIPT_LINE;
+         return line;
+      }
+   }
+   try {
+      cmdmap.at (words.at (0));
+   }catch (yshell_exn&) {
+      line.op = SCRIPT_LINE;
+      return line;
+   }
+
+   const string& cmd = words.at (0);
+   if (cmd == "cd" and words.size() == 2) {
+      line.op = SCRIPT_CD;
+   } else if (cmd == "ls" or cmd == "lsr") {
+      // options, and whatever looks like one, are left to fn_ls to
+      // make sense of, so only plain lists of paths are pre-parsed
+      bool options = any_of (words.begin() + 1, words.end(),
+                             [] (const string& word) {
+                                return word.front() == '-';
+                             });
+      if (not options) line.op = cmd == "ls" ? SCRIPT_LS : SCRIPT_LSR;
+   } else if (cmd == "make" and words.size() > 1) {
+      line.op = SCRIPT_MAKE;
+      line.data.assign (words.begin() + 2, words.end());
+   } else if (cmd == "pwd") {
+      line.op = SCRIPT_PWD;
+   } else if (cmd == "echo") {
+      line.op = SCRIPT_ECHO;
+      line.data.assign (words.begin() + 1, words.end());
+   }
+
+   switch (line.op) {
+      case SCRIPT_CD: case SCRIPT_LS: case SCRIPT_LSR:
+         for (auto it = words.begin() + 1; it != words.end(); ++it) {
+            line.paths.push_back (compile_path (*it));
+         }
+         break;
+      case SCRIPT_MAKE:
+         line.paths.push_back (compile_path (words.at (1)));
+         // make /, and the like, is left to fn_make to complain about
+         if (line.paths.back().names.empty()) line.op = SCRIPT_CALL;
+         break;
+      default:
+         break;
+   }
+   return line;
+}
+
+/**
+ * Compiles a text script into the compact form read by load_script
+ * @param text_file the script, one command per line
+ * @param out_file  where to write the compiled script
+ */
+void compile_script (const string& text_file, const string& out_file) {
+   ifstream in (text_file);
+   if (not in) throw yshell_exn (text_file + ": cannot open script");
+   commands cmdmap;
+   compiled_script script;
+   string text;
+   while (getline (in, text)) {
+      wordvec words = split (text, " \t");
+      if (words.empty() or words.front().at (0) == '#') continue;
+      script.push_back (compile_line (words, cmdmap));
+   }
+
+   ofstream out (out_file, ios::binary);
+   if (not out) throw yshell_exn (out_file + ": cannot write script");
+   out << script_magic;
+   put_number (out, script.size());
+   for (const script_line& line: script) {
+      out.put (static_cast<char> (line.op));
+      put_words (out, line.words);
+      put_number (out, line.paths.size());
+      for (const script_path& path: line.paths) {
+         out.put (static_cast<char> (path.anchor));
+         put_words (out, path.names);
+      }
+   }
+   DEBUGF ('s', text_file << ": compiled " << script.size()
+           << " lines into " << out_file);
+}
+
+// READING ============================================================
+
+//
+// script_reader -
+//    Decodes a compiled script held in memory.
+//
+
+class script_reader {
+   private:
+      const string& bytes;
+      size_t pos {0};
+      const string& name;
+      void need (size_t count) {
+         if (bytes.size() - pos < count) {
+            throw yshell_exn (name + ": truncated script");
+         }
+      }
+   public:
+      script_reader (const string& init_bytes, const string& init_name):
+         bytes (init_bytes), name (init_name) {}
+      void skip (size_t count) {
+         need (count);
+         pos += count;
+      }
+      uint8_t byte() {
+         need (1);
+         return static_cast<uint8_t> (bytes[pos++]);
+      }
+      uint64_t number() {
+         uint64_t number = 0;
+         for (int shift = 0; ; shift += 7) {
+            uint8_t next = byte();
+            number |= uint64_t (next & 0x7F) << shift;
+            if (not (next & 0x80)) return number;
+         }
+      }
+      wordvec words() {
+         wordvec words (number());
+         for (string& word: words) {
+            size_t size = number();
+            need (size);
+            word.assign (bytes, pos, size);
+            pos += size;
+         }
+         return words;
+      }
+};
+
+/**
+ * Reads a compiled script and binds each line to its command_fn, so
+ * running it never looks a command up by name
+ * @param  file   the compiled script
+ * @param  cmdmap the commands to bind to
+ * @return        the lines of the script
+ */
+compiled_script load_script (const string& file, commands& cmdmap) {
+   ifstream in (file, ios::binary);
+   if (not in) throw yshell_exn (file + ": cannot open script");
+   string bytes {istreambuf_iterator<char> (in),
+                 istreambuf_iterator<char>()};
+   if (bytes.compare (0, script_magic.size(), script_magic) != 0) {
+      throw yshell_exn (file + ": not a compiled script");
+   }
+
+   script_reader reader (bytes, file);
+   reader.skip (script_magic.size());
+   compiled_script script (reader.number());
+   for (script_line& line: script) {
+      line.op = static_cast<script_op> (reader.byte());
+      line.words = reader.words();
+      line.paths.resize (reader.number());
+      for (script_path& path: line.paths) {
+         path.anchor = static_cast<script_anchor> (reader.byte());
+         path.names = reader.words();
+      }
+      if (line.words.empty()) throw yshell_exn (file + ": empty line");
+      if (line.op == SCRIPT_LINE) continue;
+      line.fn = cmdmap.at (line.words.front());
+      if (line.op == SCRIPT_MAKE) {
+         line.data.assign (line.words.begin() + 2, line.words.end());
+      } else if (line.op == SCRIPT_ECHO) {
+         line.data.assign (line.words.begin() + 1, line.words.end());
+      }
+   }
+   DEBUGF ('s', file << ": loaded " << script.size() << " lines");
+   return script;
+}
+
+// RUNNING ============================================================
+
+/**
+ * Looks up a pre-parsed path, one lookup per name
+ * @param  path      the compiled path
+ * @param  state     the current inode state
+ * @param  skip_last how many names at the end not to look up
+ * @return           the node, or no_node if the path does not exist
+ */
+static node_id resolve (const script_path& path, inode_state& state,
+                        size_t skip_last = 0) {
+   storage& store = state.get_storage();
+   node_id node = no_node;
+   switch (path.anchor) {
+      case ANCHOR_ROOT:   node = store.root(); break;
+      case ANCHOR_CWD:    node = state.get_cwd(); break;
+      case ANCHOR_PARENT: node = store.parent (state.get_cwd()); break;
+   }
+   size_t count = path.names.size() - skip_last;
+   for (size_t i = 0; i < count and node != no_node; ++i) {
+      node = store.lookup (node, path.names[i]);
+   }
+   return node;
+}
+
+/**
+ * Runs one compiled line. Whenever a path does not resolve the line
+ * falls back to its command_fn, which reports the error.
+ */
+static void run_line (const script_line& line, commands& cmdmap,
+                      inode_state& state) {
+   storage& store = state.get_storage();
+   switch (line.op) {
+      case SCRIPT_LINE:
+         cmdmap.execute (state, line.words);
+         return;
+      case SCRIPT_CALL:
+         break;
+      case SCRIPT_CD: {
+         node_id node = resolve (line.paths.front(), state);
+         if (node == no_node or store.stat (node).type != DIR_INODE) {
+            break;
+         }
+         state.set_cwd (node);
+         return;
+      }
+      case SCRIPT_LS: case SCRIPT_LSR: {
+         if (line.paths.empty()) {
+            if (line.op == SCRIPT_LS) {
+               list_directory (state, state.get_cwd());
+            } else {
+               list_recursive (state, state.get_cwd());
+            }
+            return;
+         }
+         for (size_t i = 0; i < line.paths.size(); ++i) {
+            node_id node = resolve (line.paths[i], state);
+            if (node == no_node) {
+               cout << "error: " << line.words[i + 1]
+                    << " does not exist" << endl;
+            } else if (line.op == SCRIPT_LS) {
+               list_directory (state, node);
+            } else {
+               list_recursive (state, node);
+            }
+         }
+         return;
+      }
+      case SCRIPT_MAKE: {
+         const script_path& path = line.paths.front();
+         node_id dir = resolve (path, state, 1);
+         if (dir == no_node or store.stat (dir).type != DIR_INODE) {
+            break;
+         }
+         const string& name = path.names.back();
+         node_id file = store.lookup (dir, name);
+         if (file == no_node) {
+            file = state.make (dir, name, PLAIN_INODE);
+         }
+         if (file == no_node or store.stat (file).type != PLAIN_INODE) {
+            break;
+         }
+         state.write (file, line.data);
+         return;
+      }
+      case SCRIPT_PWD:
+         yout() << state.get_path() << endl;
+         return;
+      case SCRIPT_ECHO:
+         yout() << line.data << endl;
+         return;
+   }
+   line.fn (state, line.words);
+}
+
+/**
+ * Runs every line of a loaded script in order
+ * @param script the loaded script
+ * @param cmdmap the commands, for lines that need commands::execute
+ * @param state  the current inode state
+ */
+void run_script (const compiled_script& script, commands& cmdmap,
+                 inode_state& state) {
+   for (const script_line& line: script) {
+      try {
+         run_line (line, cmdmap, state);
+      }catch (yshell_exn& exn) {
+         complain() << exn.what() << endl;
+      }
+   }
+}
+
@@ -0,0 +1,83 @@
+// $Id$
+
+#ifndef __SCRIPT_H__
+#define __SCRIPT_H__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "commands.h"
+#include "inode.h"
+#include "util.h"
+
+//
+// script_op -
+//    What a compiled line does.  SCRIPT_LINE lines (pipelines,
+//    redirections, jobs, timed lines and unknown commands) go through
+//    commands::execute, SCRIPT_CALL lines call their bound
+//    command_fn directly, and the rest are handled by the script
+//    interpreter itself using their pre-parsed paths.  An ls or lsr
+//    with options is a SCRIPT_CALL.
+//
+
+enum script_op: uint8_t {
+   SCRIPT_LINE, SCRIPT_CALL, SCRIPT_CD, SCRIPT_LS, SCRIPT_LSR,
+   SCRIPT_MAKE, SCRIPT_PWD, SCRIPT_ECHO,
+};
+
+//
+// script_path -
+//    A path argument split once when the script is compiled.  The
+//    anchor is where it starts from: the root, the cwd, or the
+//    parent of the cwd.
+//
+
+enum script_anchor: uint8_t {
+   ANCHOR_ROOT, ANCHOR_CWD, ANCHOR_PARENT,
+};
+
+struct script_path {
+   script_anchor anchor;
+   wordvec names;
+};
+
+//
+// script_line -
+//    One compiled command.  words is the whole command line, paths
+//    are the pre-parsed path arguments and data is the rest of the
+//    arguments (the contents for make, the words for echo).  fn is
+//    bound when the script is loaded and is also used whenever a
+//    pre-parsed path does not resolve, so errors are reported
+//    exactly as the interpreter would report them.
+//
+
+struct script_line {
+   script_op op;
+   wordvec words;
+   vector<script_path> paths;
+   wordvec data;
+   command_fn fn {nullptr};
+};
+
+using compiled_script = vector<script_line>;
+
+//
+// compile_script -
+//    Tokenizes a text script and writes it in compiled form.
+//    Throws yshell_exn if either file cannot be opened.
+// load_script -
+//    Reads a compiled script and binds every line to its command.
+// run_script -
+//    Runs a loaded script in a tight loop, reporting errors on a
+//    line the same way the main loop does and going on.
+//
+
+void compile_script (const string& text_file, const string& out_file);
+compiled_script load_script (const string& file, commands& cmdmap);
+void run_script (const compiled_script& script, commands& cmdmap,
+                 inode_state& state);
+
+#endif
+
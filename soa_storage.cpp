@@ -0,0 +1,110 @@
+// $Id$
+
+using namespace std;
+
+#include "soa_storage.h"
+
+static node_id node_id_of (soa_tree::node_id node) {
+   return node == soa_tree::no_node ? no_node : node;
+}
+
+soa_tree::node_id soa_storage::node_of (node_id node) const {
+   if (node >= soa_tree::no_node or not tree.exists (node)) {
+      throw yshell_exn ("node " + to_string (node) + ": no such node");
+   }
+   return node;
+}
+
+soa_tree::node_id soa_storage::dir_of (node_id node) const {
+   soa_tree::node_id dir = node_of (node);
+   if (tree.type (dir) != DIR_INODE) {
+      throw yshell_exn (tree.name (dir) + ": not a directory");
+   }
+   return dir;
+}
+
+node_info soa_storage::info_of (soa_tree::node_id node) const {
+   node_info info;
+   info.node = node;
+   info.inode_nr = tree.inode_nr (node);
+   info.type = tree.type (node);
+   info.size = tree.size (node);
+   info.name = &tree.name (node);
+   return info;
+}
+
+node_id soa_storage::root() {
+   return tree.root();
+}
+
+node_id soa_storage::parent (node_id node) {
+   return tree.parent (node_of (node));
+}
+
+const string& soa_storage::name (node_id node) {
+   return tree.name (node_of (node));
+}
+
+node_info soa_storage::stat (node_id node) {
+   return info_of (node_of (node));
+}
+
+node_id soa_storage::find_number (uint64_t inode_nr) {
+   return node_id_of (tree.find_inode (inode_nr));
+}
+
+node_id soa_storage::lookup (node_id dir, const string& name) {
+   soa_tree::node_id node = node_of (dir);
+   if (tree.type (node) != DIR_INODE) return no_node;
+   return node_id_of (tree.lookup (node, name));
+}
+
+node_id soa_storage::create (node_id dir, const string& name,
+                             inode_t type) {
+   return node_id_of (tree.make (dir_of (dir), name, type));
+}
+
+void soa_storage::list (node_id dir, const visitor& visit) {
+   for (soa_tree::node_id child = tree.first_child (dir_of (dir));
+        child != soa_tree::no_node; child = tree.next_sibling (child)) {
+      visit (info_of (child));
+   }
+}
+
+/**
+ * Walks the sibling list up to the window, which is in name order
+ * but cannot be seeked into, and stops at its end
+ */
+void soa_storage::list_range (node_id dir, const string& after,
+                              size_t skip, size_t count,
+                              const visitor& visit) {
+   soa_tree::node_id child = tree.child_after (dir_of (dir), after,
+                                               skip);
+   for (; child != soa_tree::no_node and count > 0;
+        child = tree.next_sibling (child)) {
+      --count;
+      visit (info_of (child));
+   }
+}
+
+const wordvec& soa_storage::read (node_id file) {
+   return tree.read (node_of (file));
+}
+
+void soa_storage::write (node_id file, const wordvec& words) {
+   tree.write (node_of (file), words);
+}
+
+void soa_storage::append (node_id file, const wordvec& words) {
+   tree.append (node_of (file), words);
+}
+
+void soa_storage::remove (node_id dir, const string& name,
+                          bool recursive) {
+   tree.remove (dir_of (dir), name, recursive);
+}
+
+
+memory_use soa_storage::memory() {
+   return tree.memory();
+}
@@ -0,0 +1,47 @@
+// $Id$
+
+#ifndef __SOA_STORAGE_H__
+#define __SOA_STORAGE_H__
+
+#include <string>
+using namespace std;
+
+#include "soa_tree.h"
+#include "storage.h"
+
+//
+// soa_storage -
+//    The tree as a soa_tree.  A node_id is the node's index in the
+//    arrays.  Nodes freed by remove are used again, so a node_id is
+//    only good for as long as its node is there.  Nothing is shared,
+//    so copy and checkpoints go through the tree node by node.
+//
+
+class soa_storage: public storage {
+   private:
+      soa_tree tree;
+      soa_tree::node_id node_of (node_id node) const;
+      soa_tree::node_id dir_of (node_id node) const;
+      node_info info_of (soa_tree::node_id node) const;
+   public:
+      node_id root() override;
+      node_id parent (node_id node) override;
+      const string& name (node_id node) override;
+      node_info stat (node_id node) override;
+      node_id find_number (uint64_t inode_nr) override;
+      node_id lookup (node_id dir, const string& name) override;
+      node_id create (node_id dir, const string& name,
+                      inode_t type) override;
+      void list (node_id dir, const visitor& visit) override;
+      void list_range (node_id dir, const string& after, size_t skip,
+                       size_t count, const visitor& visit) override;
+      const wordvec& read (node_id file) override;
+      void write (node_id file, const wordvec& words) override;
+      void append (node_id file, const wordvec& words) override;
+      void remove (node_id dir, const string& name,
+                   bool recursive) override;
+      memory_use memory() override;
+};
+
+#endif
+
@@ -0,0 +1,423 @@
+// $Id$
+
+#include <algorithm>
+
+using namespace std;
+
+#include "debug.h"
+#include "soa_tree.h"
+
+constexpr soa_tree::node_id soa_tree::no_node;
+static constexpr uint32_t no_file = UINT32_MAX;
+static constexpr uint32_t no_index = UINT32_MAX;
+
+soa_tree::soa_tree() {
+   // inode numbers start at 1
+   nodes_by_nr.push_back (no_node);
+   new_node (0, DIR_INODE, "");
+}
+
+/**
+ * Finds the pool index of a name, adding it to the pool if it is new
+ * @param  name the name
+ * @return      its index in names
+ */
+uint32_t soa_tree::intern (const string& name) {
+   auto found = name_index.find (name);
+   if (found != name_index.end()) return found->second;
+   uint32_t name_id = names.size();
+   names.push_back (name);
+   name_index.emplace (name, name_id);
+   return name_id;
+}
+
+/**
+ * Takes a node off the free list, or adds one to the end of the
+ * arrays, and fills it in. It is not linked into its directory.
+ * @return the new node
+ */
+soa_tree::node_id soa_tree::new_node (node_id parent, inode_t type,
+                                      const string& name) {
+   node_id node;
+   if (free_nodes.empty()) {
+      node = parents.size();
+      inode_nrs.push_back (0);
+      parents.push_back (0);
+      types.push_back (0);
+      name_ids.push_back (0);
+      first_children.push_back (no_node);
+      next_siblings.push_back (no_node);
+      sizes.push_back (0);
+      file_ids.push_back (no_file);
+      index_ids.push_back (no_index);
+   } else {
+      node = free_nodes.back();
+      free_nodes.pop_back();
+   }
+   inode_nrs[node] = next_inode_nr++;
+   nodes_by_nr.push_back (node);
+   parents[node] = parent;
+   types[node] = type;
+   name_ids[node] = intern (name);
+   first_children[node] = no_node;
+   next_siblings[node] = no_node;
+   sizes[node] = 0;
+   file_ids[node] = no_file;
+   index_ids[node] = no_index;
+   if (type == PLAIN_INODE) {
+      if (free_files.empty()) {
+         file_ids[node] = files.size();
+         files.emplace_back();
+      } else {
+         file_ids[node] = free_files.back();
+         free_files.pop_back();
+      }
+   } else if (free_indexes.empty()) {
+      index_ids[node] = indexes.size();
+      indexes.emplace_back();
+   } else {
+      index_ids[node] = free_indexes.back();
+      free_indexes.pop_back();
+   }
+   ++live_nodes;
+   return node;
+}
+
+/**
+ * Puts a node and everything under it on the free lists
+ * @param node the node, already unlinked from its directory
+ */
+void soa_tree::free_subtree (node_id node) {
+   for (node_id child = first_children[node]; child != no_node; ) {
+      node_id next = next_siblings[child];
+      free_subtree (child);
+      child = next;
+   }
+   if (file_ids[node] != no_file) {
+      wordvec().swap (files[file_ids[node]]);
+      free_files.push_back (file_ids[node]);
+      file_ids[node] = no_file;
+   }
+   if (index_ids[node] != no_index) {
+      vector<node_id>().swap (indexes[index_ids[node]]);
+      free_indexes.push_back (index_ids[node]);
+      index_ids[node] = no_index;
+   }
+   first_children[node] = no_node;
+   nodes_by_nr[inode_nrs[node]] = no_node;
+   inode_nrs[node] = 0;
+   free_nodes.push_back (node);
+   --live_nodes;
+}
+
+soa_tree::node_id soa_tree::root() const {
+   return 0;
+}
+
+size_t soa_tree::size() const {
+   return live_nodes;
+}
+
+/**
+ * Finds where a name is, or would go, in a directory's index
+ * @param  dir  the directory
+ * @param  name the name
+ * @return      the position of the first child whose name is not
+ *              less than name
+ */
+size_t soa_tree::position (node_id dir, const string& name) const {
+   const vector<node_id>& index = indexes[index_ids[dir]];
+   auto found = lower_bound (index.begin(), index.end(), name,
+                             [this] (node_id child, const string& key) {
+                                return names[name_ids[child]] < key;
+                             });
+   return found - index.begin();
+}
+
+/**
+ * Finds a child by a binary search of the directory's index
+ * @param  dir  the directory
+ * @param  name the name of the child
+ * @return      the child, or no_node
+ */
+soa_tree::node_id soa_tree::lookup (node_id dir,
+                                    const string& name) const {
+   if (name == ".") return dir;
+   if (name == "..") return parents[dir];
+   const vector<node_id>& index = indexes[index_ids[dir]];
+   size_t at = position (dir, name);
+   if (at == index.size() or names[name_ids[index[at]]] != name) {
+      return no_node;
+   }
+   return index[at];
+}
+
+/**
+ * Seeks in a directory's index to where a window of it starts
+ * @param  dir   the directory
+ * @param  after the name the window comes after, or ""
+ * @param  skip  how many children after it to leave out
+ * @return       the first child of the window, or no_node
+ */
+soa_tree::node_id soa_tree::child_after (node_id dir,
+                                         const string& after,
+                                         size_t skip) const {
+   const vector<node_id>& index = indexes[index_ids[dir]];
+   size_t at = position (dir, after);
+   if (at < index.size() and names[name_ids[index[at]]] == after) {
+      ++at;
+   }
+   if (skip >= index.size() - at) return no_node;
+   return index[at + skip];
+}
+
+/**
+ * Makes a new node in a directory, keeping its children in name order
+ * @param  dir  the directory
+ * @param  name the name of the new node
+ * @param  type a directory or a plain file
+ * @return      the new node, or no_node if the name is taken
+ */
+soa_tree::node_id soa_tree::make (node_id dir, const string& name,
+                                  inode_t type) {
+   if (types[dir] != DIR_INODE) {
+      throw yshell_exn (names[name_ids[dir]] + ": not a directory");
+   }
+   if (name.empty() or name == "." or name == "..") return no_node;
+   size_t at = position (dir, name);
+   const vector<node_id>& index = indexes[index_ids[dir]];
+   if (at < index.size() and names[name_ids[index[at]]] == name) {
+      return no_node;
+   }
+   node_id prev = at == 0 ? no_node : index[at - 1];
+   node_id next = at == index.size() ? no_node : index[at];
+   // making a directory may move the indexes
+   node_id node = new_node (dir, type, name);
+   vector<node_id>& grown = indexes[index_ids[dir]];
+   grown.insert (grown.begin() + at, node);
+   next_siblings[node] = next;
+   if (prev == no_node) first_children[dir] = node;
+                   else next_siblings[prev] = node;
+   ++sizes[dir];
+   DEBUGF ('s', "made " << name << " as node " << node);
+   return node;
+}
+
+/**
+ * Removes a child of a directory
+ * @param dir       the directory
+ * @param name      the name of the child
+ * @param recursive true to remove a directory that is not empty
+ */
+void soa_tree::remove (node_id dir, const string& name,
+                       bool recursive) {
+   if (name == "." or name == "..") {
+      throw yshell_exn (name + ": cannot be removed");
+   }
+   vector<node_id>& index = indexes[index_ids[dir]];
+   size_t at = position (dir, name);
+   if (at == index.size() or names[name_ids[index[at]]] != name) {
+      throw yshell_exn (name + ": no such file or directory");
+   }
+   node_id node = index[at];
+   if (not recursive and types[node] == DIR_INODE and sizes[node] > 0) {
+      throw yshell_exn (name + ": directory not empty");
+   }
+   node_id prev = at == 0 ? no_node : index[at - 1];
+   index.erase (index.begin() + at);
+   if (prev == no_node) first_children[dir] = next_siblings[node];
+                   else next_siblings[prev] = next_siblings[node];
+   --sizes[dir];
+   free_subtree (node);
+}
+
+inode_t soa_tree::type (node_id node) const {
+   return static_cast<inode_t> (types[node]);
+}
+
+const string& soa_tree::name (node_id node) const {
+   return names[name_ids[node]];
+}
+
+soa_tree::node_id soa_tree::parent (node_id node) const {
+   return parents[node];
+}
+
+soa_tree::node_id soa_tree::first_child (node_id dir) const {
+   return first_children[dir];
+}
+
+soa_tree::node_id soa_tree::next_sibling (node_id node) const {
+   return next_siblings[node];
+}
+
+uint64_t soa_tree::size (node_id node) const {
+   return sizes[node];
+}
+
+uint64_t soa_tree::inode_nr (node_id node) const {
+   return inode_nrs[node];
+}
+
+bool soa_tree::exists (node_id node) const {
+   return node < inode_nrs.size() and inode_nrs[node] != 0;
+}
+
+soa_tree::node_id soa_tree::find_inode (uint64_t inode_nr) const {
+   if (inode_nr >= nodes_by_nr.size()) return no_node;
+   return nodes_by_nr[inode_nr];
+}
+
+const wordvec& soa_tree::read (node_id file) const {
+   if (file_ids[file] == no_file) {
+      throw yshell_exn (names[name_ids[file]] + ": is a directory");
+   }
+   return files[file_ids[file]];
+}
+
+void soa_tree::write (node_id file, const wordvec& words) {
+   if (file_ids[file] == no_file) {
+      throw yshell_exn (names[name_ids[file]] + ": is a directory");
+   }
+   files[file_ids[file]] = words;
+   sizes[file] = words.size();
+}
+
+void soa_tree::append (node_id file, const wordvec& words) {
+   if (file_ids[file] == no_file) {
+      throw yshell_exn (names[name_ids[file]] + ": is a directory");
+   }
+   wordvec& data = files[file_ids[file]];
+   data.insert (data.end(), words.begin(), words.end());
+   sizes[file] = data.size();
+}
+
+template <typename item_t>
+static uint64_t array_bytes (const vector<item_t>& array) {
+   return array.capacity() * sizeof (item_t);
+}
+
+/**
+ * Adds up the capacity of every array, what the words and names
+ * hold on the heap, and the name index's nodes and buckets, each
+ * node a next pointer and the cached hash ahead of its key and value
+ * @return what each part of the tree takes
+ */
+memory_use soa_tree::memory() const {
+   uint64_t headers = 0, chars = 0, pool = 0, index = 0, children = 0;
+   for (const vector<node_id>& entries: indexes) {
+      children += array_bytes (entries);
+   }
+   for (const wordvec& words: files) {
+      headers += array_bytes (words);
+      for (const string& word: words) chars += heap_bytes (word);
+   }
+   for (const string& name: names) pool += heap_bytes (name);
+   for (const auto& entry: name_index) {
+      index += heap_bytes (entry.first);
+   }
+   index += name_index.size() * (2 * sizeof (void*)
+                                 + sizeof (*name_index.begin()))
+          + name_index.bucket_count() * sizeof (void*);
+   memory_use use;
+   use.inodes = live_nodes;
+   use.bytes = {
+      {"node arrays", array_bytes (inode_nrs) + array_bytes (parents)
+                      + array_bytes (nodes_by_nr)
+                      + array_bytes (types) + array_bytes (name_ids)
+                      + array_bytes (first_children)
+                      + array_bytes (next_siblings)
+                      + array_bytes (sizes) + array_bytes (file_ids)
+                      + array_bytes (index_ids)},
+      {"free lists", array_bytes (free_nodes)
+                     + array_bytes (free_files)
+                     + array_bytes (free_indexes)},
+      {"child indexes", array_bytes (indexes) + children},
+      {"file slots", array_bytes (files)},
+      {"word headers", headers},
+      {"word characters", chars},
+      {"name pool", array_bytes (names) + pool},
+      {"name index", index},
+   };
+   return use;
+}
+
+/**
+ * Renumbers the nodes depth first, placing all of a directory's
+ * children next to each other in name order before going down into
+ * the first of them. A traversal such as lsr then moves through the
+ * arrays in one direction. Free nodes are dropped.
+ */
+void soa_tree::compact() {
+   vector<node_id> order;
+   order.reserve (live_nodes);
+   order.push_back (root());
+   vector<node_id> pending {root()};
+   vector<node_id> subdirs;
+   while (not pending.empty()) {
+      node_id dir = pending.back();
+      pending.pop_back();
+      subdirs.clear();
+      for (node_id child = first_children[dir]; child != no_node;
+           child = next_siblings[child]) {
+         order.push_back (child);
+         if (types[child] == DIR_INODE) subdirs.push_back (child);
+      }
+      pending.insert (pending.end(), subdirs.rbegin(), subdirs.rend());
+   }
+
+   vector<node_id> renumber (parents.size(), no_node);
+   for (size_t i = 0; i < order.size(); ++i) renumber[order[i]] = i;
+   auto moved = [&renumber] (node_id node) {
+      return node == no_node ? no_node : renumber[node];
+   };
+
+   size_t count = order.size();
+   vector<uint64_t> new_inode_nrs (count);
+   vector<node_id> new_parents (count);
+   vector<uint8_t> new_types (count);
+   vector<uint32_t> new_name_ids (count);
+   vector<node_id> new_first_children (count);
+   vector<node_id> new_next_siblings (count);
+   vector<uint64_t> new_sizes (count);
+   vector<uint32_t> new_file_ids (count, no_file);
+   vector<wordvec> new_files;
+   vector<uint32_t> new_index_ids (count, no_index);
+   vector<vector<node_id>> new_indexes;
+   for (size_t i = 0; i < count; ++i) {
+      node_id old = order[i];
+      new_inode_nrs[i] = inode_nrs[old];
+      nodes_by_nr[inode_nrs[old]] = i;
+      new_parents[i] = moved (parents[old]);
+      new_types[i] = types[old];
+      new_name_ids[i] = name_ids[old];
+      new_first_children[i] = moved (first_children[old]);
+      new_next_siblings[i] = moved (next_siblings[old]);
+      new_sizes[i] = sizes[old];
+      if (file_ids[old] != no_file) {
+         new_file_ids[i] = new_files.size();
+         new_files.push_back (move (files[file_ids[old]]));
+      }
+      if (index_ids[old] != no_index) {
+         new_index_ids[i] = new_indexes.size();
+         new_indexes.push_back (move (indexes[index_ids[old]]));
+         for (node_id& child: new_indexes.back()) child = moved (child);
+      }
+   }
+   inode_nrs.swap (new_inode_nrs);
+   parents.swap (new_parents);
+   types.swap (new_types);
+   name_ids.swap (new_name_ids);
+   first_children.swap (new_first_children);
+   next_siblings.swap (new_next_siblings);
+   sizes.swap (new_sizes);
+   file_ids.swap (new_file_ids);
+   files.swap (new_files);
+   index_ids.swap (new_index_ids);
+   indexes.swap (new_indexes);
+   free_nodes.clear();
+   free_files.clear();
+   free_indexes.clear();
+   DEBUGF ('s', "compacted to " << count << " nodes");
+}
+
@@ -0,0 +1,123 @@
+// $Id$
+
+#ifndef __SOA_TREE_H__
+#define __SOA_TREE_H__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "inode.h"
+#include "storage.h"
+#include "util.h"
+
+//
+// soa_tree -
+//    The whole tree kept as parallel arrays indexed by node number,
+//    instead of as separate inode, directory and map node objects
+//    reached through shared_ptrs.  A node is its parent, type, name
+//    (an index into a pool of names, each kept once), first child,
+//    next sibling, size and inode number, plus the words of a plain
+//    file.  Children are kept in name order on their sibling list,
+//    so listings come out in the same order as from a directory, and
+//    each directory also has an index of its children in that order,
+//    so that finding one by name is a binary search.
+//    Traversals read the arrays instead of chasing pointers, and
+//    after compact they read them front to back.
+// node_id -
+//    The index of a node in the arrays.  no_node is a null node.
+// root -
+//    The root directory, whose parent is itself.
+// lookup -
+//    Finds a child of a directory by name, or no_node.
+// child_after -
+//    The first child of a directory whose name comes after a name
+//    (the first child if it is ""), less the first skip of those,
+//    or no_node.
+// make -
+//    Makes a new directory or plain file in a directory, or returns
+//    no_node if the name is already there.
+// remove -
+//    Removes a child of a directory, and with recursive everything
+//    under it.  Throws a yshell_exn the same way directory::remove
+//    and remove_recursive do.  The node numbers of what is removed
+//    are used again for the next nodes made.
+// first_child, next_sibling -
+//    Walk the children of a directory in name order.
+// size, inode_nr -
+//    What ls shows about a node.
+// exists -
+//    Whether a node is in use, rather than free or out of range.
+// find_inode -
+//    The node with an inode number, or no_node, from an array
+//    indexed by inode number, which has a slot for every number
+//    handed out so far.
+// read, write, append -
+//    The words of a plain file.
+// memory -
+//    What the arrays, the files' words, the child indexes and the
+//    pool of names take.
+// compact -
+//    Renumbers the nodes in depth first order, with each directory's
+//    children next to each other, so that a traversal of the tree
+//    is a linear pass over the arrays.  Invalidates node_ids.
+//
+
+class soa_tree {
+   public:
+      using node_id = uint32_t;
+      static constexpr node_id no_node = UINT32_MAX;
+   private:
+      vector<uint64_t> inode_nrs;
+      vector<node_id> nodes_by_nr;
+      vector<node_id> parents;
+      vector<uint8_t> types;
+      vector<uint32_t> name_ids;
+      vector<node_id> first_children;
+      vector<node_id> next_siblings;
+      vector<uint64_t> sizes;
+      vector<uint32_t> file_ids;
+      vector<wordvec> files;
+      vector<uint32_t> index_ids;
+      vector<vector<node_id>> indexes;
+      vector<string> names;
+      unordered_map<string,uint32_t> name_index;
+      vector<node_id> free_nodes;
+      vector<uint32_t> free_files;
+      vector<uint32_t> free_indexes;
+      uint64_t next_inode_nr {1};
+      node_id live_nodes {0};
+      uint32_t intern (const string& name);
+      node_id new_node (node_id parent, inode_t type,
+                        const string& name);
+      void free_subtree (node_id node);
+      size_t position (node_id dir, const string& name) const;
+   public:
+      soa_tree();
+      node_id root() const;
+      size_t size() const;
+      node_id lookup (node_id dir, const string& name) const;
+      node_id child_after (node_id dir, const string& after,
+                           size_t skip) const;
+      node_id make (node_id dir, const string& name, inode_t type);
+      void remove (node_id dir, const string& name, bool recursive);
+      inode_t type (node_id node) const;
+      const string& name (node_id node) const;
+      node_id parent (node_id node) const;
+      node_id first_child (node_id dir) const;
+      node_id next_sibling (node_id node) const;
+      uint64_t size (node_id node) const;
+      uint64_t inode_nr (node_id node) const;
+      bool exists (node_id node) const;
+      node_id find_inode (uint64_t inode_nr) const;
+      const wordvec& read (node_id file) const;
+      void write (node_id file, const wordvec& words);
+      void append (node_id file, const wordvec& words);
+      memory_use memory() const;
+      void compact();
+};
+
+#endif
+
@@ -0,0 +1,571 @@
+// $Id$
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <malloc.h>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_set>
+
+using namespace std;
+
+#include "cold.h"
+#include "debug.h"
+#include "inode_table.h"
+#include "spill.h"
+#include "storage.h"
+
+//
+// The limit, set from the options before anything is written, and
+// the clock, which only the sweep advances, with the tree lock held.
+//
+
+bool spill_store::on {false};
+uint64_t spill_store::ticks {0};
+static uint64_t limit_bytes {0};
+static chrono::steady_clock::time_point started;
+
+//
+// The spill file, opened at the first spill, its free extents by
+// offset, and what is known about spilling, guarded by spill_lock.
+// Stubs go on whatever thread lets go of them last, and are read
+// back in on any thread working on the tree, so both take the lock
+// to change any of this.  Records themselves never change once
+// written, and are read without it.
+//
+
+static int spill_fd {-1};
+static map<uint64_t, uint64_t> free_space;
+static uint64_t file_end {0};
+static uint64_t stubs {0};
+static uint64_t stub_bytes {0};
+static uint64_t spills {0};
+static uint64_t spilled_inodes {0};
+static uint64_t spill_nanos {0};
+static uint64_t faults {0};
+static uint64_t faulted_inodes {0};
+static uint64_t fault_nanos {0};
+static mutex spill_lock;
+
+void spill_store::set_limit_mb (size_t megabytes) {
+   on = megabytes > 0;
+   limit_bytes = uint64_t (megabytes) << 20;
+   started = chrono::steady_clock::now();
+}
+
+static uint64_t heap_in_use() {
+   struct mallinfo2 heap = mallinfo2();
+   return heap.uordblks + heap.hblkhd;
+}
+
+static uint64_t nanos_since (chrono::steady_clock::time_point start) {
+   return chrono::duration_cast<chrono::nanoseconds> (
+             chrono::steady_clock::now() - start).count();
+}
+
+// THE FILE ===========================================================
+
+/**
+ * Opens a scratch file in $TMPDIR, or /tmp, and unlinks it at once.
+ * Called with spill_lock held.
+ */
+static void open_spill_file() {
+   const char* tmpdir = getenv ("TMPDIR");
+   string name = string (tmpdir == nullptr ? "/tmp" : tmpdir)
+               + "/yshell-spill.XXXXXX";
+   spill_fd = mkstemp (&name[0]);
+   if (spill_fd < 0) {
+      throw yshell_exn (name + ": " + strerror (errno));
+   }
+   unlink (name.c_str());
+   DEBUGF ('l', "spilling to " << name);
+}
+
+/**
+ * Finds room for a record: the first free extent big enough, or the
+ * end of the file.  Called with spill_lock held.
+ * @param  length the size of the record
+ * @return        its offset
+ */
+static uint64_t allocate_extent (uint64_t length) {
+   for (auto extent = free_space.begin(); extent != free_space.end();
+        ++extent) {
+      if (extent->second < length) continue;
+      uint64_t offset = extent->first;
+      uint64_t left = extent->second - length;
+      free_space.erase (extent);
+      if (left > 0) free_space.emplace (offset + length, left);
+      return offset;
+   }
+   uint64_t offset = file_end;
+   file_end += length;
+   return offset;
+}
+
+/**
+ * Gives a record's room back, merging it with the free extents on
+ * either side, and cutting the file short if it reaches the end.
+ * Called with spill_lock held.
+ * @param offset where the record is
+ * @param length its size
+ */
+static void free_extent (uint64_t offset, uint64_t length) {
+   auto after = free_space.lower_bound (offset);
+   if (after != free_space.end() and after->first == offset + length) {
+      length += after->second;
+      after = free_space.erase (after);
+   }
+   if (after != free_space.begin()) {
+      auto before = prev (after);
+      if (before->first + before->second == offset) {
+         offset = before->first;
+         length += before->second;
+         free_space.erase (before);
+      }
+   }
+   if (offset + length != file_end) {
+      free_space.emplace (offset, length);
+      return;
+   }
+   file_end = offset;
+   if (ftruncate (spill_fd, file_end) != 0) {
+      DEBUGF ('l', "cannot truncate to " << file_end);
+   }
+}
+
+/**
+ * Writes a record out where there is room for it
+ * @param  bytes the record
+ * @return       its offset
+ */
+static uint64_t write_extent (const string& bytes) {
+   uint64_t offset;
+   {
+      lock_guard<mutex> guard (spill_lock);
+      if (spill_fd < 0) open_spill_file();
+      offset = allocate_extent (bytes.size());
+   }
+   for (size_t done = 0; done < bytes.size();) {
+      ssize_t wrote = pwrite (spill_fd, bytes.data() + done,
+                              bytes.size() - done, offset + done);
+      if (wrote <= 0) {
+         string error = strerror (errno);
+         lock_guard<mutex> guard (spill_lock);
+         free_extent (offset, bytes.size());
+         throw yshell_exn ("spill: " + error);
+      }
+      done += wrote;
+   }
+   return offset;
+}
+
+static string read_extent (uint64_t offset, uint64_t length) {
+   string bytes (length, '\0');
+   for (size_t done = 0; done < length;) {
+      ssize_t got = pread (spill_fd, &bytes[done], length - done,
+                           offset + done);
+      if (got <= 0) throw yshell_exn ("spill: cannot read back");
+      done += got;
+   }
+   return bytes;
+}
+
+// RECORDS ============================================================
+
+//
+// A record holds the entries of a spilled directory, as a checkpoint
+// does (see checkpoint.cpp), with the number of each inode after its
+// name: the count of entries, and for each its type, its name, its
+// number and its contents, which for a plain file are the count of
+// words and the words, and for a directory its own entries.
+//
+
+enum {CARRIERS, FRESH, NUMBERED};
+
+static void put_number (string& out, uint64_t number) {
+   while (number >= 0x80) {
+      out += static_cast<char> ((number & 0x7F) | 0x80);
+      number >>= 7;
+   }
+   out += static_cast<char> (number);
+}
+
+static void put_string (string& out, const string& word) {
+   put_number (out, word.size());
+   out += word;
+}
+
+static uint64_t get_number (const char*& at) {
+   uint64_t number = 0;
+   for (int shift = 0;; shift += 7) {
+      unsigned char byte = *at++;
+      number |= uint64_t (byte & 0x7F) << shift;
+      if (byte < 0x80) return number;
+   }
+}
+
+static string get_string (const char*& at) {
+   size_t length = get_number (at);
+   string word (at, length);
+   at += length;
+   return word;
+}
+
+/**
+ * Writes the entries of a directory, and everything under them, into
+ * a record.  A stub under it has its own record copied in, and gives
+ * up the numbers in it once the new record is written.
+ * @param out     the record
+ * @param dir     the directory
+ * @param nodes   incremented for each inode written
+ * @param inlined the stubs copied in
+ */
+void spill_store::put_entries (string& out, const directory& dir,
+                               size_t& nodes,
+                               vector<spill_stub*>& inlined) {
+   put_number (out, dir.dirents.size());
+   for (const auto& entry: dir.dirents) {
+      const inode& child = *entry.second;
+      out += static_cast<char> (child.type);
+      put_string (out, entry.first);
+      put_number (out, child.inode_nr);
+      ++nodes;
+      if (child.type == PLAIN_INODE) {
+         const wordvec& words =
+            plain_file_ptr_of (child.contents)->readfile();
+         put_number (out, words.size());
+         for (const string& word: words) put_string (out, word);
+         continue;
+      }
+      spill_stub* stub = dynamic_cast<spill_stub*> (
+                            child.contents.get());
+      if (stub == nullptr) {
+         put_entries (out, static_cast<const directory&> (
+                              *child.contents), nodes, inlined);
+         continue;
+      }
+      out += read_extent (stub->offset, stub->length);
+      nodes += stub->nodes;
+      inlined.push_back (stub);
+   }
+}
+
+/**
+ * Makes the entries of a directory out of a record, and everything
+ * under them.  Inodes made FRESH get new numbers, NUMBERED ones the
+ * numbers they had, and CARRIERS none.
+ * @param at    where the entries start, left where they end
+ * @param dir   the directory
+ * @param owner the inode holding dir, or nullptr for carriers
+ * @param how   CARRIERS, FRESH or NUMBERED
+ */
+void spill_store::get_entries (const char*& at, directory& dir,
+                               const inode_ptr& owner, int how) {
+   size_t count = get_number (at);
+   wordvec words;
+   for (size_t i = 0; i < count; ++i) {
+      inode_t type = static_cast<inode_t> (*at++);
+      string name = get_string (at);
+      uint64_t number = get_number (at);
+      inode_ptr child;
+      if (how == NUMBERED) {
+         child = inode_ptr (new inode (inode::spilled_tag(), number,
+                                       type, name, owner));
+      }else if (how == FRESH) {
+         child = make_shared<inode> (type, name, owner);
+      }else {
+         file_base_ptr contents;
+         if (type == DIR_INODE) contents = make_shared<directory>();
+                           else contents = make_shared<plain_file>();
+         child = inode_ptr (new inode (inode::carrier_tag(), type,
+                                       name, contents));
+      }
+      if (type == DIR_INODE) {
+         directory_ptr below = directory_ptr_of (child->contents);
+         if (how != CARRIERS) {
+            below->dot = child;
+            below->dotdot = owner;
+         }
+         get_entries (at, *below, child, how);
+      }else {
+         words.resize (get_number (at));
+         for (string& word: words) word = get_string (at);
+         plain_file_ptr_of (child->contents)->writefile (words);
+      }
+      dir.dirents.insert (name, child);
+   }
+}
+
+/**
+ * Collects the numbers in a record without making anything
+ * @param at      where the entries start, left where they end
+ * @param numbers the numbers
+ */
+static void skip_entries (const char*& at, vector<uint64_t>& numbers) {
+   size_t count = get_number (at);
+   for (size_t i = 0; i < count; ++i) {
+      char type = *at++;
+      size_t length = get_number (at);
+      at += length;
+      numbers.push_back (get_number (at));
+      if (type == DIR_INODE) {
+         skip_entries (at, numbers);
+         continue;
+      }
+      size_t words = get_number (at);
+      for (size_t word = 0; word < words; ++word) {
+         length = get_number (at);
+         at += length;
+      }
+   }
+}
+
+/**
+ * Takes the numbers of the inodes under a directory being spilled
+ * out of the table, keeping them for when it is read back in.  The
+ * inodes then go without giving their numbers back.
+ * @param dir the directory
+ */
+void spill_store::set_numbers_aside (const directory& dir) {
+   for (const auto& entry: dir.dirents) {
+      inode& child = *entry.second;
+      inode_table::set_aside (child.inode_nr);
+      child.inode_nr = 0;
+      if (child.type == DIR_INODE and not is_stub (
+             static_cast<const directory&> (*child.contents))) {
+         set_numbers_aside (
+            static_cast<const directory&> (*child.contents));
+      }
+   }
+}
+
+// STUBS ==============================================================
+
+/**
+ * Lets the numbers in the record go, unless they were taken by the
+ * owner reading it back in, or by a record it was copied into, then
+ * gives the record's room back.  Numbers that are not reused are
+ * not worth reading the record for.
+ */
+spill_stub::~spill_stub() {
+   if (not taken and inode_table::reuses()) {
+      vector<uint64_t> numbers;
+      try {
+         string in = read_extent (offset, length);
+         const char* at = in.data();
+         skip_entries (at, numbers);
+      }catch (yshell_exn&) {
+         // the numbers are lost, but nothing else is
+      }
+      for (uint64_t inode_nr: numbers) {
+         inode_table::give_back (inode_nr);
+      }
+   }
+   lock_guard<mutex> guard (spill_lock);
+   free_extent (offset, length);
+   --stubs;
+   stub_bytes -= length;
+}
+
+size_t spill_stub::size() const {
+   return entries + 2;
+}
+
+bool spill_store::is_stub (const directory& dir) {
+   return dynamic_cast<const spill_stub*> (&dir) != nullptr;
+}
+
+/**
+ * Reads a stub back in.  The inode it was spilled from gets back the
+ * numbers of the inodes under it, the first time; any other, or the
+ * owner again, gets new ones.
+ * @param  owner the inode holding the stub
+ * @param  dir   the stub
+ * @return       owner's own directory
+ */
+directory_ptr spill_store::fault_in (const inode_ptr& owner,
+                                     directory& dir) {
+   auto start = chrono::steady_clock::now();
+   spill_stub& stub = static_cast<spill_stub&> (dir);
+   string in = read_extent (stub.offset, stub.length);
+   bool numbered = stub.owner == owner.get() and not stub.taken;
+   if (numbered) stub.taken = true;
+   directory_ptr made = make_shared<directory>();
+   made->dot = owner;
+   made->dotdot = owner->parent;
+   made->used = ticks;
+   const char* at = in.data();
+   get_entries (at, *made, owner, numbered ? NUMBERED : FRESH);
+   DEBUGF ('l', "read back inode " << owner->inode_nr << ", "
+           << stub.nodes << " inodes");
+   lock_guard<mutex> guard (spill_lock);
+   ++faults;
+   faulted_inodes += stub.nodes;
+   fault_nanos += nanos_since (start);
+   return made;
+}
+
+directory_ptr spill_store::read (const directory_ptr& dir) {
+   const spill_stub* stub = dynamic_cast<const spill_stub*> (dir.get());
+   if (stub == nullptr) return dir;
+   string in = read_extent (stub->offset, stub->length);
+   directory_ptr copy = make_shared<directory>();
+   const char* at = in.data();
+   get_entries (at, *copy, nullptr, CARRIERS);
+   return copy;
+}
+
+// SWEEPING ===========================================================
+
+//
+// spill_candidate -
+//    A directory that can be spilled, when anything under it was
+//    last used, and how far below the root it is.
+//
+
+struct spill_candidate {
+   inode_ptr node;
+   uint64_t used;
+   size_t depth;
+};
+
+/**
+ * Works out when anything under a directory was last used, and
+ * whether all of it can be spilled, adding each directory below the
+ * root that can be, and is not empty, to found.  A stub can go in
+ * a bigger spill if it is its owner's alone.
+ * @param  node  the directory
+ * @param  depth how far it is below the root
+ * @param  found the candidates
+ * @param  used  set to the last use of anything under node
+ * @return       whether node can be spilled
+ */
+bool spill_store::survey (const inode_ptr& node, size_t depth,
+                          vector<spill_candidate>& found,
+                          uint64_t& used) {
+   const directory& dir =
+      static_cast<const directory&> (*node->contents);
+   used = dir.used;
+   if (node->contents.use_count() > 1) return false;
+   if (is_stub (dir)) {
+      const spill_stub& stub = static_cast<const spill_stub&> (dir);
+      return stub.owner == node.get() and not stub.taken;
+   }
+   if (not dir.owned_by (node.get())) return false;
+   bool spillable = true;
+   for (const auto& entry: dir.dirents) {
+      const inode_ptr& child = entry.second;
+      if (child->type != DIR_INODE) continue;
+      uint64_t below = 0;
+      if (not survey (child, depth + 1, found, below)) {
+         spillable = false;
+      }
+      used = max (used, below);
+   }
+   if (spillable and depth > 0 and dir.dirents.size() > 0) {
+      found.push_back ({node, used, depth});
+   }
+   return spillable;
+}
+
+/**
+ * Writes a directory out and leaves a stub in its place, then breaks
+ * up what it held (see inode::release), so that it all goes
+ * @param node the directory
+ */
+void spill_store::spill (const inode_ptr& node) {
+   auto start = chrono::steady_clock::now();
+   directory_ptr dir = directory_ptr_of (node->contents);
+   string out;
+   size_t nodes = 0;
+   vector<spill_stub*> inlined;
+   put_entries (out, *dir, nodes, inlined);
+   uint64_t offset = write_extent (out);
+   shared_ptr<spill_stub> stub = make_shared<spill_stub>();
+   stub->offset = offset;
+   stub->length = out.size();
+   stub->entries = dir->dirents.size();
+   stub->nodes = nodes;
+   stub->owner = node.get();
+   stub->used = dir->used.load();
+   for (spill_stub* below: inlined) below->taken = true;
+   set_numbers_aside (*dir);
+   node->contents = stub;
+   for (const auto& entry: dir->dirents) entry.second->release();
+   dir->clear();
+   DEBUGF ('l', "spilled inode " << node->inode_nr << ", " << nodes
+           << " inodes in " << out.size() << " bytes");
+   lock_guard<mutex> guard (spill_lock);
+   ++stubs;
+   stub_bytes += out.size();
+   ++spills;
+   spilled_inodes += nodes;
+   spill_nanos += nanos_since (start);
+}
+
+/**
+ * Spills subtrees, those used least recently first, and of those
+ * used as recently, the biggest first, until malloc has handed out
+ * no more than seven eighths of the limit.  Only the tree backend
+ * shares its root, and so only it is ever spilled.
+ * @param state the state whose tree lock is taken
+ */
+void spill_store::sweep (inode_state& state) {
+   if (not on) return;
+   lock_guard<tree_lock> tree (state.get_mutex());
+   ++ticks;
+   if (heap_in_use() <= limit_bytes or cold_hold::held()) return;
+   file_base_ptr shared = state.get_storage().share (state.get_root());
+   if (shared == nullptr) return;
+   inode_ptr root = directory_ptr_of (shared)->dot;
+   shared.reset();
+
+   vector<spill_candidate> found;
+   uint64_t used = 0;
+   survey (root, 0, found, used);
+   unordered_set<const inode*> pinned;
+   for (inode_ptr node = inode_table::lookup (state.get_cwd());
+        node != nullptr and node != root; node = node->parent) {
+      pinned.insert (node.get());
+   }
+   sort (found.begin(), found.end(),
+         [] (const spill_candidate& a, const spill_candidate& b) {
+            return a.used != b.used ? a.used < b.used
+                                    : a.depth < b.depth;
+         });
+   uint64_t low_water = limit_bytes - limit_bytes / 8;
+   for (const spill_candidate& cold: found) {
+      if (heap_in_use() <= low_water) break;
+      // gone already in a spill of a directory above it
+      if (cold.node->inode_nr == 0) continue;
+      if (pinned.count (cold.node.get()) > 0) continue;
+      spill (cold.node);
+   }
+}
+
+spill_use spill_store::report() {
+   spill_use use;
+   use.limit_bytes = limit_bytes;
+   use.heap_bytes = heap_in_use();
+   lock_guard<mutex> guard (spill_lock);
+   use.stubs = stubs;
+   use.stub_bytes = stub_bytes;
+   use.file_bytes = file_end;
+   use.spills = spills;
+   use.spilled_inodes = spilled_inodes;
+   use.spill_nanos = spill_nanos;
+   use.faults = faults;
+   use.faulted_inodes = faulted_inodes;
+   use.fault_nanos = fault_nanos;
+   if (on) {
+      use.seconds = chrono::duration<double> (
+                       chrono::steady_clock::now() - started).count();
+   }
+   return use;
+}
+
@@ -0,0 +1,128 @@
+// $Id$
+
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "inode.h"
+
+//
+// spill_stub -
+//    What is left in a directory's place once it is spilled: where
+//    its entries, and everything under them, are in the spill file,
+//    and how many entries there are, so that ls and rm see its size
+//    as they did.  The inode it was spilled from gets the numbers of
+//    the inodes under it back when it is read in; any other inode
+//    sharing it since cp gets new ones.  When the stub goes, so does
+//    its place in the spill file.
+//
+
+class spill_stub: public directory {
+   friend class spill_store;
+   private:
+      uint64_t offset {0};
+      uint64_t length {0};
+      size_t entries {0};
+      size_t nodes {0};
+      const inode* owner {nullptr};
+      bool taken {false};
+   public:
+      ~spill_stub();
+      size_t size() const override;
+};
+
+//
+// spill_use -
+//    What spilling has done: the limit and what malloc has handed
+//    out, the stubs there are, the bytes they hold in the spill file
+//    and its size, and how many subtrees, of how many inodes, were
+//    spilled and read back in, and how long that took, over how many
+//    seconds since the limit was set.
+//
+
+struct spill_use {
+   uint64_t limit_bytes {0};
+   uint64_t heap_bytes {0};
+   uint64_t stubs {0};
+   uint64_t stub_bytes {0};
+   uint64_t file_bytes {0};
+   uint64_t spills {0};
+   uint64_t spilled_inodes {0};
+   uint64_t spill_nanos {0};
+   uint64_t faults {0};
+   uint64_t faulted_inodes {0};
+   uint64_t fault_nanos {0};
+   double seconds {0};
+};
+
+//
+// spill_store -
+//    A static class which keeps the tree backend under a limit on
+//    the memory malloc has handed out, by writing the subtrees used
+//    least recently out to a scratch file and leaving a spill_stub
+//    in each one's place.  A sweep, which the shell makes between
+//    commands, spills the coldest subtrees it can until the heap is
+//    back under seven eighths of the limit.  It never spills the
+//    root, the current directory or any directory above it, nor
+//    anything shared with a copy, nor anything while a cold_hold is
+//    held (see cold.h).  A stub is read back in by whatever reads or
+//    changes the directory (see inode::read_dir), so cd, ls, cat and
+//    every path looked up through it find the tree as it was.  Until
+//    then the inodes under it are not found by number.  A command
+//    may still take the heap over the limit until the next sweep.
+// set_limit_mb -
+//    The limit, set from the options (0 for none, the default).
+// enabled -
+//    Whether anything is ever spilled.
+// now -
+//    The clock directories are stamped with when they are used,
+//    which the sweep advances.
+// is_stub -
+//    Whether a directory is a stub.
+// fault_in -
+//    Reads a stub back in, as owner's own directory.
+// read -
+//    A directory, or if it is a stub, what it holds read into
+//    carriers, for walkers of a tree shared copy on write, which
+//    leave the tree as it is.
+// sweep -
+//    Spills what the limit says must go.  Takes the tree lock.
+// report -
+//    What spilling has done so far.
+//
+
+struct spill_candidate;
+
+class spill_store {
+   private:
+      static bool on;
+      static uint64_t ticks;
+      static bool survey (const inode_ptr& node, size_t depth,
+                          vector<spill_candidate>& found,
+                          uint64_t& used);
+      static void put_entries (string& out, const directory& dir,
+                               size_t& nodes,
+                               vector<spill_stub*>& inlined);
+      static void get_entries (const char*& at, directory& dir,
+                               const inode_ptr& owner, int how);
+      static void set_numbers_aside (const directory& dir);
+      static void spill (const inode_ptr& node);
+   public:
+      static void set_limit_mb (size_t megabytes);
+      static bool enabled() { return on; }
+      static uint64_t now() { return ticks; }
+      static bool is_stub (const directory& dir);
+      static directory_ptr fault_in (const inode_ptr& owner,
+                                     directory& stub);
+      static directory_ptr read (const directory_ptr& dir);
+      static void sweep (inode_state& state);
+      static spill_use report();
+};
+
+#endif
+
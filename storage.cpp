@@ -0,0 +1,202 @@
+// $Id$
+
+#include <vector>
+
+using namespace std;
+
+#include "debug.h"
+#include "disk_storage.h"
+#include "inode_storage.h"
+#include "soa_storage.h"
+#include "storage.h"
+
+/**
+ * Walks a subtree through list, one level at a time
+ * @param dir   the top of the subtree
+ * @param visit called for every node under dir
+ */
+void storage::iterate (node_id dir, const visitor& visit) {
+   list (dir, [this, &visit] (const node_info& info) {
+      visit (info);
+      if (info.type == DIR_INODE) iterate (info.node, visit);
+   });
+}
+
+/**
+ * Picks a window out of everything list visits
+ * @param dir   the directory
+ * @param after where the window starts, or ""
+ * @param skip  how many entries after that to leave out
+ * @param count how many entries to visit
+ * @param visit called for each
+ */
+void storage::list_range (node_id dir, const string& after,
+                          size_t skip, size_t count,
+                          const visitor& visit) {
+   list (dir, [&] (const node_info& info) {
+      if (count == 0 or (not after.empty() and *info.name <= after)) {
+         return;
+      }
+      if (skip > 0) {
+         --skip;
+         return;
+      }
+      --count;
+      visit (info);
+   });
+}
+
+/**
+ * Copies a subtree node by node. Everything under the source is
+ * gathered before anything is made, so a directory copied into its
+ * own subtree is copied as it was.
+ * @param source the node to copy
+ * @param dir    the directory to put the copy in
+ * @param name   the name of the copy
+ */
+void storage::copy (node_id source, node_id dir, const string& name) {
+   struct entry {
+      node_id source;
+      inode_t type;
+      string name;
+      size_t parent;
+   };
+   vector<entry> entries {{source, stat (source).type, name, 0}};
+   for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].type != DIR_INODE) continue;
+      list (entries[i].source, [&entries, i] (const node_info& child) {
+         entries.push_back ({child.node, child.type, *child.name, i});
+      });
+   }
+
+   vector<node_id> copies (entries.size());
+   for (size_t i = 0; i < entries.size(); ++i) {
+      const entry& next = entries[i];
+      node_id into = i == 0 ? dir : copies[next.parent];
+      copies[i] = create (into, next.name, next.type);
+      if (copies[i] == no_node) {
+         throw yshell_exn (next.name + ": already exists");
+      }
+      if (next.type == PLAIN_INODE) {
+         wordvec words = read (next.source);
+         write (copies[i], words);
+      }
+   }
+}
+
+void storage::gather (node_id file, const run_visitor& visit) {
+   const wordvec& words = read (file);
+   for (size_t i = 0; i < words.size(); ++i) {
+      if (i > 0) visit (" ", 1);
+      visit (words[i].data(), words[i].size());
+   }
+}
+
+bool storage::search (node_id file, const string& pattern) {
+   for (const string& word: read (file)) {
+      if (word.find (pattern) != string::npos) return true;
+   }
+   return false;
+}
+
+file_base_ptr storage::share (node_id) {
+   return nullptr;
+}
+
+bool storage::restored (uint64_t&) {
+   return false;
+}
+
+bool storage::shares_reads() {
+   return false;
+}
+
+memory_use storage::memory() {
+   return memory_use();
+}
+
+dedup_use storage::dedup() {
+   dedup_use use;
+   iterate (root(), [this, &use] (const node_info& info) {
+      if (info.type != PLAIN_INODE) return;
+      for (const string& word: read (info.node)) {
+         use.logical_bytes += word.size() + 1;
+      }
+      ++use.files;
+   });
+   use.contents = use.files;
+   use.unique_bytes = use.logical_bytes;
+   return use;
+}
+
+size_t heap_bytes (const string& text) {
+   const char* inside = reinterpret_cast<const char*> (&text);
+   if (text.data() >= inside and text.data() < inside + sizeof text) {
+      return 0;
+   }
+   return text.capacity() + 1;
+}
+
+unique_ptr<storage> make_storage (const string& kind) {
+   DEBUGF ('s', "storage " << kind);
+   if (kind == "tree") return unique_ptr<storage> (new inode_storage());
+   if (kind == "soa") return unique_ptr<storage> (new soa_storage());
+   if (kind == "disk") return unique_ptr<storage> (new disk_storage());
+   throw yshell_exn (kind + ": no such storage backend");
+}
+
+// PLAIN FILE WRITER ==================================================
+
+// enough words to make each journal record worth its framing
+static constexpr size_t batch_size = 1024;
+
+plain_file_writer::plain_file_writer (inode_state& state,
+                                      node_id file):
+   state (state), file (file) {
+}
+
+plain_file_writer::~plain_file_writer() {
+   try {
+      finish();
+   }catch (exception& exn) {
+      complain() << exn.what() << endl;
+   }
+}
+
+/**
+ * Appends the word being written, if any, and every word still
+ * waiting in the batch
+ */
+void plain_file_writer::finish() {
+   if (not word.empty()) put (' ');
+   flush_batch();
+}
+
+void plain_file_writer::flush_batch() {
+   if (batch.empty()) return;
+   state.append (file, batch);
+   batch.clear();
+}
+
+void plain_file_writer::put (char c) {
+   if (c == ' ' or c == '\t' or c == '\n') {
+      if (word.empty()) return;
+      batch.push_back (word);
+      word.clear();
+      if (batch.size() >= batch_size) flush_batch();
+   } else {
+      word.push_back (c);
+   }
+}
+
+plain_file_writer::int_type plain_file_writer::overflow (int_type c) {
+   if (c != traits_type::eof()) put (traits_type::to_char_type (c));
+   return traits_type::not_eof (c);
+}
+
+streamsize plain_file_writer::xsputn (const char* s,
+                                      streamsize count) {
+   for (streamsize i = 0; i < count; ++i) put (s[i]);
+   return count;
+}
+
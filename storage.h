@@ -0,0 +1,218 @@
+// $Id$
+
+#ifndef __STORAGE_H__
+#define __STORAGE_H__
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#include "inode.h"
+#include "util.h"
+
+//
+// node_info -
+//    What ls and stat show about a node.  The name points into the
+//    backend.  One handed to a visitor is good for the visit, and one
+//    from stat until the tree next changes.
+//
+
+struct node_info {
+   node_id node;
+   uint64_t inode_nr;
+   inode_t type;
+   uint64_t size;
+   const string* name;
+};
+
+//
+// memory_use -
+//    What a tree takes in memory: bytes under each of a list of
+//    headings, in the order memstat prints them, and the number of
+//    inodes they are spread over.
+//
+
+struct memory_use {
+   vector<pair<string, uint64_t>> bytes;
+   uint64_t inodes {0};
+};
+
+//
+// dedup_use -
+//    What the contents of plain files come to, in bytes as cat
+//    prints them: logical, counting each file, and unique, counting
+//    each distinct contents kept once however many files share it.
+//
+
+struct dedup_use {
+   uint64_t files {0};
+   uint64_t contents {0};
+   uint64_t logical_bytes {0};
+   uint64_t unique_bytes {0};
+};
+
+//
+// heap_bytes -
+//    The bytes a string has on the heap, none if it is short enough
+//    to be kept inside the string itself.
+//
+
+size_t heap_bytes (const string& text);
+
+//
+// class storage -
+//
+// How the tree is kept, behind the operations the commands need.
+// Nodes are named by node_ids, which mean nothing outside the
+// storage that handed them out.  Every call is made with the tree
+// lock held.  Misuse, such as reading a directory or making a file
+// in a plain file, throws a yshell_exn.
+// root, parent, name -
+//    The root, whose parent is itself, and where a node is.
+// stat -
+//    The inode number, type and size of a node.  The size of a
+//    directory is its number of entries, not counting "." and "..",
+//    and of a plain file its number of words.
+// find_number -
+//    The node with an inode number, or no_node.
+// lookup -
+//    A child of a directory, including "." and "..", or no_node if
+//    there is none or dir is not a directory.
+// create -
+//    Makes an empty directory or plain file in a directory, or
+//    returns no_node if the name is already there.
+// list -
+//    Calls visit for each child of a directory in name order.
+// list_range -
+//    Calls visit for a window of the children of a directory, in
+//    name order: those whose names come after after (all of them if
+//    it is ""), less the first skip of them, and at most count.  By
+//    default this goes through list, which visits every child;
+//    backends whose children are ordered seek to after instead.
+// iterate -
+//    Calls visit for every node under a directory, depth first, each
+//    directory before its children.
+// read, write, append -
+//    The words of a plain file.  What read returns is good until the
+//    tree next changes.
+// gather -
+//    Calls visit with the text of a plain file as cat prints it, its
+//    words with a space between each, a run of bytes at a time.
+//    Runs point into the backend where they can, and are only good
+//    until visit returns.  By default this goes through read.
+// search -
+//    Whether any word of a plain file holds pattern, as grep looks
+//    for it.  By default this goes through read.
+// remove -
+//    Removes a child of a directory, with recursive even if it is a
+//    directory that is not empty.
+// copy -
+//    Makes a copy of source, and everything under it, in a
+//    directory.  It is an error if the name is taken.  By default
+//    this goes through the other operations one node at a time.
+// share -
+//    The contents of a node and everything under it, shared copy on
+//    write for a checkpoint or an export to write out without
+//    holding the tree lock, or nullptr if the backend cannot share
+//    them.
+// restored -
+//    True if the backend opened a tree kept from an earlier run
+//    instead of making an empty one, setting position to how far
+//    into the journal the tree had got.  By default nothing is kept.
+// memory -
+//    What the tree takes in memory, found by going through all of it.
+//    By default nothing is known.
+// dedup -
+//    What the contents of the plain files under the root come to,
+//    found by going through all of them.  By default each file keeps
+//    its own.
+// shares_reads -
+//    Whether commands which only read the tree may run at once,
+//    sharing the tree lock (see tree_lock.h), every call they make
+//    being safe alongside the same calls on other threads.  By
+//    default not, since a backend may change what it caches as it
+//    reads.
+//
+
+class storage {
+   public:
+      using visitor = function<void (const node_info&)>;
+      using run_visitor = function<void (const char*, size_t)>;
+      storage() = default;
+      storage (const storage&) = delete;
+      storage& operator= (const storage&) = delete;
+      virtual ~storage() = default;
+      virtual node_id root() = 0;
+      virtual node_id parent (node_id node) = 0;
+      virtual const string& name (node_id node) = 0;
+      virtual node_info stat (node_id node) = 0;
+      virtual node_id find_number (uint64_t inode_nr) = 0;
+      virtual node_id lookup (node_id dir, const string& name) = 0;
+      virtual node_id create (node_id dir, const string& name,
+                              inode_t type) = 0;
+      virtual void list (node_id dir, const visitor& visit) = 0;
+      virtual void list_range (node_id dir, const string& after,
+                               size_t skip, size_t count,
+                               const visitor& visit);
+      virtual void iterate (node_id dir, const visitor& visit);
+      virtual const wordvec& read (node_id file) = 0;
+      virtual void gather (node_id file, const run_visitor& visit);
+      virtual bool search (node_id file, const string& pattern);
+      virtual void write (node_id file, const wordvec& words) = 0;
+      virtual void append (node_id file, const wordvec& words) = 0;
+      virtual void remove (node_id dir, const string& name,
+                           bool recursive) = 0;
+      virtual void copy (node_id source, node_id dir,
+                         const string& name);
+      virtual file_base_ptr share (node_id node);
+      virtual bool restored (uint64_t& position);
+      virtual memory_use memory();
+      virtual dedup_use dedup();
+      virtual bool shares_reads();
+};
+
+//
+// make_storage -
+//    Makes the tree in the named backend: "tree" for inodes,
+//    directories and plain files (see inode.h), "soa" for a soa_tree,
+//    or "disk" for a file of pages (see disk_storage.h), which may
+//    hold a tree kept from an earlier run.  The others are empty.
+//    Throws a yshell_exn for any other name.
+//
+
+unique_ptr<storage> make_storage (const string& kind);
+
+//
+// class plain_file_writer -
+//
+// A streambuf which appends everything written to it to a plain
+// file, a word at a time.  Whitespace separates words, so a
+// command's output can be streamed straight into a file without
+// collecting it first.  Words are handed to inode_state::append in
+// batches, so each batch is journaled as one record.  What is still
+// pending goes in when the writer is destroyed, or by finish.
+//
+
+class plain_file_writer: public streambuf {
+   private:
+      inode_state& state;
+      node_id file;
+      string word;
+      wordvec batch;
+      void put (char c);
+      void flush_batch();
+   protected:
+      int_type overflow (int_type c) override;
+      streamsize xsputn (const char* s, streamsize count) override;
+   public:
+      plain_file_writer (inode_state& state, node_id file);
+      ~plain_file_writer();
+      void finish();
+};
+
+#endif
+
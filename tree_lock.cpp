@@ -0,0 +1,42 @@
+// $Id$
+
+using namespace std;
+
+#include "tree_lock.h"
+
+void tree_lock::lock() {
+   unique_lock<mutex> lock (guard);
+   ++writers_waiting;
+   turn.wait (lock, [this] { return not writing and readers == 0; });
+   --writers_waiting;
+   writing = true;
+}
+
+void tree_lock::unlock() {
+   {
+      lock_guard<mutex> lock (guard);
+      writing = false;
+   }
+   turn.notify_all();
+}
+
+void tree_lock::lock_shared() {
+   unique_lock<mutex> lock (guard);
+   turn.wait (lock, [this] {
+      return not writing and writers_waiting == 0;
+   });
+   ++readers;
+}
+
+void tree_lock::unlock_shared() {
+   bool last = false;
+   {
+      lock_guard<mutex> lock (guard);
+      last = --readers == 0;
+   }
+   if (last) turn.notify_all();
+}
+
+bool tree_lock::wanted() const {
+   return writers_waiting > 0;
+}
@@ -0,0 +1,45 @@
+// $Id$
+
+#ifndef __TREE_LOCK_H__
+#define __TREE_LOCK_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+using namespace std;
+
+//
+// tree_lock -
+//    The lock on the tree.  Whatever changes the tree holds it alone,
+//    through lock and unlock, as it would a mutex, so lock_guard and
+//    unique_lock work with it.  Commands which only read the tree,
+//    run in the background, may share it instead, through
+//    lock_shared and unlock_shared (see stage_lock in pipe.h).  A
+//    thread waiting to hold it alone goes ahead of any waiting to
+//    share it, so readers coming and going never keep a writer out
+//    for long.
+// wanted -
+//    Whether any thread is waiting to hold the lock alone, so that a
+//    reader sharing it can let go and let the writer have its turn.
+//
+
+class tree_lock {
+   private:
+      tree_lock (const tree_lock&) = delete;
+      tree_lock& operator= (const tree_lock&) = delete;
+      mutex guard;
+      condition_variable turn;
+      size_t readers {0};
+      bool writing {false};
+      atomic<size_t> writers_waiting {0};
+   public:
+      tree_lock() = default;
+      void lock();
+      void unlock();
+      void lock_shared();
+      void unlock_shared();
+      bool wanted() const;
+};
+
+#endif
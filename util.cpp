@@ -58,8 +58,98 @@ wordvec split (const string& line, const string& delimiters) {
    return words;
 }
 
+bool next_word (const string& line, const string& delimiters,
+                size_t& end, string& word) {
+   size_t start = line.find_first_not_of (delimiters, end);
+   if (start == string::npos) return false;
+   end = line.find_first_of (delimiters, start);
+   word.assign (line, start, end - start);
+   return true;
+}
+
+//
+// The separators split_text knows, as a table so that each byte
+// costs one load.
+//
+
+struct separator_table {
+   bool is [256] {};
+   separator_table() {
+      for (unsigned char c: string (" \t\n\r\v\f")) is[c] = true;
+   }
+};
+static const separator_table separators;
+
+void split_text (const char* begin, const char* end, wordvec& words) {
+   const bool* is = separators.is;
+   const unsigned char* from =
+         reinterpret_cast<const unsigned char*> (begin);
+   const unsigned char* to = from + (end - begin);
+
+   // count the words first, so that the vector is never grown and
+   // the words moved
+   size_t count = 0;
+   bool between = true;
+   for (const unsigned char* scan = from; scan != to; ++scan) {
+      count += between and not is[*scan];
+      between = is[*scan];
+   }
+   words.reserve (words.size() + count);
+
+   const unsigned char* scan = from;
+   for (;;) {
+      while (scan != to and is[*scan]) ++scan;
+      if (scan == to) break;
+      const unsigned char* start = scan;
+      while (scan != to and not is[*scan]) ++scan;
+      words.emplace_back (reinterpret_cast<const char*> (start),
+                          scan - start);
+   }
+}
+
+ostream& operator<< (ostream& out, word_span words) {
+   const char* space = "";
+   for (const string& word: words) {
+      out << space << word;
+      space = " ";
+   }
+   return out;
+}
+
+static thread_local ostream* yout_stream = &cout;
+
+ostream& yout() {
+   return *yout_stream;
+}
+
+yout_guard::yout_guard (ostream& out): saved (yout_stream) {
+   yout_stream = &out;
+}
+
+yout_guard::~yout_guard() {
+   yout_stream = saved;
+}
+
+static thread_local istream* yin_stream = nullptr;
+
+istream* yin() {
+   return yin_stream;
+}
+
+yin_guard::yin_guard (istream* in): saved (yin_stream) {
+   yin_stream = in;
+}
+
+yin_guard::~yin_guard() {
+   yin_stream = saved;
+}
+
 ostream& complain() {
    exit_status::set (EXIT_FAILURE);
+   return warn();
+}
+
+ostream& warn() {
    cerr << execname() << ": ";
    return cerr;
 }
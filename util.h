@@ -78,6 +78,108 @@ class exit_status {
 
 wordvec split (const string& line, const string& delimiter);
 
+//
+// next_word -
+//    Finds the next word of line at or after end, as split would,
+//    and assigns it to word, reusing word's buffer, then moves end
+//    past it.  Returns false if there are no more words.  Walking a
+//    path this way allocates nothing for names short enough to be
+//    kept inside the string.
+//
+
+bool next_word (const string& line, const string& delimiters,
+                size_t& end, string& word);
+
+//
+// split_text -
+//    Appends the words of a run of text to words, as a plain file
+//    holds them: any run of spaces, tabs, newlines, carriage
+//    returns, vertical tabs or form feeds separates them.  Made for
+//    whole files, so the text need not be a string.
+//
+
+void split_text (const char* begin, const char* end, wordvec& words);
+
+//
+// word_span -
+//    A view of a run of words held in a wordvec, such as a command
+//    line without its command.  It is two pointers, so it is made and
+//    passed by value without copying any words, and is good as long
+//    as the wordvec is not changed.  at throws out_of_range, as for a
+//    vector.
+//
+
+class word_span {
+   private:
+      const string* from;
+      const string* to;
+   public:
+      using iterator = const string*;
+      word_span (): from (nullptr), to (nullptr) {}
+      word_span (const wordvec& words):
+         from (words.data()), to (words.data() + words.size()) {}
+      word_span (const string* begin, const string* end):
+         from (begin), to (end) {}
+      iterator begin() const { return from; }
+      iterator end() const { return to; }
+      size_t size() const { return to - from; }
+      bool empty() const { return from == to; }
+      const string& front() const { return *from; }
+      const string& back() const { return to[-1]; }
+      const string& operator[] (size_t index) const {
+         return from[index];
+      }
+      const string& at (size_t index) const {
+         if (index >= size()) throw out_of_range ("word_span::at");
+         return from[index];
+      }
+      word_span subspan (size_t offset) const {
+         return word_span (from + offset, to);
+      }
+      word_span subspan (size_t offset, size_t count) const {
+         return word_span (from + offset, from + offset + count);
+      }
+};
+
+ostream& operator<< (ostream& out, word_span words);
+
+// yout -
+//    The stream to which commands write their output.  Normally this
+//    is cout, but it can be pointed elsewhere for the calling thread,
+//    e.g. into a file for output redirection.
+// yout_guard -
+//    Points yout at the given stream until the guard goes out of
+//    scope, then restores the previous one.
+// yin -
+//    The stream a command reads its input from when it is a stage
+//    of a pipeline, or nullptr if it has no input.
+// yin_guard -
+//    Points yin at the given stream until it goes out of scope.
+//
+
+ostream& yout();
+istream* yin();
+
+class yout_guard {
+   private:
+      ostream* saved;
+      yout_guard (const yout_guard&) = delete;
+      yout_guard& operator= (const yout_guard&) = delete;
+   public:
+      explicit yout_guard (ostream& out);
+      ~yout_guard();
+};
+
+class yin_guard {
+   private:
+      istream* saved;
+      yin_guard (const yin_guard&) = delete;
+      yin_guard& operator= (const yin_guard&) = delete;
+   public:
+      explicit yin_guard (istream* in);
+      ~yin_guard();
+};
+
 // complain -
 //    Used for starting error messages.  Sets the exit status to
 //    EXIT_FAILURE, writes the program name to cerr, and then
@@ -87,6 +189,14 @@ wordvec split (const string& line, const string& delimiter);
 
 ostream& complain();
 
+// warn -
+//    Starts an error message the way complain does, but leaves the
+//    exit status alone, for work done in the background, which no
+//    command is waiting on.
+//
+
+ostream& warn();
+
 
 //
 // operator<< (vector) -